@@ -3,6 +3,27 @@
  * Copyright (c) 2019-2022 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
  *
  * Version history
+ * 20261016 v0.9.34 host-native build (P1P2_HOST) on virtual timer/pin/ADC model, see host/README.md
+ *                  packet descriptor queue: packetavailable() and readpacket() no longer scan the read buffer, packeterrors()
+ *                  acquirepacket()/releasepacket() for in-place access to received packets
+ *                  setCRC(): CRC checked per packet in ISR with table-driven CRC (P1P2Serial_CRC.h)
+ *                  write() precomputes data+parity frame per byte, simplifying COMPARE_W_INTERRUPT
+ *                  buffer geometry and errorbuf_t compile-time configurable (P1P2SerialConfig), mask-based wrap for power-of-2 sizes
+ *                  packet-level write queue: schedulepacket() with per-packet delay, timeout, priority and deadline
+ *                  packettime(): timer1 timestamp (extended to 32 bits) of first falling edge of each packet (PACKET_TIMESTAMP)
+ *                  isrstats(): per-ISR execution time histogram and worst case (ISR_STATS), replacing MEASURE_LOAD
+ *                  receive bit clock adapted per source to the measured bit period of the sender (RX_CLOCK_RECOVERY), clockskew()
+ *                  SW_SCOPE log compressed (P1P2Serial_Scope.h), covering whole packets instead of ~1 byte
+ *                  pause after each packet type learned (BUS_CYCLE_LEARNER), schedulegap() writes in first pause expected to be long enough
+ *                  event handlers for packet complete, write complete/collision and bus idle, run in priority order (EVENT_HANDLERS)
+ *                  second P1/P2 bus on ATmega2560 (P1P2_BUS1, class P1P2Serial1), class declaration per bus in P1P2Serial_Bus.h
+ *                  bit-synchronous ADC sampling of low and high bus levels per sender (ADC_BITSYNC), ADC_bitstats()
+ *                  streaming ADC statistics (ADC_STREAM): windowed min/max/mean/quantiles per channel computed in loop(), ADC_window()
+ *                  automatic retransmit after a collision with bounded random backoff (TX_RETRY), setRetry(), writeresult()
+ *                  idle(): IDLE sleep until the next interrupt, cycles asleep and awake counted (IDLE_SLEEP), idlestats()
+ *                  clock_cycles/usec/msec/sec(): 64-bit monotonic clock from timer1 and its overflows; S_TIMER removed, TIMER0 free for millis()
+ *                  listen before talk (TX_CARRIER_SENSE): write deferred if the bus is busy in the bit time before its start bit, writedeferred()
+ *                  replies preloaded per request type (TX_REPLY), built at the end of the request in the ISR and queued without loop(), setReply()
  * 20221028 v0.9.23 ADC code
  * 20220918 v0.9.22 scopemode also for writes, focused on actual errors, fake error generation for test purposes, removing OLDP1P2LIB
  * 20220830 v0.9.18 version alignment with example programs
@@ -65,10 +86,13 @@
 #include <inttypes.h>
 #include "Arduino.h"
 #include "P1P2Serial_ADC.h"
+#include "P1P2Serial_CRC.h"
+#include "P1P2Serial_Scope.h"
 
 // Configuration options
-//#define MEASURE_LOAD                // measures irq processing time
-#define SW_SCOPE                    // records timing info of P1/P2 bus falling edges of start of the packets
+//#define ISR_STATS                 // per ISR, keeps a log2 histogram of execution times (in CPU cycles) and the worst case, see isrstats()
+                                    //   (replaces MEASURE_LOAD; costs some 30-50 cycles per ISR call and ~100 bytes of RAM)
+#define SW_SCOPE                    // records timing info of P1/P2 bus edges of packets (see P1P2Serial_Scope.h)
 //#define GENERATE_FAKE_ERRORS        // disable this for real use!! // only for NEWLIB, and on 8MHz this may add to the CPU load
 #define SWS_FAKE_ERR_CNT 3000       // one fake error generated (per error type) per SWS_FAKE_ERR_CNT checks
 #define ALLOW_PAUSE_BETWEEN_BYTES 9 // If there is a pause between bytes on the bus which is longer than a 1/4 bit time,
@@ -78,13 +102,71 @@
                                     // ALLOW_PAUSE_BETWEEN_BYTES bit lengths is accepted; ALLOW_PAUSE_BETWEEN_BYTES should be less than
                                     //  (65536 / Rticks_per_bit) - 2; for 16MHz at most ~37 (not sure if this value is still correct)
                                     // For KLICDA devices a value of 9 bit lengths seems to work.
-#define S_TIMER                     // support for uptime_sec() in new library, but monopolizes TIMER0, so millis() cannot be used.
-                                    // if undefined, TIMER0 is not used, and millis() can be used
-                                    // if S_TIMER is undefined, the write budget (and error budget) will not increase over time TODO fix this
+#define RX_CLOCK_RECOVERY           // estimates the bit period of each sender (from the falling edges of each received byte) and times the
+                                    //   sampling of its next bytes accordingly, to tolerate more clock skew than the fixed nominal bit period,
+                                    //   see clockskew()
+#define PACKET_TIMESTAMP            // records for each packet the time of the first falling edge of its start bit, in CPU cycles (on the clock of
+                                    //   bus 0, timer1 extended by counting timer1 overflows, see clock_cycles()), see packettime()
+//#define BUS_CYCLE_LEARNER         // learns for each packet type (header) the pauses on the bus after packets read, so that packets can be written
+                                    //   in the first pause that is expected to be long enough, see schedulegap(), gaprisk() and gapsafe()
+                                    //   (costs BUS_CYCLE_SIZE * 8 bytes of RAM)
+#define EVENT_HANDLERS              // handlers for packet complete, write complete/collision and bus idle events, run in priority order by
+                                    //   dispatch() from loop(), or (if priority >= P1P2_PRIO_ISR) from the ms timer ISR, see setHandler()
+//#define ADC_BITSYNC               // if use_ADC, samples the bus voltage (ADC_pin0) in 0 bits and 1 bits of received packets, started by the receive ISRs,
+                                    //   and keeps low/high level statistics per sender (2 MSBs of first byte), see ADC_bitstats() (~80 bytes of RAM)
+//#define ADC_STREAM                // if use_ADC, the ADC ISR only stores raw samples, which ADC_process() turns into min/max/mean and quantiles
+                                    //   per window (see P1P2Serial_ADC.h, ADC_window()); ADC_results() then reports the last complete window
+                                    //   (~264 bytes of RAM with the default ADC_RING_SIZE and ADC_SKETCH_SHIFT)
+//#define TX_RETRY                  // packets queued after setRetry() are written again after a collision (in the next pause long enough, after a
+                                    //   random backoff), instead of being dropped with all other queued packets; results via writeresult()
+                                    //   (costs 6 bytes of RAM per write packet queue entry, plus the result buffer)
+#define TX_CARRIER_SENSE            // listen before talk: after a packet is selected for writing, its start bit is only scheduled if the bus stays
+                                    //   idle for one more bit time (reading continues meanwhile); otherwise the write is deferred to the next pause
+                                    //   long enough, without a collision, see writedeferred()
+//#define TX_REPLY                  // replies preloaded with setReply() are built by the ISR at the end of each matching request read and queued by
+                                    //   the ms timer ISR, so that they are written a fixed delay after the request, without waiting for loop()
+                                    //   (costs (TX_REPLY_SLOTS + 1) * TX_REPLY_SIZE + 15 * TX_REPLY_SLOTS bytes of RAM, ~110 by default)
+#define IDLE_SLEEP                  // idle() puts the CPU in IDLE sleep until the next interrupt (timers, input capture and ADC keep running)
+                                    //   and counts the cycles asleep, so that idlestats() gives the CPU utilisation; adds a check of a few cycles
+                                    //   to each ISR
+//#define P1P2_BUS1                 // second P1/P2 bus (ATmega2560 only): class P1P2Serial1 on timer4 (ICP4 pin 49, OC4A pin 6) and timer3 (ms timer),
+                                    //   with its own buffers, scope and ISRs; shares the clock, ADC and LEDs with bus 0
+                                    //   (ATmega2560 builds are refused with #error unless P1P2_BUS1 is defined, as that code is untested)
 // End of configuration options
 
+// Default buffer geometry, used for P1P2SerialCfg below unless P1P2SERIAL_CONFIG is defined (for example via build flags)
+// Power-of-2 sizes use mask-based index wrap-around
+#ifndef TX_BUFFER_SIZE
 #define TX_BUFFER_SIZE 25  // write buffer size (1 more than max size needed)
+#endif
+#ifndef RX_BUFFER_SIZE
 #define RX_BUFFER_SIZE 25  // read buffer (1 more than max size needed), should be <=254
+#endif
+#ifndef RX_PACKET_BUFFER_SIZE
+#define RX_PACKET_BUFFER_SIZE 8 // packet descriptor buffer (1 more than max # complete packets waiting to be read), should be <=254
+#endif
+#ifndef TX_PACKET_BUFFER_SIZE
+#define TX_PACKET_BUFFER_SIZE 4 // write packet queue (1 more than max # packets waiting to be written), should be <=254
+#endif
+#ifndef TX_RESULT_BUFFER_SIZE
+#define TX_RESULT_BUFFER_SIZE 4 // write results (TX_RETRY) (1 more than max # results waiting to be read by writeresult()), should be <=254
+#endif
+#ifndef TX_REPLY_SLOTS
+#define TX_REPLY_SLOTS 2    // # reply slots (TX_REPLY), TX_REPLY_SIZE + 15 bytes each (plus one TX_REPLY_SIZE reply buffer), kept small for an ATmega328P
+#endif
+#ifndef TX_REPLY_SIZE
+#define TX_REPLY_SIZE 24    // max reply size (TX_REPLY) without CRC byte, should be 3..32
+#endif
+#define TX_RETRY_BACKOFF_SHIFT 3 // backoff window doubles with each retry, up to 2^TX_RETRY_BACKOFF_SHIFT times the window set by setRetry()
+#ifndef BUS_CYCLE_SIZE
+#define BUS_CYCLE_SIZE 24 // # packet types for which pauses are learned (BUS_CYCLE_LEARNER), 8 bytes each, least observed type is replaced if full
+#endif
+#define BUS_CYCLE_HEADER 3  // # first bytes of a packet identifying its type
+#define BUS_CYCLE_LOW 3     // # shortest pauses remembered per packet type; risk estimates are exact up to BUS_CYCLE_LOW - 1 shorter pauses
+#define BUS_CYCLE_MIN_N 8   // # pauses to be observed after a packet type before schedulegap() writes after it
+#ifndef P1P2_HANDLERS
+#define P1P2_HANDLERS 4     // max # event handlers (EVENT_HANDLERS), should be <= 8
+#endif
 #define NO_HEAD2 0xFF
 
 
@@ -116,78 +198,200 @@
 #define ERROR_FLAGS               0x7F
 #endif /* GENERATE_FAKE_ERRORS */
 
-#ifdef MEASURE_LOAD
-extern volatile uint16_t irq_w, irq_r, irq_lapsed_w, irq_lapsed_r;
-extern volatile uint8_t irq_busy;
-#endif
+// ISR execution time statistics (ISR_STATS), one per ISR below
+// execution time is measured with timer1 from start to end of the ISR body, so excluding interrupt response, prologue and epilogue
+#define ISR_STATS_CAPTURE         0    // state: rx_state at entry
+#define ISR_STATS_COMPARE_R       1    // state: rx_state at entry
+#define ISR_STATS_COMPARE_W       2    // state: tx_state at entry (98: end of carrier sense window)
+#define ISR_STATS_MS_TIMER        3    // state: tx_state at exit
+#define ISR_STATS_ADC             4    // state: 0 (1 for bit sample, ADC_BITSYNC)
+#define ISR_STATS_CNT             5
+#define ISR_STATS_BINS            8    // bin i counts calls taking less than 64 << i cycles, last bin counts all longer calls
+
+typedef struct {
+  uint16_t hist[ISR_STATS_BINS];     // # calls per execution time bin, saturating at 0xFFFF
+  uint16_t max;                      // longest execution time (cycles)
+  uint8_t max_state;                 // rx/tx state in which longest execution time occurred
+} isr_stats_t;
+
+// CPU time asleep in idle() (IDLE_SLEEP), see idlestats(); the CPU utilisation (ISRs included) is 1 - sleep / cycles.
+// Sleep is counted until the start of the library ISR that wakes up the CPU (until idle() returns if another ISR, like the UART's, did).
+typedef struct {
+  uint32_t cycles;                   // CPU cycles since reset of statistics (begin() or idlestats()), wraps every 2^32 cycles (268s at 16MHz)
+  uint32_t sleep;                    // CPU cycles asleep in idle()
+  uint16_t count;                    // # times idle() slept, saturating at 0xFFFF
+} idle_stats_t;
+
+// Bus voltage levels sampled per sender (ADC_BITSYNC), see ADC_bitstats()
+// Index 0: low level, sampled in the first half of 0 bits; index 1: high level, sampled in 1 bits (both in ADC units).
+// The eye margin of a sender is min[1] - max[0].
+#define ADC_BIT_SOURCES           4    // senders distinguished by 2 MSBs of first byte (00, 40, 80, C0)
+
+typedef struct {
+  uint16_t n[2];                     // # samples (counting stops at 0xFFFF)
+  uint16_t min[2];                   // lowest sample (0x3FF if none)
+  uint16_t max[2];                   // highest sample (0 if none)
+  uint32_t sum[2];                   // sum of samples
+} adc_bit_stats_t;
+
+// Pauses observed after packets of one type (BUS_CYCLE_LEARNER), see gapstats()
+// A pause is the time between the end of a packet and the start of the next packet on the bus, in ms, as counted for setDelay().
+// Pauses followed by a packet written by us are not learned, nor are pauses after packets with errors.
+typedef struct {
+  uint8_t header[BUS_CYCLE_HEADER];  // first bytes of packet
+  uint8_t low[BUS_CYCLE_LOW];        // shortest pauses observed (ms, ascending, 255 for 255ms or more or not observed)
+  uint16_t n;                        // # pauses observed (saturating), 0 if entry unused
+} bus_gap_t;
+
+// Events (EVENT_HANDLERS), see setHandler()
+// A handler is called with the events that occurred since its previous call. For P1P2_EVENT_PACKET it is called once per packet,
+// oldest first; in the handler, readpacket() and acquirepacket() return that packet, and the packet is released when all packet handlers
+// have been called for it (releasepacket() is not needed). Handlers with priority >= P1P2_PRIO_ISR run in the ms timer ISR, after it has
+// re-enabled interrupts, so before dispatch() is called and without waiting for serial output in loop(); keep these short (replies are not
+// queued and ms timer ISRs do not run handlers meanwhile), and do not share unprotected state with loop(). Other handlers run in
+// dispatch(), highest priority first; a handler for a new event of higher priority runs before further events of lower priority are handled.
+#define P1P2_EVENT_PACKET         0x01 // complete packet received (including packets written by us, if Echo)
+#define P1P2_EVENT_WRITE          0x02 // packet written (or write stopped after a collision)
+#define P1P2_EVENT_COLLISION      0x04 // (with P1P2_EVENT_WRITE) read-back error, all queued packets have been dropped (except those to be retried)
+#define P1P2_EVENT_IDLE           0x08 // no start bit on bus for the time set by setIdle()
+#define P1P2_EVENT_RESULT         0x10 // result of a packet queued with retries available (TX_RETRY), see writeresult()
+#define P1P2_PRIO_ISR             0x80 // handlers with at least this priority run in the ms timer ISR
+
+typedef void (*P1P2_handler_t)(uint8_t events);
+
+// Result of a packet queued after setRetry() with retries > 0 (TX_RETRY), see writeresult()
+#define P1P2_TX_OK                0    // written, after attempts - 1 collisions
+#define P1P2_TX_COLLISION         1    // dropped, collision in each of the attempts allowed
+#define P1P2_TX_DEADLINE          2    // dropped, deadline passed before (re)writing started
+
+typedef struct {
+  uint8_t header[3];                 // first bytes of packet
+  uint8_t status;                    // P1P2_TX_*
+  uint8_t attempts;                  // # times writing started
+} tx_result_t;
+
+// Reply preloaded for a type of request (TX_REPLY), see setReply()
+// A request matches a slot if it has been read without errors (CRC checked, see setCRC()), has at least 3 bytes, starts with header[0] and
+// header[1], and its third byte (packet type) is in type_first..type_last. The reply has len bytes (0: as many as the request, both without
+// CRC byte; at most TX_REPLY_SIZE), followed by a CRC byte as set by setCRC(); reply byte i is copied from request byte i if bit i of copy
+// is set (and the request has byte i), and is data[i] otherwise.
+#define P1P2_REPLY_ALWAYS         0xFF // count: slot is not used up
+
+typedef struct {
+  uint8_t header[2];                 // first bytes of request
+  uint8_t type_first;                // range of packet types (third byte of request) answered
+  uint8_t type_last;
+  uint8_t len;                       // reply size without CRC byte, 0 for size of request
+  uint8_t count;                     // # replies still to be written, P1P2_REPLY_ALWAYS for no limit; slot unused if 0
+  uint16_t delay;                    // ms silence after the request before the reply is written (as t of schedulepacket())
+  uint16_t deadline;                 // reply dropped if writing has not started within deadline ms (0: no deadline)
+  uint8_t priority;                  // priority in write packet queue (see schedulepacket())
+  uint32_t copy;                     // bit i set: reply byte i copied from request
+  uint8_t data[TX_REPLY_SIZE];       // reply bytes
+} tx_reply_t;
 
 //extern volatile uint8_t toolate;
 //extern volatile uint16_t lateness;
 
-#define SWS_MAX 22          // Max # SWS events recorded, limited by ATmega memory size (3 bytes/event) and serial output bandwidth
-                            // this cannot be much higher or time-info output overwhelms and crashes ESP8266, 21 is just over 1 byte timing info
+#ifndef SWS_MAX
+#define SWS_MAX 66          // size (bytes) of compressed SW_SCOPE log, enough for a 24-byte packet read or written (~2-2.5 bytes per byte)
+#endif                      // (same size as the 22 events of 3 bytes logged before, just over 1 byte timing info)
                             // info exchange not very clean but using global variables
 
-#define SWS_EVENT_LOOP              0xF0 // stored in sws_event[SWS_MAX - 1] to indicate that <SWS_MAX events were recorded
-#define SWS_EVENT_ERR_SB            0xFF
-#define SWS_EVENT_ERR_BC            0xFE
-#define SWS_EVENT_ERR_PE            0xFD
-#define SWS_EVENT_ERR_BE            0xFC
-#define SWS_EVENT_ERR_SB_FAKE       0xFB
-#define SWS_EVENT_ERR_BC_FAKE       0xFA
-#define SWS_EVENT_ERR_PE_FAKE       0xF9
-#define SWS_EVENT_ERR_BE_FAKE       0xF8
-#define SWS_EVENT_ERR_LOW           0xF7
-#define SWS_EVENT_MASK              0xE0
-
-#define SWS_EVENT_SIGNAL_LOW     0x00
-#define SWS_EVENT_SIGNAL_HIGH_R  0x80
-#define SWS_EVENT_EDGE_FALLING_W 0x40
-#define SWS_EVENT_EDGE_FALLING_R 0xC0
-#define SWS_EVENT_EDGE_RISING    0x60
-#define SWS_EVENT_EDGE_SPIKE     0xA0
-
+#ifndef ERRORBUF_TYPE
 #ifdef GENERATE_FAKE_ERRORS
-#define errorbuf_t uint16_t
+#define ERRORBUF_TYPE uint16_t
 #else /* GENERATE_FAKE_ERRORS */
-#define errorbuf_t uint8_t
+#define ERRORBUF_TYPE uint8_t
 #endif /* GENERATE_FAKE_ERRORS */
+#endif /* ERRORBUF_TYPE */
+
+// Compile-time buffer geometry: read buffer, write buffer, packet descriptor buffer and scope buffer (bytes) sizes, error code type,
+// and (optional) write packet queue size.
+// The library is built for P1P2SerialCfg; to change it without editing this file, define P1P2SERIAL_CONFIG for all
+// compilation units, e.g. (PlatformIO) build_flags = '-D P1P2SERIAL_CONFIG=P1P2SerialConfig<64,32,16,32,uint16_t>'
+template <uint8_t RxSize, uint8_t TxSize, uint8_t PacketSize, uint8_t ScopeSize, typename ErrorT, uint8_t TxPacketSize = TX_PACKET_BUFFER_SIZE>
+struct P1P2SerialConfig {
+  static const uint8_t rx_size = RxSize;
+  static const uint8_t tx_size = TxSize;
+  static const uint8_t packet_size = PacketSize;
+  static const uint8_t scope_size = ScopeSize;
+  static const uint8_t tx_packet_size = TxPacketSize;
+  typedef ErrorT errorbuf_type;
+  static_assert((RxSize >= 2) && (RxSize <= 254), "read buffer size should be 2..254");
+  static_assert((TxSize >= 2) && (TxSize <= 254), "write buffer size should be 2..254");
+  static_assert((PacketSize >= 2) && (PacketSize <= 254), "packet descriptor buffer size should be 2..254");
+  static_assert((ScopeSize >= 8) && (ScopeSize <= 254), "scope buffer size (bytes) should be 8..254");
+  static_assert((TxPacketSize >= 2) && (TxPacketSize <= 254), "write packet queue size should be 2..254");
+  static_assert(sizeof(ErrorT) <= 2, "errorbuf type should be 8 or 16 bits");
+};
+
+#ifndef P1P2SERIAL_CONFIG
+#define P1P2SERIAL_CONFIG P1P2SerialConfig<RX_BUFFER_SIZE, TX_BUFFER_SIZE, RX_PACKET_BUFFER_SIZE, SWS_MAX, ERRORBUF_TYPE, TX_PACKET_BUFFER_SIZE>
+#endif
+typedef P1P2SERIAL_CONFIG P1P2SerialCfg;
+typedef P1P2SerialCfg::errorbuf_type errorbuf_t;
+
+// Index arithmetic for a ring buffer of N entries; wraps with a mask if N is a power of 2, with a compare otherwise
+template <uint8_t N>
+struct P1P2Ring {
+  static const bool pow2 = !(N & (N - 1));
+  static inline uint8_t next(uint8_t i) { return pow2 ? ((i + 1) & (N - 1)) : ((i + 1 >= N) ? 0 : i + 1); }
+  static inline uint8_t prev(uint8_t i) { return pow2 ? ((i - 1) & (N - 1)) : (i ? i - 1 : N - 1); }
+  static inline uint8_t add(uint8_t i, uint8_t n) { return pow2 ? ((i + n) & (N - 1)) : (((uint16_t) i + n >= N) ? i + n - N : i + n); } // n < N
+  static inline uint8_t count(uint8_t head, uint8_t tail) { return pow2 ? ((head - tail) & (N - 1)) : ((head >= tail) ? head - tail : N + head - tail); }
+};
+
+// In-place view of a received packet in the read buffer, returned by acquirepacket() and valid until releasepacket().
+// The packet occupies one segment, or two segments if it wraps around the end of the read buffer.
+// error flags per byte may include SIGNAL_EOP (on the last byte), mask with ERROR_FLAGS if needed.
+typedef struct {
+  const volatile uint8_t* data1;     // first segment
+  const volatile errorbuf_t* error1;
+  uint8_t len1;
+  const volatile uint8_t* data2;     // second segment (start of read buffer), only if len2 > 0
+  const volatile errorbuf_t* error2;
+  uint8_t len2;
+  uint8_t len;                       // len1 + len2
+  uint16_t delta;                    // pause on bus before this packet (ms)
+  uint32_t time;                     // time of first falling edge (CPU cycles, see packettime())
+  errorbuf_t errors;                 // OR of error flags of all bytes
+  uint8_t reply;                     // slot + 1 of reply to this packet built by the library (TX_REPLY), 0 if none
+  uint8_t at(uint8_t i) const { return (i < len1) ? data1[i] : data2[i - len1]; }
+  errorbuf_t error(uint8_t i) const { return ((i < len1) ? error1[i] : error2[i - len1]) & ERROR_FLAGS; }
+} packetview_t;
 
-extern volatile uint16_t sws_capture[SWS_MAX];
-extern volatile uint8_t sws_event[SWS_MAX];
-extern volatile uint8_t sws_cnt;
-extern volatile uint8_t sws_overflow;
-extern volatile byte sws_block;
-extern volatile byte sw_scope;
-//extern volatile uint16_t count;
-//extern volatile uint16_t capture;
+// Bus 0 (class P1P2Serial) and, if P1P2_BUS1 is defined, bus 1 (class P1P2Serial1) each have their own state, buffers, scope and ISRs,
+// as P1P2Serial_Bus.h (and P1P2Serial_BusImpl.h) is compiled once per bus.
+namespace P1P2Bus0 {
+#include "P1P2Serial_Bus.h"
+} // namespace P1P2Bus0
 
-class P1P2Serial
+class P1P2Serial : public P1P2Bus0::P1P2SerialBus
 {
 public:
 	P1P2Serial() { };
 	~P1P2Serial() { end(); }
-	static void begin(uint32_t baud, bool use_ADC = false, uint8_t ADC_pin0 = 0, uint8_t ADC_pin1 = 1);
-	static void end();
-	uint8_t read();      // returns next byte in read buffer
-        errorbuf_t read_error(); // returns error code or EOP signal for next byte in read buffer, to be called before read()
-	uint16_t read_delta(); // returns time difference between next byte in read buffer and previously read byte, to be called before read()
-	bool available();
-	bool packetavailable();
-	static void flushInput();
-	static void flushOutput();
-	static bool writeready();
-	static void write(uint8_t byte);
-	static void setDelay(uint16_t t);
-	static void setDelayTimeout(uint16_t t);
-#ifdef SW_SCOPE
-        static void setScope(byte b);
-#endif /* SW_SCOPE */
-	static void setEcho(uint8_t b);
-	uint16_t readpacket(uint8_t* readbuf, uint16_t &delta, errorbuf_t* errorbuf, uint8_t maxlen, uint8_t crc_gen = 0, uint8_t crc_feed = 0);
-	void writepacket(uint8_t* writebuf, uint8_t l, uint16_t t, uint8_t crc_gen = 0, uint8_t crc_feed = 0);
-        int32_t uptime_sec(void);
-        int32_t uptime_millisec(void);
-        void ADC_results(uint16_t &V0_min, uint16_t &V0_max, uint32_t &V0_avg, uint16_t &V1_min, uint16_t &V1_max, uint32_t &V1_avg);
 };
+
+// scope of bus 0
+using P1P2Bus0::sws_buffer;
+using P1P2Bus0::sws_bitcnt;
+using P1P2Bus0::sws_overflow;
+using P1P2Bus0::sws_block;
+using P1P2Bus0::sw_scope;
+
+#ifdef P1P2_BUS1
+namespace P1P2Bus1 {
+#include "P1P2Serial_Bus.h"
+} // namespace P1P2Bus1
+
+class P1P2Serial1 : public P1P2Bus1::P1P2SerialBus
+{
+public:
+	P1P2Serial1() { };
+	~P1P2Serial1() { end(); }
+};
+#endif /* P1P2_BUS1 */
+
 #endif /* P1P2Serial_h */
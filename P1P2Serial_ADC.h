@@ -3,6 +3,7 @@
  * Copyright (c) 2022 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
  *
  * Version history
+ * 20261016 v0.9.34 streaming ADC statistics (ADC_STREAM): raw sample ring, windowed min/max/mean and quantiles (adc_window_t)
  * 20221029 v0.9.23 ADC code
  *
  */
@@ -11,3 +12,32 @@
 
 #define ADC_AVG_SHIFT 4     // sum 16 = 2^ADC_AVG_SHIFT samples before doing min/max check
 #define ADC_CNT_SHIFT 4     // sum 16384 = 2^(16-ADC_CNT_SHIFT) samples to V0avg/V1avg
+
+// Streaming ADC statistics (ADC_STREAM): the ADC ISR only stores raw samples in a ring, ADC_process() (called from loop()) computes
+// statistics per channel over windows of ADC_setWindow() samples; a histogram of 1024 >> ADC_SKETCH_SHIFT bins per channel serves as
+// quantile sketch (linear interpolation within a bin), evaluated at the end of each window for the ADC_QUANTILES (per mille)
+#ifndef ADC_RING_SIZE
+#define ADC_RING_SIZE 32    // raw samples buffered between ADC ISR and ADC_process() (both channels), <=254
+#endif
+#ifndef ADC_WINDOW
+#define ADC_WINDOW 4096     // default window (samples per channel), about 1s at 8MHz
+#endif
+#ifndef ADC_SKETCH_SHIFT
+#define ADC_SKETCH_SHIFT 5  // bin width 32 ADC units, 32 bins (64 bytes) per channel
+#endif
+#define ADC_SKETCH_BINS (1024 >> ADC_SKETCH_SHIFT)
+#ifndef ADC_QUANTILES       // to override, define both ADC_QUANTILES and ADC_QUANTILE_CNT
+#define ADC_QUANTILE_CNT 3
+#define ADC_QUANTILES { 50, 500, 950 }
+#endif
+
+// Statistics of one complete window of one ADC channel (ADC units), see ADC_window()
+typedef struct {
+  uint16_t seq;                      // window number (wraps), 0 if no window completed yet
+  uint16_t n;                        // # samples in window
+  uint16_t lost;                     // # samples of this channel dropped during window (ring full, ADC_process() called too late)
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;                      // mean is sum / n
+  uint16_t q[ADC_QUANTILE_CNT];      // quantile estimates for ADC_QUANTILES
+} adc_window_t;
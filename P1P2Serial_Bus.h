@@ -0,0 +1,106 @@
+/* P1P2Serial_Bus.h: declarations of one P1/P2 bus of the P1P2Serial library
+ *
+ * Copyright (c) 2019-2022 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 class declaration moved here from P1P2Serial.h, to be declared once per bus (P1P2_BUS1)
+ *                  ADC_bitstats(): bit-synchronous ADC sampling per sender (ADC_BITSYNC)
+ *                  ADC_process(), ADC_window(), ADC_setWindow(): streaming ADC statistics (ADC_STREAM)
+ *                  setRetry(), writeresult(): automatic retransmit after a collision (TX_RETRY)
+ *                  idle(), idlestats(): IDLE sleep and CPU utilisation (IDLE_SLEEP)
+ *                  writedeferred(): writes deferred by listen before talk (TX_CARRIER_SENSE)
+ *                  clock_cycles(), clock_usec(), clock_msec(), clock_sec(): monotonic clock shared by all buses
+ *                  setReply(), replycount(), replyrefused(), packetreply(): replies queued by the library (TX_REPLY)
+ *
+ */
+
+// file included by P1P2Serial.h only, once per bus inside namespace P1P2Bus0 and P1P2Bus1, so no include guard
+
+extern volatile uint8_t sws_buffer[P1P2SerialCfg::scope_size]; // compressed log, decode with P1P2_sws_next()
+extern volatile uint16_t sws_bitcnt; // # bits in sws_buffer
+extern volatile uint8_t sws_overflow; // log stopped as sws_buffer was full
+extern volatile byte sws_block;
+extern volatile byte sw_scope;
+//extern volatile uint16_t count;
+//extern volatile uint16_t capture;
+
+class P1P2SerialBus
+{
+public:
+	static void begin(uint32_t baud, bool use_ADC = false, uint8_t ADC_pin0 = 0, uint8_t ADC_pin1 = 1);
+	static void end();
+	uint8_t read();      // returns next byte in read buffer
+        errorbuf_t read_error(); // returns error code or EOP signal for next byte in read buffer, to be called before read()
+	uint16_t read_delta(); // returns time difference between next byte in read buffer and previously read byte, to be called before read()
+	bool available();
+	bool packetavailable(); // true if a complete packet can be read (constant time)
+	static void flushInput();
+	static void flushOutput();
+	static bool writeready();
+	static void write(uint8_t byte);
+	static void setDelay(uint16_t t);
+	static void setDelayTimeout(uint16_t t);
+#ifdef SW_SCOPE
+        static void setScope(byte b);
+#endif /* SW_SCOPE */
+	static void setEcho(uint8_t b);
+	static void setCRC(uint8_t crc_gen, uint8_t crc_feed = 0); // CRC check of received packets in ISR (sets ERROR_CRC), crc_gen=0 to disable
+	static uint8_t crc(const uint8_t* buf, uint8_t n); // CRC of n bytes, using generator and feed set by setCRC()
+	uint16_t readpacket(uint8_t* readbuf, uint16_t &delta, errorbuf_t* errorbuf, uint8_t maxlen, uint8_t crc_gen = 0, uint8_t crc_feed = 0);
+	errorbuf_t packeterrors(); // returns OR of error flags of all bytes of the packet last returned by readpacket()
+	uint8_t packetreply(); // returns slot + 1 of reply to the packet last returned by readpacket() built by the library (TX_REPLY), 0 if none
+	static int32_t clockskew(uint8_t header); // estimated bit period deviation (ppm, positive if slower than nominal) of sender of packets
+	                                          // starting with header (senders are distinguished by the 2 MSBs); 0 if RX_CLOCK_RECOVERY is not defined
+	static bool isrstats(uint8_t isr, isr_stats_t &stats, bool reset = false); // copies statistics of ISR isr (ISR_STATS_*), and resets them if reset,
+	                                                                           // returns false if ISR_STATS is not defined
+	uint32_t packettime(); // returns time of first falling edge of packet last returned by readpacket(), in CPU cycles (F_CPU/1000000 per us),
+	                       // on the clock_cycles() time base (its 32 LSBs), wraps every 2^32 cycles
+	                       // (268s at 16MHz); 0 if PACKET_TIMESTAMP is not defined
+	bool acquirepacket(packetview_t &view); // if a complete packet is available, returns true and a view on it, without copying
+	static void releasepacket(); // frees the packet last acquired, to be called when done with the view
+	void writepacket(uint8_t* writebuf, uint8_t l, uint16_t t, uint8_t crc_gen = 0, uint8_t crc_feed = 0);
+	// non-blocking: queues packet (plus CRC byte if crc_gen), returns false if write buffer or write packet queue is full
+	static bool schedulepacket(const uint8_t* writebuf, uint8_t l, uint16_t t, uint16_t timeout, uint8_t priority = 0, uint16_t deadline = 0, uint8_t crc_gen = 0, uint8_t crc_feed = 0);
+	// non-blocking: queues packet to be written t ms after the next packet (starting with after[0..after_len-1] if after_len) followed by a pause
+	// of at least t + busy ms with a risk of at most maxrisk per mille (as learned by BUS_CYCLE_LEARNER), returns false if queue full or not supported
+	static bool schedulegap(const uint8_t* writebuf, uint8_t l, uint16_t t, uint16_t busy, uint16_t maxrisk, const uint8_t* after = NULL, uint8_t after_len = 0,
+	                        uint8_t priority = 0, uint16_t deadline = 0, uint8_t crc_gen = 0, uint8_t crc_feed = 0);
+	static uint16_t gaprisk(const uint8_t* header, uint16_t t); // risk (per mille) that the pause after a packet with this header is shorter than t ms,
+	                                                            // 0xFFFF if not (yet) known
+	static uint16_t gapsafe(const uint8_t* header, uint16_t maxrisk); // longest pause (ms) after a packet with this header with a risk of at most
+	                                                                  // maxrisk per mille of being shorter, 0 if not (yet) known
+	static bool gapstats(uint8_t i, bus_gap_t &stats); // copies learned entry i (0..BUS_CYCLE_SIZE-1), false if unused or not supported
+	static void setRetry(uint8_t retries, uint16_t backoff = 0); // packets queued afterwards by schedulepacket(), schedulegap() or writepacket() are
+	                                                             // written again up to retries times after a collision (0, default: dropped);
+	                                                             // each retry adds a random 0..backoff ms (doubling per retry) to their delay
+	static uint16_t writedeferred(bool reset = false); // # writes deferred by carrier sense (TX_CARRIER_SENSE) since begin(), reset if reset
+	static bool setReply(uint8_t slot, const tx_reply_t &reply); // preloads reply slot (0..TX_REPLY_SLOTS-1; the first matching slot answers a
+	                                                             // request), reply.count = 0 clears it; false if invalid or TX_REPLY is not defined
+	static uint8_t replycount(uint8_t slot); // # replies slot still answers (P1P2_REPLY_ALWAYS: no limit), 0 once used up
+	static uint16_t replyrefused(bool reset = false); // # replies built but not queued (write buffer or write packet queue full) since begin(),
+	                                                  // reset if reset
+	static bool writeresult(tx_result_t &result); // returns result of oldest packet queued with retries (TX_RETRY) written or dropped, false if none
+	static bool setHandler(uint8_t events, P1P2_handler_t handler, uint8_t priority = 0); // calls handler for events (P1P2_EVENT_*), replacing
+	                                                                                      // its previous registration (events = 0 removes it);
+	                                                                                      // false if table full or EVENT_HANDLERS is not defined
+	static void setIdle(uint16_t t); // signals P1P2_EVENT_IDLE once per pause, after t ms of silence on the bus (0, default: never)
+	static uint8_t dispatch(); // runs handlers with priority < P1P2_PRIO_ISR for pending events, returns events handled; call from loop()
+	static void idle(); // sleeps (IDLE_SLEEP) until the next interrupt unless a packet or event is waiting; call from loop() if nothing to do
+	static bool idlestats(idle_stats_t &stats, bool reset = false); // copies cycles asleep and awake, and resets them if reset,
+	                                                                // returns false if IDLE_SLEEP is not defined
+        int32_t uptime_sec(void);
+        int32_t uptime_millisec(void);
+	static uint64_t clock_cycles(); // monotonic clock shared by all buses: CPU cycles since begin() (timer1 extended by counting overflows)
+	static uint64_t clock_usec();   // same clock in us, ms and s; none of these wraps in practice
+	static uint64_t clock_msec();
+	static uint32_t clock_sec();
+        void ADC_results(uint16_t &V0_min, uint16_t &V0_max, uint32_t &V0_avg, uint16_t &V1_min, uint16_t &V1_max, uint32_t &V1_avg);
+	static bool ADC_bitstats(uint8_t source, adc_bit_stats_t &stats, bool reset = true); // copies bus levels sampled in packets of sender source
+	                                                                                  // (0..ADC_BIT_SOURCES-1, 2 MSBs of first byte), and resets
+	                                                                                  // them if reset; false if not supported or use_ADC is false
+	static void ADC_process(); // moves raw ADC samples from ring to window statistics (ADC_STREAM); call from loop() at least
+	                           // every ADC_RING_SIZE conversions (3ms at 8MHz)
+	static bool ADC_window(uint8_t channel, adc_window_t &w); // copies statistics of last complete window of channel (0: ADC_pin0, 1: ADC_pin1),
+	                                                          // false if none yet, not supported or use_ADC is false
+	static void ADC_setWindow(uint16_t samples); // window size in samples per channel (default ADC_WINDOW), restarts current windows
+};
@@ -0,0 +1,3018 @@
+/* P1P2Serial_BusImpl.h: implementation of one P1/P2 bus of the P1P2Serial library
+ *
+ * Copyright (c) 2019-2022 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 bus implementation moved here from P1P2Serial.cpp, to be compiled once per bus (P1P2_BUS1)
+ *                  ADC_bitstats(): bit-synchronous ADC sampling per sender (ADC_BITSYNC); ADC sample counter wrap test also for 32-bit int (host)
+ *                  streaming ADC statistics (ADC_STREAM): ADC ISR stores raw samples, ADC_process() computes windowed statistics and quantiles
+ *                  automatic retransmit after a collision (TX_RETRY): packet rewound and re-queued with random backoff, write results
+ *                  idle(): IDLE sleep until the next interrupt, time asleep measured with timer1 (IDLE_SLEEP), idlestats()
+ *                  listen before talk: write deferred if another device starts in the bit time before its start bit (TX_CARRIER_SENSE)
+ *                  clock: timer1 of bus 0 extended to 64 bits, replaces the s timer (timer0) for uptime and deadlines (exact)
+ *                  replies preloaded per request type (TX_REPLY): built in rx_packet_eop(), queued by the ms timer ISR with interrupts enabled
+ *
+ * See P1P2Serial.cpp for the full version history and license.
+ *
+ */
+
+// file included by P1P2Serial.cpp only, once per bus inside namespace P1P2Bus<P1P2_BUS>, with the HAL macros of that bus;
+// all file-static state and ISRs below are therefore instantiated per bus
+
+#ifdef GENERATE_FAKE_ERRORS
+#define FAKE_ERROR_PE 0 // parity error
+#define FAKE_ERROR_SB 1 // start bit error during write
+#define FAKE_ERROR_BE 2 // data read-back error, likely bus collission, in direct write verification mode
+#define FAKE_ERROR_BC 3 // high bit half read-back error, likely bus collission
+bool errorGen[4] = { true, true, true, true };
+uint16_t errorGenCnt[4] = { 0, 100, 200, 300 };
+
+bool fakeError(byte x)
+{
+  if (++errorGenCnt[x] == SWS_FAKE_ERR_CNT) {
+    errorGenCnt[x] = 0;
+    return errorGen[x];
+  }
+  return 0;
+}
+#endif /* GENERATE_FAKE_ERRORS */
+
+/****************************************/
+/**   ISR execution time statistics    **/
+/****************************************/
+
+#ifdef ISR_STATS
+
+// ISR_STATS_START starts measuring at ISR entry, ISR_STATS_STOP(isr, state) is called at each ISR exit
+// the statistics are only updated in ISRs, and copied and reset by isrstats() with interrupts disabled
+
+#ifndef ISR_STATS_CLOCK
+#define ISR_STATS_CLOCK()               (GET_TIMER_W_COUNT())
+#endif /* ISR_STATS_CLOCK */
+
+static isr_stats_t isr_stats[ISR_STATS_CNT];
+
+static inline void isr_stats_stop(uint8_t isr, uint16_t start, uint8_t state)
+{
+  uint16_t cycles = ISR_STATS_CLOCK() - start;
+  uint16_t c = cycles >> 6;
+  uint8_t bin = 0;
+  while (c && (bin < ISR_STATS_BINS - 1)) {
+    c >>= 1;
+    bin++;
+  }
+  isr_stats_t &st = isr_stats[isr];
+  if (st.hist[bin] != 0xFFFF) st.hist[bin]++;
+  if (cycles > st.max) {
+    st.max = cycles;
+    st.max_state = state;
+  }
+}
+
+#define ISR_STATS_START                 uint16_t isr_stats_start = ISR_STATS_CLOCK();
+#define ISR_STATS_STOP(isr, state)      isr_stats_stop(isr, isr_stats_start, state);
+
+#else /* ISR_STATS */
+
+#define ISR_STATS_START                 ;
+#define ISR_STATS_STOP(isr, state)      ;
+
+#endif /* ISR_STATS */
+
+#ifdef IDLE_SLEEP
+// idle() sets idle_asleep before sleeping; the first ISR of the library (of any bus) after that records when the CPU woke up
+#if P1P2_BUS == 0
+static volatile uint8_t idle_asleep = 0;
+static void idle_wake(void);
+#else /* P1P2_BUS */
+using P1P2Bus0::idle_asleep;
+using P1P2Bus0::idle_wake;
+#endif /* P1P2_BUS */
+#define IDLE_WAKE                       if (idle_asleep) idle_wake();
+#else /* IDLE_SLEEP */
+#define IDLE_WAKE                       ;
+#endif /* IDLE_SLEEP */
+
+/************************/
+/**  ADC for voltages  **/
+/************************/
+
+// the ADC, like the timer1 clock, is shared by all buses and handled by bus 0
+
+#if P1P2_BUS == 0
+
+static bool _use_ADC = false;
+static byte ADMUX0 = 0;
+static byte ADMUX1 = 0;
+
+#ifdef ADC_STREAM
+// raw samples (bit 15 set for ADC_pin1), written by ADC ISR, read by ADC_process()
+#define ADC_RING_CH1                    0x8000
+typedef P1P2Ring<ADC_RING_SIZE> AdcRing;
+static volatile uint16_t adc_ring[ADC_RING_SIZE];
+static volatile uint8_t adc_ring_head = 0;
+static volatile uint8_t adc_ring_tail = 0;
+static volatile uint16_t adc_ring_lost[2] = { 0, 0 };
+
+// window in progress per channel, and last complete window
+typedef struct {
+  uint16_t n;
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+  uint16_t hist[ADC_SKETCH_BINS];
+} adc_acc_t;
+static adc_acc_t adc_acc[2];
+static adc_window_t adc_windows[2];
+static uint16_t adc_window_n = ADC_WINDOW;
+static const uint16_t adc_quantiles[ADC_QUANTILE_CNT] = ADC_QUANTILES;
+#else /* ADC_STREAM */
+static uint16_t V0min = 0x3FF << ADC_AVG_SHIFT;
+static uint16_t V0max = 0x0000;
+static uint32_t V0avg = 0x00;
+static uint16_t V1min = 0x3FF << ADC_AVG_SHIFT;
+static uint16_t V1max = 0x0000;
+static uint32_t V1avg = 0x00;
+
+static uint16_t V0cnt = 0;
+static uint16_t V1cnt = 0;
+static uint32_t V0sum0 = 0x00;
+static uint32_t V0sum = 0x00;
+static uint32_t V1sum0 = 0x00;
+static uint32_t V1sum = 0x00;
+#endif /* ADC_STREAM */
+
+#ifdef ADC_BITSYNC
+// bit-synchronous sampling: while a packet is received, conversions on ADC_pin0 are started by the receive ISRs, in the low half of 0 bits
+// (CAPTURE_INTERRUPT) and in 1 bits (COMPARE_R_INTERRUPT), and accounted to the sender of the packet (2 MSBs of its first byte);
+// free-running conversions on ADC_pin0/ADC_pin1 for ADC_results() continue between packets
+#define ADC_BIT_FIRST                   ADC_BIT_SOURCES       // adc_bit_src during first byte, sender not yet known
+#define ADC_BIT_IDLE                    (ADC_BIT_SOURCES + 1) // adc_bit_src between packets
+#define ADC_BIT_SAMPLE                  0x80                  // adc_bit_sample: conversion in progress is a bit sample (| level << 2 | sender)
+static volatile uint8_t adc_bit_src = ADC_BIT_IDLE;
+static volatile uint8_t adc_bit_sample = 0;
+static adc_bit_stats_t adc_bit_stats[ADC_BIT_SOURCES];
+#endif /* ADC_BITSYNC */
+
+#ifdef P1P2_HOST
+
+#define ADC_TRIGGER                     (VHW_adc_trigger())
+#define ADC_INTERRUPT                   VHW_ADC_vect
+#define ADC_VALUE                       (VHW.adc_value)
+#define ADC_ADC0                        (VHW.admux = ADMUX0)
+#define ADC_ADC1                        (VHW.admux = ADMUX1)
+#define ADC_INT_DISABLE                 (VHW.adc_int_enabled = 0)
+#define ADC_INT_ENABLE                  (VHW.adc_int_enabled = 1)
+#define ADC_CONFIG(pin0, pin1)          (VHW.adc_int_enabled = 1, ADC_TRIGGER)
+#define ADC_IDLE                        (VHW.adc_int_enabled && !VHW_adc_busy())
+
+#else /* P1P2_HOST */
+
+// hard-coded for 8 MHz ATmega328P
+//
+//
+#define ADC_TRIGGER                     (ADCSRA = 0xDE)  // set ADSC to 1
+#define ADC_INTERRUPT                   ADC_vect
+#define ADC_VALUE                       (ADCL + (ADCH << 8))
+#define ADC_ADC0                        (ADMUX = ADMUX0)
+#define ADC_ADC1                        (ADMUX = ADMUX1)
+#define ADC_INT_DISABLE                 (ADCSRA = 0x86)
+#define ADC_INT_ENABLE                  (ADCSRA = 0x8E)
+// disable digital input on analog pins, ACME disabled, free running mode, conversions will be triggered by ADSC,
+// enable ADC, 8MHz/64=125kHz, clear ADC interrupt flag and trigger single ADC conversion
+#define ADC_CONFIG(pin0, pin1)          (DIDR0 = ((1 << (pin0)) | (1 << (pin1))) & 0x3F, ADCSRB = 0x00, ADCSRA = 0xDE)
+// no conversion in progress, its result has been handled, and ADC interrupt enabled (not within ADC_results())
+#define ADC_IDLE                        ((ADCSRA & ((1 << ADSC) | (1 << ADIF) | (1 << ADIE))) == (1 << ADIE))
+
+#endif /* P1P2_HOST */
+
+#ifdef ADC_BITSYNC
+static inline void adc_bit_start(void)
+// called at start bit of first byte of a packet
+{
+  adc_bit_src = _use_ADC ? ADC_BIT_FIRST : ADC_BIT_IDLE;
+}
+
+static inline void adc_bit_source(uint8_t first)
+// called after each byte received, sets sender from first byte
+{
+  if (adc_bit_src == ADC_BIT_FIRST) adc_bit_src = first >> 6;
+}
+
+static inline void adc_bit_trigger(uint8_t level)
+// called as early as possible in a 0 bit (level 0) or 1 bit (level 1); the ADC samples its input 1.5 ADC clocks (12us at 8MHz) later,
+// so a low level is sampled well within the first semibit; if the ADC is still busy, this bit is not sampled
+{
+  if ((adc_bit_src < ADC_BIT_SOURCES) && ADC_IDLE) {
+    ADC_ADC0;
+    ADC_TRIGGER;
+    adc_bit_sample = ADC_BIT_SAMPLE | (level << 2) | adc_bit_src;
+  }
+}
+
+static inline void adc_bit_eop(void)
+// called at end of packet, resumes free-running conversions
+{
+  if (adc_bit_src != ADC_BIT_IDLE) {
+    adc_bit_src = ADC_BIT_IDLE;
+    if (ADC_IDLE) ADC_TRIGGER;
+  }
+}
+
+static void adc_bit_reset(adc_bit_stats_t &st)
+{
+  for (uint8_t level = 0; level < 2; level++) {
+    st.n[level] = 0;
+    st.sum[level] = 0;
+    st.min[level] = 0x3FF;
+    st.max[level] = 0;
+  }
+}
+
+static inline void adc_bit_add(uint8_t sample, uint16_t V)
+{
+  adc_bit_stats_t &st = adc_bit_stats[sample & (ADC_BIT_SOURCES - 1)];
+  uint8_t level = (sample >> 2) & 1;
+  if (st.n[level] == 0xFFFF) return;
+  st.n[level]++;
+  st.sum[level] += V;
+  if (V < st.min[level]) st.min[level] = V;
+  if (V > st.max[level]) st.max[level] = V;
+}
+#endif /* ADC_BITSYNC */
+
+ISR(ADC_INTERRUPT) {
+  ISR_STATS_START;
+  IDLE_WAKE;
+  static bool ADC0used = true;
+  uint16_t V = ADC_VALUE;
+#ifdef ADC_BITSYNC
+  uint8_t sample = adc_bit_sample;
+  if (sample) {
+    adc_bit_sample = 0;
+    adc_bit_add(sample, V);
+    ADC0used = true; // multiplexer was set to ADC_pin0
+    if (adc_bit_src == ADC_BIT_IDLE) ADC_TRIGGER;
+    ISR_STATS_STOP(ISR_STATS_ADC, 1);
+    return;
+  }
+#endif /* ADC_BITSYNC */
+#ifdef ADC_STREAM
+  uint8_t head = AdcRing::next(adc_ring_head);
+  if (head != adc_ring_tail) {
+    adc_ring[head] = ADC0used ? V : (V | ADC_RING_CH1);
+    adc_ring_head = head;
+  } else if (adc_ring_lost[!ADC0used] != 0xFFFF) {
+    adc_ring_lost[!ADC0used]++;
+  }
+  ADC0used = !ADC0used;
+  if (ADC0used) {
+    ADC_ADC0;
+  } else {
+    ADC_ADC1;
+  }
+#else /* ADC_STREAM */
+  if (ADC0used) {
+    ADC0used = false;
+    ADC_ADC1;
+    V0cnt ++;
+    V0sum0 += V;
+    if (!((uint16_t) (V0cnt << (16 - ADC_AVG_SHIFT)))) { // sum (avg) a few samples before min/max check
+      V0sum += V0sum0;
+      if (V0sum0 < V0min) V0min = V0sum0;
+      if (V0sum0 > V0max) V0max = V0sum0;
+      V0sum0 = 0;
+      if (!((uint16_t) (V0cnt << ADC_CNT_SHIFT))) {
+        // sum 4k samples for average calculation approximately every second
+        V0avg = V0sum;
+        V0sum = 0;
+      }
+    }
+  } else {
+    ADC0used = true;
+    ADC_ADC0;
+    V1cnt ++;
+    V1sum0 += V;
+    if (!((uint16_t) (V1cnt << (16 - ADC_AVG_SHIFT)))) { // sum samples (16 samples if ADC_AVG_SHIFT1 == 4)
+      V1sum += V1sum0;
+      if (V1sum0 < V1min) V1min = V1sum0;
+      if (V1sum0 > V1max) V1max = V1sum0;
+      V1sum0 = 0;
+      if (!((uint16_t) (V1cnt << ADC_CNT_SHIFT))) {
+        V1avg = V1sum;
+        V1sum = 0;
+      }
+    }
+  }
+#endif /* ADC_STREAM */
+#ifdef ADC_BITSYNC
+  // while a packet is received, the ADC is left to the receive ISRs
+  if (adc_bit_src == ADC_BIT_IDLE) ADC_TRIGGER;
+#else /* ADC_BITSYNC */
+  ADC_TRIGGER;
+#endif /* ADC_BITSYNC */
+  ISR_STATS_STOP(ISR_STATS_ADC, 0);
+}
+
+void P1P2SerialBus::ADC_results(uint16_t &V0_min, uint16_t &V0_max, uint32_t &V0_avg,
+                             uint16_t &V1_min, uint16_t &V1_max, uint32_t &V1_avg) {
+// if use_ADC is true in P1P2SerialBus::begin,
+// ADC measurements are done alternating on pins ADC_pin0 and ADC_pin1
+// at 8MHz the average measured voltage is updated approximately every second
+// V0_avg and V1_avg are summations of 2^(16 - ADC_CNT_SHIFT)) samples (default: 4k)
+// V0_min/max and V1_min/max are sample summations over 2^ADC_AVG_SHIFT samples (default: 16)
+// the mimimum and maximum values are reset upon each call of ADC_results
+// with ADC_STREAM, the values are derived, in the same units, from the last complete windows (ADC_window()), with min/max of single samples
+#ifdef ADC_STREAM
+  if (_use_ADC) {
+    ADC_process();
+    adc_window_t &w0 = adc_windows[0];
+    adc_window_t &w1 = adc_windows[1];
+    V0_min = w0.min << ADC_AVG_SHIFT;
+    V0_max = w0.max << ADC_AVG_SHIFT;
+    V0_avg = w0.n ? ((w0.sum / w0.n) << (16 - ADC_CNT_SHIFT)) + (((w0.sum % w0.n) << (16 - ADC_CNT_SHIFT)) / w0.n) : 0;
+    V1_min = w1.min << ADC_AVG_SHIFT;
+    V1_max = w1.max << ADC_AVG_SHIFT;
+    V1_avg = w1.n ? ((w1.sum / w1.n) << (16 - ADC_CNT_SHIFT)) + (((w1.sum % w1.n) << (16 - ADC_CNT_SHIFT)) / w1.n) : 0;
+  }
+#else /* ADC_STREAM */
+  if (_use_ADC) {
+    ADC_INT_DISABLE;
+    V0_min = V0min;
+    V0_max = V0max;
+    V0_avg = V0avg;
+    V1_min = V1min;
+    V1_max = V1max;
+    V1_avg = V1avg;
+    V0min = 0x3FF << ADC_AVG_SHIFT;
+    V0max = 0x000;
+    V1min = 0x3FF << ADC_AVG_SHIFT;
+    V1max = 0x000;
+    ADC_INT_ENABLE;
+  }
+#endif /* ADC_STREAM */
+}
+
+#ifdef ADC_STREAM
+static void adc_acc_reset(adc_acc_t &acc)
+{
+  acc.n = 0;
+  acc.min = 0x3FF;
+  acc.max = 0;
+  acc.sum = 0;
+  for (uint8_t b = 0; b < ADC_SKETCH_BINS; b++) acc.hist[b] = 0;
+}
+
+static uint16_t adc_quantile(const adc_acc_t &acc, uint16_t permille)
+// value below which permille of the samples lie, assuming samples spread evenly within each histogram bin
+{
+  uint16_t rank = ((uint32_t) acc.n * permille + 500) / 1000;
+  if (!rank) return acc.min;
+  if (rank >= acc.n) return acc.max;
+  uint16_t cum = 0;
+  uint8_t b = 0;
+  while (cum + acc.hist[b] < rank) cum += acc.hist[b++];
+  // rank-th sample is the (rank - cum)-th of hist[b] samples in bin b
+  uint16_t v = (b << ADC_SKETCH_SHIFT) + ((((uint32_t) (rank - cum) << 1) - 1) << ADC_SKETCH_SHIFT) / (acc.hist[b] << 1);
+  if (v < acc.min) return acc.min;
+  if (v > acc.max) return acc.max;
+  return v;
+}
+
+static void adc_window_end(uint8_t ch)
+{
+  adc_acc_t &acc = adc_acc[ch];
+  adc_window_t &w = adc_windows[ch];
+  if (!++w.seq) w.seq = 1;
+  w.n = acc.n;
+  w.min = acc.min;
+  w.max = acc.max;
+  w.sum = acc.sum;
+  for (uint8_t i = 0; i < ADC_QUANTILE_CNT; i++) w.q[i] = adc_quantile(acc, adc_quantiles[i]);
+  uint8_t intr_state = SREG;
+  cli();
+  w.lost = adc_ring_lost[ch];
+  adc_ring_lost[ch] = 0;
+  SREG = intr_state;
+  adc_acc_reset(acc);
+}
+#endif /* ADC_STREAM */
+
+void P1P2SerialBus::ADC_process(void)
+{
+#ifdef ADC_STREAM
+  if (!_use_ADC) return;
+  uint8_t tail = adc_ring_tail;
+  while (tail != adc_ring_head) {
+    tail = AdcRing::next(tail);
+    uint16_t V = adc_ring[tail];
+    adc_ring_tail = tail;
+    uint8_t ch = (V & ADC_RING_CH1) ? 1 : 0;
+    V &= 0x3FF;
+    adc_acc_t &acc = adc_acc[ch];
+    acc.n++;
+    acc.sum += V;
+    if (V < acc.min) acc.min = V;
+    if (V > acc.max) acc.max = V;
+    acc.hist[V >> ADC_SKETCH_SHIFT]++;
+    if (acc.n >= adc_window_n) adc_window_end(ch);
+  }
+#endif /* ADC_STREAM */
+}
+
+bool P1P2SerialBus::ADC_window(uint8_t channel, adc_window_t &w)
+{
+#ifdef ADC_STREAM
+  if (!_use_ADC || (channel > 1)) return false;
+  ADC_process();
+  if (!adc_windows[channel].seq) return false;
+  w = adc_windows[channel];
+  return true;
+#else /* ADC_STREAM */
+  return false;
+#endif /* ADC_STREAM */
+}
+
+void P1P2SerialBus::ADC_setWindow(uint16_t samples)
+{
+#ifdef ADC_STREAM
+  adc_window_n = samples ? samples : 1;
+  ADC_process();
+  adc_acc_reset(adc_acc[0]);
+  adc_acc_reset(adc_acc[1]);
+#endif /* ADC_STREAM */
+}
+
+bool P1P2SerialBus::ADC_bitstats(uint8_t source, adc_bit_stats_t &stats, bool reset)
+{
+#ifdef ADC_BITSYNC
+  if (!_use_ADC || (source >= ADC_BIT_SOURCES)) return false;
+  uint8_t intr_state = SREG;
+  cli();
+  stats = adc_bit_stats[source];
+  if (reset) adc_bit_reset(adc_bit_stats[source]);
+  SREG = intr_state;
+  return true;
+#else /* ADC_BITSYNC */
+  return false;
+#endif /* ADC_BITSYNC */
+}
+
+#else /* P1P2_BUS */
+
+void P1P2SerialBus::ADC_results(uint16_t &V0_min, uint16_t &V0_max, uint32_t &V0_avg,
+                             uint16_t &V1_min, uint16_t &V1_max, uint32_t &V1_avg) {
+// ADC results of bus 0 (if started by use_ADC in its begin())
+  P1P2Bus0::P1P2SerialBus().ADC_results(V0_min, V0_max, V0_avg, V1_min, V1_max, V1_avg);
+}
+
+bool P1P2SerialBus::ADC_bitstats(uint8_t source, adc_bit_stats_t &stats, bool reset)
+{
+// signal levels on bus 0 (bus 1 is not sampled)
+  return P1P2Bus0::P1P2SerialBus::ADC_bitstats(source, stats, reset);
+}
+
+void P1P2SerialBus::ADC_process(void)
+{
+  P1P2Bus0::P1P2SerialBus::ADC_process();
+}
+
+bool P1P2SerialBus::ADC_window(uint8_t channel, adc_window_t &w)
+{
+  return P1P2Bus0::P1P2SerialBus::ADC_window(channel, w);
+}
+
+void P1P2SerialBus::ADC_setWindow(uint16_t samples)
+{
+  P1P2Bus0::P1P2SerialBus::ADC_setWindow(samples);
+}
+
+#ifdef ADC_BITSYNC
+static inline void adc_bit_start(void) {}
+static inline void adc_bit_source(uint8_t first) {}
+static inline void adc_bit_trigger(uint8_t level) {}
+static inline void adc_bit_eop(void) {}
+#endif /* ADC_BITSYNC */
+
+#endif /* P1P2_BUS */
+
+/****************************************/
+/**          Initialization            **/
+/****************************************/
+
+static uint16_t Rticks_per_bit = 0;
+static uint16_t Rticks_per_semibit = 0;
+static uint16_t Rticks_per_bit_and_semibit = 0;
+static uint16_t Rticks_suppression = 0;
+static uint16_t Wticks_per_semibit = 0;
+static uint16_t Wticks_per_bit_and_semibit = 0;
+
+typedef P1P2Ring<P1P2SerialCfg::rx_size> RxRing;
+typedef P1P2Ring<P1P2SerialCfg::tx_size> TxRing;
+typedef P1P2Ring<P1P2SerialCfg::packet_size> PacketRing;
+typedef P1P2Ring<P1P2SerialCfg::tx_packet_size> TxPacketRing;
+#ifdef GENERATE_FAKE_ERRORS
+static_assert(sizeof(errorbuf_t) >= 2, "GENERATE_FAKE_ERRORS needs a 16-bit errorbuf_t");
+#endif /* GENERATE_FAKE_ERRORS */
+
+static uint8_t rx_state;
+static uint8_t rx_byte;
+static uint8_t rx_paritycheck;
+static uint16_t rx_target;
+#ifdef RX_CLOCK_RECOVERY
+// the bit period of the sender is estimated once per byte, in the stop bit, from the falling edges of the start bit and of the last 0 bit
+// (there is no extra work per bit except remembering the state of the last falling edge), and filtered per sender;
+// the sender is identified by the 2 MSBs of the first byte of the packet; the first byte of each packet is sampled at the (slower
+// filtered) bit period of all senders, which covers a deviation of our own clock
+#define RX_SKEW_SOURCES 4               // 00 (main controller), 40 (heat pump, auxiliary controller replies), 80, C0
+#define RX_SKEW_MIN_BITS 4              // byte used for estimation only if its last falling edge is at least 4 bits after the start bit
+#define RX_SKEW_FILTER_SHIFT 2          // each new estimate weighs 1/4
+#define RX_SKEW_FIRST_SHIFT 4           // for first byte of a packet: all senders, each new estimate weighs 1/16
+static uint16_t rx_ticks_per_bit;            // bit period used for byte being received
+static uint16_t rx_ticks_per_bit_and_semibit;
+static uint16_t rx_start_capture;            // falling edge of start bit of byte being received
+static uint8_t rx_edge_state;                // rx_state of last falling edge of byte being received (1 for start bit)
+static uint8_t rx_skew_source;
+static int16_t rx_skew[RX_SKEW_SOURCES + 1]; // filtered bit period deviation per sender, and for all senders, in 1/16 ticks
+static const uint16_t rx_skew_recip[11] = { 0, 4096, 2048, 1365, 1024, 819, 683, 585, 512, 455, 410 }; // 4096/n
+#else /* RX_CLOCK_RECOVERY */
+#define rx_ticks_per_bit Rticks_per_bit
+#define rx_ticks_per_bit_and_semibit Rticks_per_bit_and_semibit
+#endif /* RX_CLOCK_RECOVERY */
+static volatile uint8_t rx_buffer_head;
+static volatile uint8_t rx_buffer_head2;
+static volatile uint8_t rx_buffer_tail;
+static volatile uint8_t rx_buffer[P1P2SerialCfg::rx_size];
+static volatile errorbuf_t error_buffer[P1P2SerialCfg::rx_size]; // records error status
+static volatile uint16_t delta_buffer[P1P2SerialCfg::rx_size]; // records timing info in ms
+
+// packet descriptors, one per complete packet in rx_buffer, added by the ISRs upon SIGNAL_EOP
+static volatile uint8_t rx_packet_head;
+static volatile uint8_t rx_packet_tail;
+static volatile uint8_t rx_packet_start[P1P2SerialCfg::packet_size];     // index in rx_buffer of first byte
+static volatile uint8_t rx_packet_len[P1P2SerialCfg::packet_size];       // # bytes stored in rx_buffer
+static volatile errorbuf_t rx_packet_errors[P1P2SerialCfg::packet_size]; // OR of error_buffer of all bytes (without SIGNAL_EOP)
+static volatile uint16_t rx_packet_delta[P1P2SerialCfg::packet_size];    // delta_buffer of first byte
+#ifdef BUS_CYCLE_LEARNER
+static volatile uint8_t rx_packet_wrote[P1P2SerialCfg::packet_size];    // we wrote on the bus since the previous packet (or this packet, if Echo)
+static uint8_t rx_packet_wrote0;
+#endif /* BUS_CYCLE_LEARNER */
+#ifdef TX_REPLY
+static volatile uint8_t rx_packet_reply[P1P2SerialCfg::packet_size];    // slot + 1 of reply built for this packet, 0 if none
+#endif /* TX_REPLY */
+// packet being received (ISR only)
+static uint8_t rx_packet_first;
+static uint8_t rx_packet_cnt;
+static errorbuf_t rx_packet_err;
+static uint16_t rx_packet_delta0;
+static uint8_t rx_packet_crc;                                       // running CRC of packet
+static uint8_t rx_packet_crc_prev;                                  // CRC of packet without last byte
+static P1P2_crc_t rx_crc_cfg = { 0, 0, { 0 } };                       // generator/feed/table as set by setCRC()
+// summary of packet last returned by readpacket()
+static errorbuf_t rx_packet_readerrors;
+#ifdef TX_REPLY
+static uint8_t rx_packet_readreply;
+#endif /* TX_REPLY */
+
+// Clock: timer1 of bus 0 extended to 32 bits (t1_extend(), t1_now(); wraps every 2^32 cycles) for timestamps and deadlines,
+// and to 64 bits for clock_cycles() (never wraps in practice), by counting timer1 overflows (an interrupt every 65536 cycles).
+// Bus 1 converts its timer values to this clock, so that all timestamps of all buses share one time base.
+#if P1P2_BUS == 0
+static volatile uint16_t t1_ovf = 0;                                // timer1 overflow count, extends timer1 to 32 bits
+static volatile uint32_t t1_ovf_hi = 0;                             // t1_ovf wrap count, extends timer1 to 64 bits
+// the same clock in s, ms and cycles, advanced by the overflow ISR with 16-bit math, so that clock_sec/msec/usec() need no 64-bit division
+#define CLK_CYC_PER_MS (F_CPU / 1000)
+static volatile uint32_t clk_sec = 0;                               // s at the last overflow
+static volatile uint16_t clk_ms = 0;                                // and ms (0..999)
+static volatile uint16_t clk_cyc = 0;                               // and cycles (0..CLK_CYC_PER_MS - 1)
+
+static inline uint32_t t1_extend(uint16_t t)
+// called with interrupts disabled: returns timer1 value t, captured less than half a timer1 period ago, extended to 32 bits
+// an overflow not yet counted by the overflow ISR counts only if it happened before t
+{
+  uint16_t ovf = t1_ovf;
+  if (OVERFLOW_PENDING() && !(t & 0x8000)) ovf++;
+  return ((uint32_t) ovf << 16) | t;
+}
+
+static inline uint32_t t1_now(void)
+// called with interrupts disabled: returns the current time, timer1 extended to 32 bits
+{
+  return t1_extend(GET_TIMER_R_COUNT());
+}
+#else /* P1P2_BUS */
+using P1P2Bus0::t1_now;
+
+static inline uint32_t t1_extend(uint16_t t)
+// called with interrupts disabled: returns timer value t of this bus, captured less than half a timer period ago, on the clock of bus 0
+{
+  uint16_t age = GET_TIMER_R_COUNT() - t;
+  return t1_now() - age;
+}
+#endif /* P1P2_BUS */
+
+#ifdef PACKET_TIMESTAMP
+static volatile uint32_t rx_packet_time[P1P2SerialCfg::packet_size]; // time of first falling edge
+static uint32_t rx_packet_time0;
+static uint32_t rx_packet_readtime;
+#endif /* PACKET_TIMESTAMP */
+
+#if (defined IDLE_SLEEP) && (P1P2_BUS == 0)
+static uint32_t idle_since;                                         // start of idle statistics (timer1 extended to 32 bits)
+static uint32_t idle_sleep;                                         // cycles asleep in idle() since idle_since
+static uint16_t idle_count;                                         // # times idle() slept since idle_since
+static uint32_t idle_woke;                                          // time the first ISR after SLEEP started (if idle_asleep was cleared)
+
+static inline void idle_reset(void)
+// called with interrupts disabled
+{
+  idle_since = t1_now();
+  idle_sleep = 0;
+  idle_count = 0;
+}
+#endif /* IDLE_SLEEP */
+
+static volatile uint8_t tx_state;
+static volatile uint8_t tx_rx_state;
+static uint16_t tx_frame;        // remaining data bits and parity bit of byte being written, LSB first
+static uint8_t tx_bit;
+static uint8_t tx_byte_verify;
+static volatile uint8_t tx_buffer_head;
+static volatile uint8_t tx_buffer_tail;
+static volatile uint16_t tx_buffer[P1P2SerialCfg::tx_size]; // frames as prepared by tx_frame_for(), bit 0-7 data, bit 8 parity
+// write packet queue: each packet occupies consecutive frames in tx_buffer, which are freed (in queue order) when written or dropped
+// tx_packet_head is the last packet queued, tx_packet_tail the last packet freed; packets may be written out of queue order (priority)
+#define TX_PACKET_DONE            0x01 // written or dropped, buffer space can be freed
+#define TX_PACKET_DEADLINE        0x02 // drop packet if not started before tx_packet_deadline
+#define TX_PACKET_GAP             0x04 // write only in a pause for which the packet is armed (schedulegap())
+#define TX_PACKET_ARMED           0x08 // armed for the pause after the packet last read, as long as tx_packet_epoch == bus_epoch
+#define TX_PACKET_RETRY           0x10 // queued after setRetry(): frames kept until done, result reported (TX_RETRY)
+#define TX_PACKET_NONE            0xFF
+static volatile uint8_t tx_packet_head;
+static volatile uint8_t tx_packet_tail;
+static uint8_t tx_packet_start[P1P2SerialCfg::tx_packet_size];     // index of first frame in tx_buffer not yet written
+static volatile uint8_t tx_packet_len[P1P2SerialCfg::tx_packet_size]; // # frames not yet written, last packet may be extended by write()
+static uint16_t tx_packet_delay[P1P2SerialCfg::tx_packet_size];    // start writing after exactly this silence (ms)
+static uint16_t tx_packet_timeout[P1P2SerialCfg::tx_packet_size];  // or after a silence of at least delay and at least timeout (ms)
+static uint8_t tx_packet_priority[P1P2SerialCfg::tx_packet_size];  // highest priority first if multiple packets may be written
+static volatile uint8_t tx_packet_flags[P1P2SerialCfg::tx_packet_size];
+static uint32_t tx_packet_deadline[P1P2SerialCfg::tx_packet_size]; // in t1_now() time
+#ifdef BUS_CYCLE_LEARNER
+static volatile uint8_t bus_epoch = 0;                             // incremented at each start bit on the bus, read or written
+static uint8_t tx_packet_epoch[P1P2SerialCfg::tx_packet_size];     // bus_epoch when armed
+// schedulegap() parameters, used by bus_gap_arm() only
+static uint8_t tx_packet_after[P1P2SerialCfg::tx_packet_size][BUS_CYCLE_HEADER];
+static uint8_t tx_packet_after_len[P1P2SerialCfg::tx_packet_size];
+static uint16_t tx_packet_busy[P1P2SerialCfg::tx_packet_size];
+static uint16_t tx_packet_maxrisk[P1P2SerialCfg::tx_packet_size];
+#endif /* BUS_CYCLE_LEARNER */
+#ifdef TX_RETRY
+static uint8_t tx_packet_first[P1P2SerialCfg::tx_packet_size];     // index of first frame, to rewind after a collision
+static uint8_t tx_packet_total[P1P2SerialCfg::tx_packet_size];     // # frames
+static uint16_t tx_packet_delay0[P1P2SerialCfg::tx_packet_size];   // delay as queued, before backoff
+static uint8_t tx_packet_retries[P1P2SerialCfg::tx_packet_size];   // # retries left
+static uint8_t tx_packet_attempts[P1P2SerialCfg::tx_packet_size];  // # times writing started
+static uint8_t tx_retry_max = 0;                                   // setRetry()
+static uint16_t tx_retry_backoff = 0;
+static uint16_t tx_retry_rnd = 1;                                  // backoff random generator (xorshift)
+typedef P1P2Ring<TX_RESULT_BUFFER_SIZE> TxResultRing;
+static tx_result_t tx_result[TX_RESULT_BUFFER_SIZE];
+static volatile uint8_t tx_result_head = 0;
+static volatile uint8_t tx_result_tail = 0;
+#endif /* TX_RETRY */
+static uint8_t tx_packet_cur;  // packet being written
+#ifdef TX_CARRIER_SENSE
+static volatile uint16_t tx_sense_deferred = 0; // # writes deferred by carrier sense, see writedeferred()
+#endif /* TX_CARRIER_SENSE */
+#ifdef TX_REPLY
+// replies preloaded by setReply(): built in rx_packet_eop() (interrupts disabled, bus idle), then queued by the ms timer ISR (tx_reply_queue())
+// with interrupts enabled, as building the frames of a 24-byte packet takes longer than a bit time; tx_build_busy is non-zero while frames are
+// prepared beyond tx_buffer_head (tx_packet_schedule()), during which replies wait for the next ms
+static_assert((TX_REPLY_SIZE >= 3) && (TX_REPLY_SIZE <= 32), "TX_REPLY_SIZE should be 3..32");
+static tx_reply_t tx_reply[TX_REPLY_SLOTS];                         // a slot is only read by the ISR while its count is not 0
+static uint8_t tx_reply_buf[TX_REPLY_SIZE];                         // reply built, waiting to be queued
+static uint8_t tx_reply_len;
+static volatile uint8_t tx_reply_pending = 0;                       // slot + 1 of reply in tx_reply_buf, 0 if none
+static volatile uint8_t tx_build_busy = 0;
+static volatile uint16_t tx_reply_refused = 0;                      // see replyrefused()
+#endif /* TX_REPLY */
+static volatile uint16_t time_msec = 0;
+#if (defined TX_REPLY) || (defined EVENT_HANDLERS)
+// the ms timer ISR queues replies and runs handlers with interrupts enabled; a nested ms timer ISR only keeps time and starts writes,
+// so the worst-case stack depth is one ms timer ISR (plus tx_packet_schedule() or a handler) plus one other, short, ISR on top
+static volatile uint8_t ms_isr_busy = 0;
+#endif /* TX_REPLY || EVENT_HANDLERS */
+
+#ifdef BUS_CYCLE_LEARNER
+// bus cycle learner (foreground only, see releasepacket())
+#define BUS_GAP_NONE 0xFF
+static bus_gap_t bus_gap[BUS_CYCLE_SIZE];
+static uint8_t bus_gap_prev;                      // entry of packet released before, BUS_GAP_NONE if unknown or with errors
+static uint8_t bus_gap_last[BUS_CYCLE_HEADER];    // header of packet released last
+static uint8_t bus_gap_last_entry;                // its entry
+static uint8_t bus_gap_last_epoch;                // bus_epoch just after it
+static uint8_t bus_gap_last_valid;                // nothing else was on the bus after it when it was released
+#endif /* BUS_CYCLE_LEARNER */
+
+#ifdef EVENT_HANDLERS
+static_assert(P1P2_HANDLERS <= 8, "P1P2_HANDLERS should be <= 8");
+#define EV_PACKET_NONE 0xFF
+static volatile uint8_t ev_pending = 0;                              // events signalled by ISRs, not yet passed to handlers
+static uint16_t ev_idle = 0;                                         // setIdle()
+static uint8_t ev_cnt = 0;                                           // # handlers
+static P1P2_handler_t ev_handler[P1P2_HANDLERS];                     // highest priority first
+static uint8_t ev_events[P1P2_HANDLERS];
+static uint8_t ev_priority[P1P2_HANDLERS];
+static volatile uint8_t ev_todo[P1P2_HANDLERS];                      // events pending per handler
+static uint8_t ev_packet_mask = 0;                                   // bit h set if ev_handler[h] handles P1P2_EVENT_PACKET
+static uint8_t ev_isr_mask = 0;                                      // bit h set if ev_handler[h] runs in ms timer ISR
+static uint8_t ev_fg_busy = 0;                                       // dispatch() is running handlers
+static uint8_t ev_packet = EV_PACKET_NONE;                           // descriptor of packet being handled
+static volatile uint8_t rx_packet_handled[P1P2SerialCfg::packet_size]; // bit h set if ev_handler[h] has been called for packet
+#endif /* EVENT_HANDLERS */
+
+#define scheduledelay Wticks_per_bit_and_semibit // should be more than 1.5 bits for writing
+
+#ifndef INPUT_PULLUP
+#define INPUT_PULLUP INPUT
+#endif /* INPUT_PULLUP */
+
+void P1P2SerialBus::begin(uint32_t baud, bool use_ADC /* = false */, uint8_t ADC_pin0 /* = 0 */, uint8_t ADC_pin1 /* = 1 */)
+{
+  uint32_t cycles_per_bit = ((ALTSS_BASE_FREQ + baud / 2) / baud); // 833 cycles at 16MHz
+
+  Rticks_per_bit = cycles_per_bit;
+  Rticks_per_semibit = Rticks_per_bit / 2;
+  Rticks_per_bit_and_semibit = Rticks_per_bit + Rticks_per_semibit;
+  Rticks_suppression = Rticks_per_semibit + Rticks_per_semibit / 4; // to avoid early ISR capture (spike, bouncing rising edge) may lead to very long while loop behaviour and loss of sync.
+#ifdef RX_CLOCK_RECOVERY
+  rx_ticks_per_bit = Rticks_per_bit;
+  rx_ticks_per_bit_and_semibit = Rticks_per_bit_and_semibit;
+  for (uint8_t i = 0; i <= RX_SKEW_SOURCES; i++) rx_skew[i] = 0;
+#endif /* RX_CLOCK_RECOVERY */
+
+  Wticks_per_semibit = cycles_per_bit / 2;
+  Wticks_per_bit_and_semibit = 3 * Wticks_per_semibit;
+
+  pinMode(LED_POWER, OUTPUT);
+  pinMode(LED_READ, OUTPUT);
+  pinMode(LED_WRITE, OUTPUT);
+  pinMode(LED_ERROR, OUTPUT);
+
+  DIGITAL_SET_LED_POWER;
+  DIGITAL_SET_LED_READ;
+  DIGITAL_SET_LED_WRITE;
+  DIGITAL_SET_LED_ERROR;
+
+  pinMode(INPUT_CAPTURE_PIN, INPUT_PULLUP);
+  digitalWrite(OUTPUT_COMPARE_PIN, HIGH);
+  pinMode(OUTPUT_COMPARE_PIN, OUTPUT);
+
+  time_msec = 0;
+  rx_state = 0;
+  rx_buffer_head = 0;
+  rx_buffer_head2 = NO_HEAD2;
+  rx_buffer_tail = 0;
+  rx_packet_head = 0;
+  rx_packet_tail = 0;
+  rx_packet_cnt = 0;
+  rx_packet_err = 0;
+  tx_state = 0;
+  tx_rx_state = 0;
+  tx_buffer_head = 0;
+  tx_buffer_tail = 0;
+  tx_packet_head = 0;
+  tx_packet_tail = 0;
+#ifdef TX_RETRY
+  tx_result_head = 0;
+  tx_result_tail = 0;
+#endif /* TX_RETRY */
+#ifdef TX_CARRIER_SENSE
+  tx_sense_deferred = 0;
+#endif /* TX_CARRIER_SENSE */
+#ifdef TX_REPLY
+  tx_reply_pending = 0;
+  tx_reply_refused = 0;
+#endif /* TX_REPLY */
+#ifdef BUS_CYCLE_LEARNER
+  memset(bus_gap, 0, sizeof(bus_gap));
+  bus_gap_prev = BUS_GAP_NONE;
+  bus_gap_last_entry = BUS_GAP_NONE;
+  bus_gap_last_valid = 0;
+  rx_packet_wrote0 = 0;
+#endif /* BUS_CYCLE_LEARNER */
+#ifdef EVENT_HANDLERS
+  ev_pending = 0;
+  for (uint8_t h = 0; h < ev_cnt; h++) ev_todo[h] = 0;
+#endif /* EVENT_HANDLERS */
+
+  CONFIG_MS_TIMER();
+  RESET_ENABLE_MS_TIMER();
+
+  CONFIG_RW_TIMER();
+  CONFIG_CAPTURE_FALLING_EDGE();
+  CONFIG_MATCH_INIT();
+  // start reading mode
+  ENABLE_INT_INPUT_CAPTURE();
+#if P1P2_BUS == 0
+  ENABLE_INT_OVERFLOW(); // clock
+#endif /* P1P2_BUS */
+#if (defined IDLE_SLEEP) && (P1P2_BUS == 0)
+  uint8_t intr_state = SREG;
+  cli();
+  idle_reset();
+  SREG = intr_state;
+#endif /* IDLE_SLEEP */
+#if P1P2_BUS == 0
+  // start ADC measurements on pins ADC_pin0 and ADC_pin1 if use_ADC is true
+  _use_ADC = use_ADC;
+  if (_use_ADC) {
+    ADMUX0 = 0xC0 | ADC_pin0; // 1.1V reference
+    ADMUX1 = 0xC0 | ADC_pin1; // 1.1V reference
+#ifdef ADC_BITSYNC
+    adc_bit_src = ADC_BIT_IDLE;
+    adc_bit_sample = 0;
+    for (uint8_t i = 0; i < ADC_BIT_SOURCES; i++) adc_bit_reset(adc_bit_stats[i]);
+#endif /* ADC_BITSYNC */
+#ifdef ADC_STREAM
+    adc_ring_head = adc_ring_tail = 0;
+    for (uint8_t ch = 0; ch < 2; ch++) {
+      adc_ring_lost[ch] = 0;
+      adc_windows[ch].seq = 0;
+      adc_acc_reset(adc_acc[ch]);
+    }
+#endif /* ADC_STREAM */
+    ADC_ADC0;      // start with ADC_pin0
+    ADC_CONFIG(ADC_pin0, ADC_pin1);
+  }
+#endif /* P1P2_BUS */
+}
+
+void P1P2SerialBus::end(void)
+{
+  DISABLE_INT_COMPARE_R();
+  DISABLE_INT_INPUT_CAPTURE();
+  flushInput();
+  flushOutput();
+  DISABLE_INT_COMPARE_W();
+  DISABLE_MS_TIMER();
+}
+
+
+/****************************************/
+/**       Millisecond counter          **/
+/****************************************/
+
+static uint16_t tx_setdelaytimeout = 2500;
+#ifdef SW_SCOPE
+// compressed scope log, see P1P2Serial_Scope.h for the format
+// logging starts at the start of a packet if the previous log has been released (sws_block = 0), and stops when the buffer is full
+#if F_CPU > 8000000L
+#define SWS_SHIFT 4 // deviations logged in units of 16 ticks, 1us at 16MHz
+#else
+#define SWS_SHIFT 3 // deviations logged in units of 8 ticks, 1us at 8MHz
+#endif
+volatile byte sw_scope = 0;
+volatile byte sw_scope_next = 0;
+volatile byte sws_block = 0;
+volatile uint8_t sws_buffer[P1P2SerialCfg::scope_size];
+volatile uint16_t sws_bitcnt = 0;
+volatile uint8_t sws_overflow = 0;
+static uint8_t sws_mode;    // SWS_MODE_READ or SWS_MODE_WRITE
+static uint8_t sws_state;   // predicted state of next event
+static int16_t sws_dev;     // deviation of last falling edge, in 2^SWS_SHIFT ticks
+static int16_t sws_dev_r;   // deviation of last rising edge (when reading: of last start bit), in 2^SWS_SHIFT ticks
+static uint8_t sws_pending; // first semibit event of a bit being written, not logged yet (SWS_X_FALLING or SWS_X_HIGH), 0 if none
+static int8_t sws_pending_d;
+
+static void sws_put(uint8_t code, uint8_t len)
+// appends len (<= 8) bits of code to the log, or stops the log if they do not fit
+{
+  uint16_t pos = sws_bitcnt;
+  if (sws_overflow || (pos + len > 8 * P1P2SerialCfg::scope_size)) {
+    sws_overflow = 1;
+    return;
+  }
+  uint8_t i = pos >> 3;
+  uint8_t b = pos & 7;
+  if (b) {
+    sws_buffer[i] |= code << b;
+  } else {
+    sws_buffer[i] = code;
+  }
+  if (b + len > 8) sws_buffer[i + 1] = code >> (8 - b);
+  sws_bitcnt = pos + len;
+}
+
+static void sws_put_d(int16_t d)
+// appends change of deviation
+{
+  uint8_t s = 0;
+  int16_t a = d;
+  if (d < 0) {
+    s = 1;
+    a = -d;
+  }
+  if (!a) {
+    sws_put(0x00, 1);
+  } else if (a == 1) {
+    sws_put(0x01 | (s << 2), 3);
+  } else if (a < 4) {
+    sws_put(0x03 | (s << 3) | ((a - 2) << 4), 5);
+  } else if (a < 8) {
+    sws_put(0x07 | (s << 4) | ((a - 4) << 5), 7);
+  } else {
+    sws_put(0x0F, 4);
+    sws_put(d & 0xFF, 8);
+    sws_put(((uint16_t) d) >> 8, 8);
+  }
+}
+
+static void sws_put_zero(int8_t d)
+// appends bit 0 with falling edge deviation change d (0 or +-1)
+{
+  if (!d) {
+    sws_put(SWS_CODE_ZERO, 2);
+  } else {
+    sws_put(SWS_CODE_ZERO_D1 | ((d < 0) ? 0x08 : 0x00), 4);
+  }
+}
+
+static void sws_flush(void)
+// logs pending first semibit event as single event
+{
+  if (sws_pending) {
+    sws_put(SWS_CODE_X | (sws_pending << 3), 7);
+    if (sws_pending == SWS_X_FALLING) sws_put_d(sws_pending_d);
+    sws_pending = 0;
+  }
+}
+
+static void sws_log(uint8_t event, int16_t dev)
+// appends event, dev is deviation in ticks of an edge from the bit grid
+{
+  if (sws_overflow) return;
+  uint8_t ev = event & SWS_EVENT_MASK;
+  if (ev == 0xE0) {
+    // error event
+    sws_flush();
+    sws_put(SWS_CODE_X | ((SWS_X_ERR + 0xFF - event) << 3), 7);
+    return;
+  }
+  if ((ev == SWS_EVENT_EDGE_FALLING_W) || (ev == SWS_EVENT_EDGE_RISING)) {
+    if (sws_mode != SWS_MODE_WRITE) {
+      sws_put(SWS_CODE_X | (SWS_X_WRITE << 3), 7);
+      sws_mode = SWS_MODE_WRITE;
+    }
+  } else if ((ev == SWS_EVENT_EDGE_FALLING_R) || (ev == SWS_EVENT_EDGE_SPIKE)) {
+    if (sws_mode != SWS_MODE_READ) {
+      sws_flush();
+      sws_put(SWS_CODE_X | (SWS_X_READ << 3), 7);
+      sws_mode = SWS_MODE_READ;
+    }
+  }
+  uint8_t state = event & 0x1F;
+  if (state != sws_state) {
+    sws_flush();
+    sws_put(SWS_CODE_X | (SWS_X_STATE << 3), 7);
+    sws_put(state, 5);
+    sws_state = state;
+  }
+  int16_t q = (dev + (1 << (SWS_SHIFT - 1))) >> SWS_SHIFT;
+  int16_t d;
+  // when writing, the event of the first semibit (odd state) is kept until the second semibit shows whether both fit a bit code
+  uint8_t first = (sws_mode == SWS_MODE_WRITE) && (state & 1);
+  switch (ev) {
+    case SWS_EVENT_EDGE_FALLING_R :
+    case SWS_EVENT_EDGE_FALLING_W : if (state < 2) {
+                                      // start bit read: change since previous start bit, bit grid of next edges restarts here
+                                      d = q - sws_dev_r;
+                                      sws_dev_r = q;
+                                      sws_dev = 0;
+                                    } else {
+                                      d = q - sws_dev;
+                                      sws_dev = q;
+                                    }
+                                    if ((d < -1) || (d > 1) || ((sws_mode == SWS_MODE_WRITE) && !first)) {
+                                      sws_flush();
+                                      sws_put(SWS_CODE_X | (SWS_X_FALLING << 3), 7);
+                                      sws_put_d(d);
+                                    } else if (first) {
+                                      sws_pending = SWS_X_FALLING;
+                                      sws_pending_d = d;
+                                    } else {
+                                      sws_put_zero(d);
+                                    }
+                                    break;
+    case SWS_EVENT_SIGNAL_HIGH_R  : if (sws_mode != SWS_MODE_WRITE) {
+                                      sws_put(SWS_CODE_ONE, 1);
+                                    } else if (first) {
+                                      sws_pending = SWS_X_HIGH;
+                                    } else if (sws_pending == SWS_X_HIGH) {
+                                      sws_pending = 0;
+                                      sws_put(SWS_CODE_ONE, 1);
+                                    } else {
+                                      sws_flush();
+                                      sws_put(SWS_CODE_X | (SWS_X_HIGH << 3), 7);
+                                    }
+                                    break;
+    case SWS_EVENT_EDGE_RISING    : d = q - sws_dev_r;
+                                    sws_dev_r = q;
+                                    if (!d && !first && (sws_pending == SWS_X_FALLING)) {
+                                      sws_pending = 0;
+                                      sws_put_zero(sws_pending_d);
+                                    } else {
+                                      sws_flush();
+                                      sws_put(SWS_CODE_X | (SWS_X_RISING << 3), 7);
+                                      sws_put_d(d);
+                                    }
+                                    break;
+    case SWS_EVENT_EDGE_SPIKE     : sws_flush();
+                                    sws_put(SWS_CODE_X | (SWS_X_SPIKE << 3), 7);
+                                    sws_put_d(q - sws_dev);
+                                    return; // a spike does not move to the next state
+    default                       : return;
+  }
+  P1P2_sws_next_state(sws_state, sws_mode);
+}
+
+#define SW_SCOPE_LOG_EVENT(dev, event)  \
+    if (sw_scope) sws_log(event, dev);
+
+#define SW_SCOPE_LOG_ERROR(event)  \
+    if (sw_scope) sws_log(event, 0);
+
+#define SW_SCOPE_START_LOG(mode) { \
+        sws_block = 1; \
+        sws_bitcnt = 0; \
+        sws_overflow = 0; \
+        sws_state = 0; \
+        sws_dev = 0; \
+        sws_dev_r = 0; \
+        sws_pending = 0; \
+        sws_mode = mode; \
+        sws_put(SWS_CODE_X | (((mode == SWS_MODE_WRITE) ? SWS_X_WRITE : SWS_X_READ) << 3), 7); };
+
+#else /* SW_SCOPE */
+
+#define SW_SCOPE_LOG_EVENT(dev, event) {};
+#define SW_SCOPE_LOG_ERROR(event) {};
+#define SW_SCOPE_START_LOG(mode) {};
+
+#endif /* SW_SCOPE */
+
+#if P1P2_BUS == 0
+ISR(OVERFLOW_INTERRUPT)
+{
+  if (!++t1_ovf) t1_ovf_hi++;
+  uint16_t cyc = clk_cyc + (uint16_t) (65536UL % CLK_CYC_PER_MS);
+  uint16_t ms = clk_ms + (uint16_t) (65536UL / CLK_CYC_PER_MS);
+  if (cyc >= CLK_CYC_PER_MS) {
+    cyc -= CLK_CYC_PER_MS;
+    ms++;
+  }
+  if (ms >= 1000) {
+    ms -= 1000;
+    clk_sec++;
+  }
+  clk_cyc = cyc;
+  clk_ms = ms;
+  IDLE_WAKE; // after counting the overflow, for the wake-up time
+}
+#endif /* P1P2_BUS */
+
+static inline void tx_packet_release(void)
+// called from ISR or with interrupts disabled: frees write buffer space of packets written or dropped, in queue order
+{
+  uint8_t tail = tx_packet_tail;
+  while (tail != tx_packet_head) {
+    uint8_t next = TxPacketRing::next(tail);
+    if (!(tx_packet_flags[next] & TX_PACKET_DONE)) break;
+    tx_buffer_tail = TxRing::prev(TxRing::add(tx_packet_start[next], tx_packet_len[next]));
+    tail = next;
+  }
+  tx_packet_tail = tail;
+}
+
+static inline uint16_t tx_packet_pop(uint8_t p)
+// called from ISR: returns next frame of packet p to be written; frees it immediately if p is the oldest packet in the queue
+// (so write() can stream packets longer than the write buffer, as before v0.9.34), unless it may have to be written again
+{
+  uint8_t start = tx_packet_start[p];
+  tx_packet_start[p] = TxRing::next(start);
+  tx_packet_len[p]--;
+  if ((p == TxPacketRing::next(tx_packet_tail)) && !(tx_packet_flags[p] & TX_PACKET_RETRY)) tx_buffer_tail = start;
+  return tx_buffer[start];
+}
+
+#ifdef TX_RETRY
+static inline void tx_result_add(uint8_t p, uint8_t status)
+// called from ISR, before packet p is released, if it was queued with retries (TX_PACKET_RETRY); result dropped if buffer full
+{
+  uint8_t head = TxResultRing::next(tx_result_head);
+  if (head == tx_result_tail) return;
+  tx_result_t &r = tx_result[head];
+  uint8_t start = tx_packet_first[p];
+  for (uint8_t i = 0; i < 3; i++) {
+    r.header[i] = (i < tx_packet_total[p]) ? (uint8_t) tx_buffer[start] : 0;
+    start = TxRing::next(start);
+  }
+  r.status = status;
+  r.attempts = tx_packet_attempts[p];
+  tx_result_head = head;
+#ifdef EVENT_HANDLERS
+  ev_pending |= P1P2_EVENT_RESULT;
+#endif /* EVENT_HANDLERS */
+}
+
+static inline void tx_retry(uint8_t p)
+// called from COMPARE_W_INTERRUPT after a collision while writing packet p, which has retries left:
+// rewinds p, and delays it by a random backoff (doubling per retry, bounded), or, for a schedulegap() packet, until it is armed again
+{
+  tx_packet_retries[p]--;
+  tx_packet_start[p] = tx_packet_first[p];
+  tx_packet_len[p] = tx_packet_total[p];
+  uint8_t shift = tx_packet_attempts[p] - 1;
+  if (shift > TX_RETRY_BACKOFF_SHIFT) shift = TX_RETRY_BACKOFF_SHIFT;
+  uint16_t x = tx_retry_rnd ^ (uint16_t) GET_TIMER_W_COUNT();
+  x ^= x << 7;
+  x ^= x >> 9;
+  x ^= x << 8;
+  tx_retry_rnd = x ? x : 1;
+  tx_packet_delay[p] = tx_packet_delay0[p] + (uint16_t) (((uint32_t) x * (((uint32_t) tx_retry_backoff << shift) + 1)) >> 16);
+#ifdef BUS_CYCLE_LEARNER
+  tx_packet_flags[p] &= ~TX_PACKET_ARMED;
+#endif /* BUS_CYCLE_LEARNER */
+}
+#endif /* TX_RETRY */
+
+static inline uint8_t tx_packet_select(void)
+// called from MS ISR while a write is scheduled (tx_state == 99):
+// drops packets beyond their deadline, and returns the packet with highest priority (first queued if equal priority)
+// for which the pause is long enough to start writing, or TX_PACKET_NONE
+{
+  uint8_t selected = TX_PACKET_NONE;
+  uint8_t waiting = 0;
+  uint8_t i = tx_packet_tail;
+  while (i != tx_packet_head) {
+    i = TxPacketRing::next(i);
+    uint8_t flags = tx_packet_flags[i];
+    if (flags & TX_PACKET_DONE) continue;
+    if ((flags & TX_PACKET_DEADLINE) && ((int32_t) (t1_now() - tx_packet_deadline[i]) >= 0)) {
+#ifdef TX_RETRY
+      if (flags & TX_PACKET_RETRY) tx_result_add(i, P1P2_TX_DEADLINE);
+#endif /* TX_RETRY */
+      tx_packet_flags[i] = flags | TX_PACKET_DONE;
+      continue;
+    }
+    waiting = 1;
+    uint16_t delay = tx_packet_delay[i];
+#ifdef BUS_CYCLE_LEARNER
+    if (flags & TX_PACKET_GAP) {
+      // only exactly delay ms after the packet it was armed for, and only if nothing has been on the bus since
+      if (!(flags & TX_PACKET_ARMED) || (tx_packet_epoch[i] != bus_epoch) || (time_msec != delay)) continue;
+    } else
+#endif /* BUS_CYCLE_LEARNER */
+    if ((time_msec != delay) && ((time_msec < delay) || (time_msec < tx_packet_timeout[i]))) continue;
+    if ((selected == TX_PACKET_NONE) || (tx_packet_priority[i] > tx_packet_priority[selected])) selected = i;
+  }
+  tx_packet_release();
+  if (!waiting) tx_state = 0;
+  return selected;
+}
+
+/****************************************/
+/**           Event handlers           **/
+/****************************************/
+
+#ifdef EVENT_HANDLERS
+// The ISRs only signal events (ev_pending). Handlers run in the ms timer ISR after it has re-enabled interrupts (priority >= P1P2_PRIO_ISR),
+// or in dispatch(); both pass pending events to the handlers registered for them, and run one handler call at a time, restarting
+// at the highest priority after each call. A packet is released by dispatch() once all packet handlers have been called for it.
+
+static inline void ev_fetch(void)
+// passes events signalled by ISRs to the handlers registered for them
+{
+  uint8_t intr_state = SREG;
+  cli();
+  uint8_t ev = ev_pending;
+  ev_pending = 0;
+  if (ev) {
+    for (uint8_t h = 0; h < ev_cnt; h++) ev_todo[h] |= ev & ev_events[h];
+  }
+  SREG = intr_state;
+}
+
+static inline void ev_todo_update(uint8_t h, uint8_t clear, uint8_t set)
+{
+  uint8_t intr_state = SREG;
+  cli();
+  ev_todo[h] = (ev_todo[h] & ~clear) | set;
+  SREG = intr_state;
+}
+
+static uint8_t ev_next_packet(uint8_t bit)
+// returns oldest packet descriptor for which the handler with bit has not been called, or EV_PACKET_NONE
+{
+  uint8_t p = rx_packet_tail;
+  uint8_t head = rx_packet_head;
+  while (p != head) {
+    p = PacketRing::next(p);
+    if (!(rx_packet_handled[p] & bit)) return p;
+  }
+  return EV_PACKET_NONE;
+}
+
+static uint8_t ev_run(uint8_t mask)
+// runs handlers in mask (bit h for ev_handler[h]) until they have no pending events left; returns events handled
+{
+  uint8_t handled = 0;
+  uint8_t h = 0;
+  ev_fetch();
+  while (h < ev_cnt) {
+    uint8_t bit = 1 << h;
+    uint8_t todo = ev_todo[h];
+    if (!(mask & bit) || !todo) {
+      h++;
+      continue;
+    }
+    if (todo & P1P2_EVENT_PACKET) {
+      ev_todo_update(h, P1P2_EVENT_PACKET, 0);
+      uint8_t p = ev_next_packet(bit);
+      if (p != EV_PACKET_NONE) {
+        ev_packet = p;
+        ev_handler[h](P1P2_EVENT_PACKET);
+        ev_packet = EV_PACKET_NONE;
+        uint8_t intr_state = SREG;
+        cli();
+        rx_packet_handled[p] |= bit;
+        SREG = intr_state;
+        // check for more packets
+        ev_todo_update(h, 0, P1P2_EVENT_PACKET);
+        handled |= P1P2_EVENT_PACKET;
+      }
+    } else {
+      ev_todo_update(h, todo, 0);
+      ev_handler[h](todo);
+      handled |= todo;
+    }
+    ev_fetch();
+    h = 0;
+  }
+  return handled;
+}
+
+static void ev_dispatch_isr(void)
+// called at the end of the ms timer ISR (interrupts disabled, ms_isr_busy set): runs handlers with priority >= P1P2_PRIO_ISR
+// with interrupts enabled, so they may be interrupted by the other ISRs (and by the ms timer ISR, which then does not run handlers)
+{
+  uint8_t work = 0;
+  ev_fetch();
+  for (uint8_t h = 0; h < ev_cnt; h++) if ((ev_isr_mask & (1 << h)) && ev_todo[h]) work = 1;
+  if (!work) return;
+  // the foreground may be reading a packet itself
+  uint8_t packet = ev_packet;
+  errorbuf_t readerrors = rx_packet_readerrors;
+#ifdef PACKET_TIMESTAMP
+  uint32_t readtime = rx_packet_readtime;
+#endif /* PACKET_TIMESTAMP */
+#ifdef TX_REPLY
+  uint8_t readreply = rx_packet_readreply;
+#endif /* TX_REPLY */
+  sei();
+  ev_run(ev_isr_mask);
+  cli();
+  ev_packet = packet;
+  rx_packet_readerrors = readerrors;
+#ifdef PACKET_TIMESTAMP
+  rx_packet_readtime = readtime;
+#endif /* PACKET_TIMESTAMP */
+#ifdef TX_REPLY
+  rx_packet_readreply = readreply;
+#endif /* TX_REPLY */
+}
+#endif /* EVENT_HANDLERS */
+
+bool P1P2SerialBus::setHandler(uint8_t events, P1P2_handler_t handler, uint8_t priority /* = 0 */)
+// Registers handler for events (P1P2_EVENT_*), or changes its events and priority if registered before; events = 0 removes it.
+// Handlers of equal priority are called in order of registration. Not to be called from a handler.
+// Packets received but not yet released are passed (again) to all packet handlers.
+{
+#ifdef EVENT_HANDLERS
+  P1P2_handler_t handler_new[P1P2_HANDLERS];
+  uint8_t events_new[P1P2_HANDLERS];
+  uint8_t priority_new[P1P2_HANDLERS];
+  uint8_t cnt = 0;
+  uint8_t added = 0;
+  if (events & P1P2_EVENT_WRITE) events |= P1P2_EVENT_COLLISION;
+  for (uint8_t h = 0; h <= ev_cnt; h++) {
+    if (events && !added && ((h == ev_cnt) || (ev_priority[h] < priority))) {
+      if (cnt == P1P2_HANDLERS) return false;
+      handler_new[cnt] = handler;
+      events_new[cnt] = events;
+      priority_new[cnt++] = priority;
+      added = 1;
+    }
+    if ((h == ev_cnt) || (ev_handler[h] == handler)) continue;
+    if (cnt == P1P2_HANDLERS) return false;
+    handler_new[cnt] = ev_handler[h];
+    events_new[cnt] = ev_events[h];
+    priority_new[cnt++] = ev_priority[h];
+  }
+  uint8_t intr_state = SREG;
+  cli();
+  ev_cnt = cnt;
+  ev_packet_mask = 0;
+  ev_isr_mask = 0;
+  for (uint8_t h = 0; h < cnt; h++) {
+    ev_handler[h] = handler_new[h];
+    ev_events[h] = events_new[h];
+    ev_priority[h] = priority_new[h];
+    ev_todo[h] = events_new[h] & P1P2_EVENT_PACKET;
+    if (events_new[h] & P1P2_EVENT_PACKET) ev_packet_mask |= (1 << h);
+    if (priority_new[h] >= P1P2_PRIO_ISR) ev_isr_mask |= (1 << h);
+  }
+  for (uint8_t p = 0; p < P1P2SerialCfg::packet_size; p++) rx_packet_handled[p] = 0;
+  SREG = intr_state;
+  return true;
+#else /* EVENT_HANDLERS */
+  return false;
+#endif /* EVENT_HANDLERS */
+}
+
+void P1P2SerialBus::setIdle(uint16_t t)
+{
+#ifdef EVENT_HANDLERS
+  uint8_t intr_state = SREG;
+  cli();
+  ev_idle = t;
+  SREG = intr_state;
+#endif /* EVENT_HANDLERS */
+}
+
+uint8_t P1P2SerialBus::dispatch(void)
+// Runs the handlers with priority < P1P2_PRIO_ISR for pending events, and releases the packets for which all packet handlers have been called.
+// Returns the events handled (0 if none, or if called from a handler).
+{
+#ifdef EVENT_HANDLERS
+  if (ev_fg_busy) return 0;
+  ev_fg_busy = 1;
+  uint8_t handled = ev_run(~ev_isr_mask);
+  if (ev_packet_mask) {
+    while (rx_packet_head != rx_packet_tail) {
+      if ((rx_packet_handled[PacketRing::next(rx_packet_tail)] & ev_packet_mask) != ev_packet_mask) break;
+      releasepacket();
+    }
+  }
+  ev_fg_busy = 0;
+  return handled;
+#else /* EVENT_HANDLERS */
+  return 0;
+#endif /* EVENT_HANDLERS */
+}
+
+static inline void tx_start(uint8_t p, uint16_t t)
+// called from ISR: starts writing packet p, with the falling edge of its start bit at timer value t
+{
+  tx_packet_cur = p;
+#ifdef TX_RETRY
+  tx_packet_attempts[p]++;
+#endif /* TX_RETRY */
+  tx_frame = tx_packet_pop(p);
+  tx_byte_verify = tx_frame; // for read-back verification
+  // start writing:
+  // at t, falling edge of start bit is scheduled
+  // This will trigger an interrupt for next action to be set up.
+  // tx_state=1 indicates that (upon start interrupt routine) the start bit has just begun.
+  tx_state = 1;
+
+  // switch from reading to writing
+  // disable reading when writing
+  // in scopemode, capture (both) edges
+  // if P1P2Monitor is still processing sws_event data (sws_block), do not start writing new events
+#ifdef SW_SCOPE
+  // if P1P2Monitor is ready reading data (sws_block = 0), start new log operation in write mode (if sw_scope_next)
+  sw_scope = sw_scope_next && !sws_block;
+  if (sw_scope) {
+    SW_SCOPE_START_LOG(SWS_MODE_WRITE);
+    // keep INT_INPUT_CAPTURE enabled
+    DISABLE_INT_INPUT_CAPTURE();
+  } else {
+    DISABLE_INT_INPUT_CAPTURE();
+  }
+#else /* SW_SCOPE */
+  DISABLE_INT_INPUT_CAPTURE();
+#endif /* SW_SCOPE */
+  DISABLE_INT_COMPARE_R();
+
+  DISABLE_MS_TIMER();
+
+  // start writing
+  SET_COMPARE_W(t);
+  CONFIG_MATCH_CLEAR();
+  CONFIG_CAPTURE_FALLING_EDGE();
+  ENABLE_INT_COMPARE_W();
+  DIGITAL_SET_LED_WRITE;
+}
+
+#ifdef TX_CARRIER_SENSE
+static inline void tx_sense_defer(void)
+// called from ISR during the carrier sense window (tx_state == 98) if another device is active: the packet stays queued
+{
+  tx_state = 99;
+  DISABLE_INT_COMPARE_W();
+  DIGITAL_RESET_LED_WRITE;
+  if (tx_sense_deferred < 0xFFFF) tx_sense_deferred++;
+}
+
+static inline void tx_sense_end(uint16_t t)
+// called from compare W ISR at timer value t, at the end of the carrier sense window: a start bit of another device would have
+// deferred the write already (capture ISR), so only an edge or low level since this ISR started can still defer it
+{
+  DISABLE_INT_INPUT_CAPTURE();
+  if (INPUT_CAPTURED() || !INPUT_CAPTURE_PIN_VALUE) {
+    RESUME_INT_INPUT_CAPTURE(); // capture ISR handles the edge
+    tx_sense_defer();
+    return;
+  }
+  tx_start(tx_packet_cur, t + Wticks_per_semibit);
+}
+#endif /* TX_CARRIER_SENSE */
+
+#ifdef TX_REPLY
+static uint8_t tx_packet_schedule(const uint8_t* writebuf, uint8_t l, uint16_t t, uint16_t timeout, uint8_t priority, uint16_t deadline, uint8_t crc_gen, uint8_t crc_feed, uint8_t flags);
+
+static void tx_reply_queue(void)
+// called at the end of the ms timer ISR (interrupts disabled, ms_isr_busy set) if a reply has been built and no packet is being prepared:
+// queues the reply with interrupts enabled, to be written after the delay of its slot counted from the end of the request
+{
+  const tx_reply_t &r = tx_reply[tx_reply_pending - 1];
+  uint16_t delay = r.delay;
+  uint16_t deadline = r.deadline;
+  uint8_t priority = r.priority;
+  tx_build_busy++;
+  sei();
+  uint8_t p = tx_packet_schedule(tx_reply_buf, tx_reply_len, delay, tx_setdelaytimeout, priority, deadline, rx_crc_cfg.gen, rx_crc_cfg.feed, 0);
+  cli();
+  tx_build_busy--;
+  if ((p == TX_PACKET_NONE) && (tx_reply_refused < 0xFFFF)) tx_reply_refused++;
+  tx_reply_pending = 0;
+}
+#endif /* TX_REPLY */
+
+ISR(MS_TIMER_COMP_vect)
+{
+  ISR_STATS_START;
+  IDLE_WAKE;
+// time_msec counts time in ms from the last start pulse (counting from the leading falling edge of the start pulse)
+// max count is 65535 ms (uint16_t)
+  if (time_msec < 0xFFFF) {
+    time_msec++;
+#ifdef EVENT_HANDLERS
+    if (time_msec == ev_idle) ev_pending |= P1P2_EVENT_IDLE;
+#endif /* EVENT_HANDLERS */
+  }
+  // if tx_state =99, a write is scheduled, so check if pause is long enough to start writing any of the queued packets
+  if (tx_state == 99) {
+    uint8_t p = tx_packet_select();
+    if (p != TX_PACKET_NONE) {
+#ifdef TX_CARRIER_SENSE
+      // listen before talk: the start bit is scheduled (in tx_sense_end()) only if the bus stays idle during the next bit time;
+      // reading continues meanwhile, and a start bit of another device defers the write (tx_sense_defer())
+      tx_packet_cur = p;
+      tx_state = 98;
+      SET_COMPARE_W(GET_TIMER_W_COUNT() + scheduledelay - Wticks_per_semibit);
+      ENABLE_INT_COMPARE_W();
+      DIGITAL_SET_LED_WRITE;
+#else /* TX_CARRIER_SENSE */
+      tx_start(p, GET_TIMER_W_COUNT() + scheduledelay);
+#endif /* TX_CARRIER_SENSE */
+    }
+  }
+  ISR_STATS_STOP(ISR_STATS_MS_TIMER, tx_state);
+#if (defined TX_REPLY) || (defined EVENT_HANDLERS)
+  // the code below enables interrupts, so it must not be re-entered by a nested ms timer ISR
+  if (ms_isr_busy) return;
+  ms_isr_busy = 1;
+#ifdef TX_REPLY
+  if (tx_reply_pending && !tx_build_busy) tx_reply_queue();
+#endif /* TX_REPLY */
+#ifdef EVENT_HANDLERS
+  if (ev_isr_mask) ev_dispatch_isr();
+#endif /* EVENT_HANDLERS */
+  ms_isr_busy = 0;
+#endif /* TX_REPLY || EVENT_HANDLERS */
+}
+
+/****************************************/
+/**           Transmission             **/
+/****************************************/
+
+static uint16_t tx_setdelay = 0;
+
+void P1P2SerialBus::setDelay(uint16_t t)
+// Input parameter: 0 <= t <= 65535
+// This sets delay for next byte (and next byte only) when it is added to the transmission buffer.
+// The writing of the next byte to be added to the queue will be delayed until (<= v0.9.4: at least; >= v0.9.5: exactly) t milliseconds silence
+//                since last falling edge of start bit has been detected. (v0.9.5:) In addition, writing will follow in case of a timeout situation.
+// This means that a delay is introduced since the byte last read, or,
+// as we also read back sent data (also for the purpose of verification), since the byte last written.
+// If a byte is added to the queue during a silence, the past silence will also be taken into account.
+// (<=v0.9.4:) If a byte is added with a setDelay which is shorter than the past silence, transmission will start immediately.
+// (>=v0.9.5:) If the past silence is more that t ms, but less than the timeout value, writing will be delayed until either one of the following 2 conditions is met:
+//                1) a new byte is received, after which a new pause will be clocked, or
+//                2) no new byte is received, but the total pause is or becomes longer than the value set with setDelayTimeout(t)
+//                The reason for this change in behaviour is to prevent bus collissions when writing a packet near the end of a pause.
+// If the value used as delay timeout is equal to or lower than the delay value, the writing behaviour of >=v0.9.5 equals the behaviour of library version <=v0.9.4
+// It is advised to call setDelaytimeout(t) with a value that is larger than the total cycle time of the P1P2 bus behaviour.
+// For many products the cycle repeats every 0.8..2s, so a setDelaytimeout(2500) would be appropriate. This is also the default value.
+// For some products the cycle time can be larger (15s or so), and a setDelaytimeout(20000) might be appropriate.
+// To simplify code, setDelay(0) and setDelay(1) are no longer supported; useless for P1/P2.
+// If setDelay (t) is called with 2 <= t <= 65535, a delay of t ms is set.
+// If setDelay (t) is called with t < 2, a delay of 2 ms is set.
+// (>=v0.9.34:) A byte written with a delay starts a new packet in the write packet queue; bytes written without a delay extend that packet.
+//                schedulepacket() sets delay, timeout, priority and deadline per packet.
+{
+  if (t < 2) t = 2;
+  tx_setdelay = t;
+}
+
+void P1P2SerialBus::setDelayTimeout(uint16_t t)
+// Input parameter: 0 <= t <= 65535
+// This sets delay timeout as described above, for packets queued by write() and writepacket()
+{
+  tx_setdelaytimeout = t;
+}
+
+bool P1P2SerialBus::writeready(void)
+// true if all queued packets have been written (or dropped)
+{
+  return (tx_buffer_tail == tx_buffer_head);
+}
+
+uint8_t tx_rx_paritycheck;
+uint8_t tx_rx_readbackerror;
+#ifdef GENERATE_FAKE_ERRORS
+uint8_t tx_rx_readbackerror_fake;
+#endif /* GENERATE_FAKE_ERRORS */
+
+static inline uint16_t tx_frame_for(uint8_t b)
+// returns data byte with even parity bit in bit 8, in transmission order (LSB first)
+// the first half of each bit (after the start bit) is low for a 0 bit, and the second half is always high,
+// so these 9 bits fully determine the 18 semibits written (and verified) after the start bit
+{
+  uint8_t p = b ^ (b >> 4);
+  p ^= (p >> 2);
+  p ^= (p >> 1);
+  return b | ((uint16_t) (p & 0x01) << 8);
+}
+
+static inline void tx_packet_add(uint8_t start, uint8_t len, uint16_t delay, uint16_t timeout, uint8_t priority, uint8_t flags)
+// to be called with interrupts disabled, if TxPacketRing::next(tx_packet_head) != tx_packet_tail
+{
+  uint8_t p = TxPacketRing::next(tx_packet_head);
+  tx_packet_start[p] = start;
+  tx_packet_len[p] = len;
+  tx_packet_delay[p] = delay;
+  tx_packet_timeout[p] = timeout;
+  tx_packet_priority[p] = priority;
+  tx_packet_flags[p] = flags;
+  tx_packet_head = p;
+  // we could initiate start writing here, as we did <=v0.9.4, but we can better leave it to the ISR, which is simpler
+  // it adds some delay (max 1 ms), but it makes operation and timing slightly more predictable
+  // set tx_state 99 to start transmission in msec ISR when time_msec becomes == delay or >= timeout
+  if (!tx_state) tx_state = 99;
+}
+
+void P1P2SerialBus::write(uint8_t b)
+{
+  uint8_t intr_state, head, p;
+  uint16_t frame = tx_frame_for(b); // computed here, outside of ISR and with interrupts enabled
+
+  while (1) {
+    intr_state = SREG;
+    cli();
+    // cli() is needed here to avoid a race condition w.r.t. tx_state and the write packet queue, which can change in ISR(),
+    // and w.r.t. tx_buffer_head, which the ms timer ISR advances when it queues a reply (TX_REPLY)
+    head = TxRing::next(tx_buffer_head);
+    if (tx_buffer_tail != head) {
+      p = tx_packet_head;
+      if (!tx_setdelay && (p != tx_packet_tail) && !(tx_packet_flags[p] & (TX_PACKET_DONE | TX_PACKET_RETRY))) {
+        // no delay set, and last packet not yet (completely) written: add byte to it, even if it is being written
+        // (its remaining frames end at tx_buffer_head, so it stays contiguous)
+        tx_buffer[head] = frame;
+        tx_buffer_head = head;
+        tx_packet_len[p]++;
+        SREG = intr_state;
+        return;
+      }
+      if (TxPacketRing::next(p) != tx_packet_tail) {
+        // start new packet; next byte after this one will be written without delay
+        tx_buffer[head] = frame;
+        tx_buffer_head = head;
+        tx_packet_add(head, 1, tx_setdelay, tx_setdelaytimeout, 0, 0);
+        tx_setdelay = 0;
+        SREG = intr_state;
+        return;
+      }
+    }
+    SREG = intr_state;
+    BUSY_WAIT(); // wait until space in write buffer and write packet queue
+  }
+}
+
+static uint16_t startbit_delta;
+static uint8_t Echo = 1;
+
+static inline void rx_packet_add(uint8_t head)
+// called from ISR after a byte has been stored in rx_buffer[head]
+// we are in the stop bit (or at the end of a written byte), so there is time to update the CRC here
+{
+  if (!rx_packet_cnt) {
+    rx_packet_first = head;
+    rx_packet_delta0 = delta_buffer[head];
+    rx_packet_crc = rx_crc_cfg.feed;
+  }
+  rx_packet_cnt++;
+  rx_packet_err |= error_buffer[head];
+  rx_packet_crc_prev = rx_packet_crc;
+  if (rx_crc_cfg.gen) rx_packet_crc = P1P2_crc_update(rx_crc_cfg, rx_packet_crc, rx_buffer[head]);
+}
+
+#ifdef TX_REPLY
+static inline uint8_t tx_reply_build(void)
+// called from ISR at the end of a packet read without errors: if a reply slot matches the packet and no reply is waiting to be queued,
+// builds the reply in tx_reply_buf (to be queued by the ms timer ISR), returns slot + 1, or 0 if no reply
+{
+  if (tx_reply_pending || (rx_packet_cnt < 3)) return 0;
+  uint8_t i = rx_packet_first;
+  uint8_t b0 = rx_buffer[i];
+  i = RxRing::next(i);
+  uint8_t b1 = rx_buffer[i];
+  uint8_t b2 = rx_buffer[RxRing::next(i)];
+  for (uint8_t s = 0; s < TX_REPLY_SLOTS; s++) {
+    tx_reply_t &r = tx_reply[s];
+    if (!r.count || (r.header[0] != b0) || (r.header[1] != b1) || (b2 < r.type_first) || (b2 > r.type_last)) continue;
+    uint8_t n = rx_packet_cnt - (rx_crc_cfg.gen ? 1 : 0);
+    uint8_t l = r.len ? r.len : n;
+    if (l > TX_REPLY_SIZE) l = TX_REPLY_SIZE;
+    uint32_t copy = r.copy;
+    i = rx_packet_first;
+    for (uint8_t j = 0; j < l; j++) {
+      tx_reply_buf[j] = ((copy & 1) && (j < n)) ? rx_buffer[i] : r.data[j];
+      copy >>= 1;
+      i = RxRing::next(i);
+    }
+    tx_reply_len = l;
+    if (r.count != P1P2_REPLY_ALWAYS) r.count--;
+    tx_reply_pending = s + 1;
+    return s + 1;
+  }
+  return 0;
+}
+#endif /* TX_REPLY */
+
+static inline void rx_packet_eop(uint8_t last, bool written)
+// called from ISR when SIGNAL_EOP has been set on rx_buffer[last]: check CRC, register descriptor for the completed packet
+// (written: read-back of a packet written by us)
+{
+  if (rx_packet_cnt) {
+    if (rx_crc_cfg.gen && (rx_packet_crc_prev != rx_buffer[last])) {
+      error_buffer[last] |= ERROR_CRC;
+      rx_packet_err |= ERROR_CRC;
+      DIGITAL_SET_LED_ERROR;
+    }
+#ifdef TX_REPLY
+    uint8_t reply = (written || rx_packet_err) ? 0 : tx_reply_build();
+#endif /* TX_REPLY */
+    uint8_t head = PacketRing::next(rx_packet_head);
+    if (head != rx_packet_tail) {
+      rx_packet_start[head] = rx_packet_first;
+      rx_packet_len[head] = rx_packet_cnt;
+      rx_packet_errors[head] = rx_packet_err & ERROR_FLAGS;
+      rx_packet_delta[head] = rx_packet_delta0;
+#ifdef PACKET_TIMESTAMP
+      rx_packet_time[head] = rx_packet_time0;
+#endif /* PACKET_TIMESTAMP */
+#ifdef BUS_CYCLE_LEARNER
+      rx_packet_wrote[head] = rx_packet_wrote0;
+#endif /* BUS_CYCLE_LEARNER */
+#ifdef TX_REPLY
+      rx_packet_reply[head] = reply;
+#endif /* TX_REPLY */
+#ifdef EVENT_HANDLERS
+      rx_packet_handled[head] = 0;
+      ev_pending |= P1P2_EVENT_PACKET;
+#endif /* EVENT_HANDLERS */
+      rx_packet_head = head;
+    } else {
+      // no descriptor available: drop packet from rx_buffer, signal overrun for *previous* packet
+      rx_buffer_head = RxRing::prev(rx_packet_first);
+      rx_packet_errors[rx_packet_head] |= ERROR_OR;
+      DIGITAL_SET_LED_ERROR;
+    }
+  }
+  rx_packet_cnt = 0;
+  rx_packet_err = 0;
+#ifdef BUS_CYCLE_LEARNER
+  rx_packet_wrote0 = 0;
+#endif /* BUS_CYCLE_LEARNER */
+}
+
+ISR(COMPARE_W_INTERRUPT)
+{
+  ISR_STATS_START;
+  IDLE_WAKE;
+  uint8_t state, bit, bit_input, errorhead = 0, head, p;
+  state = tx_state;
+  // state indicates in which part of data pattern we are when entering this ISR
+  // 1,2 startbit
+  // 3,4 .. 17,18 data bits
+  // 19,20 parity bit
+  // 21,22 stopbit (21,22 skipped)
+  // (removed) 23 after stopbit
+  // 98 carrier sense window ended (TX_CARRIER_SENSE), start bit falling edge to be scheduled if bus still idle
+  // (can't happen here) 99 pausing, pausing until we can schedule next start bit falling edge
+  // (can't happen here) 0, currently not writing
+
+  // SW_SCOPE logs states, error/event, and time of captured edge relative to output compare
+  uint16_t get_compare_w = GET_COMPARE_W();
+  uint16_t set_compare_w;
+
+  if (state < 20) {
+    set_compare_w = get_compare_w + Wticks_per_semibit;
+    SET_COMPARE_W(set_compare_w);
+    bit_input = INPUT_CAPTURE_PIN_VALUE;
+    if (state & 1) {
+      // state is odd, 1-19, next semibit will be part 2 of databit (high)
+      CONFIG_MATCH_SET();
+      CONFIG_CAPTURE_RISING_EDGE();
+      if (state == 1) {
+        // state=1, start bit
+        startbit_delta = time_msec;
+#ifdef BUS_CYCLE_LEARNER
+        bus_epoch++;
+        rx_packet_wrote0 = 1;
+#endif /* BUS_CYCLE_LEARNER */
+#ifdef PACKET_TIMESTAMP
+        if (!rx_packet_cnt) rx_packet_time0 = t1_extend(get_compare_w);
+#endif /* PACKET_TIMESTAMP */
+        DISABLE_MS_TIMER();
+        tx_rx_readbackerror = 0;
+#ifdef GENERATE_FAKE_ERRORS
+        tx_rx_readbackerror_fake = 0;
+#endif /* GENERATE_FAKE_ERRORS */
+      } else if (state == 19) {
+        // state=19, paritybit
+        PRESET_ENABLE_MS_TIMER(); // start new milli-second timer measurement here, setting timer on 1msec given we are at paritybit.
+      }
+      // check bit input signal
+      if (state == 1) {
+        // state is 1, start bit part 1, should be 0
+        if (bit_input) {
+          tx_rx_readbackerror = ERROR_SB;
+          SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_SB);
+        }
+#ifdef GENERATE_FAKE_ERRORS
+        if (fakeError(FAKE_ERROR_SB)) {
+          tx_rx_readbackerror_fake |= ERROR_SB;
+          SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_SB_FAKE);
+        }
+#endif /* GENERATE_FAKE_ERRORS */
+      } else if (state & 1) {
+        // state is odd and >1, can be bit or parity bit
+        // faster to check bit value directly here than to reconstruct tx_rx_byte
+        if (bit_input != tx_bit) {
+          tx_rx_readbackerror |= ERROR_BE; // bit differs
+          SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_BE);
+        }
+#ifdef GENERATE_FAKE_ERRORS
+        if (fakeError(FAKE_ERROR_BE)) {
+          tx_rx_readbackerror_fake |= ERROR_BE;
+          SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_BE_FAKE);
+        }
+#endif /* GENERATE_FAKE_ERRORS */
+      }
+    } else {
+      // state is even, 2..18, next semibit will be data bit part 1 (LSB first), or, for state=18, parity bit part 1
+      bit = (tx_frame & 1);
+      if (!bit) {
+        CONFIG_MATCH_CLEAR();
+        CONFIG_CAPTURE_FALLING_EDGE();
+      }
+      tx_frame >>= 1;
+      // verify
+      // state is even, check bit data (part 2), should be 1, otherwise suspect bus collission
+      if (!bit_input) {
+        tx_rx_readbackerror |= ERROR_BC;
+        SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_BC);
+      }
+#ifdef GENERATE_FAKE_ERRORS
+      if (fakeError(FAKE_ERROR_BC)) {
+        tx_rx_readbackerror_fake |= ERROR_BC;
+        SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_BC_FAKE);
+      }
+#endif /* GENERATE_FAKE_ERRORS */
+      tx_bit = bit;
+    }
+
+    bit_input = INPUT_CAPTURE_PIN_VALUE; // sample again in view of turn-around delay
+    // check if we have captured a rising edge?
+    if (INPUT_CAPTURED()) {
+      // edge captured
+      uint16_t capture = GET_INPUT_CAPTURE();
+      RESET_INPUT_CAPTURE();
+      if (bit_input) {
+        SW_SCOPE_LOG_EVENT(capture - get_compare_w, SWS_EVENT_EDGE_RISING | state);
+      } else {
+        SW_SCOPE_LOG_EVENT(capture - get_compare_w, SWS_EVENT_EDGE_FALLING_W | state);
+      }
+    } else {
+      if (!bit_input) {
+        SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_LOW);
+      } else {
+        SW_SCOPE_LOG_EVENT(0, SWS_EVENT_SIGNAL_HIGH_R | state);
+      }
+    }
+    tx_rx_state = state;
+    state++;
+    tx_state = state;
+    ISR_STATS_STOP(ISR_STATS_COMPARE_W, tx_rx_state);
+    return;
+  }
+#ifdef TX_CARRIER_SENSE
+  if (state == 98) {
+    tx_sense_end(get_compare_w);
+    ISR_STATS_STOP(ISR_STATS_COMPARE_W, 98);
+    return;
+  }
+#endif /* TX_CARRIER_SENSE */
+  // state = 20
+  // 20: next semibit will be stop bit part 1, schedule start bit part 1 if packet being written has more bytes
+  //     no further read-back-verify for stop bit
+  bit_input = INPUT_CAPTURE_PIN_VALUE; // sample again in view of turn-around delay
+  // check if we have captured a rising edge?
+  if (INPUT_CAPTURED()) {
+    // edge captured
+    uint16_t capture = GET_INPUT_CAPTURE();
+    RESET_INPUT_CAPTURE();
+    if (bit_input) {
+      SW_SCOPE_LOG_EVENT(capture - get_compare_w, SWS_EVENT_EDGE_RISING | state);
+    } else {
+      SW_SCOPE_LOG_EVENT(capture - get_compare_w, SWS_EVENT_EDGE_FALLING_W | state);
+    }
+  } else {
+    if (!bit_input) {
+      SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_LOW);
+    } else {
+      SW_SCOPE_LOG_EVENT(0, SWS_EVENT_SIGNAL_HIGH_R | state);
+    }
+  }
+  p = tx_packet_cur;
+  if (tx_rx_readbackerror) {
+    DIGITAL_SET_LED_ERROR;
+    // As of version 0.9.22: if a bus collision is suspected (=if a read errors occurs during a write), reduce risk on further collissions by emptying write buffer
+    // (TX_RETRY: except for packets queued with retries, which are written again later, if retries are left for the packet being written)
+    uint8_t i = tx_packet_tail;
+    while (i != tx_packet_head) {
+      i = TxPacketRing::next(i);
+#ifdef TX_RETRY
+      if ((tx_packet_flags[i] & TX_PACKET_RETRY) && ((i != p) || tx_packet_retries[i])) continue;
+#endif /* TX_RETRY */
+      tx_packet_flags[i] |= TX_PACKET_DONE;
+    }
+  }
+  // store transmitted byte as it it were received (if buffer space available, and if Echo), and check/store errors
+  if (Echo) {
+    head = RxRing::next(rx_buffer_head);
+    if (head != rx_buffer_tail) {
+      rx_buffer[head] = tx_byte_verify; // cheat, transmitted byte
+      delta_buffer[head] = startbit_delta;
+#ifdef GENERATE_FAKE_ERRORS
+      error_buffer[head] = tx_rx_readbackerror | (tx_rx_readbackerror_fake << 8);
+#else /* GENERATE_FAKE_ERRORS */
+      error_buffer[head] = tx_rx_readbackerror;
+#endif /* GENERATE_FAKE_ERRORS */
+      rx_buffer_head = head;
+      rx_packet_add(head);
+    } else {
+      // signal buffer overrun for *previous* byte
+      head = rx_buffer_head;
+      error_buffer[head] |= ERROR_OR;
+      rx_packet_err |= ERROR_OR;
+      DIGITAL_SET_LED_ERROR;
+    }
+    errorhead = head;
+  }
+  // more data to write?
+  if (!tx_rx_readbackerror && !(tx_packet_flags[p] & TX_PACKET_DONE) && tx_packet_len[p]) {
+    // there are more bytes to send in this packet; we don't wait and we continue writing!
+    // as we are in (silent, high) stop bit time, we set target time at end of stop bit (= next start bit)
+    tx_frame = tx_packet_pop(p);
+    tx_byte_verify = tx_frame;
+    tx_rx_paritycheck = 0;
+    SET_COMPARE_W(GET_COMPARE_W() + Wticks_per_bit_and_semibit);
+    CONFIG_MATCH_CLEAR();
+    CONFIG_CAPTURE_FALLING_EDGE();
+    tx_state = 1;
+    ISR_STATS_STOP(ISR_STATS_COMPARE_W, 20);
+    return;
+  }
+  // packet written, free its buffer space; if other packets are waiting, we have to wait for their delay setting
+#ifdef TX_RETRY
+  if (!(tx_packet_flags[p] & TX_PACKET_DONE) && tx_rx_readbackerror) {
+    // collision, packet to be written again
+    tx_retry(p);
+  } else {
+    if (tx_packet_flags[p] & TX_PACKET_RETRY) tx_result_add(p, tx_rx_readbackerror ? P1P2_TX_COLLISION : P1P2_TX_OK);
+    tx_packet_flags[p] |= TX_PACKET_DONE;
+  }
+#else /* TX_RETRY */
+  tx_packet_flags[p] |= TX_PACKET_DONE;
+#endif /* TX_RETRY */
+  tx_packet_release();
+  // we don't need to block transmission here until start bit part 1
+  // because schedule_delay >= Wticks_per_bit_and_semibit ensures this too
+  // switch from writing to reading
+  tx_state = (tx_packet_tail != tx_packet_head) ? 99 : 0;
+  DISABLE_INT_COMPARE_W();
+  CONFIG_CAPTURE_FALLING_EDGE(); // should not be needed, just in case
+  ENABLE_INT_INPUT_CAPTURE();
+  if (Echo) {
+    error_buffer[errorhead] |= SIGNAL_EOP;
+    rx_packet_eop(errorhead, true);
+  }
+#ifdef EVENT_HANDLERS
+  ev_pending |= tx_rx_readbackerror ? (P1P2_EVENT_WRITE | P1P2_EVENT_COLLISION) : P1P2_EVENT_WRITE;
+#endif /* EVENT_HANDLERS */
+  DIGITAL_RESET_LED_WRITE;
+  ISR_STATS_STOP(ISR_STATS_COMPARE_W, 20);
+}
+
+void P1P2SerialBus::flushOutput(void)
+{
+  while (tx_state) BUSY_WAIT(); /* wait */
+}
+
+/****************************************/
+/**            Reception               **/
+/****************************************/
+
+#define SUPPRESS_OSCILLATION
+//Use this to ignore edges that are very near previous edges to avoid detection of oscillating edges
+//Does not seem necessary
+
+#ifdef SW_SCOPE
+void P1P2SerialBus::setScope(byte b)
+// Set scope on or off (default off)
+// calling setScope has almost-immediate effect, starting from the next packet
+{
+  sw_scope_next = b;
+}
+#endif /* SW_SCOPE */
+
+void P1P2SerialBus::setEcho(uint8_t b)
+// Set echo mode (verify and read back written data) on or off
+// off: no read-back, no verification or bus collission detection
+// on (default): each written byte will be read back and received, collission will be detected
+// calling Echo has immediate effect
+{
+  Echo = b;
+}
+
+void P1P2SerialBus::setCRC(uint8_t crc_gen, uint8_t crc_feed /* = 0 */)
+// Set CRC generator and feed (default crc_gen = 0, no CRC check) for received (and echoed) packets.
+// The ISR then updates a CRC for each received byte, and flags ERROR_CRC on the last byte of a packet if it does not
+// match the CRC of the preceding bytes. Call once after begin(), and again whenever the generator or feed changes.
+// readpacket() and writepacket() use the same table if called with the same crc_gen.
+{
+  P1P2_crc_t cfg;
+  P1P2_crc_init(cfg, crc_gen, crc_feed);
+  uint8_t intr_state = SREG;
+  cli();
+  rx_crc_cfg = cfg;
+  SREG = intr_state;
+}
+
+uint8_t P1P2SerialBus::crc(const uint8_t* buf, uint8_t n)
+{
+  return P1P2_crc_calc(rx_crc_cfg, buf, n);
+}
+
+static uint8_t crc_update(uint8_t crc, uint8_t c, uint8_t crc_gen)
+// table-driven if crc_gen matches setCRC(), bit-serial otherwise
+{
+  if (crc_gen == rx_crc_cfg.gen) return P1P2_crc_update(rx_crc_cfg, crc, c);
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (((crc ^ c) & 0x01) ? ((crc >> 1) ^ crc_gen) : (crc >> 1));
+    c >>= 1;
+  }
+  return crc;
+}
+
+static uint16_t prev_edge_capture;  // previous capture of edge
+
+ISR(CAPTURE_INTERRUPT)
+{
+  ISR_STATS_START;
+  IDLE_WAKE;
+// called upon each edge during writes if in scopemode
+// and
+// called upon each falling edge detected during reads
+// state = 0: at falling edge of start pulse, after pause
+// state = 1: at falling edge of start pulse shortly after previous byte (so: store previously received byte)
+// state = 2..10: nr of data/parity bit of this falling edge
+  uint8_t state;
+  uint16_t capture;
+
+  capture = GET_INPUT_CAPTURE();
+  state = rx_state;
+#ifdef SW_SCOPE
+  // bit grid: start bit expected one bit after stop bit target, other falling edges one semibit before rx_target
+  uint16_t sws_expected = (state == 1) ? rx_target + Rticks_per_semibit : rx_target - Rticks_per_semibit;
+#endif /* SW_SCOPE */
+
+  if (!state) {
+    // start reading
+    DIGITAL_SET_LED_READ;
+    DIGITAL_RESET_LED_WRITE;
+    DIGITAL_RESET_LED_ERROR;
+  }
+  if (state) {
+    // detect/suppress oscillations or spurious spikes (except when expecting new start pulse, where comparison may fail due to 16-bit limitation)
+    if ((uint16_t) (capture - prev_edge_capture) < Rticks_suppression) {
+      // log spike
+      SW_SCOPE_LOG_EVENT(capture - sws_expected, SWS_EVENT_EDGE_SPIKE | state);
+#ifdef SUPPRESS_OSCILLATION
+      ISR_STATS_STOP(ISR_STATS_CAPTURE, state);
+      return;
+#endif /* SUPPRESS_OSCILLATION */
+    }
+  }
+#ifdef ADC_BITSYNC
+  // start bit or 0 bit: sample low level early in first semibit
+  if (state) {
+    adc_bit_trigger(0);
+  } else {
+    adc_bit_start();
+  }
+#endif /* ADC_BITSYNC */
+  if (state < 2) {
+    // this is first falling edge, it must be start pulse. First confirm received byte, if any (!NO_HEAD2), without SIGNAL_EOP
+    if (rx_buffer_head2 != NO_HEAD2) {
+      rx_buffer_head = rx_buffer_head2;
+      rx_buffer_head2 = NO_HEAD2;
+    }
+    startbit_delta = time_msec;
+#ifdef PACKET_TIMESTAMP
+    if (!rx_packet_cnt) rx_packet_time0 = t1_extend(capture);
+#endif /* PACKET_TIMESTAMP */
+#ifdef BUS_CYCLE_LEARNER
+    bus_epoch++;
+#endif /* BUS_CYCLE_LEARNER */
+    // time_msec = 0; // to prevent a write start to reduce bus collision risk, not needed as MS_TIMER is disabled anyway
+    DISABLE_MS_TIMER();
+#ifdef TX_CARRIER_SENSE
+    if (tx_state == 98) tx_sense_defer(); // other device started in the carrier sense window
+#endif /* TX_CARRIER_SENSE */
+    // rx_target set to middle of first data bit
+    rx_target = capture + rx_ticks_per_bit_and_semibit;
+#ifdef RX_CLOCK_RECOVERY
+    rx_start_capture = capture;
+    rx_edge_state = 1;
+#endif /* RX_CLOCK_RECOVERY */
+    rx_state = 2;
+    rx_paritycheck = 0;
+    SET_COMPARE_R(rx_target);
+    ENABLE_INT_COMPARE_R(); // only needed in state = 0 but doesn't hurt to do it in state = 1
+#ifdef SW_SCOPE
+    // if P1P2Monitor is ready reading data (sws_block = 0), start new log operation
+    if ((state == 0) && !sws_block) {
+      sw_scope = sw_scope_next;
+      if (sw_scope) SW_SCOPE_START_LOG(SWS_MODE_READ);
+    }
+#endif /* SW_SCOPE */
+  } else {
+    // state=2..9: we received a data bit; perform a shift
+    // state=10: parity bit
+    // as (data or parity) bit is 0, no need to modify rx_paritycheck
+    if (state < 10) {
+      rx_byte >>= 1;
+      rx_target += rx_ticks_per_bit; // set target time to (one semibit after) next possible falling edge
+      SET_COMPARE_R(rx_target);
+      CLEAR_COMPARE_R_FLAG();
+      rx_state = state + 1;
+#ifdef RX_CLOCK_RECOVERY
+      rx_edge_state = state;
+#endif /* RX_CLOCK_RECOVERY */
+    } else if (state == 10) {
+      rx_target += rx_ticks_per_bit; // set target time to (one semibit after) next possible falling edge = in stopbit
+      SET_COMPARE_R(rx_target - Rticks_per_semibit); // at start of stop bit, before start bit of a fast sender
+                                                     // this is the only COMPARE_R_INTERRUPT which is never cancelled
+      CLEAR_COMPARE_R_FLAG();
+      rx_state = 11;
+#ifdef RX_CLOCK_RECOVERY
+      rx_edge_state = state;
+#endif /* RX_CLOCK_RECOVERY */
+    } else {
+      // state = 11: we received falling edge during stop bit before COMPARE_R_INTERRUPT ran. Should not happen.
+    }
+  }
+  // log falling edge during reading
+  SW_SCOPE_LOG_EVENT(state ? capture - sws_expected : 0, SWS_EVENT_EDGE_FALLING_R | state);
+  prev_edge_capture = capture;
+  ISR_STATS_STOP(ISR_STATS_CAPTURE, state);
+}
+
+#ifdef RX_CLOCK_RECOVERY
+static inline void rx_clock_set(int16_t skew)
+{
+  rx_ticks_per_bit = Rticks_per_bit + ((skew + 8) >> 4);
+  rx_ticks_per_bit_and_semibit = rx_ticks_per_bit + (rx_ticks_per_bit >> 1);
+}
+
+static inline void rx_clock_update(void)
+// called from COMPARE_R_INTERRUPT in stop bit, after the byte has been stored:
+// updates bit period estimate of sender from the time between start bit and last falling edge, and sets bit period for next byte
+{
+  if (rx_packet_cnt <= 1) rx_skew_source = rx_byte >> 6;
+  uint8_t n = rx_edge_state - 1; // bits between start bit and last falling edge
+  if ((n >= RX_SKEW_MIN_BITS) && !rx_paritycheck) {
+    // deviation of last falling edge from where it was expected, relative to the bit period used for this byte
+    int16_t err = (int16_t) (prev_edge_capture - rx_start_capture - n * rx_ticks_per_bit);
+    int16_t sample = ((int16_t) (rx_ticks_per_bit - Rticks_per_bit)) * 16 + (int16_t) (((int32_t) err * rx_skew_recip[n]) >> 8);
+    // limit to 1/16 bit per bit
+    if (sample > (int16_t) Rticks_per_bit) sample = Rticks_per_bit;
+    if (sample < -(int16_t) Rticks_per_bit) sample = -Rticks_per_bit;
+    rx_skew[rx_skew_source] += (sample - rx_skew[rx_skew_source]) >> RX_SKEW_FILTER_SHIFT;
+    rx_skew[RX_SKEW_SOURCES] += (sample - rx_skew[RX_SKEW_SOURCES]) >> RX_SKEW_FIRST_SHIFT;
+  }
+  rx_clock_set(rx_skew[rx_skew_source]);
+}
+#endif /* RX_CLOCK_RECOVERY */
+
+ISR(COMPARE_R_INTERRUPT)
+// The COMPARE_R_INTERRUPT routine is called during every data bit (state=2..9) or parity bit (state=10), unless there is a falling edge for that bit,
+// and also during stop bit (state=11)
+// It is also called during the latest potential location of the next start bit (with state==1, taking ALLOW_PAUSE_BETWEEN_BYTES into account),
+// but only if no start bit has been detected, otherwise this interrupt will be cancelled.
+// this allows detection of an end of communication block.
+{
+  ISR_STATS_START;
+  IDLE_WAKE;
+
+  // COMPARE_R_INTERRUPT
+  uint8_t head;
+  uint8_t state;
+  state = rx_state;
+  if (state == 1) {
+    // no new start bit detected within expected time frame; thus pause in received data detected; register SIGNAL_EOP and quit rx mode
+    DISABLE_INT_COMPARE_R();
+    rx_state = 0;
+    if (rx_buffer_head2 != NO_HEAD2) {
+      rx_buffer_head = rx_buffer_head2;
+      error_buffer[rx_buffer_head] |= SIGNAL_EOP;
+      rx_buffer_head2 = NO_HEAD2;
+      rx_packet_eop(rx_buffer_head, false);
+    }
+#ifdef RX_CLOCK_RECOVERY
+    rx_clock_set(rx_skew[RX_SKEW_SOURCES]); // for first byte of next packet
+#endif /* RX_CLOCK_RECOVERY */
+#ifdef ADC_BITSYNC
+    adc_bit_eop();
+#endif /* ADC_BITSYNC */
+    DIGITAL_RESET_LED_READ;
+    ISR_STATS_STOP(ISR_STATS_COMPARE_R, state);
+    return;
+  } else if (state == 11) {
+    // state = 11: we are in stop bit; where W should not be hampered by our lengthy activity of finishing up
+    // we do most of the work here but have to leave some for the next start pulse routine (via rx_buffer_head2)
+    SET_COMPARE_R(rx_target + Rticks_per_bit * (1 + ALLOW_PAUSE_BETWEEN_BYTES));
+    rx_state = 1;
+    head = RxRing::next(rx_buffer_head);
+    if (head != rx_buffer_tail) {
+      rx_buffer[head] = rx_byte;
+      delta_buffer[head] = startbit_delta; // time from previous byte
+      error_buffer[head] = 0;
+#ifdef GENERATE_FAKE_ERRORS
+      if (fakeError(FAKE_ERROR_PE)) {
+        error_buffer[head] |= (ERROR_PE << 8);
+        SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_PE_FAKE);
+      }
+#endif /* GENERATE_FAKE_ERRORS */
+      if (rx_paritycheck) {
+        error_buffer[head] |= ERROR_PE;
+        SW_SCOPE_LOG_ERROR(SWS_EVENT_ERR_PE);
+      }
+      DIGITAL_WRITE_LED_ERROR(rx_paritycheck);
+      rx_buffer_head2 = head;
+      rx_packet_add(head);
+    } else {
+      // signal buffer overrun for *previous* byte
+      error_buffer[rx_buffer_head] |= ERROR_OR;
+      rx_packet_err |= ERROR_OR;
+      DIGITAL_SET_LED_ERROR;
+      rx_buffer_head2 = rx_buffer_head; // so SIGNAL_EOP can be added
+    }
+    PRESET_ENABLE_MS_TIMER();
+#ifdef RX_CLOCK_RECOVERY
+    rx_clock_update();
+#endif /* RX_CLOCK_RECOVERY */
+#ifdef ADC_BITSYNC
+    adc_bit_source(rx_byte);
+#endif /* ADC_BITSYNC */
+  } else if (state == 10) {
+    // state = 10: we received a 1 parity bit
+#ifdef ADC_BITSYNC
+    adc_bit_trigger(1);
+#endif /* ADC_BITSYNC */
+    rx_paritycheck ^= 0x80;
+    rx_state = 11;
+    rx_target += rx_ticks_per_bit;
+    SET_COMPARE_R(rx_target - Rticks_per_semibit); // at start of stop bit, before start bit of a fast sender
+    DIGITAL_WRITE_LED_ERROR(rx_paritycheck);
+  } else /* if (state < 10) */ {
+    // state = 2..9: we received a 1 data bit.
+#ifdef ADC_BITSYNC
+    adc_bit_trigger(1);
+#endif /* ADC_BITSYNC */
+    rx_byte = (rx_byte >> 1) | 0x80;
+    rx_paritycheck ^= 0x80;
+    rx_state = state + 1;
+    rx_target += rx_ticks_per_bit;
+    SET_COMPARE_R(rx_target);
+  }
+  SW_SCOPE_LOG_EVENT(0, SWS_EVENT_SIGNAL_HIGH_R | state);
+  ISR_STATS_STOP(ISR_STATS_COMPARE_R, state);
+}
+
+uint16_t P1P2SerialBus::read_delta(void)
+// should only be called if available()==1; otherwise, returns 0
+{
+  uint8_t head, tail;
+  uint16_t out;
+
+  head = rx_buffer_head;
+  tail = rx_buffer_tail;
+  if (head == tail) return 0;
+  tail = RxRing::next(tail);
+  out = delta_buffer[tail];
+  return out;
+}
+
+errorbuf_t P1P2SerialBus::read_error(void)
+// should only be called if available()==1; otherwise, returns 0
+{
+  uint8_t head, tail;
+
+  head = rx_buffer_head;
+  tail = rx_buffer_tail;
+  if (head == tail) return 0;
+  tail = RxRing::next(tail);
+  return error_buffer[tail];
+}
+
+uint8_t  P1P2SerialBus::read(void)
+// should only be called if available()==1; otherwise, returns 0
+{
+  uint8_t head, tail, out;
+
+  head = rx_buffer_head;
+  tail = rx_buffer_tail;
+  if (head == tail) return 0;
+  tail = RxRing::next(tail);
+  out = rx_buffer[tail];
+  rx_buffer_tail = tail;
+  // byte-level reading: release packet descriptor once its last byte has been read
+  if (rx_packet_head != rx_packet_tail) {
+    uint8_t ptail = PacketRing::next(rx_packet_tail);
+    uint8_t last = RxRing::add(rx_packet_start[ptail], rx_packet_len[ptail] - 1);
+    if (tail == last) rx_packet_tail = ptail;
+  }
+  return out;
+}
+
+bool P1P2SerialBus::available(void)
+{
+  uint8_t head, tail;
+
+  head = rx_buffer_head;
+  tail = rx_buffer_tail;
+  return RxRing::count(head, tail);
+}
+
+bool P1P2SerialBus::packetavailable(void)
+{
+  return (rx_packet_head != rx_packet_tail);
+}
+
+void P1P2SerialBus::flushInput(void)
+{
+  rx_buffer_head = rx_buffer_tail;
+  rx_packet_tail = rx_packet_head;
+}
+
+/****************************************/
+/**         Bus cycle learner          **/
+/****************************************/
+
+#ifdef BUS_CYCLE_LEARNER
+// For each packet type (its first BUS_CYCLE_HEADER bytes), the number of pauses observed after it and the shortest BUS_CYCLE_LOW pauses
+// are kept. This runs when packets are released (releasepacket(), readpacket()), not in the ISRs; the ISRs only count start bits (bus_epoch),
+// so a packet armed for the pause after a packet is not written if anything else has been on the bus since.
+
+static uint8_t bus_gap_find(const uint8_t* header, bool add)
+// returns entry for header or BUS_GAP_NONE; if add, a new entry replaces an unused entry or else the entry with fewest pauses observed
+{
+  uint8_t replace = 0;
+  for (uint8_t e = 0; e < BUS_CYCLE_SIZE; e++) {
+    if (bus_gap[e].n && !memcmp(bus_gap[e].header, header, BUS_CYCLE_HEADER)) return e;
+    if (bus_gap[e].n < bus_gap[replace].n) replace = e;
+  }
+  if (!add) return BUS_GAP_NONE;
+  memcpy(bus_gap[replace].header, header, BUS_CYCLE_HEADER);
+  memset(bus_gap[replace].low, 0xFF, BUS_CYCLE_LOW);
+  bus_gap[replace].n = 0;
+  return replace;
+}
+
+static void bus_gap_add(uint8_t e, uint16_t gap)
+{
+  uint8_t v = (gap > 0xFF) ? 0xFF : gap;
+  if (bus_gap[e].n < 0xFFFF) bus_gap[e].n++;
+  for (uint8_t i = 0; i < BUS_CYCLE_LOW; i++) {
+    // keep low[] ascending
+    uint8_t w = bus_gap[e].low[i];
+    if (v < w) {
+      bus_gap[e].low[i] = v;
+      v = w;
+    }
+  }
+}
+
+static uint8_t bus_gap_shorter(uint8_t e, uint16_t t)
+// returns # remembered pauses after entry e shorter than t ms (if BUS_CYCLE_LOW, there may be more)
+{
+  uint8_t c = 0;
+  while ((c < BUS_CYCLE_LOW) && (bus_gap[e].low[c] < t)) c++;
+  return c;
+}
+
+static bool bus_gap_safe(uint8_t e, uint16_t t, uint16_t maxrisk)
+// true if the pause after a packet of entry e is known to be at least t ms, with a risk of at most maxrisk per mille of being shorter
+{
+  if ((e == BUS_GAP_NONE) || (bus_gap[e].n < BUS_CYCLE_MIN_N)) return false;
+  uint8_t c = bus_gap_shorter(e, t);
+  return (c < BUS_CYCLE_LOW) && ((uint32_t) c * 1000 <= (uint32_t) maxrisk * bus_gap[e].n);
+}
+
+static void bus_gap_arm(uint8_t i)
+// arms schedulegap() packet i for the pause after the packet released last, if nothing else has been on the bus since,
+// if its header matches, and if the pause is expected to be long enough
+{
+  if (!bus_gap_last_valid) return;
+  if (tx_packet_after_len[i] && memcmp(tx_packet_after[i], bus_gap_last, tx_packet_after_len[i])) return;
+  if (!bus_gap_safe(bus_gap_last_entry, tx_packet_delay[i] + tx_packet_busy[i], tx_packet_maxrisk[i])) return;
+  uint8_t intr_state = SREG;
+  cli();
+  tx_packet_epoch[i] = bus_gap_last_epoch;
+  tx_packet_flags[i] |= TX_PACKET_ARMED;
+  SREG = intr_state;
+}
+
+static void bus_gap_packet(uint8_t p)
+// called for packet descriptor p before it is released: learns the pause before it as pause after the previous packet
+{
+  uint8_t len = rx_packet_len[p];
+  uint8_t e = BUS_GAP_NONE;
+  if ((bus_gap_prev != BUS_GAP_NONE) && !rx_packet_wrote[p]) bus_gap_add(bus_gap_prev, rx_packet_delta[p]);
+  for (uint8_t i = 0; i < BUS_CYCLE_HEADER; i++) bus_gap_last[i] = (i < len) ? rx_buffer[RxRing::add(rx_packet_start[p], i)] : 0;
+  // ERROR_OR: next packet(s) dropped, so the pause after this packet is not known
+  if ((len >= BUS_CYCLE_HEADER) && !(rx_packet_errors[p] & ERROR_REAL_MASK)) e = bus_gap_find(bus_gap_last, true);
+  bus_gap_prev = e;
+  bus_gap_last_entry = e;
+}
+
+static void bus_gap_released(void)
+// called after a packet has been released: arms the schedulegap() packets waiting for a suitable pause
+{
+  uint8_t intr_state = SREG;
+  cli();
+  bus_gap_last_valid = (rx_packet_head == rx_packet_tail) && !rx_state && ((tx_state == 0) || (tx_state == 99));
+  bus_gap_last_epoch = bus_epoch;
+  uint8_t i = tx_packet_tail;
+  uint8_t head = tx_packet_head;
+  SREG = intr_state;
+  if (!bus_gap_last_valid) return;
+  while (i != head) {
+    i = TxPacketRing::next(i);
+    if ((tx_packet_flags[i] & (TX_PACKET_GAP | TX_PACKET_DONE)) == TX_PACKET_GAP) bus_gap_arm(i);
+  }
+}
+#endif /* BUS_CYCLE_LEARNER */
+
+bool P1P2SerialBus::acquirepacket(packetview_t &view)
+{
+// Returns false if no complete packet is available.
+// Otherwise, returns true and fills view with pointers into the read buffer; the packet remains in the buffer
+// (and the ISR will not overwrite it) until releasepacket() is called. The read buffer fills up in the meantime,
+// so release the packet as soon as possible. Calling acquirepacket() again before releasepacket() returns the same packet.
+// In a P1P2_EVENT_PACKET handler, returns the packet the handler is called for.
+  uint8_t ptail, start, len;
+
+#ifdef EVENT_HANDLERS
+  if (ev_packet != EV_PACKET_NONE) {
+    ptail = ev_packet;
+  } else
+#endif /* EVENT_HANDLERS */
+  {
+    if (rx_packet_head == rx_packet_tail) return false;
+    ptail = PacketRing::next(rx_packet_tail);
+  }
+  start = rx_packet_start[ptail];
+  len = rx_packet_len[ptail];
+  view.len = len;
+  view.delta = rx_packet_delta[ptail];
+#ifdef PACKET_TIMESTAMP
+  view.time = rx_packet_time[ptail];
+#else /* PACKET_TIMESTAMP */
+  view.time = 0;
+#endif /* PACKET_TIMESTAMP */
+  view.errors = rx_packet_errors[ptail];
+#ifdef TX_REPLY
+  view.reply = rx_packet_reply[ptail];
+#else /* TX_REPLY */
+  view.reply = 0;
+#endif /* TX_REPLY */
+  view.data1 = &rx_buffer[start];
+  view.error1 = &error_buffer[start];
+  view.data2 = rx_buffer;
+  view.error2 = error_buffer;
+  if (start + len > P1P2SerialCfg::rx_size) {
+    view.len1 = P1P2SerialCfg::rx_size - start;
+    view.len2 = len - view.len1;
+  } else {
+    view.len1 = len;
+    view.len2 = 0;
+  }
+  return true;
+}
+
+void P1P2SerialBus::releasepacket(void)
+{
+  uint8_t ptail, tail;
+
+#ifdef EVENT_HANDLERS
+  // in a packet handler, dispatch() releases the packet
+  if (ev_packet != EV_PACKET_NONE) return;
+#endif /* EVENT_HANDLERS */
+  if (rx_packet_head == rx_packet_tail) return;
+  ptail = PacketRing::next(rx_packet_tail);
+#ifdef BUS_CYCLE_LEARNER
+  bus_gap_packet(ptail);
+#endif /* BUS_CYCLE_LEARNER */
+  tail = RxRing::add(rx_packet_start[ptail], rx_packet_len[ptail] - 1);
+  rx_buffer_tail = tail;
+  rx_packet_tail = ptail;
+#ifdef BUS_CYCLE_LEARNER
+  bus_gap_released();
+#endif /* BUS_CYCLE_LEARNER */
+}
+
+uint16_t P1P2SerialBus::readpacket(uint8_t* readbuf, uint16_t &delta, errorbuf_t* errorbuf, uint8_t maxlen, uint8_t crc_gen, uint8_t crc_feed)
+{
+// Reads one packet (in blocking mode)
+// To avoid blocking, only call this function if packetavailable()
+// stores maximum of maxlen bytes of read data into readbuf
+// returns total #bytes received (until v0.9.3: #bytes stored, as of v0.9.4: #bytes received, even if not stored),
+//    if (packet size/return value > maxlen) some received bytes cannot be stored, and error codes are condensed into errorbuf[maxlen - 1]
+// reading continues in case of error
+// stores maximum of maxlen bytes of error codes into errorbuf (unless errorbuf = NULL),
+// returns timing information (pause on bus before this package) in parameter delta
+// If crc_gen is not zero, verifies last byte as CRC byte; CRC byte is also stored and is counted in return value if space is available
+// As of v0.9.34, the packet is located via its descriptor, so packet-level reading (readpacket) and byte-level reading (read) should not be mixed
+//   within one packet; packeterrors() returns the OR of the error flags of this packet (including ERROR_CRC)
+// readpacket() copies the packet; acquirepacket() provides access to the packet without copying
+// If crc_gen and crc_feed are equal to those set by setCRC(), the CRC has already been checked by the ISR
+  uint8_t bytecnt;
+  uint8_t crc = crc_feed;
+  packetview_t view;
+  uint8_t crc_done = (crc_gen == rx_crc_cfg.gen) && (crc_feed == rx_crc_cfg.feed);
+  errorbuf_t mask = crc_done ? ERROR_FLAGS : (ERROR_FLAGS & ~ERROR_CRC);
+
+  while (!acquirepacket(view)) BUSY_WAIT();
+  delta = view.delta;
+  view.errors &= mask;
+  if (crc_done) crc_gen = 0;
+
+  for (bytecnt = 0; bytecnt < view.len; bytecnt++) {
+    uint8_t EOP = (bytecnt == view.len - 1);
+    if (errorbuf) {
+      if (bytecnt < maxlen) {
+        errorbuf[bytecnt] = view.error(bytecnt) & mask;
+      } else {
+        errorbuf[maxlen - 1] |= view.error(bytecnt) & mask;
+      }
+    }
+    uint8_t c = view.at(bytecnt);
+    if ((EOP == 0) || (crc_gen == 0)) {
+      if (bytecnt < maxlen) {
+        readbuf[bytecnt] = c;
+      }
+      if (crc_gen != 0) crc = crc_update(crc, c, crc_gen);
+    } else {
+      // EOP, crc in use, check crc
+      if (bytecnt < maxlen) {
+        readbuf[bytecnt] = c;
+        if (c != crc) {
+          if (errorbuf) errorbuf[bytecnt] |= ERROR_CRC;
+          view.errors |= ERROR_CRC;
+          DIGITAL_SET_LED_ERROR;
+        }
+      }
+    }
+  }
+  rx_packet_readerrors = view.errors;
+#ifdef PACKET_TIMESTAMP
+  rx_packet_readtime = view.time;
+#endif /* PACKET_TIMESTAMP */
+#ifdef TX_REPLY
+  rx_packet_readreply = view.reply;
+#endif /* TX_REPLY */
+  releasepacket();
+  return bytecnt;
+}
+
+errorbuf_t P1P2SerialBus::packeterrors(void)
+{
+  return rx_packet_readerrors;
+}
+
+uint8_t P1P2SerialBus::packetreply(void)
+{
+#ifdef TX_REPLY
+  return rx_packet_readreply;
+#else /* TX_REPLY */
+  return 0;
+#endif /* TX_REPLY */
+}
+
+uint32_t P1P2SerialBus::packettime(void)
+{
+#ifdef PACKET_TIMESTAMP
+  return rx_packet_readtime;
+#else /* PACKET_TIMESTAMP */
+  return 0;
+#endif /* PACKET_TIMESTAMP */
+}
+
+int32_t P1P2SerialBus::clockskew(uint8_t header)
+{
+#ifdef RX_CLOCK_RECOVERY
+  uint8_t intr_state = SREG;
+  cli();
+  int16_t skew = rx_skew[header >> 6];
+  SREG = intr_state;
+  return ((int32_t) skew * 62500) / Rticks_per_bit; // skew / 16 / Rticks_per_bit * 1000000
+#else /* RX_CLOCK_RECOVERY */
+  return 0;
+#endif /* RX_CLOCK_RECOVERY */
+}
+
+bool P1P2SerialBus::isrstats(uint8_t isr, isr_stats_t &stats, bool reset)
+{
+#ifdef ISR_STATS
+  if (isr >= ISR_STATS_CNT) return false;
+  uint8_t intr_state = SREG;
+  cli();
+  stats = isr_stats[isr];
+  if (reset) memset(&isr_stats[isr], 0, sizeof(isr_stats_t));
+  SREG = intr_state;
+  return true;
+#else /* ISR_STATS */
+  return false;
+#endif /* ISR_STATS */
+}
+
+void P1P2SerialBus::writepacket(uint8_t* writebuf, uint8_t l, uint16_t t, uint8_t crc_gen, uint8_t crc_feed)
+{
+// Writes one packet of l bytes, t ms after last bus action;
+// If crc_gen is not zero, adds CRC byte to packet
+// Note that t=0 or t=1 increases risk of bus collisions, don't use it if not needed (t<2 will be changed to t=2 in new library).
+// Waits until the packet fits in the write buffer; packets that can never fit are written byte by byte.
+  if ((uint16_t) l + (crc_gen ? 1 : 0) < P1P2SerialCfg::tx_size) {
+    while (!schedulepacket(writebuf, l, t, tx_setdelaytimeout, 0, 0, crc_gen, crc_feed)) BUSY_WAIT();
+    return;
+  }
+  setDelay(t);
+  uint8_t crc = crc_feed;
+  for (uint8_t i = 0; i < l; i++) {
+    uint8_t c = writebuf[i];
+    write(c);
+    if (crc_gen != 0) crc = crc_update(crc, c, crc_gen);
+  }
+  if (crc_gen) write(crc);
+}
+
+static uint8_t tx_packet_schedule(const uint8_t* writebuf, uint8_t l, uint16_t t, uint16_t timeout, uint8_t priority, uint16_t deadline, uint8_t crc_gen, uint8_t crc_feed, uint8_t flags)
+// queues packet without waiting, see schedulepacket(); returns its index in the write packet queue, or TX_PACKET_NONE if it does not fit
+{
+  uint8_t n = l + (crc_gen ? 1 : 0);
+  if (!n || ((uint16_t) l + (crc_gen ? 1 : 0) >= P1P2SerialCfg::tx_size)) return TX_PACKET_NONE; // empty, or would never fit
+  if (t < 2) t = 2;
+  // the ISR only frees space, so frames can be prepared beyond tx_buffer_head with interrupts enabled
+  // (except for replies (TX_REPLY), which the ms timer ISR queues only if tx_build_busy is 0)
+#ifdef TX_REPLY
+  tx_build_busy++;
+#endif /* TX_REPLY */
+  uint8_t head = tx_buffer_head;
+  if (TxRing::count(head, tx_buffer_tail) + n >= P1P2SerialCfg::tx_size) {
+#ifdef TX_REPLY
+    tx_build_busy--;
+#endif /* TX_REPLY */
+    return TX_PACKET_NONE;
+  }
+  uint8_t start = TxRing::next(head);
+  uint8_t crc = crc_feed;
+  for (uint8_t i = 0; i < l; i++) {
+    uint8_t c = writebuf[i];
+    head = TxRing::next(head);
+    tx_buffer[head] = tx_frame_for(c);
+    if (crc_gen) crc = crc_update(crc, c, crc_gen);
+  }
+  if (crc_gen) {
+    head = TxRing::next(head);
+    tx_buffer[head] = tx_frame_for(crc);
+  }
+  uint8_t intr_state = SREG;
+  cli();
+#ifdef TX_REPLY
+  tx_build_busy--;
+#endif /* TX_REPLY */
+  uint8_t p = TxPacketRing::next(tx_packet_head);
+  if (p == tx_packet_tail) {
+    SREG = intr_state;
+    return TX_PACKET_NONE;
+  }
+  if (deadline) {
+    flags |= TX_PACKET_DEADLINE;
+    tx_packet_deadline[p] = t1_now() + (uint32_t) deadline * (F_CPU / 1000);
+  }
+#ifdef TX_RETRY
+  if (tx_retry_max) {
+    flags |= TX_PACKET_RETRY;
+    tx_packet_first[p] = start;
+    tx_packet_total[p] = n;
+    tx_packet_delay0[p] = t;
+    tx_packet_retries[p] = tx_retry_max;
+    tx_packet_attempts[p] = 0;
+  }
+#endif /* TX_RETRY */
+  tx_buffer_head = head;
+  tx_packet_add(start, n, t, timeout, priority, flags);
+  SREG = intr_state;
+  return p;
+}
+
+bool P1P2SerialBus::schedulepacket(const uint8_t* writebuf, uint8_t l, uint16_t t, uint16_t timeout, uint8_t priority, uint16_t deadline, uint8_t crc_gen, uint8_t crc_feed)
+// Queues one packet of l bytes (plus CRC byte if crc_gen is not zero) without waiting, returns false if it does not fit in the write buffer
+//   or if the write packet queue is full.
+// The packet is written after exactly t ms silence on the bus, or, if that moment has passed, after a silence of at least timeout ms (see setDelay()).
+// If more than one queued packet may be written, the one with highest priority is written first (the first queued if equal priority).
+// If deadline is not zero, the packet is dropped if writing has not started within deadline ms (at most 65535ms).
+// Packets written out of queue order free their write buffer space only when all packets queued before them have been written or dropped.
+{
+  return (tx_packet_schedule(writebuf, l, t, timeout, priority, deadline, crc_gen, crc_feed, 0) != TX_PACKET_NONE);
+}
+
+uint16_t P1P2SerialBus::writedeferred(bool reset)
+// returns the number of writes deferred because another device started talking in the bit time before their start bit,
+//   since begin() or the last reset
+{
+#ifdef TX_CARRIER_SENSE
+  uint8_t intr_state = SREG;
+  cli();
+  uint16_t n = tx_sense_deferred;
+  if (reset) tx_sense_deferred = 0;
+  SREG = intr_state;
+  return n;
+#else /* TX_CARRIER_SENSE */
+  return 0;
+#endif /* TX_CARRIER_SENSE */
+}
+
+bool P1P2SerialBus::setReply(uint8_t slot, const tx_reply_t &reply)
+// Preloads reply slot (0..TX_REPLY_SLOTS-1) with reply (see tx_reply_t), replacing its previous contents; reply.count = 0 clears the slot.
+// At the end of each request read without errors, the first slot matching it (if any) builds the reply (in the ISR, as the bus is idle),
+//   and the next ms timer ISR queues it as schedulepacket() would, with a CRC byte as set by setCRC(); so the reply is written reply.delay ms
+//   after the request, even if loop() is busy. packetreply() tells loop() that the request has been answered.
+// Only one reply waits to be queued at a time; a request ending before the previous reply has been queued (within 1ms) is not answered.
+{
+#ifdef TX_REPLY
+  if (slot >= TX_REPLY_SLOTS) return false;
+  uint8_t intr_state = SREG;
+  cli();
+  tx_reply[slot] = reply;
+  SREG = intr_state;
+  return true;
+#else /* TX_REPLY */
+  return false;
+#endif /* TX_REPLY */
+}
+
+uint8_t P1P2SerialBus::replycount(uint8_t slot)
+// returns the number of replies slot still writes (decremented when a reply is built), P1P2_REPLY_ALWAYS if not limited, 0 if used up or unused
+{
+#ifdef TX_REPLY
+  return (slot < TX_REPLY_SLOTS) ? tx_reply[slot].count : 0;
+#else /* TX_REPLY */
+  return 0;
+#endif /* TX_REPLY */
+}
+
+uint16_t P1P2SerialBus::replyrefused(bool reset)
+// returns the number of replies built but not queued, as the write buffer or write packet queue was full, since begin() or the last reset
+{
+#ifdef TX_REPLY
+  uint8_t intr_state = SREG;
+  cli();
+  uint16_t n = tx_reply_refused;
+  if (reset) tx_reply_refused = 0;
+  SREG = intr_state;
+  return n;
+#else /* TX_REPLY */
+  return 0;
+#endif /* TX_REPLY */
+}
+
+void P1P2SerialBus::setRetry(uint8_t retries, uint16_t backoff)
+// Packets queued after this call (except packets written byte by byte by write()) are, after a collision, rewound and written again up to
+//   retries times, instead of being dropped with the other queued packets. Each retry is written after the silence the packet was queued with,
+//   plus a random 0..backoff ms, the backoff window doubling per retry (up to 2^TX_RETRY_BACKOFF_SHIFT times); a schedulegap() packet is retried
+//   in the next pause it is armed for. Such packets keep their write buffer space until done, and report a result (writeresult()).
+{
+#ifdef TX_RETRY
+  tx_retry_max = retries;
+  tx_retry_backoff = backoff;
+#endif /* TX_RETRY */
+}
+
+bool P1P2SerialBus::writeresult(tx_result_t &result)
+{
+#ifdef TX_RETRY
+  uint8_t tail = tx_result_tail;
+  if (tail == tx_result_head) return false;
+  tail = TxResultRing::next(tail);
+  result = tx_result[tail];
+  tx_result_tail = tail;
+  return true;
+#else /* TX_RETRY */
+  return false;
+#endif /* TX_RETRY */
+}
+
+bool P1P2SerialBus::schedulegap(const uint8_t* writebuf, uint8_t l, uint16_t t, uint16_t busy, uint16_t maxrisk, const uint8_t* after, uint8_t after_len,
+                             uint8_t priority, uint16_t deadline, uint8_t crc_gen, uint8_t crc_feed)
+// Queues one packet like schedulepacket(), but instead of after a fixed silence, it is written exactly t ms after the end of the first packet
+//   (starting with after[0..after_len-1], if after_len > 0) after which, as learned from the pauses after earlier packets with the same header,
+//   a pause of at least t + busy ms is expected, with a risk of at most maxrisk per mille of being shorter.
+//   busy is the bus time needed for this packet (~1.15ms per byte) and for any response to it, plus a margin.
+// Packets are considered when they are released by readpacket() or releasepacket(), including the packet released last (if nothing else was on
+//   the bus since), so a packet may be scheduled in the pause after the packet just read. Packet types need to be observed BUS_CYCLE_MIN_N times
+//   before a packet is written after them, so use a deadline to drop packets which cannot be written in time.
+{
+#ifdef BUS_CYCLE_LEARNER
+  if (after_len > BUS_CYCLE_HEADER) after_len = BUS_CYCLE_HEADER;
+  uint8_t p = tx_packet_schedule(writebuf, l, t, 0xFFFF, priority, deadline, crc_gen, crc_feed, TX_PACKET_GAP);
+  if (p == TX_PACKET_NONE) return false;
+  // not yet armed, so not used by ISR
+  if (after_len) memcpy(tx_packet_after[p], after, after_len);
+  tx_packet_after_len[p] = after_len;
+  tx_packet_busy[p] = busy;
+  tx_packet_maxrisk[p] = maxrisk;
+  bus_gap_arm(p);
+  return true;
+#else /* BUS_CYCLE_LEARNER */
+  return false;
+#endif /* BUS_CYCLE_LEARNER */
+}
+
+uint16_t P1P2SerialBus::gaprisk(const uint8_t* header, uint16_t t)
+// returns 0xFFFF if fewer than BUS_CYCLE_MIN_N pauses have been observed, or if BUS_CYCLE_LOW or more of them were shorter than t ms
+{
+#ifdef BUS_CYCLE_LEARNER
+  uint8_t e = bus_gap_find(header, false);
+  if ((e == BUS_GAP_NONE) || (bus_gap[e].n < BUS_CYCLE_MIN_N)) return 0xFFFF;
+  uint8_t c = bus_gap_shorter(e, t);
+  if (c >= BUS_CYCLE_LOW) return 0xFFFF;
+  return ((uint32_t) c * 1000 + bus_gap[e].n - 1) / bus_gap[e].n; // rounded up
+#else /* BUS_CYCLE_LEARNER */
+  return 0xFFFF;
+#endif /* BUS_CYCLE_LEARNER */
+}
+
+uint16_t P1P2SerialBus::gapsafe(const uint8_t* header, uint16_t maxrisk)
+// returns 255 if the pause is 255ms or more
+{
+#ifdef BUS_CYCLE_LEARNER
+  uint8_t e = bus_gap_find(header, false);
+  if ((e == BUS_GAP_NONE) || (bus_gap[e].n < BUS_CYCLE_MIN_N)) return 0;
+  uint32_t c = ((uint32_t) maxrisk * bus_gap[e].n) / 1000; // # shorter pauses allowed
+  if (c >= BUS_CYCLE_LOW) c = BUS_CYCLE_LOW - 1;
+  return bus_gap[e].low[c];
+#else /* BUS_CYCLE_LEARNER */
+  return 0;
+#endif /* BUS_CYCLE_LEARNER */
+}
+
+bool P1P2SerialBus::gapstats(uint8_t i, bus_gap_t &stats)
+{
+#ifdef BUS_CYCLE_LEARNER
+  if ((i >= BUS_CYCLE_SIZE) || !bus_gap[i].n) return false;
+  stats = bus_gap[i];
+  return true;
+#else /* BUS_CYCLE_LEARNER */
+  return false;
+#endif /* BUS_CYCLE_LEARNER */
+}
+
+/****************************************/
+/**            Clock                   **/
+/****************************************/
+
+// Monotonic clock since begin() of bus 0: timer1 of bus 0 extended to 64 bits by the overflow ISR (see t1_ovf),
+// so no other timer is used (TIMER0 remains available for millis()); shared by all buses.
+// The overflow ISR also keeps this clock in s, ms and cycles (clk_sec, clk_ms, clk_cyc), from which clock_usec/msec/sec() and uptime_*()
+// are derived with a few subtractions, as a 64-bit division (__udivdi3) is large and slow on an ATmega.
+
+#if P1P2_BUS == 0
+
+uint64_t P1P2SerialBus::clock_cycles(void)
+// returns CPU cycles since begin(), wraps after 2^64 cycles (36000 years at 16MHz)
+{
+  uint8_t intr_state = SREG;
+  cli();
+  uint16_t t = GET_TIMER_R_COUNT();
+  uint16_t ovf = t1_ovf;
+  uint32_t ovf_hi = t1_ovf_hi;
+  if (OVERFLOW_PENDING() && !(t & 0x8000) && !++ovf) ovf_hi++;
+  SREG = intr_state;
+  return ((uint64_t) ovf_hi << 32) | ((uint32_t) ovf << 16) | t;
+}
+
+static void clk_now(uint32_t &sec, uint16_t &ms, uint16_t &cyc)
+// returns the time since begin() as s, ms (0..999) and cycles (0..CLK_CYC_PER_MS - 1)
+{
+  uint8_t intr_state = SREG;
+  cli();
+  uint16_t t = GET_TIMER_R_COUNT();
+  sec = clk_sec;
+  ms = clk_ms;
+  uint32_t c = clk_cyc + (uint32_t) t;
+  if (OVERFLOW_PENDING() && !(t & 0x8000)) c += 65536;
+  SREG = intr_state;
+  // at most (65536 * 2 + CLK_CYC_PER_MS) / CLK_CYC_PER_MS iterations, cheaper than a 32-bit division on an ATmega
+  while (c >= CLK_CYC_PER_MS) {
+    c -= CLK_CYC_PER_MS;
+    if (++ms == 1000) {
+      ms = 0;
+      sec++;
+    }
+  }
+  cyc = c;
+}
+
+#else /* P1P2_BUS */
+
+uint64_t P1P2SerialBus::clock_cycles(void)
+{
+  return P1P2Bus0::P1P2SerialBus::clock_cycles();
+}
+
+using P1P2Bus0::clk_now;
+
+#endif /* P1P2_BUS */
+
+uint64_t P1P2SerialBus::clock_usec(void)
+{
+  uint32_t sec;
+  uint16_t ms, cyc;
+  clk_now(sec, ms, cyc);
+  return ((uint64_t) sec * 1000 + ms) * 1000 + cyc / (F_CPU / 1000000);
+}
+
+uint64_t P1P2SerialBus::clock_msec(void)
+{
+  uint32_t sec;
+  uint16_t ms, cyc;
+  clk_now(sec, ms, cyc);
+  return (uint64_t) sec * 1000 + ms;
+}
+
+uint32_t P1P2SerialBus::clock_sec(void)
+{
+  uint32_t sec;
+  uint16_t ms, cyc;
+  clk_now(sec, ms, cyc);
+  return sec;
+}
+
+int32_t P1P2SerialBus::uptime_sec(void)
+{
+// returns uptime in seconds, wraps in 68 years
+  return clock_sec() & 0x7FFFFFFF;
+}
+
+int32_t P1P2SerialBus::uptime_millisec(void)
+{
+// returns uptime in milliseconds, wraps in 24.8 days (use clock_msec() to avoid wrapping)
+  uint32_t sec;
+  uint16_t ms, cyc;
+  clk_now(sec, ms, cyc);
+  return (sec * 1000 + ms) & 0x7FFFFFFF;
+}
+
+/****************************************/
+/**            Idle sleep              **/
+/****************************************/
+
+// The CPU sleeps in IDLE mode, in which the timers, input capture, ADC and UART keep running and their interrupts wake it up.
+// The time asleep is measured with timer1 (extended to 32 bits) until the start of the library ISR that wakes up the CPU,
+// or, if another ISR (UART, millis()) woke it up, until idle() returns.
+// Sleep and its statistics are shared by all buses; idle() of bus 1 only checks bus 0 for waiting packets and events.
+
+#if P1P2_BUS == 0
+
+#ifdef IDLE_SLEEP
+static void idle_wake(void)
+// called at the start of an ISR, if idle_asleep
+{
+  idle_asleep = 0;
+  idle_woke = t1_now();
+}
+
+static inline uint8_t idle_work(void)
+// called with interrupts disabled: true if loop() has a packet to read or an event to dispatch
+{
+  if (rx_packet_head != rx_packet_tail) return 1;
+#ifdef EVENT_HANDLERS
+  for (uint8_t h = 0; h < ev_cnt; h++) {
+    if (!(ev_isr_mask & (1 << h)) && ((ev_pending & ev_events[h]) || ev_todo[h])) return 1;
+  }
+#endif /* EVENT_HANDLERS */
+  return 0;
+}
+#endif /* IDLE_SLEEP */
+
+void P1P2SerialBus::idle(void)
+// checked with interrupts disabled, so that a packet completed just before cannot wait until the interrupt after the next
+{
+#ifdef IDLE_SLEEP
+  cli();
+  if (idle_work()) {
+    sei();
+    return;
+  }
+  uint32_t t = t1_now();
+  idle_asleep = 1;
+  SLEEP_IDLE(); // enables interrupts
+  cli();
+  if (idle_asleep) {
+    idle_asleep = 0;
+    idle_woke = t1_now();
+  }
+  idle_sleep += idle_woke - t;
+  if (idle_count < 0xFFFF) idle_count++;
+  sei();
+#endif /* IDLE_SLEEP */
+}
+
+bool P1P2SerialBus::idlestats(idle_stats_t &stats, bool reset)
+{
+#ifdef IDLE_SLEEP
+  uint8_t intr_state = SREG;
+  cli();
+  stats.cycles = t1_now() - idle_since;
+  stats.sleep = idle_sleep;
+  stats.count = idle_count;
+  if (reset) idle_reset();
+  SREG = intr_state;
+  return true;
+#else /* IDLE_SLEEP */
+  return false;
+#endif /* IDLE_SLEEP */
+}
+
+#else /* P1P2_BUS */
+
+void P1P2SerialBus::idle(void)
+{
+  P1P2Bus0::P1P2SerialBus::idle();
+}
+
+bool P1P2SerialBus::idlestats(idle_stats_t &stats, bool reset)
+{
+  return P1P2Bus0::P1P2SerialBus::idlestats(stats, reset);
+}
+
+#endif /* P1P2_BUS */
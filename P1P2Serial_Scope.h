@@ -0,0 +1,209 @@
+/* P1P2Serial_Scope.h: compressed software-scope (SW_SCOPE) format, and decoder
+ *
+ * Copyright (c) 2019-2022 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 initial version
+ *
+ */
+
+// file included by P1P2Serial (P1P2Serial.h) and by the host tools, so keep header files in sync
+
+#ifndef P1P2Serial_Scope_h
+#define P1P2Serial_Scope_h
+
+#include <stdint.h>
+
+// scope events as logged by the library, and as returned by the decoder
+#define SWS_EVENT_ERR_SB            0xFF
+#define SWS_EVENT_ERR_BC            0xFE
+#define SWS_EVENT_ERR_PE            0xFD
+#define SWS_EVENT_ERR_BE            0xFC
+#define SWS_EVENT_ERR_SB_FAKE       0xFB
+#define SWS_EVENT_ERR_BC_FAKE       0xFA
+#define SWS_EVENT_ERR_PE_FAKE       0xF9
+#define SWS_EVENT_ERR_BE_FAKE       0xF8
+#define SWS_EVENT_ERR_LOW           0xF7
+#define SWS_EVENT_MASK              0xE0
+
+#define SWS_EVENT_SIGNAL_LOW     0x00
+#define SWS_EVENT_SIGNAL_HIGH_R  0x80
+#define SWS_EVENT_EDGE_FALLING_W 0x40
+#define SWS_EVENT_EDGE_FALLING_R 0xC0
+#define SWS_EVENT_EDGE_RISING    0x60
+#define SWS_EVENT_EDGE_SPIKE     0xA0
+
+// Each scope event of the library (SWS_EVENT_* above: an edge or signal level with the rx/tx state it belongs to, or an error)
+// is stored as a variable-length code in a bit stream (LSB first in each byte). Edges are not stored as timer values but as the change
+// of their deviation from the bit grid (from the sample target when reading, from the output compare when writing), in units of
+// 2^SWS_SHIFT timer ticks (1us), since the previous falling edge (falling edges and spikes) or the previous rising edge (rising edges).
+// The falling edge of a start bit read is stored relative to the previous start bit instead, as the bit grid restarts at each start bit.
+// The state of an event is not stored if it is the state following that of the previous event. The short codes describe one bit:
+// a single event when reading, the events of both semibits when writing.
+//
+//   0             bit 1: signal high at sample time, no falling edge (SWS_EVENT_SIGNAL_HIGH_R; when writing: in both semibits)
+//   10            bit 0: falling edge, d=0 (SWS_EVENT_EDGE_FALLING_R; when writing: SWS_EVENT_EDGE_FALLING_W, and SWS_EVENT_EDGE_RISING, d=0)
+//   110s          bit 0: falling edge, d=+-1 (when writing: followed by a rising edge, d=0)
+//   111 XXXX      other event X:
+//                 SWS_X_STATE    followed by 5-bit state of next event
+//                 SWS_X_SPIKE D  spike (deviation not remembered for next edge)
+//                 SWS_X_ERR + e  error event SWS_EVENT_ERR_* (0xFF - e)
+//                 SWS_X_READ     next events are read events
+//                 SWS_X_WRITE    next events are write events
+//                 SWS_X_FALLING D, SWS_X_RISING D, SWS_X_HIGH: single edge or signal level not covered by the codes above
+//
+//   D (deviation change d)  0: d=0, 10s: d=+-1, 110sm: d=+-(2+m), 1110smm: d=+-(4+mm), 1111 + 16-bit d
+//
+// A byte read or written takes typically 2-3 bytes, instead of 3 bytes per event (11-20 events per byte) before.
+
+#define SWS_CODE_ONE        0x00 // 1 bit
+#define SWS_CODE_ZERO       0x01 // 2 bits
+#define SWS_CODE_ZERO_D1    0x03 // 3 bits, followed by sign
+#define SWS_CODE_X          0x07 // 3 bits
+#define SWS_X_STATE         0
+#define SWS_X_SPIKE         1
+#define SWS_X_ERR           2    // 2..10 for SWS_EVENT_ERR_SB (0xFF) .. SWS_EVENT_ERR_LOW (0xF7)
+#define SWS_X_READ          11
+#define SWS_X_WRITE         12
+#define SWS_X_FALLING       13
+#define SWS_X_RISING        14
+#define SWS_X_HIGH          15
+
+#define SWS_MODE_NONE       0
+#define SWS_MODE_READ       1
+#define SWS_MODE_WRITE      2
+
+typedef struct {
+  const volatile uint8_t* buf;
+  uint16_t bits;       // # bits in buf
+  uint16_t pos;        // # bits decoded
+  uint8_t mode;        // SWS_MODE_*
+  uint8_t state;       // state of next event
+  uint8_t pending;     // second semibit event of a bit code when writing (SWS_EVENT_*, without state), 0 if none
+  int16_t dev;         // deviation of last falling edge from bit grid (1us units)
+  int16_t dev_r;       // deviation of last rising edge (when reading: of last start bit) from bit grid (1us units)
+} P1P2_sws_reader_t;
+
+static inline void P1P2_sws_next_state(uint8_t &state, uint8_t mode)
+// state following state of an event, as predicted by both encoder and decoder
+{
+  if (mode == SWS_MODE_WRITE) {
+    state = (state >= 20) ? 1 : state + 1;
+  } else {
+    state = (state >= 11) ? 1 : ((state < 2) ? 2 : state + 1);
+  }
+}
+
+static inline void P1P2_sws_init(P1P2_sws_reader_t &r, const volatile uint8_t* buf, uint16_t bits)
+{
+  r.buf = buf;
+  r.bits = bits;
+  r.pos = 0;
+  r.mode = SWS_MODE_READ;
+  r.state = 0;
+  r.pending = 0;
+  r.dev = 0;
+  r.dev_r = 0;
+}
+
+static inline uint16_t P1P2_sws_get(P1P2_sws_reader_t &r, uint8_t n)
+// returns next n (<= 16) bits, 0 bits beyond end of stream
+{
+  uint16_t v = 0;
+  for (uint8_t i = 0; i < n; i++, r.pos++) {
+    if ((r.pos < r.bits) && (r.buf[r.pos >> 3] & (1 << (r.pos & 7)))) v |= (1 << i);
+  }
+  return v;
+}
+
+static inline int16_t P1P2_sws_get_d(P1P2_sws_reader_t &r)
+{
+  uint8_t n = 0;
+  while ((n < 4) && P1P2_sws_get(r, 1)) n++;
+  if (n == 0) return 0;
+  if (n == 4) return (int16_t) P1P2_sws_get(r, 16);
+  uint8_t s = P1P2_sws_get(r, 1);
+  int16_t d = (1 << (n - 1)) + P1P2_sws_get(r, n - 1);
+  return s ? -d : d;
+}
+
+static inline int16_t P1P2_sws_falling(P1P2_sws_reader_t &r, int16_t d)
+// returns deviation of falling edge with deviation change d
+{
+  if ((r.mode != SWS_MODE_WRITE) && (r.state < 2)) {
+    r.dev_r += d;
+    r.dev = 0;
+    return r.dev_r;
+  }
+  r.dev += d;
+  return r.dev;
+}
+
+static inline bool P1P2_sws_next(P1P2_sws_reader_t &r, uint8_t &event, int16_t &dev)
+// decodes next event into event (SWS_EVENT_* code, including state for edges and signal levels)
+// and dev (deviation from bit grid in us, for edges and spikes); returns false at end of stream
+{
+  uint8_t state = r.state;
+  if (r.pending) {
+    event = r.pending | state;
+    dev = (r.pending == SWS_EVENT_EDGE_RISING) ? r.dev_r : 0;
+    r.pending = 0;
+    P1P2_sws_next_state(r.state, r.mode);
+    return true;
+  }
+  uint8_t falling = (r.mode == SWS_MODE_WRITE) ? SWS_EVENT_EDGE_FALLING_W : SWS_EVENT_EDGE_FALLING_R;
+  while (r.pos < r.bits) {
+    state = r.state;
+    if (!P1P2_sws_get(r, 1)) {
+      dev = 0;
+      event = SWS_EVENT_SIGNAL_HIGH_R | state;
+      if (r.mode == SWS_MODE_WRITE) r.pending = SWS_EVENT_SIGNAL_HIGH_R;
+    } else if (!P1P2_sws_get(r, 1)) {
+      dev = P1P2_sws_falling(r, 0);
+      event = falling | state;
+      if (r.mode == SWS_MODE_WRITE) r.pending = SWS_EVENT_EDGE_RISING;
+    } else if (!P1P2_sws_get(r, 1)) {
+      dev = P1P2_sws_falling(r, P1P2_sws_get(r, 1) ? -1 : 1);
+      event = falling | state;
+      if (r.mode == SWS_MODE_WRITE) r.pending = SWS_EVENT_EDGE_RISING;
+    } else {
+      uint8_t x = P1P2_sws_get(r, 4);
+      if (r.pos > r.bits) return false;
+      switch (x) {
+        case SWS_X_STATE   : r.state = P1P2_sws_get(r, 5);
+                             continue;
+        case SWS_X_READ    : r.mode = SWS_MODE_READ;
+                             falling = SWS_EVENT_EDGE_FALLING_R;
+                             continue;
+        case SWS_X_WRITE   : r.mode = SWS_MODE_WRITE;
+                             falling = SWS_EVENT_EDGE_FALLING_W;
+                             continue;
+        case SWS_X_SPIKE   : dev = r.dev + P1P2_sws_get_d(r);
+                             event = SWS_EVENT_EDGE_SPIKE | state;
+                             return (r.pos <= r.bits);
+        case SWS_X_FALLING : dev = P1P2_sws_falling(r, P1P2_sws_get_d(r));
+                             event = falling | state;
+                             break;
+        case SWS_X_RISING  : r.dev_r += P1P2_sws_get_d(r);
+                             dev = r.dev_r;
+                             event = SWS_EVENT_EDGE_RISING | state;
+                             break;
+        case SWS_X_HIGH    : dev = 0;
+                             event = SWS_EVENT_SIGNAL_HIGH_R | state;
+                             break;
+        default            : dev = 0;
+                             event = 0xFF - (x - SWS_X_ERR);
+                             return (r.pos <= r.bits);
+      }
+    }
+    if (r.pos > r.bits) {
+      r.pending = 0;
+      return false;
+    }
+    P1P2_sws_next_state(r.state, r.mode);
+    return true;
+  }
+  return false;
+}
+
+#endif /* P1P2Serial_Scope_h */
@@ -17,6 +17,8 @@
  * ESP_Telnet 1.3.1 by  Lennart Hennigs (installed using Arduino IDE)
  *
  * Version history
+ * 20261016 v0.9.34 table-driven CRC shared with P1P2Serial (P1P2Serial_CRC.h)
+ *                  binary frames from P1P2Monitor requested after 'V' and accepted next to text lines (BINARY_LINK, P1P2Serial_Link.h)
  * 20230108 v0.9.31 sensor prefix, +2 valves in HA, fix bit history for 0x30/0x31, +pseudo controlLevel
  * 20221228 v0.9.30 switch from modified ESP_telnet library to ESP_telnet v2.0.0
  * 20221211 v0.9.29 misc fixes, defrost E-series
@@ -48,6 +50,8 @@
 #include "ESPTelnet.h"
 #include "P1P2_NetworkParams.h"
 #include "P1P2_Config.h"
+#include "P1P2Serial_CRC.h"
+#include "P1P2Serial_Link.h"
 #include <ESP8266WiFi.h>
 #include <ESP8266mDNS.h>
 #include <EEPROM.h>
@@ -202,6 +206,7 @@ long int espUptime=0;
 bool shouldSaveConfig = false;
 static byte crc_gen = CRC_GEN;
 static byte crc_feed = CRC_FEED;
+static P1P2_crc_t crc_cfg;
 
 #ifdef AVRISP
 const char* avrisp_host = "esp8266-avrisp";
@@ -455,6 +460,15 @@ uint32_t milliInc = 0;
 uint32_t prevMillis = 0; //millis();
 static uint32_t reconnectTime = 0;
 
+#ifdef BINARY_LINK
+void ATmega_link_request() {
+// requests binary frames instead of text lines for packets; P1P2Monitor without BINARY_LINK does not understand this and keeps sending text
+  Serial.print(F(SERIAL_MAGICSTRING));
+  Serial.print('S');
+  Serial.println(P1P2_LINK_VERSION);
+}
+#endif /* BINARY_LINK */
+
 void ATmega_dummy_for_serial() {
   Sprint_P(true, true, true, PSTR("* [ESP] Two dummy lines to ATmega."));
   Serial.print(F(SERIAL_MAGICSTRING));
@@ -463,6 +477,9 @@ void ATmega_dummy_for_serial() {
   Serial.println(F("* Dummy line 2."));
   Serial.print(F(SERIAL_MAGICSTRING));
   Serial.println('V');
+#ifdef BINARY_LINK
+  ATmega_link_request();
+#endif /* BINARY_LINK */
 }
 
 bool MQTT_commandReceived = false;
@@ -477,6 +494,7 @@ volatile uint16_t MQTT_readBufferT = 0;
 #endif /* MQTT_INPUT_BINDATA || MQTT_INPUT_HEXDATA */
 static char* rb_buffer = readBuffer;
 static uint16_t serial_rb = 0;
+static bool linkFrame = false; // readBuffer holds a binary frame (BINARY_LINK) instead of a text line
 static int c;
 static byte ESP_serial_input_Errors_Data_Short = 0;
 static byte ESP_serial_input_Errors_CRC = 0;
@@ -817,6 +835,7 @@ void handleCommand(char* cmdString) {
                 case 'g':
                 case 'G': if (sscanf((const char*) (cmdString + 1), "%2x", &temphex) == 1) {
                             crc_gen = temphex;
+                            P1P2_crc_init(crc_cfg, crc_gen, crc_feed);
                             Sprint_P(true, true, true, PSTR("* [ESP] CRC_gen set to 0x%02X"), crc_gen);
                           } else {
                             Sprint_P(true, true, true, PSTR("* [ESP] CRC_gen 0x%02X"), crc_gen);
@@ -825,6 +844,7 @@ void handleCommand(char* cmdString) {
                 case 'h':
                 case 'H': if (sscanf((const char*) (cmdString + 1), "%2x", &temphex) == 1) {
                             crc_feed = temphex;
+                            P1P2_crc_init(crc_cfg, crc_gen, crc_feed);
                             Sprint_P(true, true, true, PSTR("* [ESP] CRC_feed set to 0x%02X"), crc_feed);
                           } else {
                             Sprint_P(true, true, true, PSTR("* [ESP] CRC_feed 0x%02X"), crc_feed);
@@ -838,6 +858,9 @@ void handleCommand(char* cmdString) {
     default : Sprint_P(true, true, true, PSTR("* [ESP] To ATmega: ->%s<-"), cmdString);
               Serial.print(F(SERIAL_MAGICSTRING));
               Serial.println((char *) cmdString);
+#ifdef BINARY_LINK
+              if ((cmdString[0] == 'v') || (cmdString[0] == 'V')) ATmega_link_request(); // 'V' switches P1P2Monitor back to text lines
+#endif /* BINARY_LINK */
               break;
   }
 }
@@ -968,6 +991,7 @@ void setup() {
 
 // Set up Serial from/to P1P2Monitor on ATmega (250kBaud); or serial from/to USB debugging (115.2kBaud);
   delay(100);
+  P1P2_crc_init(crc_cfg, crc_gen, crc_feed);
   Serial.setRxBufferSize(RX_BUFFER_SIZE); // default value is too low for ESP taking long pauses at random moments...
   Serial.begin(SERIALSPEED);
   while (!Serial);      // wait for Arduino Serial Monitor to open
@@ -1561,15 +1585,8 @@ void writePseudoPacket(byte* WB, byte rh)
   char pseudoWriteBuffer[RB];
   snprintf(pseudoWriteBuffer, 13, "R P         ");
 // if (outputMode & ??) add timestring TODO to pseudoWriteBuffer snprintf(pseudoWriteBuffer, 13, "R TIMESTRING P         ");
-  uint8_t crc = crc_feed;
-  for (uint8_t i = 0; i < rh; i++) {
-    uint8_t c = WB[i];
-    snprintf(pseudoWriteBuffer + 2 + timeStamp + (i << 1), 3, "%02X", c);
-    if (crc_gen != 0) for (uint8_t i = 0; i < 8; i++) {
-      crc = ((crc ^ c) & 0x01 ? ((crc >> 1) ^ crc_gen) : (crc >> 1));
-      c >>= 1;
-    }
-  }
+  for (uint8_t i = 0; i < rh; i++) snprintf(pseudoWriteBuffer + 2 + timeStamp + (i << 1), 3, "%02X", WB[i]);
+  uint8_t crc = P1P2_crc_calc(crc_cfg, WB, rh);
   WB[rh] = crc;
   if (crc_gen) snprintf(pseudoWriteBuffer + 2 + timeStamp + (rh << 1), 3, "%02X", crc);
 #if !((defined MQTT_INPUT_BINDATA) || (defined MQTT_INPUT_HEXDATA))
@@ -1583,6 +1600,91 @@ void writePseudoPacket(byte* WB, byte rh)
   if (outputMode & 0x0666) process_for_mqtt_json(WB, rh);
 }
 
+void handlePacket(byte* readHex, byte rh)
+// publishes and processes a packet read from P1P2Monitor, as text line (in readBuffer) and bytes (rh is packet length, not counting CRC byte readHex[rh])
+{
+#if !((defined MQTT_INPUT_BINDATA) || (defined MQTT_INPUT_HEXDATA))
+  if (outputMode & 0x0001) client_publish_mqtt(mqttHexdata, readBuffer);
+#endif /* MQTT_INPUT_BINDATA || MQTT_INPUT_HEXDATA */
+  if (outputMode & 0x0010) client_publish_telnet(mqttHexdata, readBuffer);
+  if (outputMode & 0x0100) client_publish_serial(mqttHexdata, readBuffer);
+#if !((defined MQTT_INPUT_BINDATA) || (defined MQTT_INPUT_HEXDATA))
+  if ((outputMode & 0x0800) && (mqttConnected)) mqttClient.publish((const char*) mqttBindata, MQTT_QOS, false, (const char*) readHex, rh + 1);
+#endif /* MQTT_INPUT_BINDATA || MQTT_INPUT_HEXDATA */
+  if (outputMode & 0x0666) process_for_mqtt_json(readHex, rh);
+#ifdef PSEUDO_PACKETS
+  if ((readHex[0] == 0x00) && (readHex[1] == 0x00) && (readHex[2] == 0x0D)) pseudo0D = 9; // Insert pseudo packet 40000D in output serial after 00000D
+  if ((readHex[0] == 0x00) && (readHex[1] == 0x00) && (readHex[2] == 0x0F)) pseudo0F = 9; // Insert pseudo packet 40000F in output serial after 00000F
+#endif
+  if ((readHex[0] == 0x00) && (readHex[1] == 0x00) && (readHex[2] == 0x0E)) {
+#ifdef PSEUDO_PACKETS
+    pseudo0E = 9; // Insert pseudo packet 40000E in output serial after 00000E
+#endif
+    uint32_t ATmega_uptime = (readHex[3] << 24) || (readHex[4] << 16) || (readHex[5] << 8) || readHex[6];
+    if (ATmega_uptime < ATmega_uptime_prev) {
+      // unexpected ATmega reboot detected, flush ATmega's serial input
+      delay(200);
+      ATmega_dummy_for_serial();
+    }
+    ATmega_uptime_prev = ATmega_uptime;
+  }
+}
+
+#ifdef BINARY_LINK
+bool handleLinkFrame(uint8_t* frame, uint16_t n)
+// decodes a binary frame from P1P2Monitor (n bytes between delimiters, in readBuffer) and handles it as the equivalent R or E text line;
+// the text line is only regenerated in readBuffer if it is published; returns false if the frame is not valid
+{
+  P1P2_link_record_t r;
+  byte readHex[HB];
+  if ((n > 0xFF) || !P1P2_link_decode(r, frame, n)) {
+    Sprint_P(true, true, true, PSTR("* [MON] Serial input buffer overrun or CRC-16 error in binary frame"));
+    if (ESP_serial_input_Errors_CRC < 0xFF) ESP_serial_input_Errors_CRC++;
+    return false;
+  }
+  if (r.n > HB) {
+    Sprint_P(true, true, true, PSTR("* [MON] Buffer full, binary frame with %i bytes ignored"), r.n);
+    return true;
+  }
+  byte rh = r.n;
+  // r points into readBuffer, which is overwritten below by the text line
+  for (uint8_t i = 0; i < rh; i++) readHex[i] = r.data[i];
+  if (r.flags & P1P2_LINK_ERRORS) {
+    // data with errors, reported as E line ("*" for backwards output report compatibility) with error flags per byte
+    uint16_t readErrors[HB];
+    for (uint8_t i = 0; i < rh; i++) readErrors[i] = P1P2_link_error(r, i);
+    uint8_t errorsize = r.errorsize;
+    uint16_t readerror = r.readerror;
+    int rbp = snprintf(readBuffer, RB, "* T %2u.%03u %010lu: ", r.delta / 1000, r.delta % 1000, (unsigned long) r.time);
+    for (uint8_t i = 0; i < rh; i++) rbp += snprintf(readBuffer + rbp, RB - rbp, "%02X", readHex[i]);
+    rbp += snprintf(readBuffer + rbp, RB - rbp, " readError=0x%04X EB=", readerror);
+    for (uint8_t i = 0; i < rh; i++) rbp += snprintf(readBuffer + rbp, RB - rbp, (errorsize > 1) ? "%04X" : "%02X", readErrors[i]);
+    Sprint_P(true, true, true, PSTR("* [MON]%s"), readBuffer + 1);
+    if (outputMode & 0x2000) client_publish_mqtt(mqttHexdata, readBuffer);
+    return true;
+  }
+  if ((rh == 0) || (crc_gen && (rh == 1))) {
+    Sprint_P(true, true, true, PSTR("* [MON] Not enough readable data in binary frame"));
+    if (ESP_serial_input_Errors_Data_Short < 0xFF) ESP_serial_input_Errors_Data_Short++;
+    return true;
+  }
+  if (outputMode & 0x0111) {
+    int rbp;
+    if (r.flags & P1P2_LINK_PSEUDO) {
+      rbp = snprintf(readBuffer, RB, "R P         ");
+    } else {
+      // with the microsecond time stamp, as sent by P1P2Monitor compiled with TIMESTAMP_US ("R T 65.535 0123456789: ")
+      rbp = snprintf(readBuffer, RB, "R T %2u.%03u %010lu: ", r.delta / 1000, r.delta % 1000, (unsigned long) r.time);
+    }
+    for (uint8_t i = 0; i < rh; i++) rbp += snprintf(readBuffer + rbp, RB - rbp, "%02X", readHex[i]);
+  }
+  if (crc_gen) rh--;
+  // P1P2 CRC was checked by P1P2Monitor (an error would have given an E frame), and the frame by its CRC-16
+  handlePacket(readHex, rh);
+  return true;
+}
+#endif /* BINARY_LINK */
+
 uint32_t espUptime_telnet = 0;
 static bool wasConnected = false;
 
@@ -1725,7 +1827,11 @@ void loop() {
     }
 #else
     if (!ignoreSerial) {
-       while (((c = Serial.read()) >= 0) && (c != '\n') && (serial_rb < RB)) {
+      // a binary frame may contain '\n', and ends at its end delimiter 0x00
+      while (((c = Serial.read()) >= 0) && ((c != '\n') || linkFrame) && (serial_rb < RB)) {
+#ifdef BINARY_LINK
+        if (!c) break;
+#endif /* BINARY_LINK */
         *rb_buffer++ = (char) c;
         serial_rb++;
       }
@@ -1733,6 +1839,29 @@ void loop() {
       c = -1;
     }
 #endif
+#ifdef BINARY_LINK
+    if (c == 0) {
+      // frame delimiter: end of a binary frame, or start of the next one
+      if (linkFrame && serial_rb) {
+        // if the frame is not valid, this may have been the start delimiter of a frame after a lost end delimiter
+        linkFrame = !handleLinkFrame((uint8_t*) readBuffer, serial_rb);
+      } else {
+        if (serial_rb && !linkFrame) {
+          *rb_buffer = '\0';
+          Sprint_P(true, true, true, PSTR("* [MON] Incomplete line before binary frame, ignored: ->%s<-"), readBuffer);
+        }
+        linkFrame = true;
+        ignoreremainder = 0;
+      }
+      rb_buffer = readBuffer;
+      serial_rb = 0;
+    } else if (linkFrame && (serial_rb == RB)) {
+      Sprint_P(true, true, true, PSTR("* [MON] Binary frame too long, ignored"));
+      linkFrame = false;
+      rb_buffer = readBuffer;
+      serial_rb = 0;
+    } else
+#endif /* BINARY_LINK */
     // ((c == '\n' and serial_rb > 0))  and/or  serial_rb == RB)  or  c == -1
     if (c >= 0) {
       if ((c == '\n') && (serial_rb < RB)) {
@@ -1758,6 +1887,8 @@ void loop() {
               // skip 10-character time stamp
               rbp = 12;
               timeStamp = 10;
+              // skip 11-character microsecond time stamp if P1P2Monitor was compiled with TIMESTAMP_US ("T 65.535 0123456789: ")
+              if ((serial_rb > 23) && (readBuffer[2] == 'T') && (readBuffer[10] == ' ')) rbp = 23;
             } else {
               timeStamp = 0;
             }
@@ -1769,41 +1900,10 @@ void loop() {
             if ((rh > 1) || (rh == 1) && !crc_gen) {
               if (crc_gen) rh--;
               // rh is packet length (not counting CRC byte readHex[rh])
-              uint8_t crc = crc_feed;
-              for (uint8_t i = 0; i < rh; i++) {
-                uint8_t c = readHex[i];
-                if (crc_gen != 0) for (uint8_t i = 0; i < 8; i++) {
-                  crc = ((crc ^ c) & 0x01 ? ((crc >> 1) ^ crc_gen) : (crc >> 1));
-                  c >>= 1;
-                }
-              }
+              uint8_t crc = P1P2_crc_calc(crc_cfg, readHex, rh);
 // if (outputMode & ??) add timestring TODO to readBuffer
               if ((!crc_gen) || (crc == readHex[rh])) {
-#if !((defined MQTT_INPUT_BINDATA) || (defined MQTT_INPUT_HEXDATA))
-                if (outputMode & 0x0001) client_publish_mqtt(mqttHexdata, readBuffer);
-#endif /* MQTT_INPUT_BINDATA || MQTT_INPUT_HEXDATA */
-                if (outputMode & 0x0010) client_publish_telnet(mqttHexdata, readBuffer);
-                if (outputMode & 0x0100) client_publish_serial(mqttHexdata, readBuffer);
-#if !((defined MQTT_INPUT_BINDATA) || (defined MQTT_INPUT_HEXDATA))
-                if ((outputMode & 0x0800) && (mqttConnected)) mqttClient.publish((const char*) mqttBindata, MQTT_QOS, false, (const char*) readHex, rh + 1);
-#endif /* MQTT_INPUT_BINDATA || MQTT_INPUT_HEXDATA */
-                if (outputMode & 0x0666) process_for_mqtt_json(readHex, rh);
-#ifdef PSEUDO_PACKETS
-                if ((readHex[0] == 0x00) && (readHex[1] == 0x00) && (readHex[2] == 0x0D)) pseudo0D = 9; // Insert pseudo packet 40000D in output serial after 00000D
-                if ((readHex[0] == 0x00) && (readHex[1] == 0x00) && (readHex[2] == 0x0F)) pseudo0F = 9; // Insert pseudo packet 40000F in output serial after 00000F
-#endif
-                if ((readHex[0] == 0x00) && (readHex[1] == 0x00) && (readHex[2] == 0x0E)) {
-#ifdef PSEUDO_PACKETS
-                  pseudo0E = 9; // Insert pseudo packet 40000E in output serial after 00000E
-#endif
-                  uint32_t ATmega_uptime = (readHex[3] << 24) || (readHex[4] << 16) || (readHex[5] << 8) || readHex[6];
-                  if (ATmega_uptime < ATmega_uptime_prev) {
-                    // unexpected ATmega reboot detected, flush ATmega's serial input
-                    delay(200);
-                    ATmega_dummy_for_serial();
-                  }
-                  ATmega_uptime_prev = ATmega_uptime;
-                }
+                handlePacket(readHex, rh);
               } else {
                 Sprint_P(true, true, true, PSTR("* [MON] Serial input buffer overrun or CRC error in R data:%s expected 0x%02X"), readBuffer + 1, crc);
                 if (ESP_serial_input_Errors_CRC < 0xFF) ESP_serial_input_Errors_CRC++;
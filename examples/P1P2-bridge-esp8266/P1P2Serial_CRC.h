@@ -0,0 +1,55 @@
+/* P1P2Serial_CRC.h: table-driven CRC for P1/P2 packets
+ *
+ * Copyright (c) 2019-2022 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 initial version
+ *
+ */
+
+// file included by P1P2Serial (P1P2Serial.h), by the host tools and by P1P2-bridge-esp8266 in different locations, so keep header files in sync
+
+#ifndef P1P2Serial_CRC_h
+#define P1P2Serial_CRC_h
+
+#include <stdint.h>
+
+// The Daikin CRC is an 8-bit reflected LFSR (generator 0xD9, feed 0x00 for most products), bit-serial:
+//   for each bit (LSB first): crc = ((crc ^ c) & 0x01) ? ((crc >> 1) ^ crc_gen) : (crc >> 1); c >>= 1;
+// As crc_gen can be changed at run-time, a 16-byte nibble table is calculated for the selected generator
+// instead of using a fixed 256-byte table; this processes a byte in 2 table look-ups instead of 8 iterations.
+
+typedef struct {
+  uint8_t gen;        // generator, 0 means no CRC in use
+  uint8_t feed;       // initial CRC value
+  uint8_t table[16];  // effect of 4 bit-serial iterations, indexed by low nibble
+} P1P2_crc_t;
+
+static inline void P1P2_crc_init(P1P2_crc_t &crc, uint8_t gen, uint8_t feed)
+{
+  crc.gen = gen;
+  crc.feed = feed;
+  for (uint8_t i = 0; i < 16; i++) {
+    uint8_t t = i;
+    for (uint8_t j = 0; j < 4; j++) t = (t & 0x01) ? ((t >> 1) ^ gen) : (t >> 1);
+    crc.table[i] = t;
+  }
+}
+
+static inline uint8_t P1P2_crc_update(const P1P2_crc_t &crc, uint8_t c, uint8_t b)
+// returns updated CRC value c after processing byte b
+{
+  c ^= b;
+  c = (c >> 4) ^ crc.table[c & 0x0F];
+  return (c >> 4) ^ crc.table[c & 0x0F];
+}
+
+static inline uint8_t P1P2_crc_calc(const P1P2_crc_t &crc, const uint8_t* buf, uint8_t n)
+// returns CRC of n bytes in buf
+{
+  uint8_t c = crc.feed;
+  for (uint8_t i = 0; i < n; i++) c = P1P2_crc_update(crc, c, buf[i]);
+  return c;
+}
+
+#endif /* P1P2Serial_CRC_h */
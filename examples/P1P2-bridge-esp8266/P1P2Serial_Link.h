@@ -0,0 +1,187 @@
+/* P1P2Serial_Link.h: binary framed serial link from P1P2Monitor to P1P2-bridge-esp8266
+ *
+ * Copyright (c) 2019-2022 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 initial version
+ *                  error flags of 2 bytes each if errorbuf_t is 16 bits (P1P2_LINK_ERRORS16)
+ *
+ */
+
+// file included by P1P2Monitor, by the host tools and by P1P2-bridge-esp8266 in different locations, so keep header files in sync
+
+#ifndef P1P2Serial_Link_h
+#define P1P2Serial_Link_h
+
+#include <stdint.h>
+
+// After the handshake (command "S1", see SerialProtocol.md), P1P2Monitor sends each (pseudo) packet as a frame instead of as a hex text line:
+//   0x00, COBS(record), 0x00
+// COBS (consistent overhead byte stuffing) removes all 0x00 bytes from the record at a cost of 1 byte per 254 bytes,
+// so 0x00 only occurs as frame delimiter and never in text lines, which may be interleaved with frames.
+// The record is (multi-byte fields little-endian):
+//   flags      1 byte  P1P2_LINK_* below
+//   delta      2 bytes bus pause before packet in ms (0 for pseudo packets)
+//   time       4 bytes start of packet in us, wraps every 71.6 minutes (0 for pseudo packets)
+//   data       n bytes packet bytes including CRC byte, as in a text line
+//   errors     n bytes only if P1P2_LINK_ERRORS: error flags (ERROR_*) per byte; 2n bytes (2 per byte) if also P1P2_LINK_ERRORS16,
+//              which the sender sets if its errorbuf_t is 16 bits (P1P2SerialConfig, GENERATE_FAKE_ERRORS)
+//   readerror  2 bytes only if P1P2_LINK_ERRORS: packet error summary
+//   crc16      2 bytes CRC-16/CCITT-FALSE (generator 0x1021, feed 0xFFFF) over all preceding record bytes
+
+#define P1P2_LINK_VERSION 1
+
+#define P1P2_LINK_PSEUDO  0x01 // pseudo packet generated by P1P2Monitor
+#define P1P2_LINK_ERRORS  0x02 // packet read with errors, error flags and error summary follow the data
+#define P1P2_LINK_ERRORS16 0x04 // (with P1P2_LINK_ERRORS) error flags are 2 bytes each
+
+#define P1P2_LINK_HEADER  7    // flags, delta, time
+#define P1P2_LINK_RECORD(n, e) (P1P2_LINK_HEADER + (1 + (e)) * (n) + 4)  // max record size for n data bytes with e bytes per error flag
+#define P1P2_LINK_FRAME(n, e)  (P1P2_LINK_RECORD(n, e) + P1P2_LINK_RECORD(n, e) / 254 + 3) // max frame size, including COBS overhead and delimiters
+
+static inline uint16_t P1P2_crc16_update(uint16_t crc, uint8_t b)
+// returns CRC-16/CCITT-FALSE crc updated with byte b (shift-and-xor form of the bit-serial MSB-first calculation, no table)
+{
+  uint8_t x = (crc >> 8) ^ b;
+  x ^= x >> 4;
+  return (crc << 8) ^ ((uint16_t) x << 12) ^ ((uint16_t) x << 5) ^ x;
+}
+
+// Frame writer: a record is COBS-encoded and CRC'ed byte by byte while it is written into buf
+
+typedef struct {
+  uint8_t* buf;
+  uint8_t n;     // # bytes in buf
+  uint8_t code;  // position of current COBS code byte in buf
+  uint16_t crc;
+} P1P2_link_writer_t;
+
+static inline void P1P2_link_start(P1P2_link_writer_t &w, uint8_t* buf)
+// starts a frame in buf (which must hold P1P2_LINK_FRAME(n, e) bytes for n data bytes with e bytes per error flag)
+{
+  w.buf = buf;
+  w.buf[0] = 0x00;
+  w.code = 1;
+  w.buf[1] = 1;
+  w.n = 2;
+  w.crc = 0xFFFF;
+}
+
+static inline void P1P2_link_cobs(P1P2_link_writer_t &w, uint8_t b)
+{
+  if (b) {
+    w.buf[w.n++] = b;
+    if (++w.buf[w.code] < 0xFF) return;
+  }
+  w.code = w.n++;
+  w.buf[w.code] = 1;
+}
+
+static inline void P1P2_link_put(P1P2_link_writer_t &w, uint8_t b)
+{
+  w.crc = P1P2_crc16_update(w.crc, b);
+  P1P2_link_cobs(w, b);
+}
+
+static inline void P1P2_link_put16(P1P2_link_writer_t &w, uint16_t v)
+{
+  P1P2_link_put(w, v & 0xFF);
+  P1P2_link_put(w, v >> 8);
+}
+
+static inline void P1P2_link_put32(P1P2_link_writer_t &w, uint32_t v)
+{
+  P1P2_link_put16(w, v & 0xFFFF);
+  P1P2_link_put16(w, v >> 16);
+}
+
+template <typename ErrorT>
+static inline void P1P2_link_put_errors(P1P2_link_writer_t &w, const ErrorT* errors, uint8_t n)
+// writes n error flags, 2 bytes each if ErrorT is 16 bits (the record flags then need P1P2_LINK_ERRORS16, see P1P2_link_errorflags())
+{
+  for (uint8_t i = 0; i < n; i++) {
+    if (sizeof(ErrorT) > 1) {
+      P1P2_link_put16(w, errors[i]);
+    } else {
+      P1P2_link_put(w, errors[i]);
+    }
+  }
+}
+
+template <typename ErrorT>
+static inline uint8_t P1P2_link_errorflags(void)
+// returns the record flags for a packet with error flags of type ErrorT
+{
+  return (sizeof(ErrorT) > 1) ? (P1P2_LINK_ERRORS | P1P2_LINK_ERRORS16) : P1P2_LINK_ERRORS;
+}
+
+static inline uint8_t P1P2_link_end(P1P2_link_writer_t &w)
+// appends CRC-16 and end delimiter, returns frame size
+{
+  uint16_t crc = w.crc;
+  P1P2_link_cobs(w, crc & 0xFF);
+  P1P2_link_cobs(w, crc >> 8);
+  w.buf[w.n++] = 0x00;
+  return w.n;
+}
+
+// Frame reader
+
+typedef struct {
+  uint8_t flags;
+  uint16_t delta;
+  uint32_t time;
+  uint8_t n;                // # data bytes
+  const uint8_t* data;
+  const uint8_t* errors;    // 0 unless P1P2_LINK_ERRORS, see P1P2_link_error()
+  uint8_t errorsize;        // bytes per error flag: 2 if P1P2_LINK_ERRORS16, else 1
+  uint16_t readerror;
+} P1P2_link_record_t;
+
+static inline uint16_t P1P2_link_error(const P1P2_link_record_t &r, uint8_t i)
+// returns the error flags of data byte i of a record with P1P2_LINK_ERRORS
+{
+  if (r.errorsize > 1) return r.errors[2 * i] | ((uint16_t) r.errors[2 * i + 1] << 8);
+  return r.errors[i];
+}
+
+static inline bool P1P2_link_decode(P1P2_link_record_t &r, uint8_t* buf, uint8_t n)
+// decodes n frame bytes in buf (between, not including, the delimiters) in place into r,
+// returns false if the frame is malformed or its CRC-16 is wrong
+{
+  uint8_t len = 0;
+  uint8_t i = 0;
+  while (i < n) {
+    uint8_t code = buf[i++];
+    if (!code || (i + code - 1 > n)) return false;
+    for (uint8_t j = 1; j < code; j++) buf[len++] = buf[i++];
+    if ((code < 0xFF) && (i < n)) buf[len++] = 0x00;
+  }
+  if (len < P1P2_LINK_HEADER + 2) return false;
+  uint16_t crc = 0xFFFF;
+  len -= 2;
+  for (i = 0; i < len; i++) crc = P1P2_crc16_update(crc, buf[i]);
+  if (crc != (buf[len] | ((uint16_t) buf[len + 1] << 8))) return false;
+  r.flags = buf[0];
+  r.delta = buf[1] | ((uint16_t) buf[2] << 8);
+  r.time = buf[3] | ((uint32_t) buf[4] << 8) | ((uint32_t) buf[5] << 16) | ((uint32_t) buf[6] << 24);
+  r.data = buf + P1P2_LINK_HEADER;
+  len -= P1P2_LINK_HEADER;
+  if (r.flags & P1P2_LINK_ERRORS) {
+    // n data bytes, n error flags of errorsize bytes, 2 bytes readerror
+    r.errorsize = (r.flags & P1P2_LINK_ERRORS16) ? 2 : 1;
+    if ((len < 2) || ((len - 2) % (1 + r.errorsize))) return false;
+    r.n = (len - 2) / (1 + r.errorsize);
+    r.errors = r.data + r.n;
+    len = r.n * (1 + r.errorsize);
+    r.readerror = r.data[len] | ((uint16_t) r.data[len + 1] << 8);
+  } else {
+    r.n = len;
+    r.errors = 0;
+    r.errorsize = 0;
+    r.readerror = 0;
+  }
+  return true;
+}
+
+#endif /* P1P2Serial_Link_h */
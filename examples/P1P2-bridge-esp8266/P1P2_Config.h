@@ -5,6 +5,10 @@
  * WARNING: P1P2-bridge-esp8266 is end-of-life, and will be replaced by P1P2MQTT
  *
  * Version history
+ * 20261016 v0.9.34 table-driven CRC (P1P2Serial_CRC.h)
+ *                  skip optional microsecond time stamp from P1P2Monitor (TIMESTAMP_US)
+ *                  binary link with P1P2Monitor (BINARY_LINK)
+ *                  E-series: 00000E byte 12 reported as Parameter_Write_Queued (P1P2Monitor parameter write queue)
  * 20230211 v0.9.33a 0xA3 thermistor read-out F-series
  * 20230117 v0.9.32 centralize pseudopacket handling
  * 20230108 v0.9.31 sensor prefix, +2 valves in HA, fix bit history for 0x30/0x31, +pseudo controlLevel
@@ -115,9 +119,9 @@
 #define SAVEPACKETS
 // to save memory to avoid ESP instability (until P1P2MQTT is released): do not #define SAVESCHEDULE // format of schedules will change to JSON format in P1P2MQTT
 
-#define WELCOMESTRING "* [ESP] P1P2-bridge-esp8266 v0.9.33a"
-#define WELCOMESTRING_TELNET "P1P2-bridge-esp8266 v0.9.33a"
-#define HA_SW "0.9.33a"
+#define WELCOMESTRING "* [ESP] P1P2-bridge-esp8266 v0.9.34"
+#define WELCOMESTRING_TELNET "P1P2-bridge-esp8266 v0.9.34"
+#define HA_SW "0.9.34"
 
 #define AVRISP // enables flashing ATmega by ESP on P1P2-ESP-Interface
 #define SPI_SPEED_0 2e5 // for HSPI, default avrprog speed is 3e5, which is too high to be reliable; 2e5 works
@@ -133,6 +137,10 @@
 
 #define PSEUDO_PACKETS // define to have P1P2-bridge-esp8266 output additional P1P2-like packets with internal state information
 
+#define BINARY_LINK // define to request packets from P1P2Monitor as binary frames (P1P2Serial_Link.h) instead of hex text lines,
+                    // which halves serial bandwidth and avoids parsing hex; P1P2Monitor without BINARY_LINK keeps sending text lines,
+                    // which are always accepted (not used with MQTT_INPUT_HEXDATA/MQTT_INPUT_BINDATA)
+
 // home assistant (including MQTT discovery)
 #define HA_PREFIX "homeassistant/sensor"   // homeassistant MQTT discovery prefix
 char haDeviceName[9] = "P1P2-xxx";         // becomes device name in HA
@@ -42,7 +42,11 @@
         case    9 : KEY("Counter_Request_Repeat");                         HACONFIG;                                                             VALUE_u8;
         case   10 : KEY("Counter_Request_Counter");                                                      maxOutputFilter = 2;                    VALUE_u8;
         case   11 : KEY("Error_Oversized_Packet_Count");                   HACONFIG;                                                             VALUE_u8;
+#ifdef E_SERIES
+        case   12 : KEY("Parameter_Write_Queued");                                                                                               VALUE_u8;
+#else /* E_SERIES */
         case   12 : KEY("Parameter_Write_Request");                                                                                              VALUE_u8;
+#endif /* E_SERIES */
         case   13 : KEY("Parameter_Write_Packet_Type");                                                                                          VALUE_u8hex;
         case   15 : KEY("Parameter_Write_Nr");                                                                                                   VALUE_u16hex_LE;
         case   19 : KEY("Parameter_Write_Value");                                                                                                VALUE_u32_LE;
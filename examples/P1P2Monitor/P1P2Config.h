@@ -2,6 +2,22 @@
  *
  * Copyright (c) 2019-2023 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
  *
+ * 20261016 v0.9.34 error summary per packet from library (packeterrors()), CRC check in library ISR (setCRC())
+ *                  auxiliary controller replies and counter requests queued with schedulepacket() (priority, deadline)
+ *                  optional microsecond packet timestamp in timing info (TIMESTAMP_US)
+ *                  pseudo packet 00000C with ISR execution time statistics (ISR_STATS), replacing MEASURE_LOAD output
+ *                  compact software-scope output covering whole packets (P1P2_sws_next())
+ *                  KLICDA_GAP: counter requests written in first pause learned to be long enough (schedulegap()) instead of after 400012*
+ *                  packets processed by handlePacket(), called by P1P2Serial.dispatch() if EVENT_HANDLERS
+ *                  pseudo packet 00010D with bus levels and eye margin per sender (ADC_bitstats(), ADC_BITSYNC), after each 00000D
+ *                  pseudo packet 00020D with ADC window statistics and quantiles per channel (ADC_window(), ADC_STREAM), after each 00000D
+ *                  replies and counter requests written again after a collision (TX_RETRY, WRITE_RETRIES), reported if dropped (writeresult())
+ *                  loop() ends with P1P2Serial.idle() (IDLE_SLEEP), pseudo packet 00010C with cycles asleep and CPU utilisation (idlestats())
+ *                  packet and pseudo packet lines rendered in a line buffer (LB_SIZE) and written to Serial at once
+ *                  optional binary link: packets sent as COBS frames with CRC-16 after 'S1' (BINARY_LINK, P1P2Serial_Link.h)
+ *                  E-series auxiliary controller replies without pending write preloaded in library reply slots, written without loop() (AUTO_REPLY)
+ *                  E-series auxiliary controller replies built from per-packet-type templates, compiled only when pending writes change
+ *                  E-series parameter writes queued (WRITE_QUEUE_SIZE), packed into as few replies as possible, written again until read back (WRITE_TRIES), write budget per reply
  * 20230211 v0.9.33 added ENABLE_INSERT_MESSAGE_3x, user with care!
  * 20230117 v0.9.32 check CONTROL_ID for write commands
  * 20230108 v0.9.31 fix nr_param check
@@ -63,7 +79,7 @@
 #define SERIAL_MAGICSTRING "1P2P" // Serial input line should start with SERIAL_MAGICSTRING, otherwise input line is ignored
 #endif /* F_CPU */
 
-#define WELCOMESTRING "* P1P2Monitor-v0.9.33"
+#define WELCOMESTRING "* P1P2Monitor-v0.9.34"
 
 #define INIT_VERBOSE 3
 // Set verbosity level
@@ -74,6 +90,14 @@
 //                   (format: 10-character "T 65.535: " for real packets and "P         " for pseudopackets)
 // verbose = 4: no raw/pseudopacket data output, only maximal reporting
 
+//#define TIMESTAMP_US // adds a microsecond timestamp (start of packet, from PACKET_TIMESTAMP in P1P2Serial.h) to the timing info of real packets
+                       //   (format: 21-character "T 65.535 0123456789: "; the 10-digit microsecond counter wraps every 71.6 minutes)
+                       //   P1P2-bridge-esp8266 v0.9.34 and later skip this field
+
+#define BINARY_LINK // after command 'S1', sends (pseudo) packets as binary frames (P1P2Serial_Link.h: flags, pause, microsecond timestamp,
+                    //   bytes, error flags, CRC-16) instead of hex text lines, about half the serial bandwidth; other output stays text
+                    //   P1P2-bridge-esp8266 v0.9.34 and later request this after 'V'; 'V' switches back to text lines
+
 #define COUNTERREPEATINGREQUEST 0 // Change this to 1 to trigger a counter request cycle at the start of each minute
                                   //   By default this works only as, and only if there is no other, first auxiliary controller (F0)
 				  //   The counter request is done after the (unanswered) 00F030*, unless KLICDA is defined
@@ -86,6 +110,13 @@
 #define KLICDA_DELAY 9            // If KLICDA is defined, the counter request is inserted at KLICDA_delay ms after the 400012* response
                                   //   This value needs to be selected carefully to avoid bus collission between the 4000B8* response and the next 000013* request
 				  //   A value around 9ms works for my system; use with care, and check your logs for bus collissions or other errors
+//#define KLICDA_GAP 38           // If KLICDA_GAP is also defined, the counter request is written KLICDA_DELAY ms after the first packet (the 400012* response
+                                  //   or a later one) which, as learned by the library (BUS_CYCLE_LEARNER), is followed by a pause of at least
+                                  //   KLICDA_DELAY + KLICDA_GAP ms (time needed for the 0000B8* request and 4000B8* response) with a risk of at most
+                                  //   KLICDA_GAP_RISK per mille, which avoids the occasional short pauses after the 400012* response.
+                                  //   Requires BUS_CYCLE_LEARNER to be defined in P1P2Serial.h.
+                                  //   Counter requests are dropped (after WRITE_DEADLINE) until the pauses have been learned (~10s after startup)
+#define KLICDA_GAP_RISK 0         // Maximum risk (per mille) of a pause being too short, 0: only pauses never observed to be too short
 
 // set CTRL adapter ID; if not used, installer mode becomes unavailable on main controller
 #define CTRL_ID_1 0xB4 // LAN adapter ID in 0x31 payload byte 7
@@ -132,8 +163,14 @@
 #define WB_SIZE 32
 // P1/P2 read buffer size to store raw data and error codes read from P1P2bus; 1 extra for reading back CRC byte; 24 might be enough
 #define RB_SIZE 33
+// line buffer size for serial output of a (pseudo) packet, written to Serial at once (only error flags may cause an earlier write), also holds a BINARY_LINK frame;
+// 96 fits a 33-byte packet with CRC and timing info with TIMESTAMP_US ("R T 65.535 0123456789: " + 66 + " CRC=" + "\r\n"), at least 53;
+// with BINARY_LINK and a 16-bit errorbuf_t (GENERATE_FAKE_ERRORS), a frame with 2-byte error flags needs 113
+#define LB_SIZE 96
 
-#define WR_CNT 1            // number of write repetitions for writing a paramter. 1 should work reliably, no real need for higher value
+#define WR_CNT 1            // (F_SERIES) number of write repetitions for writing a paramter. 1 should work reliably, no real need for higher value
+#define WRITE_QUEUE_SIZE 8  // (E_SERIES) number of parameter writes that can be queued, packed as many as fit into each 40Fx35..40Fx3D reply; 10 bytes each
+#define WRITE_TRIES 3       // (E_SERIES) number of times a queued parameter write is written if its reply is not read back (requires echo, 'X1')
 
 #define INIT_ECHO 1         // defines whether written data is read back and verified against written data (advise to keep this 1)
 #define INIT_SCOPE 0        // defines whether scopemode, recording timing info, is on/off at start (advise to keep this 0)
@@ -148,7 +185,16 @@
 // auxiliary controller timings
 #define F030DELAY 100   // Time delay for in ms auxiliary controller simulation, should be larger than any response of other auxiliary controllers (which is typically 25-80 ms)
 #define F03XDELAY  30   // Time delay for in ms auxiliary controller simulation, should preferably be a bit larger than any regular response from auxiliary controllers (which is typically 25 ms)
+//#define AUTO_REPLY    // (E_SERIES) replies to 00Fx3x polls not carrying a pending write are preloaded in the library (TX_REPLY, setReply()),
+                        //   which writes them F030DELAY/F03XDELAY ms after the poll without waiting for loop(); other polls are answered by loop()
+                        //   Requires TX_REPLY in P1P2Serial.h; uses up to 5 reply slots (0x30, 0x31, 0x32, 0x35-0x3D, 0x3E), polls for which
+                        //   no slot is available (TX_REPLY_SLOTS, 2 by default) are answered by loop() as well
 #define F0THRESHOLD 5   // Number of 00Fx30 messages to remain unanswered before we feel safe to act as auxiliary controller
+#define WRITE_DEADLINE 300 // Time in ms after which a queued auxiliary controller reply or counter request is dropped if it could not be written (0: never)
+#define WRITE_RETRIES 0 // Number of times a queued reply or counter request is written again after a collision (TX_RETRY; 0: dropped after a collision)
+#define WRITE_BACKOFF 4 // Maximum random delay in ms added to a retry, doubled per further collision (TX_RETRY)
+#define PRIO_REPLY 1    // Priority of auxiliary controller replies over counter requests if both are waiting to be written
+#define PRIO_REQUEST 0
 
 #define ENABLE_INSERT_MESSAGE // enables L99 to restart Daikin system and enables W command to insert messages in 40F030 (3x if ENABLE_INSERT_ME$SAGE_3x also defined) slot during L1 operation, use with care!
 #define ENABLE_INSERT_MESSAGE_3x // enables L99 to restart Daikin system and enables W command to insert messages in 40F03x slot during L1 operation, use with even more care!
@@ -94,6 +94,9 @@
 
 #include "P1P2Config.h"
 #include <P1P2Serial.h>
+#ifdef BINARY_LINK
+#include <P1P2Serial_Link.h>
+#endif /* BINARY_LINK */
 
 #define SPI_CLK_PIN_VALUE (PINB & 0x20)
 
@@ -101,6 +104,14 @@ static byte verbose = INIT_VERBOSE;
 static byte readErrors = 0;
 static byte readErrorLast = 0;
 static byte writeRefused = 0;
+#if defined TIMESTAMP_US || defined BINARY_LINK
+static uint32_t packetTimeUs = 0;   // start of last packet read, in microseconds
+static uint32_t packetTimePrev = 0; // start of last packet read, in CPU cycles as returned by packettime()
+static uint8_t packetTimeRest = 0;  // CPU cycles not yet counted in packetTimeUs
+#endif /* TIMESTAMP_US || BINARY_LINK */
+#ifdef BINARY_LINK
+static byte linkMode = 0;           // packets sent as binary frames (P1P2Serial_Link.h) instead of text lines, set by 'S' command
+#endif /* BINARY_LINK */
 static byte errorsLargePacket = 0;
 static byte controlLevel = 1; // for F-series L5 mode
 #ifdef ENABLE_INSERT_MESSAGE
@@ -170,26 +181,16 @@ static byte counterRepeatingRequest = 0;
 
 byte save_MCUSR;
 
-byte setRequestDHW = 0;
-byte setStatusDHW = 0;
-
 uint16_t setParam35 = PARAM_HC_ONOFF;
-byte setRequest35 = 0;
-uint16_t setValue35 = 0;
-
 uint16_t setParam36 = PARAM_TEMP;
-byte setRequest36 = 0;
-uint16_t setValue36 = 0;
-
 uint16_t setParam3A = PARAM_SYS;
-byte setRequest3A = 0;
-byte setValue3A = 0;
 
 uint8_t wr_cnt = 0;
-uint8_t wr_req = 0;
+uint8_t wr_req = 0; // number of parameters first written in the reply being scheduled
 uint8_t wr_pt = 0;
 uint16_t wr_nr = 0;
 uint32_t wr_val = 0;
+byte replyStale = 1; // pending writes changed since the E-series reply templates were compiled
 
 byte Tmin = 0;
 byte Tminprev = 61;
@@ -275,6 +276,10 @@ void setup() {
     Serial.print(F("* KLICDA_DELAY="));
     Serial.println(KLICDA_DELAY);
 #endif /* KLICDA_DELAY */
+#ifdef KLICDA_GAP
+    Serial.print(F("* KLICDA_GAP="));
+    Serial.println(KLICDA_GAP);
+#endif /* KLICDA_GAP */
 #endif /* KLICDA */
     Serial.print(F("* CONTROL_ID_DEFAULT=0x"));
     Serial.println(CONTROL_ID_DEFAULT, HEX);
@@ -291,10 +296,17 @@ void setup() {
   }
   P1P2Serial.begin(9600, hwID ? true : false, 6, 7); // if hwID = 1, use ADC6 and ADC7
   P1P2Serial.setEcho(echo);
+  P1P2Serial.setCRC(CRC_GEN, CRC_FEED);
 #ifdef SW_SCOPE
   P1P2Serial.setScope(scope);
 #endif
+#ifdef EVENT_HANDLERS
+  P1P2Serial.setHandler(P1P2_EVENT_PACKET, handlePacket);
+#endif /* EVENT_HANDLERS */
   P1P2Serial.setDelayTimeout(sdto);
+#ifdef TX_RETRY
+  P1P2Serial.setRetry(WRITE_RETRIES, WRITE_BACKOFF);
+#endif /* TX_RETRY */
   Serial.println(F("* Ready setup"));
 }
 
@@ -310,25 +322,92 @@ int scanhex(char* s, uint16_t &b) {
 static byte crc_gen = CRC_GEN;
 static byte crc_feed = CRC_FEED;
 
+// Line formatter for packet output: a line is rendered in LB (hex via a nibble table) and handed to Serial in a single write,
+// instead of a Serial.print() per byte, flag and field; LB is only written early if error flags do not fit
+static const char hexDigit[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+static char LB[LB_SIZE];
+static uint8_t lb = 0; // # characters in LB
+
+static void lineFlush() {
+  Serial.write((const uint8_t*) LB, lb);
+  lb = 0;
+}
+
+static inline void lineRoom(uint8_t n) {
+// makes room for n characters
+  if (lb > LB_SIZE - n) lineFlush();
+}
+
+static inline void lineChar(char c) {
+  LB[lb++] = c;
+}
+
+static void lineStr(const __FlashStringHelper* s) {
+  PGM_P p = (PGM_P) s;
+  char c;
+  while ((c = pgm_read_byte(p++))) LB[lb++] = c;
+}
+
+static inline void lineHex(uint8_t c) {
+  LB[lb++] = hexDigit[c >> 4];
+  LB[lb++] = hexDigit[c & 0x0F];
+}
+
+static void lineDec(uint32_t v, uint8_t digits) {
+// v as exactly digits decimal digits (leading zeros)
+  for (uint8_t i = digits; i--; ) {
+    LB[lb + i] = '0' + v % 10;
+    v /= 10;
+  }
+  lb += digits;
+}
+
+static void lineEnd() {
+  lineRoom(2);
+  lineChar('\r');
+  lineChar('\n');
+  lineFlush();
+}
+
+#ifdef BINARY_LINK
+// Frame writer for the binary link: a frame is COBS-encoded into LB while the record is written, and handed to Serial at once
+static_assert(P1P2_LINK_FRAME(RB_SIZE, sizeof(errorbuf_t)) <= LB_SIZE, "LB_SIZE too small for a binary link frame of RB_SIZE bytes");
+static P1P2_link_writer_t lw;
+
+static void linkStart(uint8_t flags, uint16_t delta, uint32_t time) {
+  P1P2_link_start(lw, (uint8_t*) LB);
+  P1P2_link_put(lw, flags);
+  P1P2_link_put16(lw, delta);
+  P1P2_link_put32(lw, time);
+}
+
+static void linkEnd() {
+  Serial.write((const uint8_t*) LB, P1P2_link_end(lw));
+}
+#endif /* BINARY_LINK */
+
 void writePseudoPacket(byte* WB, byte rh)
 {
-  if (verbose) Serial.print(F("R "));
-  if (verbose & 0x01) Serial.print(F("P         "));
-  uint8_t crc = crc_feed;
+#ifdef BINARY_LINK
+  if (linkMode) {
+    linkStart(P1P2_LINK_PSEUDO, 0, 0);
+    for (uint8_t i = 0; i < rh; i++) P1P2_link_put(lw, WB[i]);
+    if (crc_gen) P1P2_link_put(lw, P1P2Serial.crc(WB, rh));
+    linkEnd();
+    return;
+  }
+#endif /* BINARY_LINK */
+  if (verbose) lineStr(F("R "));
+  if (verbose & 0x01) lineStr(F("P         "));
   for (uint8_t i = 0; i < rh; i++) {
-    uint8_t c = WB[i];
-    if (c <= 0x0F) Serial.print('0');
-    Serial.print(c, HEX);
-    if (crc_gen != 0) for (uint8_t i = 0; i < 8; i++) {
-      crc = ((crc ^ c) & 0x01 ? ((crc >> 1) ^ crc_gen) : (crc >> 1));
-      c >>= 1;
-    }
+    lineRoom(2);
+    lineHex(WB[i]);
   }
   if (crc_gen) {
-    if (crc <= 0x0F) Serial.print('0');
-    Serial.print(crc, HEX);
+    lineRoom(2);
+    lineHex(P1P2Serial.crc(WB, rh));
   }
-  Serial.println();
+  lineEnd();
 }
 
 #define PARAM_TP_START      0x35
@@ -336,18 +415,957 @@ void writePseudoPacket(byte* WB, byte rh)
 #define PARAM_ARR_SZ (PARAM_TP_END - PARAM_TP_START + 1)
 const uint32_t nr_params[PARAM_ARR_SZ] = { 0x014A, 0x002D, 0x0001, 0x001F, 0x00F0, 0x006C, 0x00AF, 0x0002, 0x0020 }; // number of parameters observed
 //byte packettype                      = {   0x35,   0x36,   0x37,   0x38,   0x39,   0x3A,   0x3B,   0x3C,   0x3D };
+#ifdef E_SERIES
+// reply descriptor per 00Fx3x packet type 0x30..0x3E: payload filler, bytes copied from the request,
+// and size of the parameter values in 0x35..0x3D parameter slots (2-byte parameter number followed by the value)
+#define REPLY_NONE  0x80 // no reply
+#define REPLY_FF    0x40 // payload filled with 0xFF, else with 0x00
+#define REPLY_COPY  0x20 // payload copied from request
+#define REPLY_COPY3 0x10 // first payload byte copied from request
+#define REPLY_VALUE 0x07 // parameter value size in bytes, 0 if no parameter slots
+#define REPLY_TYPES 15
+static const byte replyType[REPLY_TYPES] PROGMEM = {
+  0x00,                    // 0x30: in: 17 byte; out: 17 byte; WB[<type - 0x2E>] set to 0x01 to request a write in packet type <type>
+  REPLY_COPY,              // 0x31: in: 15 byte; out: 15 byte; copy of request except for CTRL_ID_1/CTRL_ID_2 in WB[7]/WB[8]
+  REPLY_COPY,              // 0x32: in: 19 byte; out: 19 byte; copy of request (on one system, the reply is all-zero)
+  REPLY_NONE,              // 0x33: not seen, no response
+  REPLY_NONE,              // 0x34: not seen, no response
+  REPLY_FF | 1,            // 0x35: in: 21 byte; out: 21 byte; 3-byte parameters, may indicate status changes (DHW, ..., 0144-/0162- device name)
+  REPLY_FF | 2,            // 0x36: in: 23 byte; out: 23 byte; 4-byte parameters
+  REPLY_FF | 3,            // 0x37: in: 23 byte; out: 23 byte; 5-byte parameters; not seen in EHVX08S23D6V
+  REPLY_FF | 4,            // 0x38: in: 21 byte; out: 21 byte; 6-byte parameters; range 0000-001E, kWh/hour counters?
+  REPLY_FF | 4,            // 0x39: in: 21 byte; out: 21 byte; 6-byte parameters
+  REPLY_FF | 1,            // 0x3A: in: 21 byte; out: 21 byte; 3-byte parameters, may indicate system status (silent, schedule, unit, DST, holiday)
+  REPLY_FF | 2,            // 0x3B: in: 23 byte; out: 23 byte; 4-byte parameters
+  REPLY_FF | 3,            // 0x3C: in: 23 byte; out: 23 byte; 5-byte parameters
+  REPLY_FF | 4,            // 0x3D: in: 21 byte; out: 21 byte; 6-byte parameters; range 0000-001F, kWh/hour counters?
+  REPLY_FF | REPLY_COPY3   // 0x3E: schedule related, 0x3E01, 0x3E02, ... in: 23 byte; out: 23 byte; 40F13E01 (even for higher) + 19xFF
+};
+
+// Parameter write queue: writes requested by the E/Z/R/N/Y commands wait here until they are packed, as many as fit,
+// into the parameter slots of the next 40Fx35..40Fx3D replies; an entry is freed when its reply has been read back
+// from the bus (or, without echo, once written), else it is written again in the next bus cycle, up to WRITE_TRIES times
+#define WRITE_QUEUED 0 // waiting to be written
+#define WRITE_SENT   1 // written, waiting to be read back
+typedef struct {
+  byte pt;      // packet type 0x35..0x3D, 0 if entry is free
+  byte state;   // WRITE_QUEUED or WRITE_SENT
+  byte at;      // first packet byte of its parameter slot in the compiled reply template, 0 if not packed
+  byte tries;   // number of times written
+  uint16_t nr;  // parameter number
+  uint32_t val; // parameter value
+} writeEntry_t;
+static writeEntry_t writeQueue[WRITE_QUEUE_SIZE];
+
+static writeEntry_t* writeQueueFind(byte pt, uint16_t nr) {
+// returns the queued write to parameter <nr> in packet type <pt>, NULL if none
+  for (byte i = 0; i < WRITE_QUEUE_SIZE; i++) if (writeQueue[i].pt && (writeQueue[i].pt == pt) && (writeQueue[i].nr == nr)) return &writeQueue[i];
+  return NULL;
+}
+
+static byte writeQueueCount() {
+  byte cnt = 0;
+  for (byte i = 0; i < WRITE_QUEUE_SIZE; i++) if (writeQueue[i].pt) cnt++;
+  return cnt;
+}
+
+static bool writeQueueAdd(byte pt, uint16_t nr, uint32_t val) {
+// queues a write, or replaces the value of a queued write to the same parameter; returns false if the queue is full
+  writeEntry_t* e = writeQueueFind(pt, nr);
+  for (byte i = 0; !e && (i < WRITE_QUEUE_SIZE); i++) if (!writeQueue[i].pt) e = &writeQueue[i];
+  if (!e) return false;
+  e->pt = pt;
+  e->state = WRITE_QUEUED;
+  e->at = 0;
+  e->tries = 0;
+  e->nr = nr;
+  e->val = val;
+  replyStale = 1;
+  return true;
+}
+
+static void writeQueueClear() {
+  memset(writeQueue, 0, sizeof(writeQueue));
+  replyStale = 1;
+}
+
+static void writeQueuePrint(writeEntry_t* e) {
+  Serial.print(F(" packet type 0x"));
+  Serial.print(e->pt, HEX);
+  Serial.print(F(" parameter nr 0x"));
+  Serial.print(e->nr, HEX);
+  Serial.print(F(" value 0x"));
+  Serial.print(e->val, HEX);
+}
+
+static void writeCommand(byte pt, uint16_t nr, uint32_t val) {
+// queues a write for the Z/R/N/Y commands, continuing the line which shows the parameter number
+  if (!writeQueueAdd(pt, nr, val)) {
+    Serial.println(F(": write command ignored - parameter write queue full"));
+    return;
+  }
+  if (!writePermission) Serial.print(F(": currently no write budget left, write waits for budget"));
+  if (!verbose) {
+    Serial.println();
+    return;
+  }
+  Serial.print(F(" will be set to 0x"));
+  Serial.println(val, HEX);
+}
+
+static void writeStatus(byte pt, uint16_t nr) {
+// reports a queued write for the z/r/n/y commands, continuing the line which shows the parameter number
+  writeEntry_t* e = writeQueueFind(pt, nr);
+  if (!e) {
+    Serial.println(F(": no write-request pending"));
+    return;
+  }
+  Serial.print(F(": write-request to value 0x"));
+  Serial.print(e->val, HEX);
+  Serial.println((e->state == WRITE_SENT) ? F(" written, not yet read back") : F(" pending"));
+}
+#endif /* E_SERIES */
 
 void(* resetFunc) (void) = 0; // declare reset function at address 0
 
+static byte pseudo0C = 0;
+static byte pseudo0C_isr = 0;
 static byte pseudo0D = 0;
+#ifdef ADC_BITSYNC
+static byte pseudo0D_source = 0;
+#endif /* ADC_BITSYNC */
+#ifdef ADC_STREAM
+static byte pseudo0D_channel = 0;
+#endif /* ADC_STREAM */
 static byte pseudo0E = 0;
 static byte pseudo0F = 0;
 
 uint8_t scope_budget = 200;
 
+#if defined E_SERIES && defined MONITORCONTROL
+// Reply templates for the 00Fx3x polls, compiled from replyType[] and the pending writes by replyCompile()
+// only if these have changed (replyStale): per packet type an overlay of fixed bytes (0x30 write flags, CTRL_ID,
+// parameter slots) on top of the filled or copied payload, so replyBuild() is a memset or memcpy plus a memcpy
+typedef struct {
+  byte at;  // first packet byte of the overlay
+  byte len; // overlay length, 0 if none
+  byte pos; // overlay start in replyOverlay[]
+} replyTemplate_t;
+#define REPLY_OVERLAY_SIZE (15 + 6 * WRITE_QUEUE_SIZE) // fits the 0x30 write flags, CTRL_ID and the parameter slots of all queued writes
+static replyTemplate_t replyTemplate[REPLY_TYPES];
+static byte replyOverlay[REPLY_OVERLAY_SIZE];
+static byte replyFree = 0;
+static byte replyCompiled = 0; // incremented by each replyCompile()
+
+static byte* replyReserve(byte type, byte at, byte len) {
+// reserves an overlay of <len> bytes from packet byte <at> in the reply to <type>, initialised to the payload filler
+  if (replyFree + len > REPLY_OVERLAY_SIZE) return NULL;
+  replyTemplate_t* t = &replyTemplate[type - 0x30];
+  t->at = at;
+  t->len = len;
+  t->pos = replyFree;
+  byte* o = replyOverlay + replyFree;
+  memset(o, (pgm_read_byte(&replyType[type - 0x30]) & REPLY_FF) ? 0xFF : 0x00, len);
+  replyFree += len;
+  return o;
+}
+
+static byte* replyParam(byte* o, uint16_t nr, uint32_t val, byte size) {
+// fills a parameter slot: parameter number and <size>-byte value, both little-endian
+  *o++ = nr & 0xFF;
+  *o++ = nr >> 8;
+  while (size--) {
+    *o++ = val & 0xFF;
+    val >>= 8;
+  }
+  return o;
+}
+
+static void replyCompile() {
+// compiles the reply templates for the current pending writes
+  uint16_t pending = 0; // bit <type - 0x30> set for packet types carrying a pending write
+  replyFree = 0;
+  memset(replyTemplate, 0, sizeof(replyTemplate));
+#if defined CTRL_ID_1 && defined CTRL_ID_2
+  byte* o = replyReserve(0x31, 7, 2);
+  o[0] = CTRL_ID_1;
+  o[1] = CTRL_ID_2;
+#elif defined CTRL_ID_1
+  *replyReserve(0x31, 7, 1) = CTRL_ID_1;
+#elif defined CTRL_ID_2
+  *replyReserve(0x31, 8, 1) = CTRL_ID_2;
+#endif /* CTRL_ID_1 && CTRL_ID_2 */
+  // pack the queued writes per packet type, first writes only within the write budget (writePermission),
+  // of which each reply carrying first writes costs one unit, as a single write did before
+  byte budget = writePermission;
+  for (byte i = 0; i < WRITE_QUEUE_SIZE; i++) writeQueue[i].at = 0;
+  for (byte type = PARAM_TP_START; type <= PARAM_TP_END; type++) {
+    byte size = pgm_read_byte(&replyType[type - 0x30]) & REPLY_VALUE;
+    byte len = 0;
+    byte first = 0;
+    for (byte i = 0; i < WRITE_QUEUE_SIZE; i++) {
+      writeEntry_t* e = &writeQueue[i];
+      if ((e->pt != type) || (e->state != WRITE_QUEUED) || (3 + len + size + 2 > WB_SIZE)) continue;
+      if (!e->tries) {
+        if (!budget) continue;
+        first = 1;
+      }
+      e->at = 3 + len;
+      len += size + 2;
+    }
+    if (!len) continue;
+    if (first && (budget != 0xFF)) budget--;
+    byte* p = replyReserve(type, 3, len);
+    for (byte i = 0; i < WRITE_QUEUE_SIZE; i++) {
+      writeEntry_t* e = &writeQueue[i];
+      if ((e->pt == type) && e->at) replyParam(p + e->at - 3, e->nr, e->val, size);
+    }
+    pending |= 1 << (type - 0x30);
+  }
+  // 0x30: payload byte <type - 0x2E> set to 0x01 to request a 00Fx<type> poll for each packet type carrying a pending write
+  byte last = PARAM_TP_END;
+  while ((last >= PARAM_TP_START) && !(pending & (1 << (last - 0x30)))) last--;
+  if (last >= PARAM_TP_START) {
+    byte* f = replyReserve(0x30, 3, last - 0x30);
+    if (f) for (byte type = PARAM_TP_START; type <= last; type++) if (pending & (1 << (type - 0x30))) f[type - 0x31] = 0x01;
+  }
+  replyStale = 0;
+  replyCompiled++;
+}
+
+static byte replyBuild(byte n) {
+// builds in WB the n-byte reply to the n-byte (without CRC) 00Fx3x request in RB; returns 0 if there is no reply
+  if (RB[2] > 0x3E) return 0;
+  if (replyStale) replyCompile();
+  byte d = pgm_read_byte(&replyType[RB[2] - 0x30]);
+  if (d & REPLY_NONE) return 0;
+  if (d & REPLY_COPY) {
+    memcpy(WB + 3, RB + 3, n - 3);
+  } else {
+    memset(WB + 3, (d & REPLY_FF) ? 0xFF : 0x00, n - 3);
+  }
+  if (d & REPLY_COPY3) WB[3] = RB[3];
+  replyTemplate_t* t = &replyTemplate[RB[2] - 0x30];
+  if (t->len && (t->at < n)) memcpy(WB + t->at, replyOverlay + t->pos, (t->at + t->len > n) ? n - t->at : t->len);
+  return n;
+}
+
+static void replyWritten(byte type, byte n) {
+// marks the queued writes carried by the n-byte reply to <type> as sent, charging one unit of the write budget if it carries first writes
+  byte size = pgm_read_byte(&replyType[type - 0x30]) & REPLY_VALUE;
+  byte cnt = 0;
+  byte first = 0;
+  if (!size) return;
+  for (byte i = 0; i < WRITE_QUEUE_SIZE; i++) {
+    writeEntry_t* e = &writeQueue[i];
+    if ((e->pt != type) || !e->at || (e->at + size + 2 > n)) continue;
+    if (!e->tries++) {
+      wr_req++;
+      first = 1;
+    }
+    e->state = WRITE_SENT;
+    if (!echo) e->pt = 0; // without echo, the reply cannot be read back, so it is written only once
+    cnt++;
+  }
+  if (!cnt) return;
+  if (first && writePermission && (writePermission != 0xFF)) writePermission--;
+  Serial.print(F("* Writing "));
+  Serial.print(cnt);
+  Serial.print(F(" parameter(s) in packet type 0x"));
+  Serial.println(type, HEX);
+  replyStale = 1;
+}
+
+static void writeQueuePoll() {
+// called for each 00Fx30 poll to CONTROL_ID: writes not read back during the previous bus cycle are written again, or dropped after WRITE_TRIES
+  for (byte i = 0; i < WRITE_QUEUE_SIZE; i++) {
+    writeEntry_t* e = &writeQueue[i];
+    if (!e->pt || (e->state != WRITE_SENT)) continue;
+    if (e->tries < WRITE_TRIES) {
+      e->state = WRITE_QUEUED;
+    } else {
+      Serial.print(F("* Dropping parameter write, not read back:"));
+      writeQueuePrint(e);
+      Serial.println();
+      e->pt = 0;
+    }
+    replyStale = 1;
+  }
+}
+
+static void writeQueueReadBack(byte n) {
+// frees the queued writes found in our own n-byte (without CRC) 40Fx35..40Fx3D reply read back in RB; this only shows that the reply was
+// on the bus without collision, not that the main controller accepted the value
+  if ((RB[2] < PARAM_TP_START) || (RB[2] > PARAM_TP_END)) return;
+  byte size = pgm_read_byte(&replyType[RB[2] - 0x30]) & REPLY_VALUE;
+  for (byte w = 3; w + size + 2 <= n; w += size + 2) {
+    writeEntry_t* e = writeQueueFind(RB[2], RB[w] | (RB[w + 1] << 8));
+    if (!e || (e->state != WRITE_SENT)) continue;
+    uint32_t val = 0;
+    for (byte i = w + size + 1; i > w + 1; i--) val = (val << 8) | RB[i];
+    if (val != e->val) continue;
+    if (verbose) {
+      Serial.print(F("* Parameter write read back:"));
+      writeQueuePrint(e);
+      Serial.println();
+    }
+    e->pt = 0;
+  }
+}
+#endif /* E_SERIES && MONITORCONTROL */
+
+#if defined AUTO_REPLY && defined TX_REPLY && defined E_SERIES && defined MONITORCONTROL
+// library reply slots for the 00Fx3x polls, in order of precedence
+#define AUTO_REPLY_30 0 // 0x30: empty payload, except flags requesting a 0x35/0x36/0x3A/0x3x write
+#define AUTO_REPLY_31 1 // 0x31: copy of request, except CTRL_ID_1/CTRL_ID_2
+#define AUTO_REPLY_32 2 // 0x32: copy of request
+#define AUTO_REPLY_3X 3 // 0x35..0x3D: all parameters FF, only if no parameter write is queued
+#define AUTO_REPLY_3E 4 // 0x3E: copy of byte 3, others FF
+static uint8_t autoReplyKey = 0;   // state the slots have been loaded for, 0 if cleared
+static uint8_t autoReplyId = CONTROL_ID_NONE;
+static uint8_t autoReplyCompiled = 0;
+
+static void autoReplySlot(uint8_t slot, byte type_first, byte type_last, uint8_t count, uint16_t delay) {
+// loads a reply slot with the reply template of packet type type_first, for packet types type_first..type_last
+  if (slot >= TX_REPLY_SLOTS) return; // these polls are answered by loop()
+  tx_reply_t r;
+  byte d = pgm_read_byte(&replyType[type_first - 0x30]);
+  replyTemplate_t* t = &replyTemplate[type_first - 0x30];
+  memset(&r, 0, sizeof(r));
+  r.header[0] = 0x00;
+  r.header[1] = CONTROL_ID;
+  r.type_first = type_first;
+  r.type_last = type_last;
+  r.count = count;
+  r.delay = delay;
+  r.deadline = WRITE_DEADLINE;
+  r.priority = PRIO_REPLY;
+  r.data[0] = 0x40;
+  if (d & REPLY_COPY) {
+    r.copy = 0xFFFFFFFE;
+  } else {
+    r.copy = (d & REPLY_COPY3) ? 0x0000000E : 0x00000006; // address, packet type, and first payload byte if REPLY_COPY3
+    memset(r.data + 3, (d & REPLY_FF) ? 0xFF : 0x00, TX_REPLY_SIZE - 3);
+  }
+  for (byte i = 0; (i < t->len) && (t->at + i < TX_REPLY_SIZE); i++) {
+    r.data[t->at + i] = replyOverlay[t->pos + i];
+    r.copy &= ~(1UL << (t->at + i));
+  }
+  P1P2Serial.setReply(slot, r);
+}
+
+static void autoReplyUpdate() {
+// (re)loads the reply slots if the auxiliary controller state or the reply templates have changed since they were loaded
+  uint8_t key = 0;
+  if (CONTROL_ID && (FxAbsentCnt[CONTROL_ID & 0x01] == F0THRESHOLD)
+#ifdef ENABLE_INSERT_MESSAGE
+      && !insertMessageCnt && !restartDaikinCnt
+#endif /* ENABLE_INSERT_MESSAGE */
+     ) {
+    key = 0x01;
+#ifndef KLICDA
+    if (!counterRequest || (CONTROL_ID != CONTROL_ID_0)) // else every 4th 00F030 slot is used for a counter request
+#endif /* KLICDA */
+      key |= 0x02;
+    if (!writeQueueCount()) key |= 0x04;
+  }
+  if (replyStale) replyCompile();
+  if ((key == autoReplyKey) && (CONTROL_ID == autoReplyId) && (replyCompiled == autoReplyCompiled)) return;
+  autoReplyKey = key;
+  autoReplyId = CONTROL_ID;
+  autoReplyCompiled = replyCompiled;
+  uint8_t count = (key & 0x01) ? P1P2_REPLY_ALWAYS : 0;
+  autoReplySlot(AUTO_REPLY_30, 0x30, 0x30, (key & 0x02) ? P1P2_REPLY_ALWAYS : 0, F030DELAY);
+  autoReplySlot(AUTO_REPLY_31, 0x31, 0x31, count, F03XDELAY);
+  autoReplySlot(AUTO_REPLY_32, 0x32, 0x32, count, F03XDELAY);
+  autoReplySlot(AUTO_REPLY_3X, 0x35, 0x3D, (key & 0x04) ? count : 0, F03XDELAY);
+  autoReplySlot(AUTO_REPLY_3E, 0x3E, 0x3E, count, F03XDELAY);
+}
+#endif /* AUTO_REPLY && TX_REPLY && E_SERIES && MONITORCONTROL */
+
+void handlePacket(uint8_t event) {
+// reads, processes and prints one packet; called by P1P2Serial.dispatch() (EVENT_HANDLERS), or from loop()
+  int32_t upt = P1P2Serial.uptime_sec();
+  uint16_t delta;
+  errorbuf_t readError = 0;
+  int nread = P1P2Serial.readpacket(RB, delta, EB, RB_SIZE, crc_gen, crc_feed);
+  if (nread > RB_SIZE) {
+    Serial.println(F("* Received packet longer than RB_SIZE"));
+    nread = RB_SIZE;
+    readError = 0xFF;
+    if (errorsLargePacket < 0xFF) errorsLargePacket++;
+  }
+  readError |= P1P2Serial.packeterrors();
+#if defined TIMESTAMP_US || defined BINARY_LINK
+  // extend library timestamp (CPU cycles, wraps every 2^32 cycles) to a microsecond counter
+  uint32_t packetTime = P1P2Serial.packettime();
+  uint32_t packetCycles = packetTime - packetTimePrev + packetTimeRest;
+  packetTimePrev = packetTime;
+  packetTimeUs += packetCycles / (F_CPU / 1000000L);
+  packetTimeRest = packetCycles % (F_CPU / 1000000L);
+#endif /* TIMESTAMP_US || BINARY_LINK */
+#ifdef SW_SCOPE
+
+  if (scope && ((readError && (scope_budget > 5)) || (((RB[0] == 0x40) && (RB[1] == 0xF0)) && (scope_budget > 50)) || (scope_budget > 150))) {
+    // always keep scope write budget for 40F0 and expecially for readErrors
+    if (sws_bitcnt) {
+      scope_budget -= 5;
+      if (readError) {
+        Serial.print(F("C "));
+      } else {
+        Serial.print(F("c "));
+      }
+      if (RB[0] < 0x10) Serial.print('0');
+      Serial.print(RB[0], HEX);
+      if (RB[1] < 0x10) Serial.print('0');
+      Serial.print(RB[1], HEX);
+      if (RB[2] < 0x10) Serial.print('0');
+      Serial.print(RB[2], HEX);
+      Serial.print(' ');
+      // one character per bit (read: S start, 0/1 data and parity bits; write: \ / edges, - high semibit),
+      // followed by (+-n) if the edge deviates more than 1us from the previously shown deviation
+      P1P2_sws_reader_t sws;
+      byte sws_ev;
+      int16_t sws_dev;
+      int16_t sws_dev_shown[2] = { 0, 0 }; // falling edges, rising edges (when reading: start bits)
+      P1P2_sws_init(sws, sws_buffer, sws_bitcnt);
+      while (P1P2_sws_next(sws, sws_ev, sws_dev)) {
+        byte sws_state = sws_ev & 0x1F;
+        switch (sws_ev) {
+          // error events
+          case SWS_EVENT_ERR_BE      : Serial.print(F("[BE]")); continue;
+          case SWS_EVENT_ERR_BE_FAKE : Serial.print(F("[be]")); continue;
+          case SWS_EVENT_ERR_SB      : Serial.print(F("[SB]")); continue;
+          case SWS_EVENT_ERR_SB_FAKE : Serial.print(F("[sb]")); continue;
+          case SWS_EVENT_ERR_BC      : Serial.print(F("[BC]")); continue;
+          case SWS_EVENT_ERR_BC_FAKE : Serial.print(F("[bc]")); continue;
+          case SWS_EVENT_ERR_PE      : Serial.print(F("[PE]")); continue;
+          case SWS_EVENT_ERR_PE_FAKE : Serial.print(F("[pe]")); continue;
+          case SWS_EVENT_ERR_LOW     : Serial.print(F("[LW]")); continue;
+        }
+        // read/write related events
+        switch (sws_ev & SWS_EVENT_MASK) {
+          case SWS_EVENT_EDGE_FALLING_R : if (sws_state < 2) {
+                                            Serial.print(F(" S")); // start bit
+                                          } else if (sws_state < 11) {
+                                            Serial.print('0');     // data or parity bit
+                                          } else {
+                                            Serial.print('!');     // falling edge in stop bit
+                                          }
+                                          break;
+          case SWS_EVENT_SIGNAL_HIGH_R  : if (sws.mode == SWS_MODE_WRITE) {
+                                            Serial.print('-');
+                                          } else if (sws_state < 11) {
+                                            Serial.print('1');     // data or parity bit, stop bit not shown
+                                          }
+                                          continue;
+          case SWS_EVENT_EDGE_FALLING_W : if (sws_state == 1) Serial.print(' ');
+                                          Serial.print('\\');
+                                          break;
+          case SWS_EVENT_EDGE_RISING    : Serial.print('/');
+                                          break;
+          case SWS_EVENT_EDGE_SPIKE     : Serial.print('X');
+                                          break;
+          default                       : Serial.print('?');
+                                          continue;
+        }
+        int16_t &shown = sws_dev_shown[((sws_ev & SWS_EVENT_MASK) == SWS_EVENT_EDGE_RISING) ||
+                                       (((sws_ev & SWS_EVENT_MASK) == SWS_EVENT_EDGE_FALLING_R) && (sws_state < 2))];
+        if ((sws_dev > shown + 1) || (sws_dev < shown - 1)) {
+          Serial.print('(');
+          if (sws_dev > 0) Serial.print('+');
+          Serial.print(sws_dev);
+          Serial.print(')');
+          if ((sws_ev & SWS_EVENT_MASK) != SWS_EVENT_EDGE_SPIKE) shown = sws_dev;
+        }
+      }
+      if (sws_overflow) Serial.print(F(" .."));
+      Serial.println();
+    }
+  }
+  if (++scope_budget > 200) scope_budget = 200;
+  sws_block = 0; // release SW_SCOPE for next log operation
+#endif
+  if ((readError & ERROR_REAL_MASK) && upt) { // don't count errors while upt == 0
+    if (readErrors < 0xFF) {
+      readErrors++;
+      readErrorLast = readError;
+    }
+    if (errorsPermitted) {
+      errorsPermitted--;
+      if (!errorsPermitted) {
+        Serial.println(F("* WARNING: too many read errors detected"));
+        if (counterRepeatingRequest) Serial.println(F("* Switching counter request function off"));
+        if (CONTROL_ID) Serial.println(F("* Switching control functionality off"));
+        CONTROL_ID = CONTROL_ID_NONE;
+        counterRepeatingRequest = 0;
+        counterRequest = 0;
+        Serial.println(F("* Warning: Upon ATmega restart auxiliary controller functionality and counter request functionality will remain switched off"));
+        EEPROM_update(EEPROM_ADDRESS_CONTROL_ID, CONTROL_ID);
+        EEPROM_update(EEPROM_ADDRESS_COUNTER_STATUS, counterRepeatingRequest);
+        wr_cnt = 0;
+#ifdef E_SERIES
+        writeQueueClear();
+#endif /* E_SERIES */
+      }
+    }
+  }
+#ifdef MONITORCONTROL
+  if (!readError) {
+    // message received, no error detected, no buffer overrun
+#if (defined F_SERIES) && ((defined FDY) || (defined FDYQ))
+    byte w;
+#endif /* F_SERIES && (FDY || FDYQ) */
+    if ((nread > 9) && (RB[0] == 0x00) && (RB[1] == 0x00) && (RB[2] == 0x12)) {
+      // obtain day-of-week, hour, minute
+      Tmin = RB[6];
+      if (Tmin != Tminprev) {
+        if (counterRepeatingRequest && !counterRequest) counterRequest = 1;
+        Tminprev = Tmin;
+      }
+    }
+    bool F030forcounter = false;
+    uint8_t packetReplied = P1P2Serial.packetreply(); // reply already built by the library (AUTO_REPLY)
+#ifdef KLICDA
+    // request one counter per cycle in short pause after first 0012 msg at start of each minute
+    if ((nread > 4) && (RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x12)) {
+      if (counterRequest) {
+        WB[0] = 0x00;
+        WB[1] = 0x00;
+        WB[2] = 0xB8;
+        WB[3] = (counterRequest - 1);
+        // write KLICDA_DELAY ms after 400012 message
+        // pause after 400012 is around 47 ms for some systems which is long enough for a 0000B8*/4000B8* counter request/response pair
+        // in exceptional cases (1 in 300 in my system) the pause after 400012 is only 27ms,
+        //      in which case the 4000B* reply arrives after the 000013* request
+        //      (and in thoses cases the 000013* request is ignored)
+        //      (NOTE!: if KLICDA_DELAY is chosen incorrectly, such as 5 ms in some example systems, this results in incidental bus collisions)
+#if defined KLICDA_GAP && defined BUS_CYCLE_LEARNER
+        // with KLICDA_GAP, write KLICDA_DELAY ms after the first packet (this one or later) which, as learned by the library,
+        // is followed by a pause long enough for the counter request/response pair, avoiding such short pauses
+        if (!P1P2Serial.schedulegap(WB, 4, KLICDA_DELAY, KLICDA_GAP, KLICDA_GAP_RISK, NULL, 0, PRIO_REQUEST, WRITE_DEADLINE, crc_gen, crc_feed)) {
+#else /* KLICDA_GAP && BUS_CYCLE_LEARNER */
+        if (!P1P2Serial.schedulepacket(WB, 4, KLICDA_DELAY, sdto, PRIO_REQUEST, WRITE_DEADLINE, crc_gen, crc_feed)) {
+#endif /* KLICDA_GAP && BUS_CYCLE_LEARNER */
+          Serial.println(F("* Refusing to write counter-request packet, write queue full"));
+          if (writeRefused < 0xFF) writeRefused++;
+        }
+        if (++counterRequest == 7) counterRequest = 0; // wait until next new minute; change 0 to 1 to continuously request counters for increased resolution
+      }
+    }
+#else /* KLICDA */
+    if ((FxAbsentCnt[0] == F0THRESHOLD) && counterRequest && !packetReplied && (nread > 4) && (RB[0] == 0x00) && (RB[1] == 0xF0) && (RB[2] == 0x30)) {
+      // 00F030 request message received; counterRequest > 0 so hijack every 4th time slot to request counters
+      // but only if auxiliary F0 controller has not been detected (so check on FxAbsentCnt[0])
+      // This works only if there is no other auxiliary controller responding to 0xF0, TODO: in that case extend to hijack 0xF1 timeslot
+      if ((counterRequest & 0x03) == 0x01) {
+        WB[0] = 0x00;
+        WB[1] = 0x00;
+        WB[2] = 0xB8;
+        WB[3] = counterRequest >> 2;
+        F030forcounter = true;
+        if (!P1P2Serial.schedulepacket(WB, 4, F03XDELAY, sdto, PRIO_REQUEST, WRITE_DEADLINE, crc_gen, crc_feed)) {
+          Serial.println(F("* Refusing to write counter-request packet, write queue full"));
+          if (writeRefused < 0xFF) writeRefused++;
+        }
+      }
+      if (++counterRequest == 22) counterRequest = 0;
+    }
+#endif /* KLICDA */
+    if ((nread > 4) && (RB[0] == 0x40) && ((RB[1] & 0xFE) == 0xF0) && ((RB[2] & 0x30) == 0x30)) {
+      // 40Fx3x auxiliary controller reply received - note this could be our own (slow, delta=F030DELAY or F03XDELAY) reply so only reset count if delta < min(F03XDELAY, F030DELAY) (- margin)
+      // Note for developers using >1 P1P2Monitor-interfaces (=to self): this detection mechanism fails if there are 2 P1P2Monitor programs (and adapters) with same delay settings on the same bus.
+      // check if there is any auxiliary controller on 0x30 (including P1P2Monitor self, requires echo)
+      if (RB[2] == 0x30) FxAbsentCntInclOwn[RB[1] & 0x01] = 0;
+#ifdef E_SERIES
+      // our own reply read back completes the parameter writes it carries
+      if (RB[1] == CONTROL_ID) writeQueueReadBack(crc_gen ? nread - 1 : nread);
+#endif /* E_SERIES */
+      Fx30ReplyDelay[RB[1] & 0x01] = (delta & 0xFF00) ? 0xFF : (delta & 0xFF);
+      // check if there is any other auxiliary controller on 0x3x
+      if ((delta < F03XDELAY - 2) && (delta < F030DELAY - 2)) {
+        FxAbsentCnt[RB[1] & 0x01] = 0;
+        if (RB[1] == CONTROL_ID) {
+          // this should only happen if another auxiliary controller is connected if/after CONTROL_ID is set, either because
+          //    -CONTROL_ID_DEFAULT is set and conflicts with auxiliary controller, or
+          //    -because another auxiliary controller has been connected after CONTROL_ID has been manually set
+          Serial.print(F("* Warning: another auxiliary controller is answering to address 0x"));
+          Serial.print(RB[1], HEX);
+          Serial.println(F(" detected"));
+          CONTROL_ID = CONTROL_ID_NONE;
+          EEPROM_update(EEPROM_ADDRESS_CONTROL_ID, CONTROL_ID);
+          wr_cnt = 0;
+#ifdef E_SERIES
+          writeQueueClear();
+#endif /* E_SERIES */
+        }
+      }
+    } else if ((nread > 4) && (RB[0] == 0x00) && ((RB[1] & 0xFE) == 0xF0) && ((RB[2] & 0x30) == 0x30) && !F030forcounter) {
+      // 00Fx3x request message received, and we did not use this slot to request counters
+#ifdef E_SERIES
+      // a new bus cycle: write again what was not read back in the previous one
+      if ((RB[2] == 0x30) && (RB[1] == CONTROL_ID)) writeQueuePoll();
+#endif /* E_SERIES */
+      // check if there is any controller on 0x30 (including P1P2Monitor self, requires echo)
+      if (RB[2] == 0x30) {
+        if (FxAbsentCntInclOwn[RB[1] & 0x01] > 1) {
+          Fx30ReplyDelay[RB[1] & 0x01] = 0;
+        } else {
+          FxAbsentCntInclOwn[RB[1] & 0x01]++;
+        }
+      }
+      // check if there is no other auxiliary controller
+      if ((RB[2] == 0x30) && (FxAbsentCnt[RB[1] & 0x01] < F0THRESHOLD)) {
+        FxAbsentCnt[RB[1] & 0x01]++;
+        if (FxAbsentCnt[RB[1] & 0x01] == F0THRESHOLD) {
+          Serial.print(F("* No auxiliary controller answering to address 0x"));
+          Serial.print(RB[1], HEX);
+          if (CONTROL_ID == RB[1]) {
+            Serial.println(F(" detected, control functionality will restart"));
+            insertMessageCnt = 0;  // avoid delayed insertMessage/restartDaikin
+            restartDaikinCnt = 0;
+          } else {
+            Serial.println(F(" detected, switching control functionality can be switched on (using L1)"));
+          }
+        }
+      }
+      // act as auxiliary controller (unless the library has replied already):
+      if (!packetReplied && ((CONTROL_ID && (FxAbsentCnt[CONTROL_ID & 0x01] == F0THRESHOLD) && (RB[1] == CONTROL_ID))
+#ifdef ENABLE_INSERT_MESSAGE
+          || ((insertMessageCnt || restartDaikinCnt) && (RB[0] == 0x00) && (RB[1] == 0xF0) 
+#ifndef ENABLE_INSERT_MESSAGE_3x
+                                                                                           && (RB[2] == 0x30)
+#endif
+                                                                                                             )
+#endif
+                                                                                                   )) {
+        WB[0] = 0x40;
+        WB[1] = RB[1];
+        WB[2] = RB[2];
+        int n = nread;
+        int d = F03XDELAY;
+        bool wr = 0;
+#ifdef E_SERIES
+        bool built = 0; // reply built from its template, may carry queued parameter writes
+#endif /* E_SERIES */
+        if (crc_gen) n--; // omit CRC from received-byte-counter
+        if (n > WB_SIZE) {
+          n = WB_SIZE;
+          Serial.print(F("* Surprise: received 00Fx3x packet of size "));
+          Serial.println(nread); }
+#ifdef E_SERIES
+#ifdef ENABLE_INSERT_MESSAGE
+        if ((RB[2] == 0x30) && (insertMessageCnt || restartDaikinCnt)) {
+          for (int i = 0; i < insertMessageLength; i++) WB[i] = insertMessage[i];
+          if (insertMessageCnt) {
+            Serial.println(F("* Insert user-specified message"));
+            insertMessageCnt--;
+          }
+          if (restartDaikinCnt) {
+            Serial.println(F("* Attempt to restart Daikin"));
+            WB[RESTART_PACKET_PAYLOAD_BYTE + 3] |= RESTART_PACKET_BYTE;
+            restartDaikinCnt--;
+          }
+          d = F030DELAY_INSERT;
+          n = insertMessageLength;
+          wr = 1;
+        } else
+#endif /* ENABLE_INSERT_MESSAGE */
+        if ((n = replyBuild(n))) {
+          // reply built from its template, see replyType[] for the reply per packet type
+          if (RB[2] == 0x30) d = F030DELAY;
+          built = 1;
+          wr = 1;
+        }
+#endif /* E_SERIES */
+        switch (RB[2]) {
+#ifdef F_SERIES
+          case 0x30 : // all models: polling auxiliary controller, reply with empty payload
+            d = F030DELAY;
+            wr = 1;
+            n = 3;
+            break;
+#ifdef FDY
+          case 0x38 : // FDY control message, copy bytes back and change if 'F' command is given
+            wr = controlLevel;
+            n = 18;
+            for (w = 13; w <= 15; w++) WB[w] = 0x00;
+            WB[3]  = RB[3] & 0x01;           // W target status
+            WB[4]  = (RB[5] & 0x07) | 0x60;  // W target operating mode
+            WB[5]  = RB[7];                  // W target temperature cooling
+            WB[6]  = 0x00;                   //   clear change flag 80 from input (alternative:? WB[6] = RB[8] & 0x7F)
+            WB[7]  = (RB[9] & 0x60) | 0x11;  // W target fan speed cooling/fan    (alternative: WB[7] = RB[9] & 0x7F might work too)
+            WB[8]  = 0x00;                   //   clear change flag 80 from input
+            WB[9]  = RB[11];                 // W target temperature heating
+            WB[10] = 0x00;                   //   clear change flag from input    (alternative:? WB[10] = RB[12] & 0x7F)
+            WB[11] = (RB[13] & 0x60) | 0x11; // W target fan speed heating;       (alternative: WB[11] = RB[13] & 0x7F might work too)
+            WB[12] = RB[14] & 0x7F;          //   clear change flag from input
+            WB[16] = RB[18];                 //   target fan mode ?? & 0x03 ?
+            WB[17] = 0x00;                   //   ? (change flag, & 0x7F ?)
+            if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
+            break;
+          case 0x39 : // guess that this is filter for FDY, reply with 4-byte payload
+            wr = controlLevel;
+            n = 7;
+            WB[3] = 0x00;
+            WB[4] = 0x00;
+            WB[5] = RB[11];
+            WB[6] = RB[12];
+            if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
+            break;
+#endif
+#ifdef FDYQ
+          case 0x37 : // FDYQ zone name packet, reply with empty payload
+            wr = controlLevel;
+            n = 3;
+            break;
+          case 0x3B : // FDYQ control message, copy bytes back and change if 'F' command is given
+            wr = controlLevel;
+            n = 22;
+            for (w = 13; w <= 18; w++) WB[w] = 0x00;
+            WB[3]  = RB[3] & 0x01;           // W target status
+            WB[4]  = (RB[5] & 0x07) | 0x60;  // W target operating mode
+            WB[5]  = RB[7];                  // W target temperature cooling
+            WB[6]  = 0x00;                   //   clear change flag 80 from input (alternative:? WB[6] = RB[8] & 0x7F)
+            WB[7]  = (RB[9] & 0x60) | 0x11;  // W target fan speed cooling/fan    (alternative: WB[7] = RB[9] & 0x7F might work too)
+            WB[8]  = 0x00;                   //   clear change flag 80 from input
+            WB[9]  = RB[11];                 // W target temperature heating
+            WB[10] = 0x00;                   //   clear change flag from input    (alternative:? WB[10] = RB[12] & 0x7F)
+            WB[11] = (RB[13] & 0x60) | 0x11; // W target fan speed heating        (alternative: WB[11] = RB[13] & 0x7F might work too)
+            WB[12] = RB[14] & 0x7F;          //   clear change flag from input
+            WB[19] = RB[20];                 // W active hvac zones
+            WB[20] = RB[21] & 0x03;          // W target fan mode
+            WB[21] = 0x00;                   //   ? (change flag, & 0x7F ?)
+            if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
+            break;
+          case 0x3C : // FDYQ filter message, reply with 2-byte zero payload
+            wr = controlLevel;
+            n = 5;
+            WB[3] = 0x00;
+            WB[4] = 0x00;
+            if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
+            break;
+#endif
+#ifdef FXMQ
+          case 0x32 : // incoming message,  occurs only once, 8 bytes, first byte is 0xC0, others 0x00; reply is one byte value 0x01? polling auxiliary controller?, reply with empty payload
+            d = F030DELAY;
+            wr = controlLevel;
+            n = 4;
+            WB[3]  = 0x01; // W target status
+            break;
+          case 0x35 : // FXMQ outside unit name, reply with empty payload
+            wr = controlLevel;
+            n = 3;
+            break;
+          case 0x36 : // FXMQ indoor unit name, reply with empty payload
+            wr = controlLevel;
+            n = 3;
+            break;
+          case 0x38 : // FXMQ control message, copy a few bytes back, change bytes if 'F' command is given
+            wr = controlLevel;
+            n = 20;
+            WB[3]  = RB[3] & 0x01;           // W target status
+            WB[4]  = RB[5];                  // W target operating mode
+            WB[5]  = RB[7];                  // W target temperature cooling (can be changed by reply with different value)
+            WB[6]  = 0x00;
+            WB[7]  = RB[9];                  // W target fan speed cooling/fan (11 / 31 / 51) (can be changed by reply with different value)
+            WB[8]  = 0x00;
+            WB[9]  = RB[11];                 // W target temperature heating (can be changed by reply with different value)
+            WB[10] = 0x00;
+            WB[11] = RB[13];                 // W target fan speed heating/fan (11 / 31 / 51)
+            WB[12] = RB[14];                 // no flag?
+            WB[13] = 0x00;
+            WB[14] = 0x00;
+            WB[15] = 0x00;
+            WB[16] = RB[18];                 // C0, E0 when payload byte 0 set to 1
+            WB[17] = 0x00;
+            WB[18] = 0;                      // puzzle: initially 0, then 2, then 1 ????
+            WB[19] = 0x00;
+            if (wr_cnt && (wr_pt == RB[2])) {
+              if ((wr_nr == 0) && (WB[wr_nr + 3] == 0x00) && (wr_val)) WB[16] |= 0x20; // change payload byte 13 from C0 to E0, only if payload byte 0 is set to 1 here
+              WB[wr_nr + 3] = wr_val;
+              wr_cnt--;
+            }
+            break;
+          case 0x39 : // ??, reply with 5-byte all-zero payload
+            wr = controlLevel;
+            n = 8;
+            WB[3] = 0x00;
+            WB[4] = 0x00;
+            WB[5] = 0x00;
+            WB[6] = 0x00;
+            WB[7] = 0x00;
+            // for now, don't support write: if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
+            break;
+          case 0x3A : // ??, reply with 8-byte all-zero payload
+            wr = controlLevel;
+            n = 11;
+            WB[3] = 0x00;
+            WB[4] = 0x00;
+            WB[5] = 0x00;
+            WB[6] = 0x00;
+            WB[7] = 0x00;
+            WB[8] = 0x00;
+            WB[9] = 0x00;
+            // for now, don't support write: if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
+            break;
+#endif
+#endif /* F_SERIES */
+          default   : // not seen, no response
+            break;
+        }
+        if (wr) {
+          if (P1P2Serial.schedulepacket(WB, n, d, sdto, PRIO_REPLY, WRITE_DEADLINE, crc_gen, crc_feed)) {
+#ifdef E_SERIES
+            if (built) replyWritten(RB[2], n); // only now, so that a refused reply costs no write budget or try
+#endif /* E_SERIES */
+            parameterWritesDone += wr_req;
+            wr_req = 0;
+          } else {
+            Serial.println(F("* Refusing to write packet, write queue full, flushing write action"));
+            if (writeRefused < 0xFF) writeRefused++;
+            // E_SERIES: parameter writes in this reply stay queued, and are written in a later reply
+            wr_req = 0;
+          }
+        }
+      }
+    }
+  }
+#if defined AUTO_REPLY && defined TX_REPLY && defined E_SERIES
+  autoReplyUpdate();
+#endif /* AUTO_REPLY && TX_REPLY && E_SERIES */
+#endif /* MONITORCONTROL */
+#ifdef ENABLE_INSERT_MESSAGE
+  if ((insertMessageCnt == 0) && (RB[0] == 0x00) && (RB[1] == 0x00) && (RB[2] == RESTART_PACKET_TYPE)) {
+    for (int i = 0; i < nread; i++) insertMessage[i] = RB[i];
+    insertMessageLength = nread;
+    restartDaikinReady = 1;
+  }
+#endif
+#ifdef PSEUDO_PACKETS
+#ifdef E_SERIES
+  if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x10)) pseudo0D = 5; // Insert one pseudo packet 00000D in output serial after 400010
+  if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x11)) pseudo0E = 5; // Insert one pseudo packet 00000E in output serial after 400011
+  if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x12)) pseudo0F = 5; // Insert one pseudo packet 00000F in output serial after 400012
+#endif /* E_SERIES */
+#ifdef F_SERIES
+  if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x10)) pseudo0D = 5; // Insert one pseudo packet 00000D in output serial after 400010
+  if ((RB[0] == 0x00) && (RB[1] == 0x00) && (RB[2] == 0x1F)) pseudo0E = 5; // Insert one pseudo packet 00000E in output serial after 00001F
+  if ((RB[0] == 0x80) && (RB[1] == 0x00) && (RB[2] == 0x18)) pseudo0F = 5; // Insert one pseudo packet 00000F in output serial after 800018
+#endif /* F_SERIES */
+#endif /* PSEUDO_PACKETS */
+#ifdef BINARY_LINK
+  if (linkMode) {
+    if ((verbose < 4) || readError) {
+      linkStart(readError ? P1P2_link_errorflags<errorbuf_t>() : 0, delta, packetTimeUs);
+      for (int i = 0; i < nread; i++) P1P2_link_put(lw, RB[i]);
+      if (readError) {
+        P1P2_link_put_errors(lw, EB, nread);
+        P1P2_link_put16(lw, readError);
+      }
+      linkEnd();
+    }
+    return;
+  }
+#endif /* BINARY_LINK */
+  // line starts empty (LB_SIZE >= 23 for "E T 65.535 0123456789: ")
+  if (readError) {
+    lineStr(F("E "));
+  } else {
+    if (verbose && (verbose < 4)) lineStr(F("R "));
+  }
+  if (((verbose & 0x01) == 1) || readError) {
+    // 3nd-12th characters show length of bus pause (max "R T 65.535: ")
+    lineStr(F("T "));
+    uint8_t sec = delta / 1000;
+    lineChar((sec < 10) ? ' ' : '0' + sec / 10);
+    lineChar('0' + sec % 10);
+    lineChar('.');
+    lineDec(delta % 1000, 3);
+#ifdef TIMESTAMP_US
+    lineChar(' ');
+    lineDec(packetTimeUs, 10);
+#endif /* TIMESTAMP_US */
+    lineStr(F(": "));
+  }
+  if ((verbose < 4) || readError) {
+    for (int i = 0; i < nread; i++) {
+      byte c = RB[i];
+      if (verbose && EB[i]) {
+        // room for all flags of this byte
+#ifdef GENERATE_FAKE_ERRORS
+        lineRoom(53);
+#else
+        lineRoom(37);
+#endif
+        if (EB[i] & ERROR_SB) {
+          // collision suspicion due to data verification error in reading back written data
+          lineStr(F("-SB:"));
+        }
+        if (EB[i] & ERROR_BE) { // or BE3 (duplicate code)
+          // collision suspicion due to data verification error in reading back written data
+          lineStr(F("-XX:"));
+        }
+        if (EB[i] & ERROR_BC) {
+          // collision suspicion due to 0 during 2nd half bit signal read back
+          lineStr(F("-BC:"));
+        }
+        if (EB[i] & ERROR_PE) {
+          // parity error detected
+          lineStr(F("-PE:"));
+        }
+#ifdef GENERATE_FAKE_ERRORS
+        if (EB[i] & (ERROR_SB << 8)) {
+          // collision suspicion due to data verification error in reading back written data
+          lineStr(F("-sb:"));
+        }
+        if (EB[i] & (ERROR_BE << 8)) {
+          // collision suspicion due to data verification error in reading back written data
+          lineStr(F("-xx:"));
+        }
+        if (EB[i] & (ERROR_BC << 8)) {
+          // collision suspicion due to 0 during 2nd half bit signal read back
+          lineStr(F("-bc:"));
+        }
+        if (EB[i] & (ERROR_PE << 8)) {
+          // parity error detected
+          lineStr(F("-pe:"));
+        }
+#endif
+      } else {
+        lineRoom(7);
+      }
+      if (crc_gen && (verbose == 1) && (i == nread - 1)) {
+        lineStr(F(" CRC="));
+      }
+      lineHex(c);
+      if (verbose && (EB[i] & ERROR_OR)) {
+        // buffer overrun detected (overrun is after, not before, the read byte)
+        lineStr(F(":OR-"));
+      }
+      if (verbose && (EB[i] & ERROR_CRC)) {
+        // CRC error detected in readpacket
+        lineStr(F(" CRC error"));
+      }
+    }
+    if (readError) {
+      lineRoom(17);
+      lineStr(F(" readError=0x"));
+      lineHex(readError >> 8);
+      lineHex(readError & 0xFF);
+    }
+    lineEnd();
+  } else {
+    lineFlush();
+  }
+}
+
 void loop() {
   uint16_t temp;
   uint16_t temphex;
+#ifdef E_SERIES
+  uint32_t tempval;
+#endif /* E_SERIES */
   int wb = 0;
   int n;
   int wbtemp;
@@ -443,81 +1461,50 @@ void loop() {
                         Serial.println(F("* Command requires operation as auxiliary controller (L1)"));
                         break;
                       }
-                      if (wr_cnt) {
-                        // previous write still being processed
-                        Serial.println(F("* Previous parameter write action still busy"));
-                        break;
-                      } else if ( (n = sscanf(RSp, (const char*) "%2x%4x%8lx", &wr_pt, &wr_nr, &wr_val)) == 3) {
-                        if ((wr_pt < PARAM_TP_START) || (wr_pt > PARAM_TP_END)) {
+                      if ( (n = sscanf(RSp, (const char*) "%2x%4x%8lx", &temp, &temphex, &tempval)) == 3) {
+                        if ((temp < PARAM_TP_START) || (temp > PARAM_TP_END)) {
                           Serial.print(F("* wr_pt: 0x"));
-                          Serial.print(wr_pt, HEX);
+                          Serial.print(temp, HEX);
                           Serial.println(F(" out of range 0x35-0x3D"));
                           break;
                         }
-                        if (wr_nr > nr_params[wr_pt - PARAM_TP_START]) {
+                        if (temphex > nr_params[temp - PARAM_TP_START]) {
                           Serial.print(F("* wr_nr > expected: 0x"));
-                          Serial.println(wr_nr, HEX);
+                          Serial.println(temphex, HEX);
                           break;
                         }
-                        uint8_t wr_nrb;
-                        switch (wr_pt) {
-                          case 0x35 : // fallthrough
-                          case 0x3A : wr_nrb = 1; break;
-                          case 0x36 : // fallthrough
-                          case 0x3B : wr_nrb = 2; break;
-                          case 0x37 : // fallthrough
-                          case 0x3C : wr_nrb = 3; break;
-                          case 0x38 : // fallthrough
-                          case 0x39 : // fallthrough
-                          case 0x3D : wr_nrb = 4; break;
-                        }
-                        if (wr_val >> (wr_nrb << 3)) {
+                        uint8_t wr_nrb = pgm_read_byte(&replyType[temp - 0x30]) & REPLY_VALUE;
+                        if ((wr_nrb < 4) && (tempval >> (wr_nrb << 3))) {
                           Serial.print(F("* Parameter value too large for packet type; #bytes is "));
                           Serial.print(wr_nrb);
                           Serial.print(F(" value is "));
-                          Serial.println(wr_val, HEX);
-                          break;
-                        }
-                        if ((wr_pt == 0x35) && (wr_nr == PARAM_DHW_ONOFF) && (setRequestDHW)) {
-                          Serial.println(F("* Ignored - Writing to this parameter already pending by DHW35_request"));
+                          Serial.println(tempval, HEX);
                           break;
                         }
-                        if ((wr_pt == 0x35) && (wr_nr == setParam35) && (setRequest35)) {
-                          Serial.println(F("* Ignored - Writing to this parameter already pending by 35_request"));
-                          break;
-                        }
-                        if ((wr_pt == 0x36) && (wr_nr == setParam36) && (setRequest36)) {
-                          Serial.println(F("* Ignored - Writing to this parameter already pending by 36_request"));
-                          break;
-                        }
-                        if ((wr_pt == 0x3A) && (wr_nr == setParam3A) && (setRequest3A)) {
-                          Serial.println(F("* Ignored - Writing to this parameter already pending by 3A_request"));
-                          break;
-                        }
-                        if (writePermission) {
-                          if (writePermission != 0xFF) writePermission--;
-                          wr_cnt = WR_CNT; // write repetitions, 1 should be enough
-                          Serial.print(F("* Initiating parameter write for packet-type 0x"));
-                          Serial.print(wr_pt, HEX);
-                          Serial.print(F(" parameter nr 0x"));
-                          Serial.print(wr_nr, HEX);
-                          Serial.print(F(" to value 0x"));
-                          Serial.print(wr_val, HEX);
-                          Serial.println();
-                        } else {
-                          Serial.println(F("* Currently no write budget left"));
+                        if (!writeQueueAdd(temp, temphex, tempval)) {
+                          Serial.println(F("* Parameter write queue full, try again later"));
                           break;
                         }
+                        Serial.print(F("* Initiating parameter write for packet-type 0x"));
+                        Serial.print(temp, HEX);
+                        Serial.print(F(" parameter nr 0x"));
+                        Serial.print(temphex, HEX);
+                        Serial.print(F(" to value 0x"));
+                        Serial.print(tempval, HEX);
+                        Serial.print(F(", "));
+                        Serial.print(writeQueueCount());
+                        Serial.println(F(" write(s) queued"));
+                        if (!writePermission) Serial.println(F("* Currently no write budget left, write waits for budget"));
                       } else {
                         Serial.print(F("* Ignoring instruction, expected 3 arguments, received: "));
                         Serial.print(n);
                         if (n > 0) {
                           Serial.print(F(" pt: 0x"));
-                          Serial.print(wr_pt, HEX);
+                          Serial.print(temp, HEX);
                         }
                         if (n > 1) {
                           Serial.print(F(" nr: 0x"));
-                          Serial.print(wr_nr, HEX);
+                          Serial.print(temphex, HEX);
                         }
                         Serial.println();
                       }
@@ -605,6 +1592,7 @@ void loop() {
             case 'G': if (verbose) Serial.print(F("* Crc_gen "));
                       if (scanhex(RSp, temphex) == 1) {
                         crc_gen = temphex;
+                        P1P2Serial.setCRC(crc_gen, crc_feed);
                         if (!verbose) break;
                         Serial.print(F("set to "));
                       }
@@ -616,6 +1604,7 @@ void loop() {
             case 'H': if (verbose) Serial.print(F("* Crc_feed "));
                       if (scanhex(RSp, temphex) == 1) {
                         crc_feed = temphex;
+                        P1P2Serial.setCRC(crc_gen, crc_feed);
                         if (!verbose) break;
                         Serial.print(F("set to "));
                       }
@@ -625,6 +1614,9 @@ void loop() {
                       break;
             case 'v':
             case 'V': Serial.print(F("* Verbose "));
+#ifdef BINARY_LINK
+                      linkMode = 0; // P1P2-bridge-esp8266 sends 'V' at start-up and requests the binary link after it
+#endif /* BINARY_LINK */
                       if (scanint(RSp, temp) == 1) {
                         if (temp > 4) temp = 4;
                         Serial.print(F("set to "));
@@ -657,6 +1649,14 @@ void loop() {
                       Serial.print(F("* P1P2-ESP-Interface hwID "));
                       Serial.println(hwID);
                       break;
+#ifdef BINARY_LINK
+            case 's': // S  report serial link format for packets
+            case 'S': // S1 binary frames (P1P2Serial_Link.h), S0 text lines
+                      if (scanint(RSp, temp) == 1) linkMode = (temp == P1P2_LINK_VERSION);
+                      Serial.print(F("* Serial link "));
+                      Serial.println(linkMode ? P1P2_LINK_VERSION : 0);
+                      break;
+#endif /* BINARY_LINK */
             case 't':
             case 'T': if (verbose) Serial.print(F("* Delay "));
                       if (scanint(RSp, sd) == 1) {
@@ -821,11 +1821,10 @@ void loop() {
                             break;
                           } else {
                             CONTROL_ID = 0x00;
-                            setRequest35 = 0;
-                            setRequest36 = 0;
-                            setRequest3A = 0;
-                            setRequestDHW = 0;
                             wr_cnt = 0;
+#ifdef E_SERIES
+                            writeQueueClear();
+#endif /* E_SERIES */
                           }
                           if (temp < 2) EEPROM_update(EEPROM_ADDRESS_CONTROL_ID, CONTROL_ID);
                         }
@@ -891,10 +1890,6 @@ void loop() {
             case 'p': // select F035-parameter to write in z step below (default PARAM_HC_ONOFF in P1P2Config.h)
             case 'P': if (verbose) Serial.print(F("* Param35-2Write "));
                       if (scanhex(RSp, temphex) == 1) {
-                        if (setRequest35) {
-                          Serial.println(F("* Cannot change param35-2write while previous request still pending"));
-                          break;
-                        }
                         setParam35 = temphex;
                         if (!verbose) break;
                         Serial.print(F("set to "));
@@ -908,10 +1903,6 @@ void loop() {
             case 'q': // select F036-parameter to write in r step below (default PARAM_TEMP in P1P2Config.h)
             case 'Q': if (verbose) Serial.print(F("* Param36-2Write "));
                       if (scanhex(RSp, temphex) == 1) {
-                        if (setRequest36) {
-                          Serial.println(F("* Cannot change param36-2write while previous request still pending"));
-                          break;
-                        }
                         setParam36 = temphex;
                         if (!verbose) break;
                         Serial.print(F("set to "));
@@ -925,10 +1916,6 @@ void loop() {
             case 'm': // select F03A-parameter to write in n step below (default PARAM_SYS in P1P2Config.h)
             case 'M': if (verbose) Serial.print(F("* Param3A-2Write "));
                       if (scanhex(RSp, temphex) == 1) {
-                        if (setRequest3A) {
-                          Serial.println(F("* Cannot change param3A-2write while previous request still pending"));
-                          break;
-                        }
                         setParam3A = temphex;
                         if (!verbose) break;
                         Serial.print(F("set to "));
@@ -953,34 +1940,9 @@ void loop() {
                       if (setParam35 <= 0x0FFF) Serial.print('0');
                       Serial.print(setParam35, HEX);
                       if (scanhex(RSp, temphex) == 1) {
-                        if ((wr_pt == 0x35) && (wr_nr == setParam35) && wr_cnt) {
-                          Serial.println(F(": write command ignored - E-write-request is pending"));
-                          break;
-                        }
-                        if ((setParam35 == PARAM_DHW_ONOFF) && setRequestDHW) {
-                          Serial.println(F(": write command ignored - DHW-write-request is pending"));
-                          break;
-                        }
-                        if (writePermission) {
-                          if (writePermission != 0xFF) writePermission--;
-                          setRequest35 = 1;
-                          setValue35 = temphex;
-                          if (!verbose) break;
-                          Serial.print(F(" will be set to 0x"));
-                          if (setValue35 <= 0x0F) Serial.print('0');
-                          Serial.println(setValue35, HEX);
-                          break;
-                        } else {
-                          Serial.println(F("* Currently no write budget left"));
-                          break;
-                        }
-                      } else if (setRequest35) {
-                        Serial.print(F(": 35-write-request to value 0x"));
-                        if (setValue35 <= 0x0F) Serial.print('0');
-                        Serial.print(setValue35, HEX);
-                        Serial.println(F(" pending"));
+                        writeCommand(0x35, setParam35, temphex & 0xFF);
                       } else {
-                        Serial.println(F(": no 35-write-request pending"));
+                        writeStatus(0x35, setParam35);
                       }
                       break;
             case 'r': // R  report status of packet type 36 write action
@@ -994,36 +1956,11 @@ void loop() {
                       if (setParam36 <= 0x000F) Serial.print('0');
                       if (setParam36 <= 0x00FF) Serial.print('0');
                       if (setParam36 <= 0x0FFF) Serial.print('0');
-                      Serial.println(setParam36, HEX);
+                      Serial.print(setParam36, HEX);
                       if (scanhex(RSp, temphex) == 1) {
-                        if ((wr_pt == 0x36) && (wr_nr == setParam36) && wr_cnt) {
-                          Serial.println(F(" write command ignored - E-write-request is pending"));
-                          break;
-                        }
-                        if (writePermission) {
-                          if (writePermission != 0xFF) writePermission--;
-                          setRequest36 = 1;
-                          setValue36 = temphex;
-                          if (!verbose) break;
-                          Serial.print(F(" will be set to 0x"));
-                          if (setValue36 <= 0x000F) Serial.print('0');
-                          if (setValue36 <= 0x00FF) Serial.print('0');
-                          if (setValue36 <= 0x0FFF) Serial.print('0');
-                          Serial.println(setValue36, HEX);
-                          break;
-                        } else {
-                          Serial.println(F("* Currently no write budget left"));
-                          break;
-                        }
-                      } else if (setRequest36) {
-                        Serial.print(F(": 36-write-request to value 0x"));
-                        if (setValue36 <= 0x000F) Serial.print('0');
-                        if (setValue36 <= 0x00FF) Serial.print('0');
-                        if (setValue36 <= 0x0FFF) Serial.print('0');
-                        Serial.print(setValue36, HEX);
-                        Serial.println(F(" still pending"));
+                        writeCommand(0x36, setParam36, temphex);
                       } else {
-                        Serial.println(F(": no 36-write-request pending"));
+                        writeStatus(0x36, setParam36);
                       }
                       break;
             case 'n': // N  report status of packet type 3A write action
@@ -1037,72 +1974,29 @@ void loop() {
                       if (setParam3A <= 0x000F) Serial.print('0');
                       if (setParam3A <= 0x00FF) Serial.print('0');
                       if (setParam3A <= 0x0FFF) Serial.print('0');
-                      Serial.println(setParam3A, HEX);
+                      Serial.print(setParam3A, HEX);
                       if (scanhex(RSp, temphex) == 1) {
-                        if ((wr_pt == 0x3A) && (wr_nr == setParam3A) && wr_cnt) {
-                          Serial.println(F(": write command ignored - E-write-request is pending"));
-                          break;
-                        }
-                        if (writePermission) {
-                          if (writePermission != 0xFF) writePermission--;
-                          setRequest3A = 1;
-                          setValue3A = temphex;
-                          if (!verbose) break;
-                          Serial.print(F(": will be set to 0x"));
-                          if (setValue3A <= 0x0F) Serial.print('0');
-                          Serial.println(setValue3A, HEX);
-                          break;
-                        } else {
-                          Serial.println(F(": currently no write budget left"));
-                          break;
-                        }
-                      } else if (setRequest3A) {
-                        Serial.print(F(": 3A-write-request to value 0x"));
-                        if (setValue3A <= 0x0F) Serial.print('0');
-                        Serial.print(setValue3A, HEX);
-                        Serial.println(F(" still pending"));
+                        writeCommand(0x3A, setParam3A, temphex & 0xFF);
                       } else {
-                        Serial.println(F(": no 3A-write-request pending"));
+                        writeStatus(0x3A, setParam3A);
                       }
                       break;
             case 'y': // Y  report status of DHW write action (packet type 0x35)
             case 'Y': // Yx set value for DHW parameter write (defined by PARAM_DHW_ONOFF in P1P2Config.h, not reconfigurable) in packet type 35 and initiate write action
-                      if (!CONTROL_ID) Serial.println(F("* Command requires operation as auxiliary controller (L1)"));
+                      if (!CONTROL_ID) {
+                        Serial.println(F("* Command requires operation as auxiliary controller (L1)"));
+                        break;
+                      }
                       if (verbose) Serial.print(F("* DHWparam35 "));
                       Serial.print(F("0x"));
                       if (PARAM_DHW_ONOFF <= 0x000F) Serial.print('0');
                       if (PARAM_DHW_ONOFF <= 0x00FF) Serial.print('0');
                       if (PARAM_DHW_ONOFF <= 0x0FFF) Serial.print('0');
-                      Serial.println(PARAM_DHW_ONOFF, HEX);
+                      Serial.print(PARAM_DHW_ONOFF, HEX);
                       if (scanint(RSp, temp) == 1) {
-                        if ((wr_pt == 0x35) && (wr_nr == PARAM_DHW_ONOFF) && wr_cnt) {
-                          Serial.println(F("* Ignored - Writing to this parameter already pending by E-request"));
-                          break;
-                        }
-                        if ((setParam35 == PARAM_DHW_ONOFF) && setRequest35) {
-                          Serial.println(F("* Ignored - Writing to this parameter already pending by 35-request"));
-                          break;
-                        }
-                        if (writePermission) {
-                          if (writePermission != 0xFF) writePermission--;
-                          setRequestDHW = 1;
-                          setStatusDHW = temp;
-                          if (!verbose) break;
-                          Serial.print(F(" will be set to 0x"));
-                          if (setStatusDHW <= 0x000F) Serial.print('0');
-                          Serial.println(setStatusDHW);
-                          break;
-                        } else {
-                          Serial.println(F("* Currently no write budget left"));
-                          break;
-                        }
-                      } else if (setRequestDHW) {
-                        Serial.print(F(": DHW-write-request to value 0x"));
-                        if (setStatusDHW <= 0x0F) Serial.print('0');
-                        Serial.print(setStatusDHW, HEX);
-                        Serial.println(F(" still pending"));
+                        writeCommand(0x35, PARAM_DHW_ONOFF, temp & 0xFF);
                       } else {
-                        Serial.println(F(": no DHW-write-request pending"));
+                        writeStatus(0x35, PARAM_DHW_ONOFF);
                       }
                       break;
 #endif /* E_SERIES */
@@ -1129,6 +2023,7 @@ void loop() {
   }
   int32_t upt = P1P2Serial.uptime_sec();
   if (upt > upt_prev_pseudo) {
+    pseudo0C++;
     pseudo0D++;
     pseudo0E++;
     pseudo0F++;
@@ -1136,707 +2031,85 @@ void loop() {
   }
   if (upt >= upt_prev_write + TIME_WRITE_PERMISSION) {
     if (writePermission < MAX_WRITE_PERMISSION) writePermission++;
+    replyStale = 1; // parameter writes waiting for budget may be packed now
     upt_prev_write += TIME_WRITE_PERMISSION;
   }
   if (upt >= upt_prev_error + TIME_ERRORS_PERMITTED) {
     if (errorsPermitted < MAX_ERRORS_PERMITTED) errorsPermitted++;
     upt_prev_error += TIME_ERRORS_PERMITTED;
   }
-  while (P1P2Serial.packetavailable()) {
-    uint16_t delta;
-    errorbuf_t readError = 0;
-    int nread = P1P2Serial.readpacket(RB, delta, EB, RB_SIZE, crc_gen, crc_feed);
-    if (nread > RB_SIZE) {
-      Serial.println(F("* Received packet longer than RB_SIZE"));
-      nread = RB_SIZE;
-      readError = 0xFF;
-      if (errorsLargePacket < 0xFF) errorsLargePacket++;
-    }
-    for (int i = 0; i < nread; i++) readError |= EB[i];
-#ifdef SW_SCOPE
-
-#if F_CPU > 8000000L
-#define FREQ_DIV 4 // 16 MHz
-#else
-#define FREQ_DIV 3 // 8 MHz
-#endif
-
-    if (scope && ((readError && (scope_budget > 5)) || (((RB[0] == 0x40) && (RB[1] == 0xF0)) && (scope_budget > 50)) || (scope_budget > 150))) {
-      // always keep scope write budget for 40F0 and expecially for readErrors
-      if (sws_cnt || (sws_event[SWS_MAX - 1] != SWS_EVENT_LOOP)) {
-        scope_budget -= 5;
-        if (readError) {
-          Serial.print(F("C "));
-        } else {
-          Serial.print(F("c "));
-        }
-        if (RB[0] < 0x10) Serial.print('0');
-        Serial.print(RB[0], HEX);
-        if (RB[1] < 0x10) Serial.print('0');
-        Serial.print(RB[1], HEX);
-        if (RB[2] < 0x10) Serial.print('0');
-        Serial.print(RB[2], HEX);
-        Serial.print(' ');
-        static uint16_t capture_prev;
-        int i = 0;
-        if (sws_event[SWS_MAX - 1] != SWS_EVENT_LOOP) i = sws_cnt;
-        bool skipfirst = true;
-        do {
-          switch (sws_event[i]) {
-            // error events
-            case SWS_EVENT_ERR_BE      : Serial.print(F("   BE   ")); break;
-            case SWS_EVENT_ERR_BE_FAKE : Serial.print(F("   be   ")); break;
-            case SWS_EVENT_ERR_SB      : Serial.print(F("   SB   ")); break;
-            case SWS_EVENT_ERR_SB_FAKE : Serial.print(F("   sb   ")); break;
-            case SWS_EVENT_ERR_BC      : Serial.print(F("   BC   ")); break;
-            case SWS_EVENT_ERR_BC_FAKE : Serial.print(F("   bc   ")); break;
-            case SWS_EVENT_ERR_PE      : Serial.print(F("   PE   ")); break;
-            case SWS_EVENT_ERR_PE_FAKE : Serial.print(F("   pe   ")); break;
-            case SWS_EVENT_ERR_LOW     : Serial.print(F("   lw   ")); break;
-            // read/write related events
-            default   : byte sws_ev    = sws_event[i] & SWS_EVENT_MASK;
-                        byte sws_state = sws_event[i] & 0x1F;
-                        if (!skipfirst) {
-                          if (sws_ev == SWS_EVENT_EDGE_FALLING_W) Serial.print(' ');
-                          uint16_t t_diff = (sws_capture[i] - capture_prev) >> FREQ_DIV;
-                          if (t_diff < 10) Serial.print(' ');
-                          if (t_diff < 100) Serial.print(' ');
-                          Serial.print(t_diff);
-                          if (sws_ev != SWS_EVENT_EDGE_FALLING_W) Serial.print(':');
-                        }
-                        capture_prev = sws_capture[i];
-                        skipfirst = false;
-                        switch (sws_ev) {
-                          case SWS_EVENT_SIGNAL_LOW     : Serial.print('?'); break;
-                          case SWS_EVENT_EDGE_FALLING_W : Serial.print(' '); break;
-                          case SWS_EVENT_EDGE_RISING    :
-                                                          // state = 1 .. 20 (1,2 start bit, 3-18 data bit, 19,20 parity bit),
-                                                          switch (sws_state) {
-                                                            case 1       :
-                                                            case 2       : Serial.print('S'); break; // start bit
-                                                            case 3 ... 18: Serial.print((sws_state - 3) >> 1); break; // state=3-18 for data bit 0-7
-                                                            case 19      :
-                                                            case 20      : Serial.print('P'); break; // parity bit
-                                                            default      : Serial.print(' '); break;
-                                                          }
-                                                          break;
-                          case SWS_EVENT_EDGE_SPIKE     :
-                          case SWS_EVENT_SIGNAL_HIGH_R  :
-                          case SWS_EVENT_EDGE_FALLING_R :
-                                                          switch (sws_state) {
-                                                            case 11      : Serial.print('E'); break; // stop bit ('end' bit)
-                                                            case 10      : Serial.print('P'); break; // parity bit
-                                                            case 0       :
-                                                            case 1       : Serial.print('S'); break; // parity bit
-                                                            case 2 ... 9 : Serial.print(sws_state - 2); break; // state=2-9 for data bit 0-7
-                                                            default      : Serial.print(' '); break;
-                                                          }
-                                                          break;
-                          default                       : Serial.print(' ');
-                                                          break;
-                        }
-                        switch (sws_ev) {
-                          case SWS_EVENT_EDGE_SPIKE     : Serial.print(F("-X-"));  break;
-                          case SWS_EVENT_SIGNAL_HIGH_R  : Serial.print(F("‾‾‾")); break;
-                          case SWS_EVENT_SIGNAL_LOW     : Serial.print(F("___")); break;
-                          case SWS_EVENT_EDGE_RISING    : Serial.print(F("_/‾")); break;
-                          case SWS_EVENT_EDGE_FALLING_W :
-                          case SWS_EVENT_EDGE_FALLING_R : Serial.print(F("‾\\_")); break;
-                          default                       : Serial.print(F(" ? ")); break;
-                        }
-          }
-          if (++i == SWS_MAX) i = 0;
-        } while (i != sws_cnt);
-        Serial.println();
-      }
-    }
-    if (++scope_budget > 200) scope_budget = 200;
-    sws_block = 0; // release SW_SCOPE for next log operation
-#endif
-#ifdef MEASURE_LOAD
-    if (irq_r) {
-      uint8_t irq_busy_c1 = irq_busy;
-      uint16_t irq_lapsed_r_c = irq_lapsed_r;
-      uint16_t irq_r_c = irq_r;
-      uint8_t  irq_busy_c2 = irq_busy;
-      if (irq_busy_c1 || irq_busy_c2) {
-        Serial.println(F("* irq_busy"));
-      } else {
-        Serial.print(F("* sh_r="));
-        Serial.println(100.0 * irq_r_c / irq_lapsed_r_c);
-      }
-    }
-    if (irq_w) {
-      uint8_t irq_busy_c1 = irq_busy;
-      uint16_t irq_lapsed_w_c = irq_lapsed_w;
-      uint16_t irq_w_c = irq_w;
-      uint8_t  irq_busy_c2 = irq_busy;
-      if (irq_busy_c1 || irq_busy_c2) {
-        Serial.println(F("* irq_busy"));
-      } else {
-        Serial.print(F("* sh_w="));
-        Serial.println(100.0 * irq_w_c / irq_lapsed_w_c);
-      }
-    }
-#endif
-    if ((readError & ERROR_REAL_MASK) && upt) { // don't count errors while upt == 0
-      if (readErrors < 0xFF) {
-        readErrors++;
-        readErrorLast = readError;
-      }
-      if (errorsPermitted) {
-        errorsPermitted--;
-        if (!errorsPermitted) {
-          Serial.println(F("* WARNING: too many read errors detected"));
-          if (counterRepeatingRequest) Serial.println(F("* Switching counter request function off"));
-          if (CONTROL_ID) Serial.println(F("* Switching control functionality off"));
-          CONTROL_ID = CONTROL_ID_NONE;
-          counterRepeatingRequest = 0;
-          counterRequest = 0;
-          Serial.println(F("* Warning: Upon ATmega restart auxiliary controller functionality and counter request functionality will remain switched off"));
-          EEPROM_update(EEPROM_ADDRESS_CONTROL_ID, CONTROL_ID);
-          EEPROM_update(EEPROM_ADDRESS_COUNTER_STATUS, counterRepeatingRequest);
-          setRequest35 = 0;
-          setRequest36 = 0;
-          setRequest3A = 0;
-          setRequestDHW = 0;
-          wr_cnt = 0;
-        }
-      }
+#ifdef EVENT_HANDLERS
+  P1P2Serial.dispatch(); // calls handlePacket() for each packet received
+#else /* EVENT_HANDLERS */
+  while (P1P2Serial.packetavailable()) handlePacket(P1P2_EVENT_PACKET);
+#endif /* EVENT_HANDLERS */
+#ifdef TX_RETRY
+  tx_result_t txResult;
+  while (P1P2Serial.writeresult(txResult)) {
+    // replies and counter requests are only reported if not written
+    if (!verbose || (txResult.status == P1P2_TX_OK)) continue;
+    Serial.print(F("* Write "));
+    for (uint8_t i = 0; i < 3; i++) {
+      if (txResult.header[i] <= 0x0F) Serial.print("0");
+      Serial.print(txResult.header[i], HEX);
     }
-#ifdef MONITORCONTROL
-    if (!readError) {
-      // message received, no error detected, no buffer overrun
-      byte w;
-      if ((nread > 9) && (RB[0] == 0x00) && (RB[1] == 0x00) && (RB[2] == 0x12)) {
-        // obtain day-of-week, hour, minute
-        Tmin = RB[6];
-        if (Tmin != Tminprev) {
-          if (counterRepeatingRequest && !counterRequest) counterRequest = 1;
-          Tminprev = Tmin;
-        }
-      }
-      bool F030forcounter = false;
-#ifdef KLICDA
-      // request one counter per cycle in short pause after first 0012 msg at start of each minute
-      if ((nread > 4) && (RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x12)) {
-        if (counterRequest) {
-          WB[0] = 0x00;
-          WB[1] = 0x00;
-          WB[2] = 0xB8;
-          WB[3] = (counterRequest - 1);
-          if (P1P2Serial.writeready()) {
-            // write KLICDA_DELAY ms after 400012 message
-            // pause after 400012 is around 47 ms for some systems which is long enough for a 0000B8*/4000B8* counter request/response pair
-            // in exceptional cases (1 in 300 in my system) the pause after 400012 is only 27ms,
-            //      in which case the 4000B* reply arrives after the 000013* request
-            //      (and in thoses cases the 000013* request is ignored)
-            //      (NOTE!: if KLICDA_DELAY is chosen incorrectly, such as 5 ms in some example systems, this results in incidental bus collisions)
-            P1P2Serial.writepacket(WB, 4, KLICDA_DELAY, crc_gen, crc_feed);
-          } else {
-            Serial.println(F("* Refusing to write counter-request packet while previous packet wasn't finished"));
-            if (writeRefused < 0xFF) writeRefused++;
-          }
-          if (++counterRequest == 7) counterRequest = 0; // wait until next new minute; change 0 to 1 to continuously request counters for increased resolution
-        }
-      }
-#else /* KLICDA */
-      if ((FxAbsentCnt[0] == F0THRESHOLD) && counterRequest && (nread > 4) && (RB[0] == 0x00) && (RB[1] == 0xF0) && (RB[2] == 0x30)) {
-        // 00F030 request message received; counterRequest > 0 so hijack every 4th time slot to request counters
-        // but only if auxiliary F0 controller has not been detected (so check on FxAbsentCnt[0])
-        // This works only if there is no other auxiliary controller responding to 0xF0, TODO: in that case extend to hijack 0xF1 timeslot
-        if ((counterRequest & 0x03) == 0x01) {
-          WB[0] = 0x00;
-          WB[1] = 0x00;
-          WB[2] = 0xB8;
-          WB[3] = counterRequest >> 2;
-          F030forcounter = true;
-          if (P1P2Serial.writeready()) {
-            P1P2Serial.writepacket(WB, 4, F03XDELAY, crc_gen, crc_feed);
-          } else {
-            Serial.println(F("* Refusing to write counter-request packet while previous packet wasn't finished"));
-            if (writeRefused < 0xFF) writeRefused++;
-          }
-        }
-        if (++counterRequest == 22) counterRequest = 0;
-      }
-#endif /* KLICDA */
-      if ((nread > 4) && (RB[0] == 0x40) && ((RB[1] & 0xFE) == 0xF0) && ((RB[2] & 0x30) == 0x30)) {
-        // 40Fx3x auxiliary controller reply received - note this could be our own (slow, delta=F030DELAY or F03XDELAY) reply so only reset count if delta < min(F03XDELAY, F030DELAY) (- margin)
-        // Note for developers using >1 P1P2Monitor-interfaces (=to self): this detection mechanism fails if there are 2 P1P2Monitor programs (and adapters) with same delay settings on the same bus.
-        // check if there is any auxiliary controller on 0x30 (including P1P2Monitor self, requires echo)
-        if (RB[2] == 0x30) FxAbsentCntInclOwn[RB[1] & 0x01] = 0;
-        Fx30ReplyDelay[RB[1] & 0x01] = (delta & 0xFF00) ? 0xFF : (delta & 0xFF);
-        // check if there is any other auxiliary controller on 0x3x
-        if ((delta < F03XDELAY - 2) && (delta < F030DELAY - 2)) {
-          FxAbsentCnt[RB[1] & 0x01] = 0;
-          if (RB[1] == CONTROL_ID) {
-            // this should only happen if another auxiliary controller is connected if/after CONTROL_ID is set, either because
-            //    -CONTROL_ID_DEFAULT is set and conflicts with auxiliary controller, or
-            //    -because another auxiliary controller has been connected after CONTROL_ID has been manually set
-            Serial.print(F("* Warning: another auxiliary controller is answering to address 0x"));
-            Serial.print(RB[1], HEX);
-            Serial.println(F(" detected"));
-            CONTROL_ID = CONTROL_ID_NONE;
-            EEPROM_update(EEPROM_ADDRESS_CONTROL_ID, CONTROL_ID);
-            setRequest35 = 0;
-            setRequest36 = 0;
-            setRequest3A = 0;
-            setRequestDHW = 0;
-            wr_cnt = 0;
-          }
-        }
-      } else if ((nread > 4) && (RB[0] == 0x00) && ((RB[1] & 0xFE) == 0xF0) && ((RB[2] & 0x30) == 0x30) && !F030forcounter) {
-        // 00Fx3x request message received, and we did not use this slot to request counters
-        // check if there is any controller on 0x30 (including P1P2Monitor self, requires echo)
-        if (RB[2] == 0x30) {
-          if (FxAbsentCntInclOwn[RB[1] & 0x01] > 1) {
-            Fx30ReplyDelay[RB[1] & 0x01] = 0;
-          } else {
-            FxAbsentCntInclOwn[RB[1] & 0x01]++;
-          }
-        }
-        // check if there is no other auxiliary controller
-        if ((RB[2] == 0x30) && (FxAbsentCnt[RB[1] & 0x01] < F0THRESHOLD)) {
-          FxAbsentCnt[RB[1] & 0x01]++;
-          if (FxAbsentCnt[RB[1] & 0x01] == F0THRESHOLD) {
-            Serial.print(F("* No auxiliary controller answering to address 0x"));
-            Serial.print(RB[1], HEX);
-            if (CONTROL_ID == RB[1]) {
-              Serial.println(F(" detected, control functionality will restart"));
-              insertMessageCnt = 0;  // avoid delayed insertMessage/restartDaikin
-              restartDaikinCnt = 0;
-            } else {
-              Serial.println(F(" detected, switching control functionality can be switched on (using L1)"));
-            }
-          }
-        }
-        // act as auxiliary controller:
-        if ((CONTROL_ID && (FxAbsentCnt[CONTROL_ID & 0x01] == F0THRESHOLD) && (RB[1] == CONTROL_ID))
-#ifdef ENABLE_INSERT_MESSAGE
-            || ((insertMessageCnt || restartDaikinCnt) && (RB[0] == 0x00) && (RB[1] == 0xF0) 
-#ifndef ENABLE_INSERT_MESSAGE_3x
-                                                                                             && (RB[2] == 0x30)
-#endif
-                                                                                                               )
-#endif
-                                                                                                     ) {
-          WB[0] = 0x40;
-          WB[1] = RB[1];
-          WB[2] = RB[2];
-          int n = nread;
-          int d = F03XDELAY;
-          bool wr = 0;
-          if (crc_gen) n--; // omit CRC from received-byte-counter
-          if (n > WB_SIZE) {
-            n = WB_SIZE;
-            Serial.print(F("* Surprise: received 00Fx3x packet of size "));
-            Serial.println(nread); }
-          switch (RB[2]) {
-#ifdef E_SERIES
-            case 0x30 :
-#ifdef ENABLE_INSERT_MESSAGE
-                        if (insertMessageCnt || restartDaikinCnt) {
-                          for (int i = 0; i < insertMessageLength; i++) WB[i] = insertMessage[i];
-                          if (insertMessageCnt) {
-                            Serial.println(F("* Insert user-specified message"));
-                            insertMessageCnt--;
-                          }
-                          if (restartDaikinCnt) {
-                            Serial.println(F("* Attempt to restart Daikin"));
-                            WB[RESTART_PACKET_PAYLOAD_BYTE + 3] |= RESTART_PACKET_BYTE;
-                            restartDaikinCnt--;
-                          }
-                          d = F030DELAY_INSERT;
-                          n = insertMessageLength;
-                          wr = 1;
-                          break;
-                        }
-#endif
-                        // in: 17 byte; out: 17 byte; answer WB[7] should contain a 01 if we want to communicate a new setting in packet type 35
-                        for (w = 3; w < n; w++) WB[w] = 0x00;
-                        // set byte WB[7] to 0x01 to request a F035 message to set Value35 and/or DHWstatus
-                        if (setRequestDHW || setRequest35) WB[7] = 0x01;
-                        // set byte WB[8] to 0x01 to request a F036 message to set setParam36 to Value36
-                        if (setRequest36) WB[8] = 0x01;
-                        // set byte WB[12] to 0x01 to request a F03A message to set setParam3A to Value3A
-                        if (setRequest3A) WB[12] = 0x01;
-                        // set byte WB[<wr_pt - 0x2E>] to 0x01 to request a F03x message to set wr_nr to wr_val
-                        if (wr_cnt) WB[wr_pt - 0x2E] = 0x01;
-                        d = F030DELAY;
-                        wr = 1;
-                        break;
-            case 0x31 : // in: 15 byte; out: 15 byte; out pattern is copy of in pattern except for 2 bytes RB[7] RB[8]; function partly date/time, partly unknown
-                        // RB[7] RB[8] seem to identify the auxiliary controller type;
-                        // Do pretend to be a LAN adapter (even though this may trigger "data not in sync" upon restart?)
-                        // If we don't set address, installer mode in main thermostat may become inaccessible
-                        for (w = 3; w < n; w++) WB[w] = RB[w];
-#ifdef CTRL_ID_1
-                        WB[7] = CTRL_ID_1;
-#endif
-#ifdef CTRL_ID_2
-                        WB[8] = CTRL_ID_2;
-#endif
-                        wr = 1;
-                        break;
-            case 0x32 : // in: 19 byte: out 19 byte, out is copy in
-                        for (w = 3; w < n; w++) WB[w] = RB[w];
-                        // on one system, response is all-zero, so consider to change to all-zero response:
-                        // for (w = 3; w < n; w++) WB[w] = 0x00;
-                        wr = 1;
-                        break;
-            case 0x33 : // not seen, no response
-                        break;
-            case 0x34 : // not seen, no response
-                        break;
-            case 0x35 : // in: 21 byte; out 21 byte; 3-byte parameters reply with FF
-                        // LAN adapter replies first packet which starts with 930000 (why?)
-                        // A parameter consists of 3 bytes: 2 bytes for param nr, and 1 byte for value
-                        // parameters in the 00F035 message may indicate status changes in the heat pump
-                        // for now we only check for the following parameters:
-                        // DHW parameter PARAM_DHW_ONOFF
-                        // EHVX08S26CB9W DHWbooster parameter 0x48 (EHVX08S26CB9W)
-                        // 35requester SetParam
-                        // parameters 0144- or 0162- ASCII name of device
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        // change bytes for triggering 35request
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = (wr_val & 0xFF); wr_cnt--; wr_req = 1; Serial.println("* Executing E command"); }
-                        if (setRequestDHW) { WB[w++] = PARAM_DHW_ONOFF & 0xff; WB[w++] = PARAM_DHW_ONOFF >> 8; WB[w++] = setStatusDHW; setRequestDHW = 0; Serial.println("* Executing Y command"); }
-                        if (setRequest35)  { WB[w++] = setParam35  & 0xff; WB[w++] = setParam35  >> 8; WB[w++] = setValue35;   setRequest35 = 0; Serial.println("* Executing Z command"); }
-                        // feedback no longer supported:
-                        // for (w = 3; w < n; w+=3) if ((RB[w] | (RB[w+1] << 8)) == setParam35) Value35 = RB[w+2];
-                        // for (w = 3; w < n; w+=3) if ((RB[w] | (RB[w+1] << 8)) == PARAM_DHW_ONOFF) DHWstatus = RB[w+2];
-                        wr = 1;
-                        break;
-            case 0x36 : // in: 23 byte; out 23 byte; 2-byte parameters; reply with FF
-                        // A parameter consists of 4 bytes: 2 bytes for param nr, and 2 bytes for value
-                        // write bytes for parameter setParam36 to value set36status if setRequest36
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = wr_val & 0xFF; WB[w++] = (wr_val >> 8) & 0xFF; wr_cnt--; wr_req = 1; Serial.println("* Executing E command"); }
-                        if (setRequest36) { WB[w++] = setParam36 & 0xff; WB[w++] = (setParam36 >> 8) & 0xff; WB[w++] = setValue36 & 0xff; WB[w++] = (setValue36 >> 8) & 0xff; setRequest36 = 0; Serial.println("* Executing R command"); }
-                        // check if set36status has been changed by main controller; removed this part as it is not the most reliable confirmation method
-                        // for (w = 3; w < n; w+=4) if (((RB[w+1] << 8) | RB[w]) == setParam36) Value36 = RB[w+2] | (RB[w+3] << 8);
-                        wr = 1;
-                        break;
-            case 0x37 : // in: 23 byte; out 23 byte; 3-byte parameters; reply with FF
-                        // not seen in EHVX08S23D6V
-                        // seen in EHVX08S26CB9W (value: 00001001010100001001)
-                        // seen in EHYHBX08AAV3
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = wr_val & 0xFF; WB[w++] = (wr_val >> 8) & 0xFF; WB[w++] = (wr_val >> 16) & 0xFF; wr_cnt--; wr_req = 1; Serial.println("* Executing E command"); }
-                        wr = 1;
-                        break;
-            case 0x38 : // in: 21 byte; out 21 byte; 4-byte parameters; reply with FF
-                        // parameter range 0000-001E; kwH/hour counters?
-                        // not seen in EHVX08S23D6V
-                        // seen in EHVX08S26CB9W
-                        // seen in EHYHBX08AAV3
-                        // A parameter consists of 6 bytes: 2 bytes for param nr, and 4 bytes for value
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = wr_val & 0xFF; WB[w++] = (wr_val >> 8) & 0xFF; WB[w++] = (wr_val >> 16) & 0xFF; WB[w++] = (wr_val >> 24) & 0xFF; wr_cnt--; wr_req = 1; Serial.println("* Executing E command"); };
-                        wr = 1;
-                        break;
-            case 0x39 : // in: 21 byte; out 21 byte; 4-byte parameters; reply with FF
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = wr_val & 0xFF; WB[w++] = (wr_val >> 8) & 0xFF; WB[w++] = (wr_val >> 16) & 0xFF; WB[w++] = (wr_val >> 24) & 0xFF; wr_cnt--; wr_req = 1;Serial.println("* Executing E command"); }
-                        wr = 1;
-                        break;
-            case 0x3A : // in: 21 byte; out 21 byte; 1-byte parameters reply with FF
-                        // A parameter consists of 3 bytes: 2 bytes for param nr, and 1 byte for value
-                        // parameters in the 00F03A message may indicate system status (silent, schedule, unit, DST, holiday)
-                        // change bytes for triggering 3Arequest
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = (wr_val & 0xFF); wr_cnt--; wr_req = 1;Serial.println("* Executing E command"); }
-                        if (setRequest3A)  { WB[w++] = setParam3A  & 0xff; WB[w++] = setParam3A  >> 8; WB[w++] = setValue3A;   setRequest3A = 0; Serial.println("* Executing N command"); }
-                        // feedback no longer supported:
-                        // for (w = 3; w < n; w+=3) if ((RB[w] | (RB[w+1] << 8)) == setParam3A) Value3A = RB[w+2];
-                        wr = 1;
-                        break;
-            case 0x3B : // in: 23 byte; out 23 byte; 2-byte parameters; reply with FF
-                        // not seen in EHVX08S23D6V
-                        // seen in EHVX08S26CB9W
-                        // seen in EHYHBX08AAV3
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = wr_val & 0xFF; WB[w++] = (wr_val >> 8) & 0xFF; wr_cnt--; wr_req = 1; Serial.println("* Executing E command"); }
-                        wr = 1;
-                        break;
-            case 0x3C : // in: 23 byte; out 23 byte; 3-byte parameters; reply with FF
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = wr_val & 0xFF; WB[w++] = (wr_val >> 8) & 0xFF; WB[w++] = (wr_val >> 16) & 0xFF; wr_cnt--; wr_req = 1; Serial.println("* Executing E command"); }
-                        wr = 1;
-                        break;
-            case 0x3D : // in: 21 byte; out: 21 byte; 4-byte parameters; reply with FF
-                        // parameter range 0000-001F; kwH/hour counters?
-                        // not seen in EHVX08S23D6V
-                        // seen in EHVX08S26CB9W
-                        // seen in EHYHBX08AAV3
-                        for (w = 3; w < n; w++) WB[w] = 0xFF;
-                        w = 3;
-                        if (wr_cnt && (wr_pt == RB[2])) { WB[w++] = wr_nr & 0xff; WB[w++] = wr_nr >> 8; WB[w++] = wr_val & 0xFF; WB[w++] = (wr_val >> 8) & 0xFF; WB[w++] = (wr_val >> 16) & 0xFF; WB[w++] = (wr_val >> 24) & 0xFF; wr_cnt--; wr_req = 1; Serial.println("* Executing E command"); }
-                        wr = 1;
-                        break;
-            case 0x3E : // schedule related packet
-                        // 0x3E01, 0x3E02, ... in: 23 byte; out: 23 byte; out 40F13E01(even for higher) + 19xFF
-                        WB[3] = RB[3];
-                        for (w = 4; w < n; w++) WB[w] = 0xFF;
-                        wr = 1;
-                        break;
-#endif /* E_SERIES */
-#ifdef F_SERIES
-            case 0x30 : // all models: polling auxiliary controller, reply with empty payload
-              d = F030DELAY;
-              wr = 1;
-              n = 3;
-              break;
-#ifdef FDY
-            case 0x38 : // FDY control message, copy bytes back and change if 'F' command is given
-              wr = controlLevel;
-              n = 18;
-              for (w = 13; w <= 15; w++) WB[w] = 0x00;
-              WB[3]  = RB[3] & 0x01;           // W target status
-              WB[4]  = (RB[5] & 0x07) | 0x60;  // W target operating mode
-              WB[5]  = RB[7];                  // W target temperature cooling
-              WB[6]  = 0x00;                   //   clear change flag 80 from input (alternative:? WB[6] = RB[8] & 0x7F)
-              WB[7]  = (RB[9] & 0x60) | 0x11;  // W target fan speed cooling/fan    (alternative: WB[7] = RB[9] & 0x7F might work too)
-              WB[8]  = 0x00;                   //   clear change flag 80 from input
-              WB[9]  = RB[11];                 // W target temperature heating
-              WB[10] = 0x00;                   //   clear change flag from input    (alternative:? WB[10] = RB[12] & 0x7F)
-              WB[11] = (RB[13] & 0x60) | 0x11; // W target fan speed heating;       (alternative: WB[11] = RB[13] & 0x7F might work too)
-              WB[12] = RB[14] & 0x7F;          //   clear change flag from input
-              WB[16] = RB[18];                 //   target fan mode ?? & 0x03 ?
-              WB[17] = 0x00;                   //   ? (change flag, & 0x7F ?)
-              if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
-              break;
-            case 0x39 : // guess that this is filter for FDY, reply with 4-byte payload
-              wr = controlLevel;
-              n = 7;
-              WB[3] = 0x00;
-              WB[4] = 0x00;
-              WB[5] = RB[11];
-              WB[6] = RB[12];
-              if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
-              break;
-#endif
-#ifdef FDYQ
-            case 0x37 : // FDYQ zone name packet, reply with empty payload
-              wr = controlLevel;
-              n = 3;
-              break;
-            case 0x3B : // FDYQ control message, copy bytes back and change if 'F' command is given
-              wr = controlLevel;
-              n = 22;
-              for (w = 13; w <= 18; w++) WB[w] = 0x00;
-              WB[3]  = RB[3] & 0x01;           // W target status
-              WB[4]  = (RB[5] & 0x07) | 0x60;  // W target operating mode
-              WB[5]  = RB[7];                  // W target temperature cooling
-              WB[6]  = 0x00;                   //   clear change flag 80 from input (alternative:? WB[6] = RB[8] & 0x7F)
-              WB[7]  = (RB[9] & 0x60) | 0x11;  // W target fan speed cooling/fan    (alternative: WB[7] = RB[9] & 0x7F might work too)
-              WB[8]  = 0x00;                   //   clear change flag 80 from input
-              WB[9]  = RB[11];                 // W target temperature heating
-              WB[10] = 0x00;                   //   clear change flag from input    (alternative:? WB[10] = RB[12] & 0x7F)
-              WB[11] = (RB[13] & 0x60) | 0x11; // W target fan speed heating        (alternative: WB[11] = RB[13] & 0x7F might work too)
-              WB[12] = RB[14] & 0x7F;          //   clear change flag from input
-              WB[19] = RB[20];                 // W active hvac zones
-              WB[20] = RB[21] & 0x03;          // W target fan mode
-              WB[21] = 0x00;                   //   ? (change flag, & 0x7F ?)
-              if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
-              break;
-            case 0x3C : // FDYQ filter message, reply with 2-byte zero payload
-              wr = controlLevel;
-              n = 5;
-              WB[3] = 0x00;
-              WB[4] = 0x00;
-              if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
-              break;
-#endif
-#ifdef FXMQ
-            case 0x32 : // incoming message,  occurs only once, 8 bytes, first byte is 0xC0, others 0x00; reply is one byte value 0x01? polling auxiliary controller?, reply with empty payload
-              d = F030DELAY;
-              wr = controlLevel;
-              n = 4;
-              WB[3]  = 0x01; // W target status
-              break;
-            case 0x35 : // FXMQ outside unit name, reply with empty payload
-              wr = controlLevel;
-              n = 3;
-              break;
-            case 0x36 : // FXMQ indoor unit name, reply with empty payload
-              wr = controlLevel;
-              n = 3;
-              break;
-            case 0x38 : // FXMQ control message, copy a few bytes back, change bytes if 'F' command is given
-              wr = controlLevel;
-              n = 20;
-              WB[3]  = RB[3] & 0x01;           // W target status
-              WB[4]  = RB[5];                  // W target operating mode
-              WB[5]  = RB[7];                  // W target temperature cooling (can be changed by reply with different value)
-              WB[6]  = 0x00;
-              WB[7]  = RB[9];                  // W target fan speed cooling/fan (11 / 31 / 51) (can be changed by reply with different value)
-              WB[8]  = 0x00;
-              WB[9]  = RB[11];                 // W target temperature heating (can be changed by reply with different value)
-              WB[10] = 0x00;
-              WB[11] = RB[13];                 // W target fan speed heating/fan (11 / 31 / 51)
-              WB[12] = RB[14];                 // no flag?
-              WB[13] = 0x00;
-              WB[14] = 0x00;
-              WB[15] = 0x00;
-              WB[16] = RB[18];                 // C0, E0 when payload byte 0 set to 1
-              WB[17] = 0x00;
-              WB[18] = 0;                      // puzzle: initially 0, then 2, then 1 ????
-              WB[19] = 0x00;
-              if (wr_cnt && (wr_pt == RB[2])) {
-                if ((wr_nr == 0) && (WB[wr_nr + 3] == 0x00) && (wr_val)) WB[16] |= 0x20; // change payload byte 13 from C0 to E0, only if payload byte 0 is set to 1 here
-                WB[wr_nr + 3] = wr_val;
-                wr_cnt--;
-              }
-              break;
-            case 0x39 : // ??, reply with 5-byte all-zero payload
-              wr = controlLevel;
-              n = 8;
-              WB[3] = 0x00;
-              WB[4] = 0x00;
-              WB[5] = 0x00;
-              WB[6] = 0x00;
-              WB[7] = 0x00;
-              // for now, don't support write: if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
-              break;
-            case 0x3A : // ??, reply with 8-byte all-zero payload
-              wr = controlLevel;
-              n = 11;
-              WB[3] = 0x00;
-              WB[4] = 0x00;
-              WB[5] = 0x00;
-              WB[6] = 0x00;
-              WB[7] = 0x00;
-              WB[8] = 0x00;
-              WB[9] = 0x00;
-              // for now, don't support write: if (wr_cnt && (wr_pt == RB[2])) { WB[wr_nr + 3] = wr_val; wr_cnt--; };
-              break;
-#endif
-#endif /* F_SERIES */
-            default   : // not seen, no response
-              break;
-          }
-          if (wr) {
-            if (P1P2Serial.writeready()) {
-              P1P2Serial.writepacket(WB, n, d, crc_gen, crc_feed);
-              parameterWritesDone += wr_req;
-              wr_req = 0;
-            } else {
-              Serial.println(F("* Refusing to write packet while previous packet wasn't finished, flushing write action"));
-              if (writeRefused < 0xFF) writeRefused++;
-              wr_req = 0;
-            }
-          }
-        }
-      }
-    }
-#endif /* MONITORCONTROL */
-#ifdef ENABLE_INSERT_MESSAGE
-    if ((insertMessageCnt == 0) && (RB[0] == 0x00) && (RB[1] == 0x00) && (RB[2] == RESTART_PACKET_TYPE)) {
-      for (int i = 0; i < nread; i++) insertMessage[i] = RB[i];
-      insertMessageLength = nread;
-      restartDaikinReady = 1;
-    }
-#endif
+    Serial.print((txResult.status == P1P2_TX_COLLISION) ? F(" dropped after collisions, attempts ") : F(" dropped at deadline, attempts "));
+    Serial.println(txResult.attempts);
+  }
+#endif /* TX_RETRY */
+#ifdef ADC_STREAM
+  if (hwID) P1P2Serial.ADC_process();
+#endif /* ADC_STREAM */
 #ifdef PSEUDO_PACKETS
-#ifdef E_SERIES
-    if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x10)) pseudo0D = 5; // Insert one pseudo packet 00000D in output serial after 400010
-    if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x11)) pseudo0E = 5; // Insert one pseudo packet 00000E in output serial after 400011
-    if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x12)) pseudo0F = 5; // Insert one pseudo packet 00000F in output serial after 400012
-#endif /* E_SERIES */
-#ifdef F_SERIES
-    if ((RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x10)) pseudo0D = 5; // Insert one pseudo packet 00000D in output serial after 400010
-    if ((RB[0] == 0x00) && (RB[1] == 0x00) && (RB[2] == 0x1F)) pseudo0E = 5; // Insert one pseudo packet 00000E in output serial after 00001F
-    if ((RB[0] == 0x80) && (RB[1] == 0x00) && (RB[2] == 0x18)) pseudo0F = 5; // Insert one pseudo packet 00000F in output serial after 800018
-#endif /* F_SERIES */
-#endif /* PSEUDO_PACKETS */
-    if (readError) {
-      Serial.print(F("E "));
-    } else {
-      if (verbose && (verbose < 4)) Serial.print(F("R "));
-    }
-    if (((verbose & 0x01) == 1) || readError) {
-      // 3nd-12th characters show length of bus pause (max "R T 65.535: ")
-      Serial.print(F("T "));
-      if (delta < 10000) Serial.print(F(" "));
-      if (delta < 1000) Serial.print('0'); else { Serial.print(delta / 1000); delta %= 1000; };
-      Serial.print(F("."));
-      if (delta < 100) Serial.print('0');
-      if (delta < 10) Serial.print('0');
-      Serial.print(delta);
-      Serial.print(F(": "));
-    }
-    if ((verbose < 4) || readError) {
-      for (int i = 0; i < nread; i++) {
-        if (verbose && (EB[i] & ERROR_SB)) {
-          // collision suspicion due to data verification error in reading back written data
-          Serial.print(F("-SB:"));
-        }
-        if (verbose && (EB[i] & ERROR_BE)) { // or BE3 (duplicate code)
-          // collision suspicion due to data verification error in reading back written data
-          Serial.print(F("-XX:"));
-        }
-        if (verbose && (EB[i] & ERROR_BC)) {
-          // collision suspicion due to 0 during 2nd half bit signal read back
-          Serial.print(F("-BC:"));
-        }
-        if (verbose && (EB[i] & ERROR_PE)) {
-          // parity error detected
-          Serial.print(F("-PE:"));
-        }
-#ifdef GENERATE_FAKE_ERRORS
-        if (verbose && (EB[i] & (ERROR_SB << 8))) {
-          // collision suspicion due to data verification error in reading back written data
-          Serial.print(F("-sb:"));
-        }
-        if (verbose && (EB[i] & (ERROR_BE << 8))) {
-          // collision suspicion due to data verification error in reading back written data
-          Serial.print(F("-xx:"));
-        }
-        if (verbose && (EB[i] & (ERROR_BC << 8))) {
-          // collision suspicion due to 0 during 2nd half bit signal read back
-          Serial.print(F("-bc:"));
-        }
-        if (verbose && (EB[i] & (ERROR_PE << 8))) {
-          // parity error detected
-          Serial.print(F("-pe:"));
-        }
-#endif
-        byte c = RB[i];
-        if (crc_gen && (verbose == 1) && (i == nread - 1)) {
-          Serial.print(F(" CRC="));
-        }
-        if (c < 0x10) Serial.print('0');
-        Serial.print(c, HEX);
-        if (verbose && (EB[i] & ERROR_OR)) {
-          // buffer overrun detected (overrun is after, not before, the read byte)
-          Serial.print(F(":OR-"));
-        }
-        if (verbose && (EB[i] & ERROR_CRC)) {
-          // CRC error detected in readpacket
-          Serial.print(F(" CRC error"));
-        }
+#if (defined ISR_STATS) || (defined IDLE_SLEEP)
+  if (pseudo0C > 4) {
+    pseudo0C = 0;
+#ifdef ISR_STATS
+    // execution time statistics of one ISR per pseudo packet, cycling through all ISRs
+    isr_stats_t isrStats;
+    if (P1P2Serial.isrstats(pseudo0C_isr, isrStats, true)) {
+      WB[0]  = 0x00;
+      WB[1]  = 0x00;
+      WB[2]  = 0x0C;
+      WB[3]  = pseudo0C_isr;
+      WB[4]  = (isrStats.max >> 8) & 0xFF;
+      WB[5]  = isrStats.max & 0xFF;
+      WB[6]  = isrStats.max_state;
+      for (uint8_t i = 0; i < ISR_STATS_BINS; i++) {
+        WB[7 + 2 * i] = (isrStats.hist[i] >> 8) & 0xFF;
+        WB[8 + 2 * i] = isrStats.hist[i] & 0xFF;
       }
-      if (readError) {
-        Serial.print(F(" readError=0x"));
-        if (readError < 0x10) Serial.print('0');
-        if (readError < 0x100) Serial.print('0');
-        if (readError < 0x1000) Serial.print('0');
-        Serial.print(readError, HEX);
-      }
-      Serial.println();
+      if (verbose < 4) writePseudoPacket(WB, 23);
+    }
+    if (++pseudo0C_isr >= ISR_STATS_CNT) pseudo0C_isr = 0;
+#endif /* ISR_STATS */
+#ifdef IDLE_SLEEP
+    // CPU cycles asleep in idle() and CPU utilisation since previous pseudo packet 00010C
+    idle_stats_t idleStats;
+    if (P1P2Serial.idlestats(idleStats, true)) {
+      uint32_t c = idleStats.cycles >> 8;
+      uint16_t util = c ? 1000 - (uint16_t) ((idleStats.sleep >> 8) * 1000 / c) : 0; // per mille
+      WB[0]  = 0x00;
+      WB[1]  = 0x01;
+      WB[2]  = 0x0C;
+      WB[3]  = (idleStats.cycles >> 24) & 0xFF;
+      WB[4]  = (idleStats.cycles >> 16) & 0xFF;
+      WB[5]  = (idleStats.cycles >> 8) & 0xFF;
+      WB[6]  = idleStats.cycles & 0xFF;
+      WB[7]  = (idleStats.sleep >> 24) & 0xFF;
+      WB[8]  = (idleStats.sleep >> 16) & 0xFF;
+      WB[9]  = (idleStats.sleep >> 8) & 0xFF;
+      WB[10] = idleStats.sleep & 0xFF;
+      WB[11] = (idleStats.count >> 8) & 0xFF;
+      WB[12] = idleStats.count & 0xFF;
+      WB[13] = (util >> 8) & 0xFF;
+      WB[14] = util & 0xFF;
+      for (uint8_t i = 15; i <= 22; i++) WB[i] = 0x00;
+      if (verbose < 4) writePseudoPacket(WB, 23);
     }
+#endif /* IDLE_SLEEP */
   }
-#ifdef PSEUDO_PACKETS
+#endif /* ISR_STATS || IDLE_SLEEP */
   if (pseudo0D > 4) {
     pseudo0D = 0;
     WB[0]  = 0x00;
@@ -1874,6 +2147,64 @@ void loop() {
       for (int i = 3; i <= 22; i++) WB[i]  = 0x00;
     }
     if (verbose < 4) writePseudoPacket(WB, 23);
+#ifdef ADC_BITSYNC
+    // bus levels sampled in 0 bits (low) and 1 bits (high) of one sender per pseudo packet 00010D, cycling through senders 00, 40, 80, C0
+    adc_bit_stats_t bitStats;
+    if (hwID && P1P2Serial.ADC_bitstats(pseudo0D_source, bitStats, true)) {
+      WB[0]  = 0x00;
+      WB[1]  = 0x01;
+      WB[2]  = 0x0D;
+      WB[3]  = pseudo0D_source << 6;
+      for (uint8_t l = 0; l < 2; l++) {
+        uint16_t avg = bitStats.n[l] ? bitStats.sum[l] / bitStats.n[l] : 0;
+        WB[4 + 8 * l]  = (bitStats.n[l] >> 8) & 0xFF;
+        WB[5 + 8 * l]  = bitStats.n[l] & 0xFF;
+        WB[6 + 8 * l]  = (bitStats.min[l] >> 8) & 0xFF;
+        WB[7 + 8 * l]  = bitStats.min[l] & 0xFF;
+        WB[8 + 8 * l]  = (bitStats.max[l] >> 8) & 0xFF;
+        WB[9 + 8 * l]  = bitStats.max[l] & 0xFF;
+        WB[10 + 8 * l] = (avg >> 8) & 0xFF;
+        WB[11 + 8 * l] = avg & 0xFF;
+      }
+      int16_t eye = (bitStats.n[0] && bitStats.n[1]) ? (int16_t) bitStats.min[1] - (int16_t) bitStats.max[0] : 0; // eye margin
+      WB[20] = (eye >> 8) & 0xFF;
+      WB[21] = eye & 0xFF;
+      WB[22] = 0x00;
+      if (verbose < 4) writePseudoPacket(WB, 23);
+    }
+    if (++pseudo0D_source >= ADC_BIT_SOURCES) pseudo0D_source = 0;
+#endif /* ADC_BITSYNC */
+#ifdef ADC_STREAM
+    // last complete ADC window of one channel per pseudo packet 00020D, alternating between ADC6 (bus voltage) and ADC7 (3V3)
+    adc_window_t adcWindow;
+    if (hwID && P1P2Serial.ADC_window(pseudo0D_channel, adcWindow)) {
+      uint16_t mean = adcWindow.n ? adcWindow.sum / adcWindow.n : 0;
+      WB[0]  = 0x00;
+      WB[1]  = 0x02;
+      WB[2]  = 0x0D;
+      WB[3]  = pseudo0D_channel;
+      WB[4]  = (adcWindow.seq >> 8) & 0xFF;
+      WB[5]  = adcWindow.seq & 0xFF;
+      WB[6]  = (adcWindow.n >> 8) & 0xFF;
+      WB[7]  = adcWindow.n & 0xFF;
+      WB[8]  = (adcWindow.lost >> 8) & 0xFF;
+      WB[9]  = adcWindow.lost & 0xFF;
+      WB[10] = (adcWindow.min >> 8) & 0xFF;
+      WB[11] = adcWindow.min & 0xFF;
+      WB[12] = (adcWindow.max >> 8) & 0xFF;
+      WB[13] = adcWindow.max & 0xFF;
+      WB[14] = (mean >> 8) & 0xFF;
+      WB[15] = mean & 0xFF;
+      for (uint8_t i = 0; i < 3; i++) {
+        uint16_t q = (i < ADC_QUANTILE_CNT) ? adcWindow.q[i] : 0;
+        WB[16 + 2 * i] = (q >> 8) & 0xFF;
+        WB[17 + 2 * i] = q & 0xFF;
+      }
+      WB[22] = 0x00;
+      if (verbose < 4) writePseudoPacket(WB, 23);
+    }
+    pseudo0D_channel ^= 1;
+#endif /* ADC_STREAM */
   }
   if (pseudo0E > 4) {
     pseudo0E = 0;
@@ -1892,6 +2223,19 @@ void loop() {
     WB[12] = counterRepeatingRequest;
     WB[13] = counterRequest;
     WB[14] = errorsLargePacket;
+#ifdef E_SERIES
+    // number of queued parameter writes, and the first of these
+    writeEntry_t* e = writeQueue;
+    while ((e < writeQueue + WRITE_QUEUE_SIZE - 1) && !e->pt) e++;
+    WB[15] = writeQueueCount();
+    WB[16] = e->pt;
+    WB[17] = e->nr >> 8;
+    WB[18] = e->nr & 0xFF;
+    WB[19] = e->val >> 24;
+    WB[20] = 0xFF & (e->val >> 16);
+    WB[21] = 0xFF & (e->val >> 8);
+    WB[22] = 0xFF & e->val;
+#else /* E_SERIES */
     WB[15] = wr_cnt;
     WB[16] = wr_pt;
     WB[17] = wr_nr >> 8;
@@ -1900,6 +2244,7 @@ void loop() {
     WB[20] = 0xFF & (wr_val >> 16);
     WB[21] = 0xFF & (wr_val >> 8);
     WB[22] = 0xFF & wr_val;
+#endif /* E_SERIES */
     if (verbose < 4) writePseudoPacket(WB, 23);
   }
   if (pseudo0F > 4) {
@@ -1939,4 +2284,7 @@ void loop() {
     if (verbose < 4) writePseudoPacket(WB, 23);
   }
 #endif /* PSEUDO_PACKETS */
+#ifdef IDLE_SLEEP
+  P1P2Serial.idle(); // sleeps until the next interrupt (bus, timers, serial input or output), unless a packet is waiting
+#endif /* IDLE_SLEEP */
 }
@@ -0,0 +1,48 @@
+/* Arduino.h: minimal Arduino core replacement for the host-native build of P1P2Serial
+ *
+ * Copyright (c) 2019-2023 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 initial version
+ *                  ISRs with C linkage, as on avr-libc, so that they can be defined in the per-bus namespaces
+ *
+ * Only provides what P1P2Serial.cpp needs; all hardware access goes through VirtualHW.h.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "VirtualHW.h"
+
+#ifndef F_CPU
+#error F_CPU must be defined (8000000L or 16000000L)
+#endif
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define LED_BUILTIN 13
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#define ISR(vector) extern "C" void vector(void)
+#define SREG  (VHW.sreg)
+#define cli() (VHW.sreg &= ~0x80)
+#define sei() (VHW.sreg |= 0x80)
+
+inline void pinMode(uint8_t pin, uint8_t mode) { (void) pin; (void) mode; }
+inline void digitalWrite(uint8_t pin, uint8_t val) { VHW_digital_write(pin, val); }
+
+#endif /* Arduino_h */
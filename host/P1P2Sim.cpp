@@ -0,0 +1,1099 @@
+/* P1P2Sim: host-native bench for the P1P2Serial library on the virtual ATmega timer model
+ *
+ * Copyright (c) 2019-2023 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 initial version
+ *                  -q: queue several packets per cycle with schedulepacket() (priority, deadline)
+ *                  packet timestamps (packettime()) checked against the time the other devices started sending
+ *                  per-ISR execution time histograms as measured by the library itself (isrstats())
+ *                  -s: separate clock deviation for the 40 (heat pump) packets, estimated clock skew per sender (clockskew())
+ *                  -u: software scope on, compressed log decoded (P1P2Serial_Scope.h) and checked against each packet read or written
+ *                  -g: counter requests written in learned pauses (schedulegap()), pause after 400012 occasionally short
+ *                  -d: packets read and answered by an event handler in the ms timer ISR, main loop slowed down (setHandler(), dispatch())
+ *                  -b: second, fully loaded bus (P1P2Serial1 on virtual timer4/timer3), checked independently
+ *                  -a: bus voltage on ADC with sender-dependent low level, bit-synchronous level statistics checked (ADC_bitstats())
+ *                  -a: windowed ADC statistics and quantiles checked (ADC_STREAM, ADC_window())
+ *                  -r: collisions injected in our replies, retransmit checked (setRetry(), writeresult())
+ *                  -i: main loop sleeps in idle() when it has nothing to do, CPU utilisation checked (idlestats())
+ *                  -c: another device starts a packet just before our reply, which is deferred by listen before talk (writedeferred())
+ *                  clock (clock_cycles(), clock_usec(), clock_msec(), clock_sec(), uptime_*()) of both buses checked against virtual time in each loop
+ *                  -f: each packet read encoded as binary link frame (P1P2Serial_Link.h), decoded and compared, corruption detected
+ *                  -y: 00F030 requests answered by the library from preloaded reply slots while the main loop is busy (setReply(), TX_REPLY)
+ *
+ * Replays a Daikin E-series style bus cycle (00/40 request/response pairs) on the virtual bus,
+ * acts as auxiliary controller by answering each 00F030 request, and verifies that every packet
+ * (including the read-back of our own replies) is received unchanged and without error flags.
+ * Reports per-ISR call counts, estimated ISR load, worst-case interrupt latency and missed
+ * semibit deadlines, so changes to the ISRs can be evaluated on a PC.
+ *
+ * Usage: p1p2sim [-n cycles] [-p ppm] [-s ppm] [-k pausebits] [-e vector=cycles] [-l entrycycles] [-z] [-q] [-g] [-u] [-d] [-b] [-a] [-r] [-i] [-c] [-f] [-y] [-v]
+ *   -n cycles      number of bus cycles to simulate (default 10)
+ *   -p ppm         clock deviation of the other devices on the bus (default 0)
+ *   -s ppm         clock deviation of the heat pump (packets starting with 40) (default: same as -p)
+ *   -k pausebits   pause between bytes of other devices, in bits (KLIC-DA style, default 0)
+ *   -e vec=cycles  ISR cost estimate in cycles for vector vec (0..11, see VirtualHW.h)
+ *   -l cycles      ISR entry latency in cycles (default 20)
+ *   -z             read packets in place with acquirepacket()/releasepacket() instead of readpacket()
+ *   -q             per 00F030 request, queue a 0000B8 counter request (priority 0), the 40F030 reply (priority 1, written first)
+ *                  and a packet which can only be written after 60s silence, and is dropped after 100ms (deadline)
+ *   -g             per 400011 response, queue a 0000B8 counter request with schedulegap() (5ms after a packet followed by a pause of
+ *                  at least 35ms, risk 0), dropped after 300ms; the pause after 400012 is only 27ms in every 4th cycle
+ *   -u             software scope (SW_SCOPE) on: the bits of each packet read or written are decoded from the scope log and compared,
+ *                  with -v the scope log is printed as by P1P2Monitor
+ *   -d             packets are read, checked and answered by a P1P2_EVENT_PACKET handler running in the ms timer ISR, while the main loop
+ *                  only calls dispatch() every 10ms (as if busy with serial output); write and idle events are counted by handlers in dispatch()
+ *   -b             second bus (P1P2Serial1), during the same time: packets of 4..24 bytes (clock deviation -p) with pauses of 2-3ms, every 8th
+ *                  packet a 00F030 request answered by us, so that both buses are read and written at the same time (needs 16MHz; not with -d,
+ *                  as a main loop busy for 10ms cannot keep up with such a bus)
+ *   -a             ADC on (use_ADC): bus voltage on ADC0 is 700 (high), 250 (low, main controller 00) or 380 (low, heat pump 40 and
+ *                  our own replies), with +-16 noise; the levels and eye margin per sender reported by ADC_bitstats() are checked (not with -q,
+ *                  as our 0000B8 requests would count as sender 00); the ADC windows (1024 samples) of ADC1 (736 +-16) are checked as well
+ *   -r             replies queued with one retry (setRetry(1, 4)) and a 70ms deadline; another device pulls the bus low during the first byte
+ *                  of our reply to every 4th 00F030 request (written again after a backoff), and during both attempts for every 8th (dropped);
+ *                  the read-back of each collision, and the results reported by writeresult() are checked (with -q, no collisions are
+ *                  injected, as the retried reply would be written after the counter request, nor with -b, as both buses share the write LED
+ *                  used to detect the start of our write)
+ *   -i             main loop calls idle() after each iteration (100 cycles, plus 2000 cycles per packet read), instead of polling every 100us;
+ *                  the cycles asleep and awake reported by idlestats() are checked against the virtual ATmega (not with -r, which needs to
+ *                  watch the bus while the main loop sleeps)
+ *   -c             for every 2nd 00F030 request, the main controller starts a 4-byte packet 20us after our reply is selected for writing
+ *                  (write LED on), in the carrier sense window; our reply is expected to be deferred (TX_CARRIER_SENSE) and written
+ *                  after that packet, without a collision (not with -q, -r, -b or -i)
+ *   -f             each packet read is encoded as a binary link frame (P1P2Serial_Link.h) as by P1P2Monitor with BINARY_LINK, and decoded
+ *                  and compared as by P1P2-bridge-esp8266; a copy with one bit flipped must be rejected; frame sizes are compared with
+ *                  the text lines of verbosity level 3
+ *   -y             00F030 requests are answered by the library (TX_REPLY) instead of by the main loop: slot 1 answers each request with a fixed
+ *                  payload (header copied from the request), and for every 2nd request the main loop preloads a one-shot reply with a random
+ *                  payload in slot 0, which takes precedence; after reading a request, the main loop is busy for F03XDELAY + 30ms, so a reply
+ *                  queued by it would be late; packetreply(), replycount() and the pause before each reply are checked (not with -q, -r, -c,
+ *                  -d, -i or -b, as a busy main loop cannot keep up with bus 1; with -a, ADC samples may be lost meanwhile)
+ *   -v             print all packets, in P1P2Monitor format
+ *
+ * Exit status is 0 if all packets were received as sent, with correct timestamps, 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+#include "P1P2Serial.h"
+#include "P1P2Serial_Link.h"
+
+#define CRC_GEN 0xD9
+#define CRC_FEED 0x00
+#define F03XDELAY 30
+#define RB_SIZE 33
+
+P1P2Serial P1P2Serial;
+P1P2Serial1 P1P2Serial1;
+
+typedef std::vector<uint8_t> packet_t;
+
+static std::deque<packet_t> expected;
+static std::deque<uint64_t> expected_time; // first falling edge (cycles), 0 for our own packets
+static uint32_t time_maxdev = 0;           // max deviation of packettime() from expected_time
+static uint32_t clock_checks = 0;          // clock readings checked against VHW_now
+static uint32_t clock_bad = 0;
+static uint32_t packets_ok = 0;
+static uint32_t packets_bad = 0;
+static uint32_t bytes_rx = 0;
+static uint8_t verbose = 0;
+static bool queue = false;
+static bool scope = false;
+static bool gap = false;
+static std::deque<packet_t> gap_pending;   // schedulegap() packets queued, not yet read back
+static uint32_t gap_queued = 0;
+static uint32_t gap_written = 0;
+static uint32_t gap_refused = 0;
+static uint16_t gap_delta_max = 0;         // longest pause before a schedulegap() packet
+static uint8_t prev_header[3];             // header of previous packet read
+static uint32_t scope_packets = 0;         // packets with a scope log
+static uint32_t scope_bytes = 0;           // bytes read whose bits were decoded correctly from the scope log
+static uint32_t scope_bits = 0;            // size of these scope logs
+static uint32_t scope_written = 0;         // bytes of these written by us
+static uint32_t scope_collisions = 0;      // bytes written with a read-back error in the scope log, not compared
+static uint32_t scope_bad = 0;             // bytes decoded from the scope log which differ from the bytes read
+static uint8_t scope_maxbytes = 0;
+static bool zerocopy = false;
+static uint32_t ev_writes = 0;             // P1P2_EVENT_WRITE events handled
+static uint32_t ev_collisions = 0;
+static uint32_t ev_idles = 0;
+static bool bus1 = false;
+static std::deque<packet_t> expected1;     // -b: packets expected on bus 1, empty for our own replies until written
+static uint32_t packets1_ok = 0;
+static uint32_t packets1_bad = 0;
+static uint32_t bytes1_rx = 0;
+static uint32_t writes1 = 0;
+static bool adc = false;
+static std::map<uint64_t, std::pair<uint64_t, uint8_t> > adc_sender; // -a: packets sent by other devices: start -> (end, first byte)
+static uint32_t adc_seed = 1;             // separate noise generator, so that -a does not change the packets sent
+static bool retry = false;
+static uint32_t f030_cnt = 0;               // -r: 00F030 requests read
+static uint8_t collide_left = 0;            // -r: attempts to write our reply still to be hit by a collision
+static uint8_t led_write_prev = 0;
+static uint32_t collisions = 0;             // -r: collisions injected
+static uint32_t collision_echoes = 0;       // -r: read-back of a collided write expected (1 byte with error flags)
+static uint32_t results[3] = { 0, 0, 0 };   // -r: writeresult() per status for our 40F030 replies
+static uint32_t results_retried = 0;        // -r: 40F030 replies written after more than 1 attempt
+static uint32_t results_exp[3] = { 0, 0, 0 };
+static uint32_t results_retried_exp = 0;
+static uint32_t results_other[3] = { 0, 0, 0 }; // -r: writeresult() per status for other packets (-q, -g)
+static uint32_t results_other_exp[3] = { 0, 0, 0 };
+static bool sleep_idle = false;
+static bool sense = false;
+static uint32_t sense_cnt = 0;              // -c: 00F030 requests read
+static packet_t sense_packet;               // -c: packet to be sent when our next write starts, if not empty
+static uint32_t sense_sent = 0;             // -c: packets sent in the carrier sense window
+static bool link = false;
+static uint32_t link_frames = 0;            // -f: packets encoded as binary link frame
+static uint32_t link_bytes = 0;             // -f: size of these frames
+static uint32_t link_text = 0;              // -f: size of the same packets as text lines
+static uint32_t link_bad = 0;               // -f: frames not decoded correctly, or corrupted copies accepted
+static bool autoreply = false;
+static tx_reply_t reply_slot[2];            // -y: contents of reply slots 0 (one-shot) and 1
+static uint32_t reply_requests = 0;         // -y: 00F030 requests read
+static uint32_t reply_lib = 0;              // -y: requests answered by the library
+static uint32_t reply_oneshot = 0;          // -y: requests answered by slot 0
+static uint16_t reply_delta_min = 0xFFFF;   // -y: pause before our replies read back
+static uint16_t reply_delta_max = 0;
+static bool reply_pending = false;          // -y: our reply is the next packet expected
+static bool reply_busy = false;             // -y: main loop to be busy after a request
+#define LOOP_CYCLES 100                     // -i: main loop iteration without work
+#define PACKET_CYCLES 2000                  // -i: reading and checking a packet
+static uint64_t idle_cycles = 0;            // -i: sums of idlestats(), read every simulated second
+static uint64_t idle_sleep = 0;
+static uint32_t idle_count = 0;
+static uint32_t seed = 1;
+static P1P2_crc_t crc_cfg;
+
+static uint8_t rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+#define ADC_HIGH      700
+#define ADC_LOW_00    250
+#define ADC_LOW_40    380
+#define ADC_NOISE     16
+#define ADC_V1        0x2E0
+#define ADC_SIM_WINDOW 1024
+
+static uint16_t adc_source(uint8_t channel)
+// -a: ADC0 measures the bus voltage, ADC1 a constant supply voltage
+{
+  adc_seed = adc_seed * 1103515245 + 12345;
+  int16_t noise = (int16_t) ((adc_seed >> 16) % (2 * ADC_NOISE + 1)) - ADC_NOISE;
+  if (channel) return ADC_V1 + noise;
+  if (VHW_input_pin(0)) return ADC_HIGH + noise;
+  uint8_t sender = 0x40; // our own replies
+  std::map<uint64_t, std::pair<uint64_t, uint8_t> >::const_iterator it = adc_sender.upper_bound(VHW_now);
+  if (it != adc_sender.begin()) {
+    --it;
+    if (VHW_now < it->second.first) sender = it->second.second;
+  }
+  return ((sender == 0x00) ? ADC_LOW_00 : ADC_LOW_40) + noise;
+}
+
+static uint8_t crc8(const uint8_t* b, uint8_t n)
+{
+  return P1P2_crc_calc(crc_cfg, b, n);
+}
+
+static packet_t make_packet(uint8_t src, uint8_t dst, uint8_t type, uint8_t payload)
+{
+  packet_t p;
+  p.push_back(src);
+  p.push_back(dst);
+  p.push_back(type);
+  for (uint8_t i = 0; i < payload; i++) p.push_back(rnd());
+  p.push_back(crc8(p.data(), p.size()));
+  return p;
+}
+
+static void print_packet(const char* dir, const uint8_t* b, uint16_t n, uint16_t delta, const errorbuf_t* e)
+{
+  printf("%s %5u: ", dir, delta);
+  for (uint16_t i = 0; i < n; i++) printf("%02X", b[i]);
+  if (e) for (uint16_t i = 0; i < n; i++) if (e[i]) {
+    printf(" err[%u]=0x%02X", i, (unsigned) e[i]);
+  }
+  printf("\n");
+}
+
+#ifdef SW_SCOPE
+static void check_scope(const uint8_t* RB, uint16_t n)
+// decodes scope log of packet just read (read mode) or written (write mode), and compares bits of bytes read with RB
+{
+  static const char* const err_name[] = { "LW", "be", "pe", "bc", "sb", "BE", "PE", "BC", "SB" }; // SWS_EVENT_ERR_LOW .. SWS_EVENT_ERR_SB
+  P1P2_sws_reader_t r;
+  uint8_t event;
+  int16_t dev;
+  int16_t dev_printed[2] = { 0, 0 }; // falling edges, rising edges (when reading: start bits)
+  uint8_t b = 0;
+  uint16_t bytes = 0;
+  uint8_t first = 0; // write mode: level of first semibit (0 falling edge, 1 high, 2 rising edge)
+  bool wbad = false; // write mode: semibit events of byte do not match a written bit
+  bool werr = false; // write mode: read-back error logged for byte (collision), not checked
+  P1P2_sws_init(r, sws_buffer, sws_bitcnt);
+  if (verbose) printf("c %02X%02X%02X ", RB[0], RB[1], RB[2]);
+  while (P1P2_sws_next(r, event, dev)) {
+    uint8_t ev = event & SWS_EVENT_MASK;
+    uint8_t state = event & 0x1F;
+    if (ev == 0xE0) {
+      if (r.mode == SWS_MODE_WRITE) werr = true;
+      if (verbose) printf("[%s]", (event >= SWS_EVENT_ERR_LOW) ? err_name[event - SWS_EVENT_ERR_LOW] : "??");
+      continue;
+    }
+    char c = ' ';
+    switch (ev) {
+      case SWS_EVENT_EDGE_FALLING_R : if (state < 2) {
+                                        b = 0;
+                                        if (verbose) printf(" ");
+                                        c = 'S';
+                                      } else if (state < 11) {
+                                        c = '0';
+                                      } else {
+                                        c = '!';
+                                      }
+                                      break;
+      case SWS_EVENT_SIGNAL_HIGH_R  : if (r.mode == SWS_MODE_WRITE) {
+                                        c = '-';
+                                      } else if (state < 10) {
+                                        b |= (1 << (state - 2));
+                                        c = '1';
+                                      } else if (state == 10) {
+                                        c = '1';
+                                      } else {
+                                        if ((bytes < n) && (RB[bytes] == b)) {
+                                          scope_bytes++;
+                                        } else {
+                                          scope_bad++;
+                                        }
+                                        bytes++;
+                                        c = 0;
+                                      }
+                                      break;
+      case SWS_EVENT_EDGE_FALLING_W : if ((state == 1) && verbose) printf(" ");
+                                      c = '\\';
+                                      break;
+      case SWS_EVENT_EDGE_RISING    : c = '/';
+                                      break;
+      case SWS_EVENT_EDGE_SPIKE     : c = 'x';
+                                      break;
+    }
+    if ((r.mode == SWS_MODE_WRITE) && (ev != SWS_EVENT_EDGE_SPIKE)) {
+      // start bit, data bits (LSB first) and parity bit as written: falling and rising edge for 0, high semibits for 1
+      uint8_t level = (ev == SWS_EVENT_EDGE_FALLING_W) ? 0 : ((ev == SWS_EVENT_SIGNAL_HIGH_R) ? 1 : 2);
+      if (state & 1) {
+        first = level;
+        if (state == 1) {
+          b = 0;
+          wbad = (level != 0);
+          werr = false;
+        } else if (level == 2) {
+          wbad = true;
+        } else if ((state < 19) && level) {
+          b |= (1 << ((state - 3) >> 1));
+        }
+      } else {
+        if (level != (first ? 1 : 2)) wbad = true;
+        if (state == 20) {
+          if (werr) {
+            scope_collisions++;
+          } else if (!wbad && (bytes < n) && (RB[bytes] == b)) {
+            scope_bytes++;
+            scope_written++;
+          } else {
+            scope_bad++;
+          }
+          bytes++;
+        }
+      }
+    }
+    if (verbose && c) {
+      printf("%c", c);
+      int16_t &shown = dev_printed[(ev == SWS_EVENT_EDGE_RISING) || ((ev == SWS_EVENT_EDGE_FALLING_R) && (state < 2))];
+      if ((ev != SWS_EVENT_SIGNAL_HIGH_R) && ((dev > shown + 1) || (dev < shown - 1))) { // ignore 1us jitter
+        printf("(%+d)", dev);
+        if (ev != SWS_EVENT_EDGE_SPIKE) shown = dev;
+      }
+    }
+  }
+  if (verbose) printf("%s\n", sws_overflow ? " ..." : "");
+  scope_packets++;
+  if (bytes) scope_bits += sws_bitcnt;
+  if (bytes > scope_maxbytes) scope_maxbytes = bytes;
+  sws_block = 0; // release log for next packet
+}
+#endif /* SW_SCOPE */
+
+// E-series request/response payload lengths for packet types 0x10..0x15
+static const uint8_t req_len[] = { 20, 8, 13, 0, 15, 3 };
+static const uint8_t resp_len[] = { 20, 17, 17, 13, 15, 6 };
+
+#define MS(x) ((uint64_t) (x) * (F_CPU / 1000))
+
+static uint64_t bus_send(uint64_t t, const packet_t &p, int32_t ppm, uint8_t pause)
+{
+  uint64_t t_end = VHW_bus_send(t, p.data(), p.size(), ppm, pause);
+  if (adc) adc_sender[t] = std::make_pair(t_end, p[0]);
+  return t_end;
+}
+
+static uint64_t schedule_cycles(uint16_t n, int32_t ppm, int32_t ppm40, uint8_t pause)
+{
+  uint64_t t = MS(50);
+  for (uint16_t c = 0; c < n; c++) {
+    for (uint8_t i = 0; i < sizeof(req_len); i++) {
+      packet_t req = make_packet(0x00, 0x00, 0x10 + i, req_len[i]);
+      expected_time.push_back(t);
+      t = bus_send(t, req, ppm, pause);
+      expected.push_back(req);
+      t += MS(25) + (rnd() & 0x3FF);
+      packet_t resp = make_packet(0x40, 0x00, 0x10 + i, resp_len[i]);
+      expected_time.push_back(t);
+      t = bus_send(t, resp, ppm40, pause);
+      expected.push_back(resp);
+      // with -g, every 4th pause after 400012 is too short for a counter request and its response
+      t += MS((gap && (i == 2) && ((c & 3) == 3)) ? 27 : 40) + (rnd() & 0x3FF);
+    }
+    packet_t req = make_packet(0x00, 0xF0, 0x30, 14);
+    expected_time.push_back(t);
+    t = bus_send(t, req, ppm, pause);
+    expected.push_back(req);
+    // 40F030 reply written by us, F03XDELAY ms after the request, read back as echo
+    expected.push_back(packet_t());
+    expected_time.push_back(0);
+    t += MS(F03XDELAY + 25 + 40);
+    if (queue) {
+      // 0000B8 request written by us, F03XDELAY ms after our reply
+      expected.push_back(packet_t());
+      expected_time.push_back(0);
+      t += MS(F03XDELAY + 10);
+    }
+  }
+  return t;
+}
+
+static void schedule_bus1(uint64_t t_end, int32_t ppm)
+// fully loaded second bus, until t_end
+{
+  uint64_t t = MS(50);
+  for (uint32_t i = 0; t < t_end; i++) {
+    bool f030 = ((i & 7) == 7);
+    packet_t p = f030 ? make_packet(0x00, 0xF0, 0x30, 14) : make_packet((i & 1) ? 0x40 : 0x00, 0x00, 0x10 + (i % 6), rnd() % 21);
+    t = VHW_bus_send(t, p.data(), p.size(), ppm, 0, 1);
+    expected1.push_back(p);
+    if (f030) {
+      // 40F030 reply written by us, F03XDELAY ms after the request
+      expected1.push_back(packet_t());
+      t += MS(F03XDELAY + 25);
+    }
+    t += MS(2) + (rnd() & 0x3FF);
+  }
+}
+
+static void check_link(const uint8_t* RB, const errorbuf_t* EB, uint16_t n, uint16_t delta, errorbuf_t packeterrors, uint32_t time)
+// -f: encodes a packet as binary link frame as P1P2Monitor does (which sends microseconds instead of packettime()),
+// decodes it as P1P2-bridge-esp8266 does, and checks that a copy with one bit flipped is rejected
+{
+  uint8_t frame[P1P2_LINK_FRAME(RB_SIZE, sizeof(errorbuf_t))];
+  P1P2_link_writer_t w;
+  P1P2_link_start(w, frame);
+  uint8_t flags = packeterrors ? P1P2_link_errorflags<errorbuf_t>() : 0;
+  P1P2_link_put(w, flags);
+  P1P2_link_put16(w, delta);
+  P1P2_link_put32(w, time);
+  for (uint16_t i = 0; i < n; i++) P1P2_link_put(w, RB[i]);
+  if (packeterrors) {
+    P1P2_link_put_errors(w, EB, n);
+    P1P2_link_put16(w, packeterrors);
+  }
+  uint8_t len = P1P2_link_end(w);
+  link_frames++;
+  link_bytes += len;
+  link_text += 12 + 2 * n + 2 + (packeterrors ? 17 : 0); // "R T  0.036: ", hex, "\r\n", " readError=0x...."
+  uint8_t copy[sizeof(frame)];
+  memcpy(copy, frame, len);
+  P1P2_link_record_t r;
+  bool ok = !frame[0] && !frame[len - 1] && !memchr(frame + 1, 0, len - 2) && P1P2_link_decode(r, frame + 1, len - 2)
+            && (r.flags == flags) && (r.delta == delta) && (r.time == time) && (r.n == n)
+            && std::equal(RB, RB + n, r.data) && (r.readerror == packeterrors);
+  for (uint16_t i = 0; ok && packeterrors && (i < n); i++) ok = (P1P2_link_error(r, i) == EB[i]);
+  // flip a bit, in another byte and bit position for each frame; a 0x00 would only split the frame
+  uint8_t* b = copy + 1 + link_frames % (len - 2);
+  *b ^= 1 << (link_frames & 7);
+  if (ok && *b && P1P2_link_decode(r, copy + 1, len - 2)) {
+    printf("* binary link: corrupted frame accepted\n");
+    ok = false;
+  }
+  if (!ok) {
+    print_packet("* binary link: frame not decoded correctly for", RB, n, delta, EB);
+    link_bad++;
+  }
+}
+
+static void check_reply(const uint8_t* RB, uint16_t n, uint8_t reply)
+// -y: 00F030 request read, answered by the library from slot reply - 1; sets the reply expected, and for every 2nd request preloads slot 0
+{
+  reply_requests++;
+  if (!reply) {
+    printf("* 00F030 request not answered by the library\n");
+    packets_bad++;
+  } else {
+    const tx_reply_t& r = reply_slot[reply - 1];
+    uint8_t WB[RB_SIZE];
+    uint8_t l = r.len ? r.len : n - 1;
+    for (uint8_t i = 0; i < l; i++) WB[i] = ((r.copy >> i) & 1) ? RB[i] : r.data[i];
+    if (!expected.empty() && expected.front().empty()) {
+      expected.front().assign(WB, WB + l);
+      expected.front().push_back(crc8(WB, l));
+    }
+    if (verbose) print_packet("W", WB, l, r.delay, NULL);
+    reply_lib++;
+    reply_pending = true;
+    if (reply == 1) reply_oneshot++;
+  }
+  if (P1P2Serial.replycount(0)) {
+    printf("* one-shot reply slot not used up\n");
+    packets_bad++;
+  }
+  if (reply_requests & 1) {
+    tx_reply_t& r = reply_slot[0];
+    r.count = 1;
+    for (uint8_t i = 3; i < 17; i++) r.data[i] = rnd();
+    P1P2Serial.setReply(0, r);
+  }
+  reply_busy = true;
+}
+
+static void check_packet(const uint8_t* RB, const errorbuf_t* EB, uint16_t n, uint16_t delta, errorbuf_t packeterrors, uint32_t time, uint8_t reply)
+{
+  bytes_rx += n;
+  if (link) check_link(RB, EB, n, delta, packeterrors, time);
+  if (verbose) print_packet("R", RB, n, delta, EB);
+  if (collision_echoes && (n == 1) && (EB[0] & (ERROR_SB | ERROR_BE | ERROR_BC))) {
+    // -r: first byte of our reply, written until the collision was detected
+    collision_echoes--;
+    return;
+  }
+  if (!gap_pending.empty() && (gap_pending.front().size() == n) && std::equal(RB, RB + n, gap_pending.front().begin()) && !packeterrors) {
+    // schedulegap() packet read back: not in the bus schedule, so not in expected
+    gap_pending.pop_front();
+    gap_written++;
+    if (delta > gap_delta_max) gap_delta_max = delta;
+    if ((prev_header[0] == 0x40) && (prev_header[2] == 0x12)) {
+      printf("* schedulegap() packet written after 400012, pause too short in some cycles\n");
+      packets_bad++;
+    }
+    packets_ok++;
+    memcpy(prev_header, RB, 3);
+#ifdef SW_SCOPE
+    if (scope) check_scope(RB, n);
+#endif /* SW_SCOPE */
+    return;
+  }
+  if (n >= 3) memcpy(prev_header, RB, 3);
+  bool ok = !expected.empty() && !packeterrors;
+  if (ok) {
+    const packet_t& p = expected.front();
+    ok = (p.size() == n);
+    for (uint16_t i = 0; ok && (i < n); i++) ok = (p[i] == RB[i]) && !EB[i];
+  }
+  if (ok && !expected_time.empty() && expected_time.front()) {
+    // captured after the 4-cycle noise canceler; a deviation of more than a few cycles means a wrong overflow count
+    uint32_t dev = time - (uint32_t) expected_time.front();
+    if (dev > time_maxdev) time_maxdev = dev;
+    if (dev > 16) {
+      printf("* timestamp off by %d cycles\n", (int32_t) dev);
+      ok = false;
+    }
+  }
+  if (ok && reply_pending) {
+    // -y: our reply, read back
+    if (delta < reply_delta_min) reply_delta_min = delta;
+    if (delta > reply_delta_max) reply_delta_max = delta;
+  }
+  reply_pending = false;
+  if (ok) {
+    packets_ok++;
+  } else {
+    packets_bad++;
+    if (!verbose) print_packet("* mismatch R", RB, n, delta, EB);
+    if (!expected.empty()) print_packet("* expected  ", expected.front().data(), expected.front().size(), 0, NULL);
+  }
+  if (!expected.empty()) expected.pop_front();
+  if (!expected_time.empty()) expected_time.pop_front();
+#ifdef SW_SCOPE
+  if (scope) check_scope(RB, n);
+#endif /* SW_SCOPE */
+  if (gap && (n >= 3) && (RB[0] == 0x40) && (RB[1] == 0x00) && (RB[2] == 0x11)) {
+    // counter request and response need 35ms, 5ms after the packet; only written after 4000xx responses followed by 40ms pauses,
+    // once they have been observed BUS_CYCLE_MIN_N times
+    uint8_t WB[4] = { 0x00, 0x00, 0xB8, (uint8_t) (0x10 + (gap_queued & 0x7F)) }; // distinct from -q counter requests
+    gap_queued++;
+    if (P1P2Serial.schedulegap(WB, 4, 5, 30, 0, NULL, 0, 0, 300, CRC_GEN, CRC_FEED)) {
+      gap_pending.push_back(packet_t(WB, WB + 4));
+      gap_pending.back().push_back(crc8(WB, 4));
+      // dropped after deadline if not written
+      while (gap_pending.size() > 1) gap_pending.pop_front();
+    } else {
+      gap_refused++;
+    }
+  }
+  if (autoreply && (n == 18) && (RB[0] == 0x00) && (RB[1] == 0xF0) && (RB[2] == 0x30)) {
+    check_reply(RB, n, reply);
+    return;
+  }
+  if ((n == 18) && (RB[0] == 0x00) && (RB[1] == 0xF0) && (RB[2] == 0x30)) {
+    uint8_t WB[RB_SIZE];
+    WB[0] = 0x40;
+    WB[1] = 0xF0;
+    WB[2] = 0x30;
+    for (uint8_t i = 3; i < 17; i++) WB[i] = rnd();
+    if (!expected.empty() && expected.front().empty()) {
+      expected.front().assign(WB, WB + 17);
+      expected.front().push_back(crc8(WB, 17));
+    }
+    if (verbose) print_packet("W", WB, 17, F03XDELAY, NULL);
+    if (sense && (sense_cnt++ & 1)) {
+      // other device starts while our reply is in its carrier sense window: its packet is read before our reply
+      sense_packet = make_packet(0x00, 0x00, 0x30, 1);
+      expected.push_front(sense_packet);
+      expected_time.push_front(0);
+    }
+    if (retry) {
+      // collision in first attempt of every 4th reply, in both attempts of every 8th (dropped, so not read back)
+      f030_cnt++;
+      collide_left = (queue || bus1) ? 0 : ((f030_cnt & 7) == 3) ? 2 : ((f030_cnt & 3) == 1) ? 1 : 0;
+      if (collide_left == 2) {
+        results_exp[P1P2_TX_COLLISION]++;
+        if (!expected.empty()) expected.pop_front();
+        if (!expected_time.empty()) expected_time.pop_front();
+      } else {
+        results_exp[P1P2_TX_OK]++;
+        if (collide_left) results_retried_exp++;
+      }
+      if (queue) {
+        results_other_exp[P1P2_TX_OK]++;       // 0000B8 request
+        results_other_exp[P1P2_TX_DEADLINE]++; // packet waiting for 60s silence
+      }
+    }
+    if (!queue && retry) {
+      if (!P1P2Serial.schedulepacket(WB, 17, F03XDELAY, 2500, 0, 70, CRC_GEN, CRC_FEED)) {
+        printf("* schedulepacket() refused packet\n");
+        packets_bad++;
+      }
+      return;
+    }
+    if (!queue) {
+      P1P2Serial.writepacket(WB, 17, F03XDELAY, CRC_GEN, CRC_FEED);
+      return;
+    }
+    uint8_t WB2[4] = { 0x00, 0x00, 0xB8, (uint8_t) (rnd() & 0x01) };
+    uint8_t e = (retry && (collide_left == 2)) ? 0 : 1; // reply dropped after collisions
+    if (expected.size() >= e + 1U) {
+      expected[e].assign(WB2, WB2 + 4);
+      expected[e].push_back(crc8(WB2, 4));
+    }
+    uint8_t WB3[1] = { 0xFF };
+    // all queued at once, without waiting for writeready(); needs TX_PACKET_BUFFER_SIZE >= 4 and 24 frames in write buffer
+    bool ok = P1P2Serial.schedulepacket(WB2, 4, F03XDELAY, 2500, 0, 0, CRC_GEN, CRC_FEED)
+           && P1P2Serial.schedulepacket(WB, 17, F03XDELAY, 2500, 1, retry ? 70 : 0, CRC_GEN, CRC_FEED)
+           && P1P2Serial.schedulepacket(WB3, 1, 60000, 60000, 2, 100);
+    if (!ok) {
+      printf("* schedulepacket() refused packet\n");
+      packets_bad++;
+    }
+  }
+}
+
+static void read_packet(void)
+// reads and checks the next packet (or, in a packet handler, the packet it is called for)
+{
+  uint8_t RB[RB_SIZE];
+  errorbuf_t EB[RB_SIZE];
+  if (zerocopy) {
+    packetview_t view;
+    if (!P1P2Serial.acquirepacket(view)) return;
+    // only copied here for the comparison with the expected packet
+    uint8_t n = (view.len > RB_SIZE) ? RB_SIZE : view.len;
+    for (uint8_t i = 0; i < n; i++) {
+      RB[i] = view.at(i);
+      EB[i] = view.error(i);
+    }
+    check_packet(RB, EB, n, view.delta, view.errors, view.time, view.reply);
+    P1P2Serial.releasepacket();
+  } else {
+    uint16_t delta;
+    uint16_t n = P1P2Serial.readpacket(RB, delta, EB, RB_SIZE, CRC_GEN, CRC_FEED);
+    check_packet(RB, EB, (n > RB_SIZE) ? RB_SIZE : n, delta, P1P2Serial.packeterrors(), P1P2Serial.packettime(), P1P2Serial.packetreply());
+  }
+}
+
+static void read_packet1(void)
+// reads and checks the next packet of bus 1, and answers 00F030 requests
+{
+  uint8_t RB[RB_SIZE];
+  errorbuf_t EB[RB_SIZE];
+  uint16_t delta;
+  uint16_t n = P1P2Serial1.readpacket(RB, delta, EB, RB_SIZE, CRC_GEN, CRC_FEED);
+  if (n > RB_SIZE) n = RB_SIZE;
+  bytes1_rx += n;
+  if (verbose) print_packet("R1", RB, n, delta, EB);
+  bool ok = !expected1.empty() && !P1P2Serial1.packeterrors() && (expected1.front().size() == n) && std::equal(RB, RB + n, expected1.front().begin());
+  if (ok) {
+    packets1_ok++;
+  } else {
+    packets1_bad++;
+    if (!verbose) print_packet("* mismatch R1", RB, n, delta, EB);
+    if (!expected1.empty()) print_packet("* expected   ", expected1.front().data(), expected1.front().size(), 0, NULL);
+  }
+  if (!expected1.empty()) expected1.pop_front();
+  if ((n == 18) && (RB[0] == 0x00) && (RB[1] == 0xF0) && (RB[2] == 0x30)) {
+    uint8_t WB[17] = { 0x40, 0xF0, 0x30 };
+    for (uint8_t i = 3; i < 17; i++) WB[i] = rnd();
+    if (!expected1.empty() && expected1.front().empty()) {
+      expected1.front().assign(WB, WB + 17);
+      expected1.front().push_back(crc8(WB, 17));
+    }
+    if (verbose) print_packet("W1", WB, 17, F03XDELAY, NULL);
+    P1P2Serial1.writepacket(WB, 17, F03XDELAY, CRC_GEN, CRC_FEED);
+    writes1++;
+  }
+}
+
+static void packet_handler(uint8_t events)
+{
+  read_packet();
+}
+
+static void print_isrstats(const char* bus, bool (*isrstats)(uint8_t isr, isr_stats_t &stats, bool reset))
+{
+  static const char* const isr_name[ISR_STATS_CNT] = { "capture", "compare-R", "compare-W", "ms-timer", "ADC" };
+  isr_stats_t is;
+  if (!isrstats(0, is, false)) return;
+  printf("* %-17s %8s %9s   cycles: <64 <128 <256 <512 <1k <2k <4k >=4k\n", "isrstats()", "max", "maxstate");
+  for (uint8_t i = 0; i < ISR_STATS_CNT; i++) {
+    isrstats(i, is, false);
+    char name[24];
+    snprintf(name, sizeof(name), "%s%s", isr_name[i], bus);
+    printf("* %-17s %8u %9u  ", name, is.max, is.max_state);
+    for (uint8_t b = 0; b < ISR_STATS_BINS; b++) printf(" %u", is.hist[b]);
+    printf("\n");
+  }
+}
+
+static void read_results(void)
+{
+  tx_result_t r;
+  while (P1P2Serial.writeresult(r)) {
+    if (verbose) printf("* writeresult(): %02X%02X%02X status %u attempts %u\n", r.header[0], r.header[1], r.header[2], r.status, r.attempts);
+    if (r.status > P1P2_TX_DEADLINE) continue;
+    if ((r.header[0] == 0x40) && (r.header[1] == 0xF0) && (r.header[2] == 0x30)) {
+      results[r.status]++;
+      if ((r.status == P1P2_TX_OK) && (r.attempts > 1)) results_retried++;
+    } else {
+      results_other[r.status]++;
+    }
+  }
+}
+
+static void bus_handler(uint8_t events)
+{
+  if (events & P1P2_EVENT_WRITE) ev_writes++;
+  if (events & P1P2_EVENT_COLLISION) ev_collisions++;
+  if (events & P1P2_EVENT_IDLE) ev_idles++;
+  if (events & P1P2_EVENT_RESULT) read_results();
+}
+
+static void check_clock(void)
+// called from the main loop, also while an overflow interrupt is pending
+{
+  uint64_t c = P1P2Serial::clock_cycles();
+  clock_checks++;
+  if ((c != VHW_now) || (P1P2Serial1::clock_cycles() != c) || (P1P2Serial::clock_usec() != c / (F_CPU / 1000000))
+      || (P1P2Serial::clock_msec() != c / (F_CPU / 1000)) || (P1P2Serial1::clock_msec() != c / (F_CPU / 1000))
+      || (P1P2Serial::clock_sec() != c / F_CPU) || (P1P2Serial.uptime_sec() != (int32_t) (c / F_CPU))
+      || (P1P2Serial.uptime_millisec() != (int32_t) ((c / (F_CPU / 1000)) & 0x7FFFFFFF))) clock_bad++;
+}
+
+static void read_idlestats(void)
+{
+  idle_stats_t st;
+  if (!P1P2Serial.idlestats(st, true)) return;
+  idle_cycles += st.cycles;
+  idle_sleep += st.sleep;
+  idle_count += st.count;
+}
+
+static void run(uint64_t cycles)
+// runs the virtual ATmega; with -r, another device pulls the bus low for 150us during the first byte of a write to be hit by a collision,
+// with -c, another device starts a packet 20us after the write LED is switched on (checked every 10us)
+{
+  if (!retry && !sense) {
+    VHW_run(cycles);
+    return;
+  }
+  uint64_t t_end = VHW_now + cycles;
+  while (VHW_now < t_end) {
+    if (VHW.led_write && !led_write_prev && collide_left) {
+      // write starts 1.5 bits after the write LED is switched on
+      collide_left--;
+      collisions++;
+      collision_echoes++;
+      VHW_bus_pulse(VHW_now + F_CPU / 2500, F_CPU / 6667);
+    }
+    if (VHW.led_write && !led_write_prev && !sense_packet.empty()) {
+      // write starts 1.5 bits after the write LED is switched on, unless the bus is busy in the first bit time
+      bus_send(VHW_now + F_CPU / 50000, sense_packet, 0, 0);
+      sense_packet.clear();
+      sense_sent++;
+    }
+    led_write_prev = VHW.led_write;
+    uint64_t step = t_end - VHW_now;
+    uint64_t step_max = sense ? F_CPU / 100000 : F_CPU / 10000;
+    VHW_run((step < step_max) ? step : step_max);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  uint16_t cycles = 10;
+  int32_t ppm = 0;
+  int32_t ppm40 = 0;
+  bool ppm40_set = false;
+  uint8_t pause = 0;
+  int opt_entry = -1;
+  bool events = false;
+  uint16_t cost[VHW_VEC_CNT];
+  bool cost_set[VHW_VEC_CNT] = { false };
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v")) {
+      verbose = 1;
+    } else if (!strcmp(argv[i], "-z")) {
+      zerocopy = true;
+    } else if (!strcmp(argv[i], "-q")) {
+      queue = true;
+    } else if (!strcmp(argv[i], "-g")) {
+      gap = true;
+    } else if (!strcmp(argv[i], "-u")) {
+      scope = true;
+    } else if (!strcmp(argv[i], "-d")) {
+      events = true;
+    } else if (!strcmp(argv[i], "-b")) {
+      bus1 = true;
+    } else if (!strcmp(argv[i], "-a")) {
+      adc = true;
+    } else if (!strcmp(argv[i], "-r")) {
+      retry = true;
+    } else if (!strcmp(argv[i], "-i")) {
+      sleep_idle = true;
+    } else if (!strcmp(argv[i], "-c")) {
+      sense = true;
+    } else if (!strcmp(argv[i], "-f")) {
+      link = true;
+    } else if (!strcmp(argv[i], "-y")) {
+      autoreply = true;
+    } else if ((i + 1 < argc) && !strcmp(argv[i], "-n")) {
+      cycles = atoi(argv[++i]);
+    } else if ((i + 1 < argc) && !strcmp(argv[i], "-p")) {
+      ppm = atoi(argv[++i]);
+    } else if ((i + 1 < argc) && !strcmp(argv[i], "-s")) {
+      ppm40 = atoi(argv[++i]);
+      ppm40_set = true;
+    } else if ((i + 1 < argc) && !strcmp(argv[i], "-k")) {
+      pause = atoi(argv[++i]);
+    } else if ((i + 1 < argc) && !strcmp(argv[i], "-l")) {
+      opt_entry = atoi(argv[++i]);
+    } else if ((i + 1 < argc) && !strcmp(argv[i], "-e")) {
+      unsigned v, c;
+      if ((sscanf(argv[++i], "%u=%u", &v, &c) != 2) || (v >= VHW_VEC_CNT)) {
+        fprintf(stderr, "p1p2sim: -e expects vector=cycles with vector 0..%u\n", VHW_VEC_CNT - 1);
+        return 2;
+      }
+      cost[v] = c;
+      cost_set[v] = true;
+    } else {
+      fprintf(stderr, "usage: %s [-n cycles] [-p ppm] [-s ppm] [-k pausebits] [-e vector=cycles] [-l entrycycles] [-z] [-q] [-g] [-u] [-d] [-b] [-a] [-r] [-i] [-c] [-f] [-y] [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (bus1 && events) {
+    fprintf(stderr, "p1p2sim: -b and -d cannot be combined\n");
+    return 2;
+  }
+  if (adc && queue) {
+    fprintf(stderr, "p1p2sim: -a and -q cannot be combined\n");
+    return 2;
+  }
+  if (sleep_idle && retry) {
+    fprintf(stderr, "p1p2sim: -i and -r cannot be combined\n");
+    return 2;
+  }
+  if (sense && (queue || retry || bus1 || sleep_idle)) {
+    fprintf(stderr, "p1p2sim: -c cannot be combined with -q, -r, -b or -i\n");
+    return 2;
+  }
+
+  if (autoreply && (queue || retry || sense || events || sleep_idle || bus1)) {
+    fprintf(stderr, "p1p2sim: -y cannot be combined with -q, -r, -c, -d, -i or -b\n");
+    return 2;
+  }
+
+  P1P2_crc_init(crc_cfg, CRC_GEN, CRC_FEED);
+  VHW_init();
+  for (uint8_t v = 0; v < VHW_VEC_CNT; v++) if (cost_set[v]) VHW.isr_cost[v] = cost[v];
+  if (opt_entry >= 0) VHW.isr_entry_cycles = opt_entry;
+
+  if (adc) VHW.adc_source = adc_source;
+  P1P2Serial.begin(9600, adc, 0, 1);
+  P1P2Serial.ADC_setWindow(ADC_SIM_WINDOW);
+  P1P2Serial.setEcho(1);
+  P1P2Serial.setCRC(CRC_GEN, CRC_FEED);
+  P1P2Serial.setDelayTimeout(2500);
+  if (retry) P1P2Serial.setRetry(1, 4);
+  if (autoreply) {
+    // slot 1: fixed payload, header 40F030 (bytes 1 and 2 copied from the request); slot 0: one-shot, preloaded by check_reply()
+    tx_reply_t& r = reply_slot[1];
+    memset(&r, 0, sizeof(r));
+    r.header[0] = 0x00;
+    r.header[1] = 0xF0;
+    r.type_first = 0x30;
+    r.type_last = 0x30;
+    r.count = P1P2_REPLY_ALWAYS;
+    r.delay = F03XDELAY;
+    r.deadline = 70;
+    r.priority = 1;
+    r.copy = 0x06;
+    r.data[0] = 0x40;
+    for (uint8_t i = 3; i < 17; i++) r.data[i] = 0xA0 + i;
+    reply_slot[0] = r;
+    reply_slot[0].count = 0;
+    if (!P1P2Serial.setReply(1, r)) {
+      fprintf(stderr, "p1p2sim: -y needs TX_REPLY\n");
+      return 2;
+    }
+  }
+#ifdef SW_SCOPE
+  P1P2Serial.setScope(scope);
+#endif /* SW_SCOPE */
+  if (events) {
+    P1P2Serial.setHandler(P1P2_EVENT_PACKET, packet_handler, P1P2_PRIO_ISR);
+    P1P2Serial.setHandler(P1P2_EVENT_WRITE | P1P2_EVENT_IDLE | P1P2_EVENT_RESULT, bus_handler);
+    P1P2Serial.setIdle(35);
+  }
+  if (bus1) {
+    P1P2Serial1.begin(9600);
+    P1P2Serial1.setEcho(1);
+    P1P2Serial1.setCRC(CRC_GEN, CRC_FEED);
+    P1P2Serial1.setDelayTimeout(2500);
+  }
+
+  if (!ppm40_set) ppm40 = ppm;
+  uint64_t t_end = schedule_cycles(cycles, ppm, ppm40, pause) + MS(100);
+  if (bus1) schedule_bus1(t_end - MS(200), ppm);
+
+  idle_stats_t idle_start;
+  P1P2Serial.idlestats(idle_start, true);
+  uint64_t idle_t0 = VHW_now;
+  uint64_t idle_next = VHW_now + F_CPU;
+  while (VHW_now < t_end) {
+    check_clock();
+    if (events) {
+      P1P2Serial.dispatch();
+      P1P2Serial.ADC_process();
+      if (!sleep_idle) run(MS(10)); // main loop busy for 10ms
+    } else {
+      while (P1P2Serial.packetavailable()) {
+        read_packet();
+        if (sleep_idle) VHW_run(PACKET_CYCLES);
+        if (reply_busy) {
+          run(MS(F03XDELAY + 30)); // -y: main loop busy after a request, reply written meanwhile
+          reply_busy = false;
+        }
+      }
+      if (bus1) while (P1P2Serial1.packetavailable()) {
+        read_packet1();
+        if (sleep_idle) VHW_run(PACKET_CYCLES);
+      }
+      P1P2Serial.ADC_process();
+      read_results();
+      if (!sleep_idle) run(F_CPU / 10000); // main loop polls every 100us
+    }
+    if (sleep_idle) {
+      if (VHW_now >= idle_next) {
+        read_idlestats();
+        idle_next += F_CPU;
+      }
+      VHW_run(LOOP_CYCLES);
+      P1P2Serial.idle();
+    }
+  }
+  if (events) P1P2Serial.dispatch();
+  packets_bad += expected.size();
+  packets1_bad += expected1.size();
+
+  double seconds = (double) VHW_now / F_CPU;
+  uint64_t busy = 0;
+  printf("* P1P2Sim F_CPU=%lu simulated=%.3fs packets ok=%u bad/missing=%u bytes=%u\n", (unsigned long) F_CPU, seconds, packets_ok, packets_bad, bytes_rx);
+  printf("* packet timestamp max deviation %u cycles\n", time_maxdev);
+  printf("* clock: %u readings checked, %u wrong, %.6fs at end\n", clock_checks, clock_bad, P1P2Serial::clock_usec() / 1e6);
+  if (clock_bad || !clock_checks) packets_bad++;
+  if (bus1) {
+    printf("* bus 1: packets ok=%u bad/missing=%u bytes=%u, %u written; estimated clock skew %ld ppm (sent %ld)\n", packets1_ok, packets1_bad,
+           bytes1_rx, writes1, (long) P1P2Serial1.clockskew(0x00), (long) ppm);
+    if (!writes1) packets1_bad++;
+  }
+#ifdef SW_SCOPE
+  if (scope) printf("* scope: %u packets logged, %u bytes decoded correctly (%u written, %.1f scope bits per byte), %u wrong, %u written with "
+                    "read-back error, max %u bytes per log (%u bytes buffer)\n", scope_packets, scope_bytes, scope_written,
+                    scope_bytes ? (double) scope_bits / scope_bytes : 0.0, scope_bad, scope_collisions, scope_maxbytes, P1P2SerialCfg::scope_size);
+#endif /* SW_SCOPE */
+  if (gap) {
+    static const uint8_t h12[3] = { 0x40, 0x00, 0x12 };
+    static const uint8_t h13[3] = { 0x40, 0x00, 0x13 };
+    printf("* schedulegap(): %u queued, %u written (max pause before %u ms), %u refused; risk(400012, 35ms) %u, risk(400013, 35ms) %u per mille, "
+           "gapsafe(400012) %u ms\n", gap_queued, gap_written, gap_delta_max, gap_refused, P1P2Serial.gaprisk(h12, 35), P1P2Serial.gaprisk(h13, 35),
+           P1P2Serial.gapsafe(h12, 0));
+    if (verbose) {
+      bus_gap_t g;
+      for (uint8_t i = 0; i < BUS_CYCLE_SIZE; i++) if (P1P2Serial.gapstats(i, g)) {
+        printf("*   pause after %02X%02X%02X: n=%u shortest", g.header[0], g.header[1], g.header[2], g.n);
+        for (uint8_t j = 0; j < BUS_CYCLE_LOW; j++) printf(" %u", g.low[j]);
+        printf(" ms\n");
+      }
+    }
+    if (gap_refused || (cycles > 2 * BUS_CYCLE_MIN_N && gap_written < (uint32_t) (cycles - 2 * BUS_CYCLE_MIN_N))) packets_bad++;
+  }
+  if (events) {
+    printf("* event handlers: %u writes, %u collisions, %u idle\n", ev_writes, ev_collisions, ev_idles);
+    if ((ev_collisions != collisions) || !ev_writes || !ev_idles) packets_bad++;
+  }
+  if (adc) {
+    // expected: mean levels within 4, extremes within the noise, eye margin high - noise - (low + noise)
+    static const uint16_t low[2] = { ADC_LOW_00, ADC_LOW_40 };
+    for (uint8_t i = 0; i < 2; i++) {
+      adc_bit_stats_t st;
+      bool ok = P1P2Serial.ADC_bitstats(i, st);
+      printf("* ADC_bitstats(%02X): ", i << 6);
+      if (ok) {
+        uint16_t avg[2];
+        for (uint8_t l = 0; l < 2; l++) avg[l] = st.n[l] ? st.sum[l] / st.n[l] : 0;
+        int16_t eye = (int16_t) st.min[1] - (int16_t) st.max[0];
+        printf("low n=%u min=%u max=%u avg=%u, high n=%u min=%u max=%u avg=%u, eye margin %d\n", st.n[0], st.min[0], st.max[0], avg[0],
+               st.n[1], st.min[1], st.max[1], avg[1], eye);
+        int16_t eye_exp = (ADC_HIGH - ADC_NOISE) - (low[i] + ADC_NOISE);
+        ok = (st.n[0] >= cycles) && (st.n[1] >= cycles) && (abs(avg[0] - low[i]) <= 4) && (abs(avg[1] - ADC_HIGH) <= 4)
+             && (st.max[0] <= low[i] + ADC_NOISE) && (st.min[1] >= ADC_HIGH - ADC_NOISE) && (eye >= eye_exp) && (eye <= eye_exp + 2 * ADC_NOISE);
+      } else {
+        printf("not supported\n");
+      }
+      if (!ok) packets_bad++;
+    }
+    uint16_t V0_min, V0_max, V1_min, V1_max;
+    uint32_t V0_avg, V1_avg;
+    P1P2Serial.ADC_results(V0_min, V0_max, V0_avg, V1_min, V1_max, V1_avg);
+    printf("* ADC_results(): V0 min=%u max=%u avg=%u, V1 min=%u max=%u avg=%u\n", V0_min, V0_max, V0_avg, V1_min, V1_max, V1_avg);
+    static const uint16_t quantiles[ADC_QUANTILE_CNT] = ADC_QUANTILES;
+    for (uint8_t ch = 0; ch < 2; ch++) {
+      adc_window_t w;
+      bool ok = P1P2Serial.ADC_window(ch, w);
+      printf("* ADC_window(%u): ", ch);
+      if (!ok) {
+        printf("not supported\n");
+        packets_bad++;
+        continue;
+      }
+      double mean = w.n ? (double) w.sum / w.n : 0.0;
+      printf("window %u n=%u lost=%u min=%u max=%u mean=%.1f quantiles", w.seq, w.n, w.lost, w.min, w.max, mean);
+      for (uint8_t i = 0; i < ADC_QUANTILE_CNT; i++) printf(" %u%%o=%u", quantiles[i], w.q[i]);
+      printf("\n");
+      ok = (w.n == ADC_SIM_WINDOW) && (w.seq >= 2) && (events || autoreply || !w.lost);
+      for (uint8_t i = 0; i < ADC_QUANTILE_CNT; i++) ok = ok && (w.q[i] >= w.min) && (w.q[i] <= w.max) && (!i || (w.q[i] >= w.q[i - 1]));
+      if (ch) {
+        // uniform noise: quantiles within one sketch bin of the exact value
+        ok = ok && (w.min >= ADC_V1 - ADC_NOISE) && (w.max <= ADC_V1 + ADC_NOISE) && (fabs(mean - ADC_V1) <= 2);
+        for (uint8_t i = 0; i < ADC_QUANTILE_CNT; i++) {
+          double exact = ADC_V1 - ADC_NOISE - 0.5 + (2 * ADC_NOISE + 1) * quantiles[i] / 1000.0;
+          ok = ok && (fabs(w.q[i] - exact) <= (1 << ADC_SKETCH_SHIFT));
+        }
+      } else {
+        ok = ok && (w.min >= ADC_LOW_00 - ADC_NOISE) && (w.max <= ADC_HIGH + ADC_NOISE) && (w.q[ADC_QUANTILE_CNT - 1] >= ADC_HIGH - ADC_NOISE);
+      }
+      if (!ok) packets_bad++;
+    }
+  }
+  if (sleep_idle) {
+    // idle() measures from just before SLEEP until the start of the ISR that woke up the CPU, the virtual ATmega until its interrupt flag
+    read_idlestats();
+    uint64_t elapsed = VHW_now - idle_t0;
+    uint64_t extra = idle_sleep - VHW_sleep_cycles;
+    uint64_t isr_busy = 0;
+    for (uint8_t v = 0; v < VHW_VEC_CNT; v++) isr_busy += VHW_isr_stats[v].busy_cycles;
+    printf("* idle(): %u sleeps, CPU utilisation %.1f%% of %.3fs (ISR load %.1f%%); virtual ATmega: %u sleeps, %.1f%% asleep, "
+           "%.1f cycles per sleep from interrupt to ISR start\n", idle_count, 100.0 - 100.0 * idle_sleep / idle_cycles, (double) idle_cycles / F_CPU,
+           100.0 * isr_busy / VHW_now, VHW_sleeps, 100.0 * VHW_sleep_cycles / elapsed, idle_count ? (double) extra / idle_count : 0.0);
+    if ((idle_cycles != elapsed) || (idle_count != VHW_sleeps) || (idle_sleep < VHW_sleep_cycles) || (extra > (uint64_t) (4 + VHW.isr_entry_cycles) * idle_count)
+        || !idle_count) packets_bad++;
+  }
+  if (sense) {
+    uint16_t deferred = P1P2Serial.writedeferred();
+    printf("* carrier sense: %u packets started by another device in the carrier sense window, %u writes deferred\n", sense_sent, deferred);
+    if (!sense_sent || (deferred != sense_sent)) packets_bad++;
+  } else if (P1P2Serial.writedeferred()) {
+    printf("* carrier sense: %u writes deferred while the bus was idle\n", P1P2Serial.writedeferred());
+    packets_bad++;
+  }
+  if (link) {
+    printf("* binary link: %u frames, %.1f bytes per frame, %.1f%% of the text lines, %u bad\n", link_frames,
+           link_frames ? (double) link_bytes / link_frames : 0.0, link_text ? 100.0 * link_bytes / link_text : 0.0, link_bad);
+    if (!link_frames || link_bad) packets_bad++;
+  }
+  if (autoreply) {
+    printf("* auto-reply: %u requests, %u answered by the library (%u from one-shot slot), %u refused, pause before reply %u..%u ms (delay %u)\n",
+           reply_requests, reply_lib, reply_oneshot, P1P2Serial.replyrefused(), reply_delta_min, reply_delta_max, F03XDELAY);
+    if (!reply_requests || (reply_lib != reply_requests) || (reply_oneshot != reply_requests / 2) || P1P2Serial.replyrefused()
+        || (reply_delta_min != F03XDELAY) || (reply_delta_max != F03XDELAY)) packets_bad++;
+  }
+  if (retry) {
+    read_results();
+    // schedulegap() packets: written, or dropped at their deadline (the last one may still be pending)
+    results_other_exp[P1P2_TX_OK] += gap_written;
+    if (gap) results_other_exp[P1P2_TX_DEADLINE] = results_other[P1P2_TX_DEADLINE];
+    printf("* retry: %u collisions injected, %u read back; writeresult() for replies: %u written (%u after a retry), %u dropped after "
+           "collisions, %u dropped at deadline (expected %u (%u), %u, %u); for other packets: %u written, %u dropped at deadline\n",
+           collisions, collisions - collision_echoes, results[P1P2_TX_OK], results_retried, results[P1P2_TX_COLLISION],
+           results[P1P2_TX_DEADLINE], results_exp[P1P2_TX_OK], results_retried_exp, results_exp[P1P2_TX_COLLISION],
+           results_exp[P1P2_TX_DEADLINE], results_other[P1P2_TX_OK], results_other[P1P2_TX_DEADLINE]);
+    if (collision_echoes || (results_retried != results_retried_exp) || memcmp(results, results_exp, sizeof(results))
+        || memcmp(results_other, results_other_exp, sizeof(results_other))) packets_bad++;
+  }
+  printf("* estimated clock skew 00: %ld ppm (sent %ld), 40: %ld ppm (sent %ld)\n", (long) P1P2Serial.clockskew(0x00), (long) ppm,
+         (long) P1P2Serial.clockskew(0x40), (long) ppm40);
+  printf("* %-17s %8s %9s %7s %11s %7s %12s\n", "ISR", "calls", "cyc/call", "load%", "maxlatency", "missed", "host-ns/call");
+  for (uint8_t v = 0; v < VHW_VEC_CNT; v++) {
+    const VHW_isr_stats_t& st = VHW_isr_stats[v];
+    busy += st.busy_cycles;
+    if ((v >= VHW_VEC_TIMER3_COMPA) && !bus1) continue; // bus 1 vectors
+    printf("* %-17s %8u %9u %7.3f %11u %7u %12.1f\n", VHW_vec_name[v], st.count,
+           st.count ? (unsigned) (st.busy_cycles / st.count) : 0, 100.0 * st.busy_cycles / VHW_now,
+           st.max_latency, st.missed_deadlines, st.count ? (double) st.host_ns / st.count : 0.0);
+  }
+  print_isrstats("", P1P2Serial::isrstats);
+  if (bus1) print_isrstats("1", P1P2Serial1::isrstats);
+  uint64_t bits = (uint64_t) (bytes_rx + bytes1_rx) * 11;
+  printf("* total ISR load %.3f%%, ISR cycles per received bit %.1f (%.1f cycles per bit available)\n",
+         100.0 * busy / VHW_now, bits ? (double) busy / bits : 0.0, VHW_cycles_per_bit_x1000() / 1000.0);
+  uint32_t missed = 0;
+  for (uint8_t v = 0; v < VHW_VEC_CNT; v++) missed += VHW_isr_stats[v].missed_deadlines;
+  return (packets_bad || packets1_bad || missed || scope_bad) ? 1 : 0;
+}
@@ -0,0 +1,410 @@
+/* VirtualHW.cpp: virtual ATmega timer/pin/ADC model for the host-native build of P1P2Serial
+ *
+ * Copyright (c) 2019-2023 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 initial version
+ *                  timer1 overflow interrupt
+ *                  second P1/P2 bus on timer4 (ms timer3)
+ *                  ADC input sampled (sample-and-hold) 1.5 ADC clocks after the start of a conversion, VHW_adc_busy()
+ *                  ADC ISR cost estimate lowered to that of storing raw samples (ADC_STREAM)
+ *                  IDLE sleep (VHW_sleep()): virtual time advances until an interrupt is dispatched, plus the wake-up time
+ *
+ */
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include "Arduino.h"
+
+VirtualHW_t VHW;
+uint64_t VHW_now = 0;
+VHW_isr_stats_t VHW_isr_stats[VHW_VEC_CNT];
+uint64_t VHW_sleep_cycles = 0;
+uint32_t VHW_sleeps = 0;
+const char* const VHW_vec_name[VHW_VEC_CNT] = { "TIMER2_COMPA(ms)", "TIMER1_CAPT", "TIMER1_COMPA(W)", "TIMER1_COMPB(R)", "TIMER1_OVF", "TIMER0_COMPA(s)", "ADC",
+                                                 "TIMER3_COMPA(ms1)", "TIMER4_CAPT", "TIMER4_COMPA(W1)", "TIMER4_COMPB(R1)", "TIMER4_OVF" };
+
+static void (* const vec_isr[VHW_VEC_CNT])(void) = { VHW_TIMER2_COMPA_vect, VHW_TIMER1_CAPT_vect, VHW_TIMER1_COMPA_vect, VHW_TIMER1_COMPB_vect, VHW_TIMER1_OVF_vect, VHW_TIMER0_COMPA_vect, VHW_ADC_vect,
+                                                     VHW_TIMER3_COMPA_vect, VHW_TIMER4_CAPT_vect, VHW_TIMER4_COMPA_vect, VHW_TIMER4_COMPB_vect, VHW_TIMER4_OVF_vect };
+
+static uint64_t flag_time[VHW_VEC_CNT];
+static uint64_t busy_until = 0;
+static uint8_t s_flag = 0;
+static uint64_t s_next = 0;
+static uint8_t adc_flag = 0;
+static uint64_t adc_done = 0;
+static uint64_t adc_sh = 0;      // sample-and-hold time of conversion in progress
+static uint16_t adc_sample = 0;
+static uint32_t isr_calls = 0;
+
+// bus model, per bus: other devices pull the bus low (wired-AND); remote[t] holds the change in #devices pulling low at time t
+typedef struct {
+  uint8_t vec_ms, vec_capt, vec_compa, vec_compb, vec_ovf;
+  uint8_t ms_flag;
+  uint64_t ms_next;
+  std::multimap<uint64_t, int8_t> remote;
+  int16_t remote_low;
+  uint8_t oca;                                   // our output compare pin OCnA (TX)
+  std::deque<std::pair<uint64_t, uint8_t> > echo; // our output as it will be seen on the input after echo_delay
+  uint8_t tx_seen;
+  uint8_t raw_prev;
+  uint8_t raw_stable;
+  uint8_t icp_filtered;
+} bus_model_t;
+
+static bus_model_t bm[VHW_BUSES];
+
+static void set_oca(bus_model_t &b, uint8_t level)
+{
+  if (level == b.oca) return;
+  b.oca = level;
+  b.echo.push_back(std::make_pair(VHW_now, level));
+}
+
+static inline uint8_t raw_input(const bus_model_t &b)
+{
+  return (b.remote_low == 0) && b.tx_seen;
+}
+
+static void step_bus(VHW_bus_t &t, bus_model_t &b, uint16_t tcnt)
+{
+  if (tcnt == t.ocra) {
+    t.tifr |= VHW_OCF1A;
+    flag_time[b.vec_compa] = VHW_now;
+    if (t.coma == VHW_COM_CLEAR) set_oca(b, 0);
+    if (t.coma == VHW_COM_SET) set_oca(b, 1);
+  }
+  if (tcnt == t.ocrb) {
+    t.tifr |= VHW_OCF1B;
+    flag_time[b.vec_compb] = VHW_now;
+  }
+  if (!tcnt) {
+    t.tifr |= VHW_TOV1;
+    flag_time[b.vec_ovf] = VHW_now;
+  }
+
+  while (!b.remote.empty() && (b.remote.begin()->first <= VHW_now)) {
+    b.remote_low += b.remote.begin()->second;
+    b.remote.erase(b.remote.begin());
+  }
+  while (!b.echo.empty() && (b.echo.front().first + VHW.echo_delay <= VHW_now)) {
+    b.tx_seen = b.echo.front().second;
+    b.echo.pop_front();
+  }
+
+  // input capture, with 4-sample noise canceler if enabled
+  uint8_t raw = raw_input(b);
+  if (raw == b.raw_prev) {
+    if (b.raw_stable < 4) b.raw_stable++;
+  } else {
+    b.raw_stable = 1;
+    b.raw_prev = raw;
+  }
+  if ((raw != b.icp_filtered) && (!t.icnc || (b.raw_stable == 4))) {
+    b.icp_filtered = raw;
+    if (raw == (t.ices ? 1 : 0)) {
+      t.icr = tcnt;
+      t.tifr |= VHW_ICF1;
+      flag_time[b.vec_capt] = VHW_now;
+    }
+  }
+
+  if (t.ms_period && (VHW_now >= b.ms_next)) {
+    b.ms_flag = 1;
+    flag_time[b.vec_ms] = VHW_now;
+    b.ms_next += t.ms_period;
+  }
+}
+
+// advance hardware by one CPU cycle
+static void step(void)
+{
+  VHW_now++;
+  uint16_t tcnt = (uint16_t) VHW_now;
+
+  for (uint8_t i = 0; i < VHW_BUSES; i++) step_bus(VHW.bus[i], bm[i], tcnt);
+  if (VHW.s_period && (VHW_now >= s_next)) {
+    s_flag = 1;
+    flag_time[VHW_VEC_TIMER0_COMPA] = VHW_now;
+    s_next += VHW.s_period;
+  }
+  if (adc_sh && (VHW_now >= adc_sh)) {
+    adc_sh = 0;
+    adc_sample = VHW.adc_source ? (VHW.adc_source(VHW.admux & 0x0F) & 0x3FF) : 0x200;
+  }
+  if (adc_done && (VHW_now >= adc_done)) {
+    adc_done = 0;
+    VHW.adc_value = adc_sample;
+    adc_flag = 1;
+    flag_time[VHW_VEC_ADC] = VHW_now;
+  }
+}
+
+static int8_t pending_bus(uint8_t i)
+{
+  const VHW_bus_t &t = VHW.bus[i];
+  const bus_model_t &b = bm[i];
+  if (b.ms_flag && t.ms_enabled && vec_isr[b.vec_ms]) return b.vec_ms;
+  if ((t.tifr & t.timsk & VHW_ICF1) && vec_isr[b.vec_capt]) return b.vec_capt;
+  if ((t.tifr & t.timsk & VHW_OCF1A) && vec_isr[b.vec_compa]) return b.vec_compa;
+  if ((t.tifr & t.timsk & VHW_OCF1B) && vec_isr[b.vec_compb]) return b.vec_compb;
+  if ((t.tifr & t.timsk & VHW_TOV1) && vec_isr[b.vec_ovf]) return b.vec_ovf;
+  return -1;
+}
+
+static int8_t pending(void)
+{
+  int8_t v = pending_bus(0);
+  if (v >= 0) return v;
+  if (s_flag && VHW.s_enabled && VHW_TIMER0_COMPA_vect) return VHW_VEC_TIMER0_COMPA;
+  if (adc_flag && VHW.adc_int_enabled) return VHW_VEC_ADC;
+  return pending_bus(1);
+}
+
+static void clear_flag(uint8_t v)
+{
+  for (uint8_t i = 0; i < VHW_BUSES; i++) {
+    bus_model_t &b = bm[i];
+    if (v == b.vec_ms) b.ms_flag = 0;
+    if (v == b.vec_capt) VHW.bus[i].tifr &= ~VHW_ICF1;
+    if (v == b.vec_compa) VHW.bus[i].tifr &= ~VHW_OCF1A;
+    if (v == b.vec_compb) VHW.bus[i].tifr &= ~VHW_OCF1B;
+    if (v == b.vec_ovf) VHW.bus[i].tifr &= ~VHW_TOV1;
+  }
+  if (v == VHW_VEC_TIMER0_COMPA) s_flag = 0;
+  if (v == VHW_VEC_ADC) adc_flag = 0;
+}
+
+// a compare register is missed if, after the ISR, it is not ahead of the counter (next match would be ~65536 cycles late)
+static int8_t isr_current = -1;
+static uint8_t isr_clock_reads;
+
+static inline bool behind(uint16_t ocr)
+{
+  uint16_t d = ocr - (uint16_t) VHW_now;
+  return (d == 0) || (d & 0x8000);
+}
+
+static void dispatch(void)
+{
+  int8_t v = pending();
+  if (v < 0) return;
+  clear_flag(v);
+  isr_calls++;
+  VHW_isr_stats_t &st = VHW_isr_stats[v];
+  uint32_t latency = VHW_now - flag_time[v];
+  if (latency > st.max_latency) st.max_latency = latency;
+  busy_until = VHW_now + VHW.isr_entry_cycles + VHW.isr_cost[v];
+  for (uint16_t i = 0; i < VHW.isr_entry_cycles; i++) step();
+  uint16_t ocra[VHW_BUSES], ocrb[VHW_BUSES];
+  for (uint8_t i = 0; i < VHW_BUSES; i++) {
+    ocra[i] = VHW.bus[i].ocra;
+    ocrb[i] = VHW.bus[i].ocrb;
+  }
+  uint8_t sreg = VHW.sreg;
+  VHW.sreg &= ~0x80;
+  isr_current = v;
+  isr_clock_reads = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  vec_isr[v]();
+  auto t1 = std::chrono::steady_clock::now();
+  isr_current = -1;
+  VHW.sreg = sreg;
+  st.host_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+  st.count++;
+  st.busy_cycles += VHW.isr_entry_cycles + VHW.isr_cost[v];
+  for (uint8_t i = 0; i < VHW_BUSES; i++) {
+    const VHW_bus_t &t = VHW.bus[i];
+    if ((t.timsk & VHW_OCF1A) && (t.ocra != ocra[i]) && behind(t.ocra)) VHW_isr_stats[bm[i].vec_compa].missed_deadlines++;
+    if ((t.timsk & VHW_OCF1B) && (t.ocrb != ocrb[i]) && behind(t.ocrb)) VHW_isr_stats[bm[i].vec_compb].missed_deadlines++;
+  }
+}
+
+void VHW_run_until(uint64_t t)
+{
+  while (VHW_now < t) {
+    step();
+    if ((VHW_now >= busy_until) && (VHW.sreg & 0x80)) dispatch();
+  }
+}
+
+void VHW_run(uint64_t cycles)
+{
+  VHW_run_until(VHW_now + cycles);
+}
+
+void VHW_yield(void)
+{
+  VHW_run(16);
+}
+
+// the ATmega328P needs 4 extra cycles to wake up from IDLE sleep before the interrupt response starts
+void VHW_sleep(void)
+{
+  uint32_t calls = isr_calls;
+  uint64_t t = VHW_now;
+  VHW.sreg |= 0x80;
+  while (isr_calls == calls) {
+    step();
+    if ((VHW_now >= busy_until) && (pending() >= 0)) {
+      VHW_sleep_cycles += VHW_now - t;
+      for (uint8_t i = 0; i < 4; i++) step();
+      dispatch();
+    }
+  }
+  VHW_sleeps++;
+  VHW_run_until(busy_until);
+}
+
+void VHW_init(void)
+{
+  memset(&VHW, 0, sizeof(VHW));
+  memset(VHW_isr_stats, 0, sizeof(VHW_isr_stats));
+  VHW.sreg = 0x80;
+  for (uint8_t i = 0; i < VHW_BUSES; i++) VHW.bus[i].icnc = 1;
+  VHW.isr_entry_cycles = 20;
+  // rough estimates for the ATmega328P, override from the command line of the simulator for what-if analysis
+  VHW.isr_cost[VHW_VEC_TIMER2_COMPA] = 60;
+  VHW.isr_cost[VHW_VEC_TIMER1_CAPT]  = 150;
+  VHW.isr_cost[VHW_VEC_TIMER1_COMPA] = 200;
+  VHW.isr_cost[VHW_VEC_TIMER1_COMPB] = 170;
+  VHW.isr_cost[VHW_VEC_TIMER1_OVF]   = 60; // also advances the s/ms clock (clk_sec, clk_ms, clk_cyc)
+  VHW.isr_cost[VHW_VEC_TIMER0_COMPA] = 50;
+  VHW.isr_cost[VHW_VEC_ADC]          = 60; // storing raw samples (ADC_STREAM), ~90 with the statistics in the ISR
+  VHW.isr_cost[VHW_VEC_TIMER3_COMPA] = 60;
+  VHW.isr_cost[VHW_VEC_TIMER4_CAPT]  = 150;
+  VHW.isr_cost[VHW_VEC_TIMER4_COMPA] = 200;
+  VHW.isr_cost[VHW_VEC_TIMER4_COMPB] = 170;
+  VHW.isr_cost[VHW_VEC_TIMER4_OVF]   = 30;
+  VHW.echo_delay = F_CPU / 1000000; // 1us
+  VHW_now = 0;
+  busy_until = 0;
+  isr_calls = 0;
+  VHW_sleep_cycles = 0;
+  VHW_sleeps = 0;
+  s_flag = adc_flag = 0;
+  adc_done = 0;
+  adc_sh = 0;
+  static const uint8_t vec[VHW_BUSES][5] = {
+    { VHW_VEC_TIMER2_COMPA, VHW_VEC_TIMER1_CAPT, VHW_VEC_TIMER1_COMPA, VHW_VEC_TIMER1_COMPB, VHW_VEC_TIMER1_OVF },
+    { VHW_VEC_TIMER3_COMPA, VHW_VEC_TIMER4_CAPT, VHW_VEC_TIMER4_COMPA, VHW_VEC_TIMER4_COMPB, VHW_VEC_TIMER4_OVF } };
+  for (uint8_t i = 0; i < VHW_BUSES; i++) {
+    bus_model_t &b = bm[i];
+    b.vec_ms = vec[i][0];
+    b.vec_capt = vec[i][1];
+    b.vec_compa = vec[i][2];
+    b.vec_compb = vec[i][3];
+    b.vec_ovf = vec[i][4];
+    b.ms_flag = 0;
+    b.ms_next = 0;
+    b.remote.clear();
+    b.remote_low = 0;
+    b.oca = 1;
+    b.echo.clear();
+    b.tx_seen = 1;
+    b.raw_prev = 1;
+    b.raw_stable = 4;
+    b.icp_filtered = 1;
+  }
+}
+
+uint8_t VHW_input_pin(uint8_t bus)
+{
+  return raw_input(bm[bus]);
+}
+
+uint16_t VHW_tcnt(void)
+{
+  return (uint16_t) VHW_now;
+}
+
+// virtual time does not advance within an ISR body, so the first read in an ISR returns the entry time
+// and later reads return the time at which the ISR ends according to its estimated cost
+uint16_t VHW_isr_clock(void)
+{
+  if ((isr_current < 0) || !isr_clock_reads++) return (uint16_t) VHW_now;
+  return (uint16_t) (VHW_now + VHW.isr_cost[isr_current]);
+}
+
+void VHW_force_compare_a(uint8_t bus)
+{
+  if (VHW.bus[bus].coma == VHW_COM_CLEAR) set_oca(bm[bus], 0);
+  if (VHW.bus[bus].coma == VHW_COM_SET) set_oca(bm[bus], 1);
+}
+
+void VHW_reset_ms_timer(uint8_t bus)
+{
+  bm[bus].ms_next = VHW_now + VHW.bus[bus].ms_period;
+  bm[bus].ms_flag = 0;
+}
+
+void VHW_reset_s_timer(void)
+{
+  s_next = VHW_now + VHW.s_period;
+  s_flag = 0;
+}
+
+void VHW_adc_trigger(void)
+{
+  adc_sh = VHW_now + 3 * 32;    // input sampled 1.5 ADC clocks after start
+  adc_done = VHW_now + 13 * 64; // 13 ADC clocks at F_CPU/64
+}
+
+uint8_t VHW_adc_busy(void)
+{
+  return adc_done || adc_flag;
+}
+
+void VHW_digital_write(uint8_t pin, uint8_t val)
+{
+  // OC1A (bus 0) on pin 9, OC4A (bus 1) on pin 11
+  if (pin == 9) set_oca(bm[0], val ? 1 : 0);
+  if (pin == 11) set_oca(bm[1], val ? 1 : 0);
+}
+
+uint64_t VHW_cycles_per_bit_x1000(void)
+{
+  return ((uint64_t) F_CPU * 1000) / VHW_BAUD;
+}
+
+uint64_t VHW_bus_send(uint64_t t, const uint8_t* data, uint8_t n, int32_t clock_ppm, uint8_t pause_bits, uint8_t bus)
+{
+  std::multimap<uint64_t, int8_t> &remote = bm[bus].remote;
+  double bit = (double) F_CPU / VHW_BAUD * (1.0 + clock_ppm * 1e-6);
+  double tb = t;
+  for (uint8_t j = 0; j < n; j++) {
+    uint8_t b = data[j];
+    uint8_t parity = 0;
+    uint8_t bits[11];
+    bits[0] = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+      bits[i + 1] = (b >> i) & 1;
+      parity ^= bits[i + 1];
+    }
+    bits[9] = parity;
+    bits[10] = 1;
+    for (uint8_t i = 0; i < 11; i++) {
+      if (!bits[i]) {
+        // 0 bit: low during first semibit, high during second semibit
+        remote.insert(std::make_pair((uint64_t) (tb + i * bit + 0.5), (int8_t) 1));
+        remote.insert(std::make_pair((uint64_t) (tb + i * bit + bit / 2 + 0.5), (int8_t) -1));
+      }
+    }
+    tb += (11 + pause_bits) * bit;
+  }
+  return (uint64_t) (tb + 0.5);
+}
+
+void VHW_bus_pulse(uint64_t t, uint32_t len, uint8_t bus)
+{
+  std::multimap<uint64_t, int8_t> &remote = bm[bus].remote;
+  remote.insert(std::make_pair(t, (int8_t) 1));
+  remote.insert(std::make_pair(t + len, (int8_t) -1));
+}
+
+uint8_t VHW_bus_idle_after(uint64_t t, uint8_t bus)
+{
+  const bus_model_t &b = bm[bus];
+  return (b.remote_low == 0) && (b.remote.empty() || (b.remote.rbegin()->first < t));
+}
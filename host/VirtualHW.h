@@ -0,0 +1,152 @@
+/* VirtualHW.h: virtual ATmega timer/pin/ADC model for the host-native build of P1P2Serial
+ *
+ * Copyright (c) 2019-2023 Arnold Niessen, arnold.niessen-at-gmail-dot-com - licensed under CC BY-NC-ND 4.0 with exceptions (see LICENSE.md)
+ *
+ * Version history
+ * 20261016 v0.9.34 initial version: virtual 16-bit timer1 (input capture, 2 output compares), ms/s timers, ADC, P1/P2 bus model
+ *                  timer1 overflow interrupt
+ *                  VHW_isr_clock() for ISR execution time statistics
+ *                  second P1/P2 bus on timer4 (ms timer3), as on an ATmega2560 with P1P2_BUS1
+ *                  ADC sample-and-hold timing, VHW_adc_busy()
+ *                  IDLE sleep until the next interrupt, VHW_sleep()
+ *
+ * The model is cycle-based: VHW_run() advances virtual time one CPU cycle at a time, updates the
+ * timer, compare-match and input-capture flags exactly as on the ATmega328P, and dispatches pending
+ * interrupts in AVR vector priority order. An ISR is entered VHW.isr_entry_cycles after it is dispatched
+ * (vector fetch + prologue) and then keeps the CPU busy for VHW.isr_cost[] cycles, during which
+ * hardware events still occur but other interrupts remain pending. This is what makes ISR latency,
+ * ISR load and missed semibit deadlines measurable without an ATmega.
+ */
+
+#ifndef VirtualHW_h
+#define VirtualHW_h
+
+#include <stdint.h>
+
+#define VHW_BUSES 2
+
+#define VHW_ICF1  0x20 // same bit positions as in TIFR1/TIMSK1 (and TIFR4/TIMSK4)
+#define VHW_OCF1B 0x04
+#define VHW_OCF1A 0x02
+#define VHW_TOV1  0x01
+
+#define VHW_COM_NORMAL 0
+#define VHW_COM_CLEAR  2
+#define VHW_COM_SET    3
+
+// interrupt vectors, in AVR priority order (lowest number is served first): bus 0 (timer1, ms timer2) as on the ATmega328P,
+// then bus 1 (timer4, ms timer3)
+#define VHW_VEC_TIMER2_COMPA 0
+#define VHW_VEC_TIMER1_CAPT  1
+#define VHW_VEC_TIMER1_COMPA 2
+#define VHW_VEC_TIMER1_COMPB 3
+#define VHW_VEC_TIMER1_OVF   4
+#define VHW_VEC_TIMER0_COMPA 5
+#define VHW_VEC_ADC          6
+#define VHW_VEC_TIMER3_COMPA 7
+#define VHW_VEC_TIMER4_CAPT  8
+#define VHW_VEC_TIMER4_COMPA 9
+#define VHW_VEC_TIMER4_COMPB 10
+#define VHW_VEC_TIMER4_OVF   11
+#define VHW_VEC_CNT          12
+
+#define VHW_BAUD 9600
+
+typedef struct {
+  // 16-bit timer (timer1 for bus 0, timer4 for bus 1), input capture (ICPn) and output compare (OCnA/OCnB)
+  uint8_t timsk;
+  uint8_t tifr;
+  uint8_t ices;
+  uint8_t icnc;
+  uint8_t coma;
+  uint16_t icr;
+  uint16_t ocra;
+  uint16_t ocrb;
+  // ms timer (timer2 for bus 0, timer3 for bus 1) in CTC mode
+  uint32_t ms_period;
+  uint8_t ms_enabled;
+} VHW_bus_t;
+
+typedef struct {
+  VHW_bus_t bus[VHW_BUSES];
+  // s timer (timer0) in CTC mode
+  uint32_t s_period;
+  uint8_t s_enabled;
+  // ADC
+  uint8_t admux;
+  uint8_t adc_int_enabled;
+  uint16_t adc_value;
+  // LEDs
+  uint8_t led_power;
+  uint8_t led_read;
+  uint8_t led_write;
+  uint8_t led_error;
+  // status register, only the I-bit is modelled
+  uint8_t sreg;
+  // simulation parameters
+  uint16_t isr_entry_cycles;           // vector fetch, jump and prologue before the first ISR instruction that matters
+  uint16_t isr_cost[VHW_VEC_CNT];      // estimated cycles spent in each ISR (including epilogue/reti)
+  uint16_t echo_delay;                 // cycles before our own output is seen on the input pin (transceiver turn-around)
+  uint16_t (*adc_source)(uint8_t channel); // returns 10-bit ADC value for channel, or NULL for 0x200
+} VirtualHW_t;
+
+typedef struct {
+  uint32_t count;
+  uint64_t busy_cycles;
+  uint32_t max_latency;                // cycles between interrupt flag and ISR entry
+  uint32_t missed_deadlines;           // compare register left behind the counter by the ISR
+  uint64_t host_ns;                    // host time spent in the ISR body, for relative comparisons
+} VHW_isr_stats_t;
+
+extern VirtualHW_t VHW;
+extern uint64_t VHW_now;               // virtual time in CPU cycles since VHW_init()
+extern VHW_isr_stats_t VHW_isr_stats[VHW_VEC_CNT];
+extern const char* const VHW_vec_name[VHW_VEC_CNT];
+extern uint64_t VHW_sleep_cycles;      // cycles spent in VHW_sleep() until an interrupt woke the CPU
+extern uint32_t VHW_sleeps;            // # calls of VHW_sleep()
+
+// ISRs provided by P1P2Serial.cpp when built with P1P2_HOST (bus 1 only with P1P2_BUS1)
+extern "C" {
+void VHW_TIMER1_CAPT_vect(void);
+void VHW_TIMER1_COMPA_vect(void);
+void VHW_TIMER1_COMPB_vect(void);
+void VHW_TIMER2_COMPA_vect(void);
+void VHW_TIMER1_OVF_vect(void) __attribute__((weak));
+void VHW_TIMER0_COMPA_vect(void) __attribute__((weak));
+void VHW_ADC_vect(void);
+void VHW_TIMER4_CAPT_vect(void) __attribute__((weak));
+void VHW_TIMER4_COMPA_vect(void) __attribute__((weak));
+void VHW_TIMER4_COMPB_vect(void) __attribute__((weak));
+void VHW_TIMER3_COMPA_vect(void) __attribute__((weak));
+void VHW_TIMER4_OVF_vect(void) __attribute__((weak));
+}
+
+// hardware access used by the P1P2Serial HAL macros
+uint8_t VHW_input_pin(uint8_t bus);
+uint16_t VHW_tcnt(void);               // timer1 and timer4 run in sync
+uint16_t VHW_isr_clock(void);          // timer count for ISR execution time measurement, see VirtualHW.cpp
+void VHW_force_compare_a(uint8_t bus);
+void VHW_reset_ms_timer(uint8_t bus);
+void VHW_reset_s_timer(void);
+void VHW_adc_trigger(void);
+uint8_t VHW_adc_busy(void);            // conversion in progress, or its interrupt flag still set
+void VHW_digital_write(uint8_t pin, uint8_t val);
+void VHW_yield(void);
+void VHW_sleep(void);                  // sei() and SLEEP in IDLE mode: returns after the ISR that wakes the CPU
+
+// simulation control
+void VHW_init(void);
+void VHW_run(uint64_t cycles);
+void VHW_run_until(uint64_t t);
+uint64_t VHW_cycles_per_bit_x1000(void);
+
+// P1/P2 buses: other devices on each bus, wired-AND with our own output for that bus
+// schedules a packet from another device on bus, first falling edge at time t (cycles),
+// clock_ppm is that device's clock deviation in ppm, pause_bits adds a pause after each byte (KLIC-DA style)
+// returns time (cycles) of the end of the stop bit of the last byte
+uint64_t VHW_bus_send(uint64_t t, const uint8_t* data, uint8_t n, int32_t clock_ppm = 0, uint8_t pause_bits = 0, uint8_t bus = 0);
+// adds a single low pulse of len cycles at time t (spike/collision injection)
+void VHW_bus_pulse(uint64_t t, uint32_t len, uint8_t bus = 0);
+uint8_t VHW_bus_idle_after(uint64_t t, uint8_t bus = 0); // true if no other device drives the bus at or after t
+
+#endif /* VirtualHW_h */